@@ -0,0 +1,108 @@
+/* lsmem_stats.c - show heap allocator statistics.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/command.h>
+#include <grub/i18n.h>
+#include <grub/mm.h>
+#include <grub/mm_private.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static void
+show_slabs (void)
+{
+  struct grub_mm_slab_class *c;
+
+  grub_printf_ (N_("Slab classes:\n"));
+  for (c = grub_mm_slab_classes;
+       c < grub_mm_slab_classes + GRUB_MM_SLAB_CLASSES; c++)
+    {
+      grub_size_t objects = c->slabs * c->count;
+
+      grub_printf_ (N_("  %5lu bytes: %lu slabs, %lu/%lu objects used (%lu%%)\n"),
+		    (unsigned long) ((c->size - 1) << GRUB_MM_ALIGN_LOG2),
+		    (unsigned long) c->slabs, (unsigned long) c->used,
+		    (unsigned long) objects,
+		    (unsigned long) (objects ? c->used * 100 / objects : 0));
+    }
+}
+
+static void
+show_regions (void)
+{
+  grub_mm_region_t r;
+
+  grub_printf_ (N_("Regions:\n"));
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      grub_size_t free = 0, largest = 0, blocks = 0;
+      grub_mm_header_t p;
+
+      /* A region whose ring start is allocated has no free space.  */
+      if (r->first->magic == GRUB_MM_FREE_MAGIC)
+	{
+	  p = r->first;
+	  do
+	    {
+	      grub_size_t size = p->size << GRUB_MM_ALIGN_LOG2;
+
+	      free += size;
+	      if (size > largest)
+		largest = size;
+	      blocks++;
+	      p = p->next;
+	    }
+	  while (p != r->first);
+	}
+
+      /* Fragmentation is the share of free space outside the largest
+	 free block.  */
+      grub_printf_ (N_("  %p: size %lu, free %lu in %lu blocks, "
+		       "largest %lu, fragmentation %lu%%\n"),
+		    r, (unsigned long) r->size, (unsigned long) free,
+		    (unsigned long) blocks, (unsigned long) largest,
+		    (unsigned long) (free ? (free - largest) * 100 / free : 0));
+    }
+}
+
+static grub_err_t
+grub_cmd_lsmem_stats (grub_command_t cmd __attribute__ ((unused)),
+		      int argc __attribute__ ((unused)),
+		      char **args __attribute__ ((unused)))
+{
+  show_slabs ();
+  show_regions ();
+
+  return 0;
+}
+
+static grub_command_t cmd;
+
+GRUB_MOD_INIT(lsmem_stats)
+{
+  cmd = grub_register_command ("lsmem_stats", grub_cmd_lsmem_stats,
+			       0, N_("Show heap allocator statistics."));
+}
+
+GRUB_MOD_FINI(lsmem_stats)
+{
+  grub_unregister_command (cmd);
+}
@@ -0,0 +1,440 @@
+/* mmprof.c - heap allocation profiler.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/err.h>
+#include <grub/time.h>
+#include <grub/command.h>
+#include <grub/procfs.h>
+#include <grub/i18n.h>
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/tsc.h>
+#endif
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Number of distinct allocation sites tracked.  Anything beyond goes to
+   a shared overflow slot.  */
+#define MAX_SITES	512
+#define MAX_SAMPLES	256
+/* Record a timeline sample whenever the live heap moves by this much.  */
+#define SAMPLE_STEP	0x10000
+/* Room for the source file name of a site, including the NUL.  */
+#define SITE_FILE_LEN	48
+
+struct site
+{
+  void *caller;
+  /* Only compared: the name lives in the image of the calling module,
+     which may be unloaded before the report is made.  */
+  const char *file;
+  int line;
+  char file_name[SITE_FILE_LEN];
+  grub_uint64_t allocs;
+  grub_uint64_t frees;
+  grub_uint64_t failures;
+  grub_uint64_t requested;
+  grub_uint64_t ticks;
+  grub_size_t live;
+  grub_size_t peak;
+};
+
+struct sample
+{
+  grub_uint64_t ms;
+  grub_size_t live;
+};
+
+/* The hooks run inside the allocator, so everything they touch is
+   static; they must never allocate.  */
+static struct site sites[MAX_SITES + 1];
+static struct sample samples[MAX_SAMPLES];
+static unsigned nsamples;
+static grub_size_t live_total, peak_total, last_sample;
+static grub_uint64_t untracked_frees;
+static grub_uint16_t generation;
+
+#if defined (__i386__) || defined (__x86_64__)
+static int use_tsc;
+
+/* Unlike grub_get_tsc this doesn't serialize with CPUID, which would
+   dominate the cost of small allocations.  */
+static grub_uint64_t
+read_tsc (void)
+{
+  grub_uint32_t lo, hi;
+
+  __asm__ __volatile__ ("rdtsc":"=a" (lo), "=d" (hi));
+  return (((grub_uint64_t) hi) << 32) | lo;
+}
+
+static grub_uint64_t
+ticks_to_us (grub_uint64_t ticks)
+{
+  grub_uint64_t rate = (grub_uint64_t) grub_tsc_rate * 1000;
+
+  if (!use_tsc)
+    return ticks * 1000;
+  /* grub_tsc_rate is in ms per 2^32 ticks.  */
+  return (ticks >> 32) * rate + (((ticks & 0xffffffff) * rate) >> 32);
+}
+#else
+static grub_uint64_t
+ticks_to_us (grub_uint64_t ticks)
+{
+  return ticks * 1000;
+}
+#endif
+
+/* Copy the name FILE into DST of SITE_FILE_LEN bytes.  Long names lose
+   their start rather than the file name proper.  */
+static void
+copy_file_name (char *dst, const char *file)
+{
+  grub_size_t len = grub_strlen (file);
+
+  if (len >= SITE_FILE_LEN)
+    file += len - (SITE_FILE_LEN - 1);
+  grub_strcpy (dst, file);
+}
+
+static struct site *
+find_site (void *caller, const char *file, int line)
+{
+  unsigned i, n;
+
+  i = (((grub_addr_t) caller >> 2) ^ (grub_addr_t) file ^ line) % MAX_SITES;
+  for (n = 0; n < MAX_SITES; n++, i = (i + 1) % MAX_SITES)
+    {
+      struct site *s = &sites[i];
+
+      if (s->caller == caller && s->file == file && s->line == line)
+	return s;
+      if (!s->caller)
+	{
+	  s->caller = caller;
+	  s->file = file;
+	  s->line = line;
+	  if (file)
+	    copy_file_name (s->file_name, file);
+	  return s;
+	}
+    }
+  return &sites[MAX_SITES];
+}
+
+static void
+account (grub_size_t live)
+{
+  grub_size_t delta;
+
+  live_total = live;
+  if (live_total > peak_total)
+    peak_total = live_total;
+
+  delta = live > last_sample ? live - last_sample : last_sample - live;
+  if (delta < SAMPLE_STEP || nsamples == MAX_SAMPLES)
+    return;
+  samples[nsamples].ms = grub_get_time_ms ();
+  samples[nsamples].live = live;
+  nsamples++;
+  last_sample = live;
+}
+
+static grub_uint32_t
+prof_alloc (grub_size_t size, grub_size_t footprint, void *caller,
+	    const char *file, int line, grub_uint64_t ticks)
+{
+  struct site *s = find_site (caller, file, line);
+
+  s->ticks += ticks;
+  if (!footprint)
+    {
+      s->failures++;
+      return 0;
+    }
+  s->allocs++;
+  s->requested += size;
+  s->live += footprint;
+  if (s->live > s->peak)
+    s->peak = s->live;
+  account (live_total + footprint);
+  return ((grub_uint32_t) generation << 16) | (s - sites + 1);
+}
+
+static void
+prof_free (grub_uint32_t tag, grub_size_t footprint,
+	   void *caller __attribute__ ((unused)), grub_uint64_t ticks)
+{
+  struct site *s;
+  unsigned idx = tag & 0xffff;
+
+  /* Blocks allocated before the last reset, or while disabled.  */
+  if ((tag >> 16) != generation || idx == 0 || idx > MAX_SITES + 1)
+    {
+      untracked_frees++;
+      return;
+    }
+
+  s = &sites[idx - 1];
+  s->frees++;
+  s->ticks += ticks;
+  s->live -= footprint;
+  account (live_total - footprint);
+}
+
+static grub_uint64_t
+prof_clock (void)
+{
+#if defined (__i386__) || defined (__x86_64__)
+  if (use_tsc)
+    return read_tsc ();
+#endif
+  return grub_get_time_ms ();
+}
+
+static struct grub_mm_profiler profiler =
+  {
+    .clock = prof_clock,
+    .alloc = prof_alloc,
+    .free = prof_free
+  };
+
+static void
+reset (void)
+{
+  grub_memset (sites, 0, sizeof (sites));
+  nsamples = 0;
+  live_total = peak_total = last_sample = 0;
+  untracked_frees = 0;
+  /* Invalidate the tags of all blocks handed out so far.  0 is never
+     used so that blocks allocated without a profiler stay untracked.  */
+  if (++generation == 0)
+    generation = 1;
+}
+
+struct report
+{
+  char *buf;
+  grub_size_t len;
+  grub_size_t alloc;
+};
+
+static void
+report_printf (struct report *r, const char *fmt, ...)
+{
+  va_list ap;
+  char *line;
+  grub_size_t n;
+
+  va_start (ap, fmt);
+  line = grub_xvasprintf (fmt, ap);
+  va_end (ap);
+  if (!line)
+    return;
+
+  n = grub_strlen (line);
+  if (r->len + n + 1 > r->alloc)
+    {
+      grub_size_t alloc = r->alloc ? r->alloc : 4096;
+      char *buf;
+
+      while (r->len + n + 1 > alloc)
+	alloc *= 2;
+      buf = grub_realloc (r->buf, alloc);
+      if (!buf)
+	{
+	  grub_free (line);
+	  return;
+	}
+      r->buf = buf;
+      r->alloc = alloc;
+    }
+  grub_memcpy (r->buf + r->len, line, n + 1);
+  r->len += n;
+  grub_free (line);
+}
+
+static void
+report_caller (struct report *r, const struct site *s)
+{
+  grub_dl_t mod;
+
+  if (s == &sites[MAX_SITES])
+    {
+      report_printf (r, "(other sites)\n");
+      return;
+    }
+
+  FOR_DL_MODULES (mod)
+    if ((grub_uint8_t *) s->caller >= (grub_uint8_t *) mod->base
+	&& (grub_uint8_t *) s->caller < (grub_uint8_t *) mod->base + mod->sz)
+      break;
+
+  if (mod)
+    report_printf (r, "%s+0x%lx", mod->name,
+		   (unsigned long) ((grub_uint8_t *) s->caller
+				    - (grub_uint8_t *) mod->base));
+  else
+    report_printf (r, "kernel:%p", s->caller);
+  if (s->file)
+    report_printf (r, " (%s:%d)", s->file_name, s->line);
+  report_printf (r, "\n");
+}
+
+static char *
+make_report (grub_size_t *sz)
+{
+  struct report r = { 0, 0, 0 };
+  grub_mm_profiler_t saved = grub_mm_profiler;
+  struct site **order;
+  unsigned i, j, n = 0;
+
+  /* Keep the report's own allocations out of the figures.  */
+  grub_mm_profiler = NULL;
+
+  order = grub_malloc ((MAX_SITES + 1) * sizeof (order[0]));
+  if (!order)
+    goto out;
+
+  /* Insertion sort by peak usage.  */
+  for (i = 0; i <= MAX_SITES; i++)
+    {
+      struct site *s = &sites[i];
+
+      if (!s->allocs && !s->failures)
+	continue;
+      for (j = n; j > 0 && order[j - 1]->peak < s->peak; j--)
+	order[j] = order[j - 1];
+      order[j] = s;
+      n++;
+    }
+
+  report_printf (&r, "Profiling %s, live %lu bytes, peak %lu bytes, "
+		 "%llu untracked frees\n",
+		 saved ? "on" : "off", (unsigned long) live_total,
+		 (unsigned long) peak_total,
+		 (unsigned long long) untracked_frees);
+  report_printf (&r, "%10s %10s %8s %8s %5s %12s %10s  %s\n",
+		 "peak", "live", "allocs", "frees", "fail", "requested",
+		 "time(us)", "site");
+  for (i = 0; i < n; i++)
+    {
+      struct site *s = order[i];
+
+      report_printf (&r, "%10lu %10lu %8llu %8llu %5llu %12llu %10llu  ",
+		     (unsigned long) s->peak, (unsigned long) s->live,
+		     (unsigned long long) s->allocs,
+		     (unsigned long long) s->frees,
+		     (unsigned long long) s->failures,
+		     (unsigned long long) s->requested,
+		     (unsigned long long) ticks_to_us (s->ticks));
+      report_caller (&r, s);
+    }
+
+  if (nsamples)
+    {
+      report_printf (&r, "Heap timeline (ms: live bytes):\n");
+      for (i = 0; i < nsamples; i++)
+	report_printf (&r, "  %llu: %lu\n",
+		       (unsigned long long) samples[i].ms,
+		       (unsigned long) samples[i].live);
+    }
+
+  grub_free (order);
+
+ out:
+  grub_mm_profiler = saved;
+  if (!r.buf)
+    {
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+      return NULL;
+    }
+  if (sz)
+    *sz = r.len;
+  return r.buf;
+}
+
+static grub_err_t
+grub_cmd_mmprof (grub_command_t cmd __attribute__ ((unused)),
+		 int argc, char **argv)
+{
+  char *report;
+
+  if (argc == 0)
+    {
+      report = make_report (NULL);
+      if (!report)
+	return grub_errno;
+      grub_xputs (report);
+      grub_free (report);
+      return GRUB_ERR_NONE;
+    }
+
+  if (grub_strcmp (argv[0], "on") == 0)
+    {
+      if (grub_mm_profiler)
+	return GRUB_ERR_NONE;
+#if defined (__i386__) || defined (__x86_64__)
+      use_tsc = grub_tsc_rate && grub_cpu_is_tsc_supported ();
+#endif
+      reset ();
+      grub_mm_profiler = &profiler;
+    }
+  else if (grub_strcmp (argv[0], "off") == 0)
+    grub_mm_profiler = NULL;
+  else if (grub_strcmp (argv[0], "reset") == 0)
+    reset ();
+  else
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("unknown argument `%s'"), argv[0]);
+
+  return GRUB_ERR_NONE;
+}
+
+static char *
+mmprof_get (grub_size_t *sz)
+{
+  return make_report (sz);
+}
+
+static struct grub_procfs_entry mmprof_entry =
+{
+  .name = "mmprof",
+  .get_contents = mmprof_get
+};
+
+static grub_command_t cmd;
+
+GRUB_MOD_INIT (mmprof)
+{
+  cmd = grub_register_command ("mmprof", grub_cmd_mmprof,
+			       N_("[on|off|reset]"),
+			       N_("Profile heap allocations by call site."));
+  grub_procfs_register ("mmprof", &mmprof_entry);
+}
+
+GRUB_MOD_FINI (mmprof)
+{
+  grub_mm_profiler = NULL;
+  grub_procfs_unregister (&mmprof_entry);
+  grub_unregister_command (cmd);
+}
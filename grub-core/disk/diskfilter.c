@@ -575,6 +575,152 @@ validate_segment (struct grub_diskfilter_segment *seg)
 
 }
 
+/* Upper bound, in sectors, on how much of a striped request is gathered
+   from one member with a single read.  */
+#define STRIPED_COALESCE_SECTORS 2048
+
+/* Mirrors are picked per region of this many sectors, so that sequential
+   reads stay on one member while different parts of the array are spread
+   over all of them.  */
+#define MIRROR_BALANCE_SHIFT 11
+
+static int
+is_recoverable_error (grub_err_t err)
+{
+  return err == GRUB_ERR_READ_ERROR || err == GRUB_ERR_UNKNOWN_DEVICE;
+}
+
+/* Read from a striped (RAID0 or LVM striped) segment.  The request is
+   split into per-member extents; the chunks a member holds within the
+   request are adjacent on that member and are fetched with one read, then
+   scattered into BUF.  */
+static grub_err_t
+read_striped (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	      grub_size_t size, char *buf)
+{
+  grub_uint64_t stripe = seg->stripe_size;
+  grub_uint64_t nodes = seg->node_count;
+  char *bounce = NULL;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  while (size)
+    {
+      grub_uint64_t first, last, b, e, m;
+      grub_size_t len;
+
+      first = grub_divmod64 (sector, stripe, &b);
+
+      /* Requests within a single chunk go straight to its member.  */
+      if (b + size <= stripe)
+	{
+	  grub_uint64_t row = grub_divmod64 (first, nodes, &m);
+	  err = grub_diskfilter_read_node (&seg->nodes[m], row * stripe + b,
+					   size, buf);
+	  break;
+	}
+
+      len = size;
+      if (len > STRIPED_COALESCE_SECTORS * nodes)
+	len = STRIPED_COALESCE_SECTORS * nodes;
+      last = grub_divmod64 (sector + len - 1, stripe, &e);
+      e++;
+
+      for (m = 0; m < nodes; m++)
+	{
+	  grub_uint64_t k, row, start, end, first_m;
+	  grub_disk_addr_t mstart;
+	  char *src;
+
+	  grub_divmod64 (first, nodes, &k);
+	  first_m = first + (unsigned int) (m + nodes - k)
+	    % (unsigned int) nodes;
+	  if (first_m > last)
+	    continue;
+
+	  row = grub_divmod64 (first_m, nodes, 0);
+	  mstart = row * stripe + ((first_m == first) ? b : 0);
+
+	  /* A member with one chunk in this window is read in place.  */
+	  if (first_m + nodes > last)
+	    {
+	      start = (first_m == first) ? b : 0;
+	      end = (first_m == last) ? e : stripe;
+	      err = grub_diskfilter_read_node (&seg->nodes[m], mstart,
+					       end - start,
+					       buf + ((first_m * stripe + start
+						       - sector)
+						      << GRUB_DISK_SECTOR_BITS));
+	      if (err)
+		goto fail;
+	      continue;
+	    }
+
+	  if (!bounce)
+	    {
+	      bounce = grub_malloc ((STRIPED_COALESCE_SECTORS + stripe)
+				    << GRUB_DISK_SECTOR_BITS);
+	      if (!bounce)
+		return grub_errno;
+	    }
+
+	  /* Number of whole rows up to the last chunk of this member.  */
+	  row = grub_divmod64 (last - first_m, nodes, 0);
+	  end = (first_m + row * nodes == last) ? e : stripe;
+	  err = grub_diskfilter_read_node (&seg->nodes[m], mstart,
+					   row * stripe + end
+					   - ((first_m == first) ? b : 0),
+					   bounce);
+	  if (err)
+	    goto fail;
+
+	  src = bounce;
+	  for (k = first_m; k <= last; k += nodes)
+	    {
+	      start = (k == first) ? b : 0;
+	      end = (k == last) ? e : stripe;
+	      grub_memcpy (buf + ((k * stripe + start - sector)
+				  << GRUB_DISK_SECTOR_BITS),
+			   src, (end - start) << GRUB_DISK_SECTOR_BITS);
+	      src += (end - start) << GRUB_DISK_SECTOR_BITS;
+	    }
+	}
+
+      buf += len << GRUB_DISK_SECTOR_BITS;
+      sector += len;
+      size -= len;
+    }
+
+ fail:
+  grub_free (bounce);
+  return err;
+}
+
+/* Read a whole request from one mirror, falling back to the others.  */
+static grub_err_t
+read_mirror (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	     grub_size_t size, char *buf)
+{
+  grub_uint64_t first;
+  unsigned int i;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  grub_divmod64 (sector >> MIRROR_BALANCE_SHIFT, seg->node_count, &first);
+
+  for (i = 0; i < seg->node_count; i++)
+    {
+      unsigned int k = ((unsigned int) first + i) % seg->node_count;
+
+      if (is_recoverable_error (grub_errno))
+	grub_errno = GRUB_ERR_NONE;
+
+      err = grub_diskfilter_read_node (&seg->nodes[k], sector, size, buf);
+      if (!err || !is_recoverable_error (err))
+	return err;
+    }
+
+  return err;
+}
+
 static grub_err_t
 read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	      grub_size_t size, char *buf)
@@ -586,35 +732,31 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
       if (seg->node_count == 1)
 	return grub_diskfilter_read_node (&seg->nodes[0],
 					  sector, size, buf);
-      /* Fallthrough.  */
+      return read_striped (seg, sector, size, buf);
+
     case GRUB_DISKFILTER_MIRROR:
+      return read_mirror (seg, sector, size, buf);
+
     case GRUB_DISKFILTER_RAID10:
       {
 	grub_disk_addr_t read_sector, far_ofs;
-	grub_uint64_t disknr, b, near, far, ofs;
+	grub_uint64_t disknr, b, near, far, ofs, first;
 	unsigned int i, j;
 	    
 	read_sector = grub_divmod64 (sector, seg->stripe_size, &b);
-	far = ofs = near = 1;
-	far_ofs = 0;
-
-	if (seg->type == 1)
-	  near = seg->node_count;
-	else if (seg->type == 10)
+	ofs = 1;
+	near = seg->layout & 0xFF;
+	far = (seg->layout >> 8) & 0xFF;
+	if (seg->layout >> 16)
 	  {
-	    near = seg->layout & 0xFF;
-	    far = (seg->layout >> 8) & 0xFF;
-	    if (seg->layout >> 16)
-	      {
-		ofs = far;
-		far_ofs = 1;
-	      }
-	    else
-	      far_ofs = grub_divmod64 (seg->raid_member_size,
-				       far * seg->stripe_size, 0);
-		
-	    far_ofs *= seg->stripe_size;
+	    ofs = far;
+	    far_ofs = 1;
 	  }
+	else
+	  far_ofs = grub_divmod64 (seg->raid_member_size,
+				   far * seg->stripe_size, 0);
+
+	far_ofs *= seg->stripe_size;
 
 	read_sector = grub_divmod64 (read_sector * near, 
 				     seg->node_count,
@@ -622,6 +764,11 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 
 	ofs *= seg->stripe_size;
 	read_sector *= ofs;
+
+	/* Spread regions of the array over the near copies.  */
+	first = 0;
+	if (near)
+	  grub_divmod64 (sector >> MIRROR_BALANCE_SHIFT, near, &first);
 	
 	while (1)
 	  {
@@ -635,24 +782,28 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	    for (i = 0; i < near; i++)
 	      {
 		unsigned int k;
+		grub_disk_addr_t copy_sector = read_sector;
 
-		k = disknr;
+		k = disknr + ((unsigned int) first + i) % (unsigned int) near;
+		if (k >= seg->node_count)
+		  {
+		    k -= seg->node_count;
+		    copy_sector += ofs;
+		  }
 		err = 0;
 		for (j = 0; j < far; j++)
 		  {
-		    if (grub_errno == GRUB_ERR_READ_ERROR
-			|| grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
+		    if (is_recoverable_error (grub_errno))
 		      grub_errno = GRUB_ERR_NONE;
 
 		    err = grub_diskfilter_read_node (&seg->nodes[k],
-						     read_sector
+						     copy_sector
 						     + j * far_ofs + b,
 						     read_size,
 						     buf);
 		    if (! err)
 		      break;
-		    else if (err != GRUB_ERR_READ_ERROR
-			     && err != GRUB_ERR_UNKNOWN_DEVICE)
+		    else if (!is_recoverable_error (err))
 		      return err;
 		    k++;
 		    if (k == seg->node_count)
@@ -661,13 +812,6 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 
 		if (! err)
 		  break;
-
-		disknr++;
-		if (disknr == seg->node_count)
-		  {
-		    disknr = 0;
-		    read_sector += ofs;
-		  }
 	      }
 
 	    if (err)
@@ -679,7 +823,7 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	      return GRUB_ERR_NONE;
 	    
 	    b = 0;
-	    disknr += (near - i);
+	    disknr += near;
 	    while (disknr >= seg->node_count)
 	      {
 		disknr -= seg->node_count;
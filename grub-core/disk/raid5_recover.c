@@ -23,24 +23,104 @@
 #include <grub/err.h>
 #include <grub/misc.h>
 #include <grub/diskfilter.h>
-#include <grub/crypto.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Scratch space reused across recoveries.  Nested arrays (a degraded
+   member that is itself a degraded array) re-enter while it is busy and
+   fall back to a temporary allocation.  */
+static grub_uint64_t *scratch;
+static grub_size_t scratch_size;
+static int scratch_busy;
+
+static grub_uint64_t *
+get_scratch (grub_size_t size)
+{
+  if (scratch_busy)
+    return grub_malloc (size);
+
+  if (size > scratch_size)
+    {
+      grub_free (scratch);
+      scratch_size = 0;
+      scratch = grub_malloc (size);
+      if (!scratch)
+	return NULL;
+      scratch_size = size;
+    }
+  scratch_busy = 1;
+  return scratch;
+}
+
+static void
+put_scratch (grub_uint64_t *ptr)
+{
+  if (ptr == scratch)
+    scratch_busy = 0;
+  else
+    grub_free (ptr);
+}
+
+/* XOR COUNT blocks of WORDS words each, laid out back to back starting at
+   IN, into OUT in a single pass so that each output word is written only
+   once.  */
+static void
+xor_blocks (grub_uint64_t *out, const grub_uint64_t *in,
+	    unsigned count, grub_size_t words)
+{
+  grub_size_t i;
+  unsigned j;
+
+  for (i = 0; i + 4 <= words; i += 4)
+    {
+      grub_uint64_t a = 0, b = 0, c = 0, d = 0;
+      const grub_uint64_t *src = in + i;
+
+      for (j = 0; j < count; j++, src += words)
+	{
+	  a ^= src[0];
+	  b ^= src[1];
+	  c ^= src[2];
+	  d ^= src[3];
+	}
+      out[i] = a;
+      out[i + 1] = b;
+      out[i + 2] = c;
+      out[i + 3] = d;
+    }
+
+  for (; i < words; i++)
+    {
+      grub_uint64_t a = 0;
+      const grub_uint64_t *src = in + i;
+
+      for (j = 0; j < count; j++, src += words)
+	a ^= *src;
+      out[i] = a;
+    }
+}
+
 static grub_err_t
 grub_raid5_recover (struct grub_diskfilter_segment *array, int disknr,
                     char *buf, grub_disk_addr_t sector, grub_size_t size)
 {
-  char *buf2;
+  grub_uint64_t *blocks;
+  grub_size_t words;
+  unsigned count = 0;
   int i;
 
-  size <<= GRUB_DISK_SECTOR_BITS;
-  buf2 = grub_malloc (size);
-  if (!buf2)
-    return grub_errno;
+  if (array->node_count < 2)
+    return grub_error (GRUB_ERR_BAD_DEVICE, "invalid RAID5 array");
+
+  words = size << (GRUB_DISK_SECTOR_BITS - 3);
 
-  grub_memset (buf, 0, size);
+  /* One slot per surviving member plus one for the result, so that the
+     result is always suitably aligned for word-wide XOR.  */
+  blocks = get_scratch (array->node_count * (size << GRUB_DISK_SECTOR_BITS));
+  if (!blocks)
+    return grub_errno;
 
+  /* Issue all the surviving members' reads before combining them.  */
   for (i = 0; i < (int) array->node_count; i++)
     {
       grub_err_t err;
@@ -48,19 +128,20 @@ grub_raid5_recover (struct grub_diskfilter_segment *array, int disknr,
       if (i == disknr)
         continue;
 
-      err = grub_diskfilter_read_node (&array->nodes[i], sector,
-				       size >> GRUB_DISK_SECTOR_BITS, buf2);
-
+      err = grub_diskfilter_read_node (&array->nodes[i], sector, size,
+				       (char *) (blocks + (count + 1) * words));
       if (err)
         {
-          grub_free (buf2);
+          put_scratch (blocks);
           return err;
         }
-
-      grub_crypto_xor (buf, buf, buf2, size);
+      count++;
     }
 
-  grub_free (buf2);
+  xor_blocks (blocks, blocks + words, count, words);
+  grub_memcpy (buf, blocks, size << GRUB_DISK_SECTOR_BITS);
+
+  put_scratch (blocks);
 
   return GRUB_ERR_NONE;
 }
@@ -73,4 +154,7 @@ GRUB_MOD_INIT(raid5rec)
 GRUB_MOD_FINI(raid5rec)
 {
   grub_raid5_recover_func = 0;
+  grub_free (scratch);
+  scratch = NULL;
+  scratch_size = 0;
 }
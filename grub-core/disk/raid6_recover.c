@@ -33,16 +33,81 @@ static grub_uint8_t powx[255 * 2];
 static unsigned powx_inv[256];
 static const grub_uint8_t poly = 0x1d;
 
+/* Scratch space reused across recoveries, see raid5_recover.c.  */
+static char *scratch;
+static grub_size_t scratch_size;
+static int scratch_busy;
+
+static char *
+get_scratch (grub_size_t size)
+{
+  if (scratch_busy)
+    return grub_malloc (size);
+
+  if (size > scratch_size)
+    {
+      grub_free (scratch);
+      scratch_size = 0;
+      scratch = grub_malloc (size);
+      if (!scratch)
+	return NULL;
+      scratch_size = size;
+    }
+  scratch_busy = 1;
+  return scratch;
+}
+
+static void
+put_scratch (char *ptr)
+{
+  if (ptr == scratch)
+    scratch_busy = 0;
+  else
+    grub_free (ptr);
+}
+
+/* Expand multiplication by x**MUL into a full 256-entry table so that the
+   per-byte work is a single branchless lookup.  */
+static void
+grub_raid_mulx_table (unsigned mul, grub_uint8_t *table)
+{
+  unsigned i;
+
+  table[0] = 0;
+  for (i = 1; i < 256; i++)
+    table[i] = powx[mul + powx_inv[i]];
+}
+
 static void
 grub_raid_block_mulx (unsigned mul, char *buf, grub_size_t size)
 {
+  grub_uint8_t table[256];
+  grub_uint8_t *p = (grub_uint8_t *) buf;
+  grub_size_t i;
+
+  grub_raid_mulx_table (mul, table);
+  for (i = 0; i < size; i++)
+    p[i] = table[p[i]];
+}
+
+/* dst ^= src * x**MUL.  */
+static void
+grub_raid_block_mulx_xor (const grub_uint8_t *table, char *dst,
+			  const char *src, grub_size_t size)
+{
+  grub_uint8_t *d = (grub_uint8_t *) dst;
+  const grub_uint8_t *s = (const grub_uint8_t *) src;
   grub_size_t i;
-  grub_uint8_t *p;
 
-  p = (grub_uint8_t *) buf;
-  for (i = 0; i < size; i++, p++)
-    if (*p)
-      *p = powx[mul + powx_inv[*p]];
+  for (i = 0; i + 4 <= size; i += 4)
+    {
+      d[i] ^= table[s[i]];
+      d[i + 1] ^= table[s[i + 1]];
+      d[i + 2] ^= table[s[i + 2]];
+      d[i + 3] ^= table[s[i + 3]];
+    }
+  for (; i < size; i++)
+    d[i] ^= table[s[i]];
 }
 
 static void
@@ -79,16 +144,25 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
 {
   int i, q, pos;
   int bad1 = -1, bad2 = -1;
-  char *pbuf = 0, *qbuf = 0;
+  unsigned count = 0;
+  char *blocks, *pbuf, *qbuf;
+  int *mul;
+  grub_uint8_t table[256];
 
-  size <<= GRUB_DISK_SECTOR_BITS;
-  pbuf = grub_zalloc (size);
-  if (!pbuf)
-    goto quit;
+  mul = grub_malloc (array->node_count * sizeof (mul[0]));
+  if (!mul)
+    return grub_errno;
 
-  qbuf = grub_zalloc (size);
-  if (!qbuf)
-    goto quit;
+  size <<= GRUB_DISK_SECTOR_BITS;
+  /* P and Q accumulators followed by one slot per data member.  */
+  blocks = get_scratch (array->node_count * size);
+  if (!blocks)
+    {
+      grub_free (mul);
+      return grub_errno;
+    }
+  pbuf = blocks;
+  qbuf = blocks + size;
 
   q = p + 1;
   if (q == (int) array->node_count)
@@ -98,6 +172,7 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
   if (pos == (int) array->node_count)
     pos = 0;
 
+  /* Issue all the surviving data members' reads before combining them.  */
   for (i = 0; i < (int) array->node_count - 2; i++)
     {
       int c;
@@ -110,12 +185,9 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
       else
         {
           if (! grub_diskfilter_read_node (&array->nodes[pos], sector,
-					   size >> GRUB_DISK_SECTOR_BITS, buf))
-            {
-              grub_crypto_xor (pbuf, pbuf, buf, size);
-              grub_raid_block_mulx (c, buf, size);
-              grub_crypto_xor (qbuf, qbuf, buf, size);
-            }
+					   size >> GRUB_DISK_SECTOR_BITS,
+					   blocks + (count + 2) * size))
+	    mul[count++] = c;
           else
             {
               /* Too many bad devices */
@@ -136,6 +208,16 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
   if (bad1 < 0)
     goto quit;
 
+  grub_memset (pbuf, 0, 2 * size);
+  for (i = 0; i < (int) count; i++)
+    {
+      char *data = blocks + (i + 2) * size;
+
+      grub_crypto_xor (pbuf, pbuf, data, size);
+      grub_raid_mulx_table (mul[i], table);
+      grub_raid_block_mulx_xor (table, qbuf, data, size);
+    }
+
   if (bad2 < 0)
     {
       /* One bad device */
@@ -179,13 +261,12 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
       c = mod_255((unsigned) bad2 + c);
       grub_raid_block_mulx (c, pbuf, size);
 
-      grub_crypto_xor (pbuf, pbuf, qbuf, size);
-      grub_memcpy (buf, pbuf, size);
+      grub_crypto_xor (buf, pbuf, qbuf, size);
     }
 
 quit:
-  grub_free (pbuf);
-  grub_free (qbuf);
+  put_scratch (blocks);
+  grub_free (mul);
 
   return grub_errno;
 }
@@ -199,4 +280,7 @@ GRUB_MOD_INIT(raid6rec)
 GRUB_MOD_FINI(raid6rec)
 {
   grub_raid6_recover_func = 0;
+  grub_free (scratch);
+  scratch = NULL;
+  scratch_size = 0;
 }
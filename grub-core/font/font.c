@@ -110,6 +110,8 @@ static struct grub_font null_font;
 /* Flag to ensure module is initialized only once.  */
 static grub_uint8_t font_loader_initialized;
 
+static struct grub_font_cache_stats font_cache_stats;
+
 #if HAVE_FONT_SOURCE
 static struct grub_font_glyph *ascii_font_glyph[0x80];
 #endif
@@ -166,6 +168,7 @@ grub_font_loader_init (void)
   if (!unknown_glyph)
     return;
 
+  unknown_glyph->font = NULL;
   unknown_glyph->width = 8;
   unknown_glyph->height = 16;
   unknown_glyph->offset_x = 0;
@@ -274,6 +277,7 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 {
   unsigned i;
   grub_uint32_t last_code;
+  grub_uint8_t *raw, *ptr;
 
 #if FONT_DEBUG >= 2
   grub_dprintf ("font", "load_font_index(sect_length=%d)\n", sect_length);
@@ -307,17 +311,31 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
   grub_dprintf ("font", "num_chars=%d)\n", font->num_chars);
 #endif
 
+  /* Read the whole index at once rather than entry by entry.  */
+  raw = grub_malloc (sect_length);
+  if (!raw)
+    return 1;
+  if (grub_file_read (file, raw, sect_length) != (grub_ssize_t) sect_length)
+    {
+      grub_free (raw);
+      return 1;
+    }
+
   last_code = 0;
 
   /* Load the character index data from the file.  */
-  for (i = 0; i < font->num_chars; i++)
+  for (i = 0, ptr = raw; i < font->num_chars;
+       i++, ptr += FONT_CHAR_INDEX_ENTRY_SIZE)
     {
       struct char_index_entry *entry = &font->char_index[i];
 
-      /* Read code point value; convert to native byte order.  */
-      if (grub_file_read (file, &entry->code, 4) != 4)
-	return 1;
+      /* Code point value, storage flags byte and glyph data offset, the
+	 numbers in big-endian byte order.  */
+      entry->code = grub_get_unaligned32 (ptr);
       entry->code = grub_be_to_cpu32 (entry->code);
+      entry->storage_flags = ptr[4];
+      entry->offset = grub_get_unaligned32 (ptr + 5);
+      entry->offset = grub_be_to_cpu32 (entry->offset);
 
       /* Verify that characters are in ascending order.  */
       if (i != 0 && entry->code <= last_code)
@@ -325,6 +343,7 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 	  grub_error (GRUB_ERR_BAD_FONT,
 		      "font characters not in ascending order: %u <= %u",
 		      entry->code, last_code);
+	  grub_free (raw);
 	  return 1;
 	}
 
@@ -333,15 +352,6 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 
       last_code = entry->code;
 
-      /* Read storage flags byte.  */
-      if (grub_file_read (file, &entry->storage_flags, 1) != 1)
-	return 1;
-
-      /* Read glyph data offset; convert to native byte order.  */
-      if (grub_file_read (file, &entry->offset, 4) != 4)
-	return 1;
-      entry->offset = grub_be_to_cpu32 (entry->offset);
-
       /* No glyph loaded.  Will be loaded on demand and cached thereafter.  */
       entry->glyph = 0;
 
@@ -352,6 +362,7 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 #endif
     }
 
+  grub_free (raw);
   return 0;
 }
 
@@ -652,25 +663,6 @@ fail:
   return 0;
 }
 
-/* Read a 16-bit big-endian integer from FILE, convert it to native byte
-   order, and store it in *VALUE.
-   Returns 0 on success, 1 on failure.  */
-static int
-read_be_uint16 (grub_file_t file, grub_uint16_t * value)
-{
-  if (grub_file_read (file, value, 2) != 2)
-    return 1;
-  *value = grub_be_to_cpu16 (*value);
-  return 0;
-}
-
-static int
-read_be_int16 (grub_file_t file, grub_int16_t * value)
-{
-  /* For the signed integer version, use the same code as for unsigned.  */
-  return read_be_uint16 (file, (grub_uint16_t *) value);
-}
-
 /* Return a pointer to the character index entry for the glyph corresponding to
    the codepoint CODE in the font FONT.  If not found, return zero.  */
 static inline struct char_index_entry *
@@ -712,6 +704,125 @@ find_glyph (const grub_font_t font, grub_uint32_t code)
   return 0;
 }
 
+/* Glyph data is read this many bytes at a time.  Glyphs are stored in
+   the order of the index, so the glyphs that follow a missing one in
+   the index are loaded along with it, which makes the neighbours of a
+   character (the rest of a word, or a block of CJK ideographs) cheap
+   to get.  */
+#define FONT_PRELOAD_BYTES 8192
+
+/* Width, height, x and y offsets and device width, as 16-bit numbers.  */
+#define FONT_GLYPH_HEADER_SIZE 10
+
+/* Size of the data of the glyph whose header is at PTR.  */
+static inline grub_size_t
+glyph_bitmap_size (const grub_uint8_t *ptr)
+{
+  return ((grub_size_t) grub_be_to_cpu16 (grub_get_unaligned16 (ptr))
+	  * grub_be_to_cpu16 (grub_get_unaligned16 (ptr + 2)) + 7) / 8;
+}
+
+/* Load the glyph of INDEX_ENTRY from the font file, together with those
+   of the entries after it whose data fits in the same read.  All of the
+   glyphs go into one allocation, since they are never freed.  Returns 0
+   on success, nonzero on failure (in which case grub_errno is set).  */
+static int
+load_glyphs (grub_font_t font, struct char_index_entry *index_entry)
+{
+  struct char_index_entry *end = font->char_index + font->num_chars;
+  struct char_index_entry *entry, *last;
+  grub_uint8_t *buf, *ptr;
+  grub_size_t buf_size = FONT_PRELOAD_BYTES;
+  grub_size_t size = 0, pos;
+  grub_ssize_t got;
+  char *glyphs;
+
+  buf = grub_malloc (buf_size);
+  if (!buf)
+    return 1;
+
+  grub_file_seek (font->file, index_entry->offset);
+  got = grub_file_read (font->file, buf, buf_size);
+  if (got < FONT_GLYPH_HEADER_SIZE)
+    goto fail;
+
+  /* A glyph bigger than the buffer is read on its own.  */
+  if (FONT_GLYPH_HEADER_SIZE + glyph_bitmap_size (buf) > (grub_size_t) got)
+    {
+      buf_size = FONT_GLYPH_HEADER_SIZE + glyph_bitmap_size (buf);
+      grub_free (buf);
+      buf = grub_malloc (buf_size);
+      if (!buf)
+	return 1;
+      grub_file_seek (font->file, index_entry->offset);
+      got = grub_file_read (font->file, buf, buf_size);
+      if (got != (grub_ssize_t) buf_size)
+	goto fail;
+    }
+  font_cache_stats.glyph_reads++;
+
+  /* Find the entries whose data was read in full.  */
+  pos = 0;
+  for (entry = index_entry; entry < end; entry++)
+    {
+      grub_size_t len;
+
+      if (entry->offset < index_entry->offset
+	  || entry->offset - index_entry->offset < pos
+	  || entry->offset - index_entry->offset > (grub_size_t) got
+	  - FONT_GLYPH_HEADER_SIZE)
+	break;
+      pos = entry->offset - index_entry->offset;
+      len = glyph_bitmap_size (buf + pos);
+      if (len > (grub_size_t) got - FONT_GLYPH_HEADER_SIZE - pos)
+	break;
+      pos += FONT_GLYPH_HEADER_SIZE + len;
+      if (!entry->glyph)
+	size += ALIGN_UP (sizeof (struct grub_font_glyph) + len,
+			  sizeof (grub_addr_t));
+    }
+  last = entry;
+
+  glyphs = grub_malloc (size);
+  if (!glyphs)
+    goto fail;
+
+  for (entry = index_entry; entry < last; entry++)
+    {
+      struct grub_font_glyph *glyph = (struct grub_font_glyph *) glyphs;
+      grub_size_t len;
+
+      if (entry->glyph)
+	continue;
+
+      ptr = buf + (entry->offset - index_entry->offset);
+      len = glyph_bitmap_size (ptr);
+      glyph->font = font;
+      glyph->width = grub_be_to_cpu16 (grub_get_unaligned16 (ptr));
+      glyph->height = grub_be_to_cpu16 (grub_get_unaligned16 (ptr + 2));
+      glyph->offset_x = grub_be_to_cpu16 (grub_get_unaligned16 (ptr + 4));
+      glyph->offset_y = grub_be_to_cpu16 (grub_get_unaligned16 (ptr + 6));
+      glyph->device_width
+	= grub_be_to_cpu16 (grub_get_unaligned16 (ptr + 8));
+      grub_memcpy (glyph->bitmap, ptr + FONT_GLYPH_HEADER_SIZE, len);
+
+      /* Cache the glyph.  */
+      entry->glyph = glyph;
+      font_cache_stats.glyphs_loaded++;
+      glyphs += ALIGN_UP (sizeof (struct grub_font_glyph) + len,
+			  sizeof (grub_addr_t));
+    }
+
+  grub_free (buf);
+  return 0;
+
+ fail:
+  grub_free (buf);
+  if (!grub_errno)
+    grub_error (GRUB_ERR_BAD_FONT, "premature end of font file");
+  return 1;
+}
+
 /* Get a glyph for the Unicode character CODE in FONT.  The glyph is loaded
    from the font file if has not been loaded yet.
    Returns a pointer to the glyph if found, or 0 if it is not found.  */
@@ -723,14 +834,6 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
   index_entry = find_glyph (font, code);
   if (index_entry)
     {
-      struct grub_font_glyph *glyph = 0;
-      grub_uint16_t width;
-      grub_uint16_t height;
-      grub_int16_t xoff;
-      grub_int16_t yoff;
-      grub_int16_t dwidth;
-      int len;
-
       if (index_entry->glyph)
 	/* Return cached glyph.  */
 	return index_entry->glyph;
@@ -743,52 +846,16 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
          error message to error stack and reset error message.  */
       grub_error_push ();
 
-      grub_file_seek (font->file, index_entry->offset);
-
-      /* Read the glyph width, height, and baseline.  */
-      if (read_be_uint16 (font->file, &width) != 0
-	  || read_be_uint16 (font->file, &height) != 0
-	  || read_be_int16 (font->file, &xoff) != 0
-	  || read_be_int16 (font->file, &yoff) != 0
-	  || read_be_int16 (font->file, &dwidth) != 0)
-	{
-	  remove_font (font);
-	  return 0;
-	}
-
-      len = (width * height + 7) / 8;
-      glyph = grub_malloc (sizeof (struct grub_font_glyph) + len);
-      if (!glyph)
+      if (load_glyphs (font, index_entry) != 0)
 	{
 	  remove_font (font);
 	  return 0;
 	}
 
-      glyph->font = font;
-      glyph->width = width;
-      glyph->height = height;
-      glyph->offset_x = xoff;
-      glyph->offset_y = yoff;
-      glyph->device_width = dwidth;
-
-      /* Don't try to read empty bitmaps (e.g., space characters).  */
-      if (len != 0)
-	{
-	  if (grub_file_read (font->file, glyph->bitmap, len) != len)
-	    {
-	      remove_font (font);
-	      grub_free (glyph);
-	      return 0;
-	    }
-	}
-
       /* Restore old error message.  */
       grub_error_pop ();
 
-      /* Cache the glyph.  */
-      index_entry->glyph = glyph;
-
-      return glyph;
+      return index_entry->glyph;
     }
 
   return 0;
@@ -1453,6 +1520,10 @@ grub_font_construct_dry_run (grub_font_t hinted_font,
 }
 
 static struct grub_font_glyph **render_combining_glyphs = 0;
+
+/* Buffer for the glyphs made by grub_font_construct_glyph.  Unlike all
+   other glyphs, its contents change.  */
+static struct grub_font_glyph *constructed_glyph = 0;
 static grub_size_t render_max_comb_glyphs = 0;
 
 static void
@@ -1494,7 +1565,7 @@ grub_font_construct_glyph (grub_font_t hinted_font,
 {
   struct grub_font_glyph *main_glyph;
   struct grub_video_signed_rect bounds;
-  static struct grub_font_glyph *glyph = 0;
+  struct grub_font_glyph *glyph = constructed_glyph;
   static grub_size_t max_glyph_size = 0;
 
   ensure_comb_space (glyph_id);
@@ -1518,7 +1589,7 @@ grub_font_construct_glyph (grub_font_t hinted_font,
       max_glyph_size = (sizeof (*glyph) + (bounds.width * bounds.height + GRUB_CHAR_BIT - 1) / GRUB_CHAR_BIT) * 2;
       if (max_glyph_size < 8)
 	max_glyph_size = 8;
-      glyph = grub_malloc (max_glyph_size);
+      glyph = constructed_glyph = grub_malloc (max_glyph_size);
     }
   if (!glyph)
     {
@@ -1553,12 +1624,387 @@ grub_font_construct_glyph (grub_font_t hinted_font,
   return glyph;
 }
 
-/* Draw the specified glyph at (x, y).  The y coordinate designates the
-   baseline of the character, while the x coordinate designates the left
-   side location of the character.  */
-grub_err_t
-grub_font_draw_glyph (struct grub_font_glyph * glyph,
-		      grub_video_color_t color, int left_x, int baseline_y)
+/* Glyphs are drawn from atlases: bitmaps in which glyphs of one font are
+   expanded to RGBA in one color, so that drawing them is a 32-bit blend
+   rather than a walk over bits.  For 16-bit and palette targets the
+   blitters are faster with the bits, so there glyphs are drawn as they
+   are.
+
+   A glyph which fits is stored in a cell as wide as its advance and as
+   high as its font.  Glyphs that were first drawn next to each other,
+   like those of a menu entry, are next to each other in the atlas too,
+   and are drawn with one blit when they are drawn together again.  */
+#define FONT_ATLAS_PAGE_WIDTH 512
+#define FONT_ATLAS_PAGE_HEIGHT 128
+#define FONT_ATLAS_PAGE_BYTES (FONT_ATLAS_PAGE_WIDTH * FONT_ATLAS_PAGE_HEIGHT \
+			       * sizeof (grub_uint32_t))
+
+/* Memory all atlases may use together.  */
+#define FONT_ATLAS_BYTES (4 << 20)
+
+/* Initial number of glyph slots in an atlas.  */
+#define FONT_ATLAS_SLOTS 64
+
+/* The bitmap of a page is set up by hand rather than with
+   grub_video_bitmap_create, which the font code in the utilities
+   doesn't have.  */
+struct font_atlas_page
+{
+  struct font_atlas_page *next;
+  struct grub_video_bitmap bitmap;
+};
+
+struct font_atlas_slot
+{
+  /* Glyph stored in this slot, or NULL if it's free.  */
+  const struct grub_font_glyph *glyph;
+  struct font_atlas_page *page;
+
+  /* Top left corner of the cell, or of the glyph if it has none.  */
+  grub_uint16_t x;
+  grub_uint16_t y;
+  int cell;
+};
+
+struct font_atlas
+{
+  struct font_atlas *next;
+  grub_font_t font;
+
+  /* Color of the glyphs, as an RGBA8888 pixel.  */
+  grub_uint32_t pixel;
+
+  /* Extent of the cells above and below the baseline.  */
+  int ascent;
+  int descent;
+
+  /* Pages, newest first, and the free space on the newest one: glyphs
+     are put left to right on shelves.  */
+  struct font_atlas_page *pages;
+  unsigned shelf_x;
+  unsigned shelf_y;
+  unsigned shelf_height;
+
+  /* Glyphs in the atlas, hashed by address with linear probing.  */
+  struct font_atlas_slot *slots;
+  unsigned num_slots;
+  unsigned used_slots;
+
+  grub_size_t size;
+  grub_uint64_t stamp;
+};
+
+/* Cells next to each other both in an atlas page and on the target, to
+   be drawn with one blit.  */
+struct font_atlas_run
+{
+  struct font_atlas_page *page;
+  int x;
+  int y;
+  int src_x;
+  int src_y;
+  int width;
+
+  /* Rows of the cells which have glyph pixels.  */
+  int top;
+  int bottom;
+};
+
+static struct font_atlas *font_atlases;
+static grub_size_t font_atlas_size;
+static grub_uint64_t font_atlas_stamp;
+
+/* Drop the pages of ATLAS and the glyphs on them.  */
+static void
+atlas_clear (struct font_atlas *atlas)
+{
+  struct font_atlas_page *page, *next;
+
+  for (page = atlas->pages; page; page = next)
+    {
+      next = page->next;
+      grub_free (page->bitmap.data);
+      grub_free (page);
+      atlas->size -= FONT_ATLAS_PAGE_BYTES;
+      font_atlas_size -= FONT_ATLAS_PAGE_BYTES;
+    }
+  atlas->pages = 0;
+  grub_memset (atlas->slots, 0, atlas->num_slots * sizeof (atlas->slots[0]));
+  atlas->used_slots = 0;
+}
+
+/* Free least recently used atlases other than KEEP until SIZE more bytes
+   fit in the limit, or there are none left.  */
+static void
+atlas_evict (struct font_atlas *keep, grub_size_t size)
+{
+  while (font_atlas_size + size > FONT_ATLAS_BYTES)
+    {
+      struct font_atlas **prev, **victim = 0;
+      struct font_atlas *atlas;
+
+      for (prev = &font_atlases; *prev; prev = &(*prev)->next)
+	if (*prev != keep && (!victim || (*prev)->stamp < (*victim)->stamp))
+	  victim = prev;
+      if (!victim)
+	return;
+
+      atlas = *victim;
+      *victim = atlas->next;
+      atlas_clear (atlas);
+      font_atlas_size -= atlas->size;
+      grub_free (atlas->slots);
+      grub_free (atlas);
+      font_cache_stats.atlas_evictions++;
+    }
+}
+
+/* Get the atlas for glyphs of FONT in the color PIXEL, creating it if
+   needed.  Returns NULL if there's no memory for it.  */
+static struct font_atlas *
+atlas_get (grub_font_t font, grub_uint32_t pixel)
+{
+  struct font_atlas *atlas;
+  grub_font_t metrics = font ? : &null_font;
+
+  for (atlas = font_atlases; atlas; atlas = atlas->next)
+    if (atlas->font == font && atlas->pixel == pixel)
+      {
+	atlas->stamp = ++font_atlas_stamp;
+	return atlas;
+      }
+
+  atlas = grub_zalloc (sizeof (*atlas));
+  if (!atlas)
+    return 0;
+  atlas->slots = grub_zalloc (FONT_ATLAS_SLOTS * sizeof (atlas->slots[0]));
+  if (!atlas->slots)
+    {
+      grub_free (atlas);
+      return 0;
+    }
+  atlas->num_slots = FONT_ATLAS_SLOTS;
+  atlas->font = font;
+  atlas->pixel = pixel;
+  atlas->ascent = metrics->ascent;
+  atlas->descent = metrics->descent;
+  atlas->size = sizeof (*atlas) + FONT_ATLAS_SLOTS * sizeof (atlas->slots[0]);
+  atlas->stamp = ++font_atlas_stamp;
+  font_atlas_size += atlas->size;
+
+  atlas->next = font_atlases;
+  font_atlases = atlas;
+  return atlas;
+}
+
+/* Return the slot of GLYPH in ATLAS, or the free slot it would go to.  */
+static struct font_atlas_slot *
+atlas_find_slot (struct font_atlas *atlas, const struct grub_font_glyph *glyph)
+{
+  unsigned mask = atlas->num_slots - 1;
+  unsigned i = ((grub_addr_t) glyph >> 3) * 0x9e3779b1 & mask;
+
+  while (atlas->slots[i].glyph && atlas->slots[i].glyph != glyph)
+    i = (i + 1) & mask;
+  return &atlas->slots[i];
+}
+
+/* Double the number of slots of ATLAS.  */
+static grub_err_t
+atlas_grow (struct font_atlas *atlas)
+{
+  struct font_atlas_slot *old = atlas->slots;
+  unsigned i, num = atlas->num_slots;
+
+  atlas->slots = grub_zalloc (num * 2 * sizeof (atlas->slots[0]));
+  if (!atlas->slots)
+    {
+      atlas->slots = old;
+      return grub_errno;
+    }
+  atlas->num_slots = num * 2;
+  for (i = 0; i < num; i++)
+    if (old[i].glyph)
+      *atlas_find_slot (atlas, old[i].glyph) = old[i];
+  grub_free (old);
+
+  atlas->size += num * sizeof (atlas->slots[0]);
+  font_atlas_size += num * sizeof (atlas->slots[0]);
+  return GRUB_ERR_NONE;
+}
+
+/* Start a new page in ATLAS.  If it doesn't fit in the memory limit,
+   older atlases are freed, and then the pages of ATLAS itself.  */
+static grub_err_t
+atlas_add_page (struct font_atlas *atlas)
+{
+  struct font_atlas_page *page;
+  struct grub_video_mode_info *mode_info;
+
+  atlas_evict (atlas, FONT_ATLAS_PAGE_BYTES);
+  if (font_atlas_size + FONT_ATLAS_PAGE_BYTES > FONT_ATLAS_BYTES)
+    {
+      atlas_clear (atlas);
+      font_cache_stats.atlas_evictions++;
+    }
+
+  page = grub_zalloc (sizeof (*page));
+  if (!page)
+    return grub_errno;
+  page->bitmap.data = grub_zalloc (FONT_ATLAS_PAGE_BYTES);
+  if (!page->bitmap.data)
+    {
+      grub_free (page);
+      return grub_errno;
+    }
+  mode_info = &page->bitmap.mode_info;
+  mode_info->width = FONT_ATLAS_PAGE_WIDTH;
+  mode_info->height = FONT_ATLAS_PAGE_HEIGHT;
+  mode_info->blit_format = GRUB_VIDEO_BLIT_FORMAT_RGBA_8888;
+  mode_info->mode_type = GRUB_VIDEO_MODE_TYPE_RGB | GRUB_VIDEO_MODE_TYPE_ALPHA;
+  mode_info->bpp = 32;
+  mode_info->bytes_per_pixel = 4;
+  mode_info->pitch = FONT_ATLAS_PAGE_WIDTH * 4;
+  mode_info->number_of_colors = 256;
+  mode_info->red_mask_size = 8;
+  mode_info->red_field_pos = 0;
+  mode_info->green_mask_size = 8;
+  mode_info->green_field_pos = 8;
+  mode_info->blue_mask_size = 8;
+  mode_info->blue_field_pos = 16;
+  mode_info->reserved_mask_size = 8;
+  mode_info->reserved_field_pos = 24;
+  page->bitmap.refcnt = 1;
+
+  page->next = atlas->pages;
+  atlas->pages = page;
+  atlas->shelf_x = 0;
+  atlas->shelf_y = 0;
+  atlas->shelf_height = 0;
+  atlas->size += FONT_ATLAS_PAGE_BYTES;
+  font_atlas_size += FONT_ATLAS_PAGE_BYTES;
+  return GRUB_ERR_NONE;
+}
+
+/* Expand GLYPH into ATLAS.  Returns its slot, or NULL if the glyph can't
+   be stored, in which case it's to be drawn from its bits.  */
+static struct font_atlas_slot *
+atlas_add (struct font_atlas *atlas, const struct grub_font_glyph *glyph)
+{
+  struct font_atlas_slot *slot;
+  struct font_atlas_page *page;
+  unsigned width, height, x, y, i, j, bit;
+  grub_uint32_t *row;
+  int cell;
+
+  cell = (glyph->offset_x >= 0
+	  && glyph->offset_x + glyph->width <= glyph->device_width
+	  && glyph->offset_y >= -atlas->descent
+	  && glyph->offset_y + glyph->height <= atlas->ascent);
+  if (cell)
+    {
+      width = glyph->device_width;
+      height = atlas->ascent + atlas->descent;
+    }
+  else
+    {
+      width = glyph->width;
+      height = glyph->height;
+    }
+  if (width == 0 || height == 0
+      || width > FONT_ATLAS_PAGE_WIDTH || height > FONT_ATLAS_PAGE_HEIGHT)
+    return 0;
+
+  if ((atlas->used_slots + 1) * 2 > atlas->num_slots && atlas_grow (atlas))
+    return 0;
+
+  if (atlas->pages && atlas->shelf_x + width > FONT_ATLAS_PAGE_WIDTH)
+    {
+      atlas->shelf_y += atlas->shelf_height;
+      atlas->shelf_x = 0;
+      atlas->shelf_height = 0;
+    }
+  if ((!atlas->pages || atlas->shelf_y + height > FONT_ATLAS_PAGE_HEIGHT)
+      && atlas_add_page (atlas))
+    return 0;
+
+  page = atlas->pages;
+  x = atlas->shelf_x;
+  y = atlas->shelf_y;
+  atlas->shelf_x += width;
+  if (atlas->shelf_height < height)
+    atlas->shelf_height = height;
+
+  row = (grub_uint32_t *) page->bitmap.data + y * FONT_ATLAS_PAGE_WIDTH + x;
+  if (cell)
+    row += ((atlas->ascent - glyph->offset_y - glyph->height)
+	    * FONT_ATLAS_PAGE_WIDTH + glyph->offset_x);
+  for (j = 0, bit = 0; j < glyph->height; j++, row += FONT_ATLAS_PAGE_WIDTH)
+    for (i = 0; i < glyph->width; i++, bit++)
+      if (glyph->bitmap[bit >> 3] & (0x80 >> (bit & 7)))
+	row[i] = atlas->pixel;
+
+  slot = atlas_find_slot (atlas, glyph);
+  slot->glyph = glyph;
+  slot->page = page;
+  slot->x = x;
+  slot->y = y;
+  slot->cell = cell;
+  atlas->used_slots++;
+  return slot;
+}
+
+/* Get COLOR as an RGBA8888 pixel in *PIXEL.  Returns 0 if glyphs are
+   better drawn from their bits on the active render target.  */
+static int
+atlas_pixel (grub_video_color_t color, grub_uint32_t *pixel)
+{
+  struct grub_video_mode_info info;
+  grub_uint8_t red, green, blue, alpha;
+
+  if (grub_video_get_info (&info) != GRUB_ERR_NONE)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  switch (info.blit_format)
+    {
+    case GRUB_VIDEO_BLIT_FORMAT_RGBA_8888:
+    case GRUB_VIDEO_BLIT_FORMAT_BGRA_8888:
+    case GRUB_VIDEO_BLIT_FORMAT_RGB_888:
+    case GRUB_VIDEO_BLIT_FORMAT_BGR_888:
+      break;
+    default:
+      return 0;
+    }
+
+  grub_video_unmap_color (color, &red, &green, &blue, &alpha);
+  *pixel = (red | (green << 8) | (blue << 16)
+	    | ((grub_uint32_t) alpha << 24));
+  return 1;
+}
+
+static grub_err_t
+atlas_flush_run (struct font_atlas_run *run)
+{
+  struct font_atlas_page *page = run->page;
+
+  run->page = 0;
+  if (!page || run->top >= run->bottom)
+    return GRUB_ERR_NONE;
+
+  font_cache_stats.atlas_blits++;
+  return grub_video_blit_bitmap (&page->bitmap, GRUB_VIDEO_BLIT_BLEND,
+				 run->x, run->y + run->top,
+				 run->src_x, run->src_y + run->top,
+				 run->width, run->bottom - run->top);
+}
+
+/* Draw GLYPH from its bits.  */
+static grub_err_t
+draw_glyph_bits (struct grub_font_glyph *glyph, grub_video_color_t color,
+		 int left_x, int baseline_y)
 {
   struct grub_video_bitmap glyph_bitmap;
 
@@ -1599,3 +2045,156 @@ grub_font_draw_glyph (struct grub_font_glyph * glyph,
 				 bitmap_left, bitmap_top,
 				 0, 0, glyph->width, glyph->height);
 }
+
+/* Draw GLYPH at (LEFT_X, BASELINE_Y), from the atlas for its font in the
+   color PIXEL if HAVE_PIXEL is set.  *ATLAS caches the atlas of the
+   previous glyph, and a glyph whose cell continues RUN is added to it
+   rather than drawn right away.  */
+static grub_err_t
+draw_glyph_atlas (struct grub_font_glyph *glyph, grub_video_color_t color,
+		  int have_pixel, grub_uint32_t pixel,
+		  struct font_atlas **atlas, struct font_atlas_run *run,
+		  int left_x, int baseline_y)
+{
+  struct font_atlas_slot *slot = 0;
+  grub_err_t err;
+  int x, y;
+
+  /* The contents of constructed glyphs change, so they can't be kept.  */
+  if (have_pixel && glyph != constructed_glyph)
+    {
+      if (!*atlas || (*atlas)->font != glyph->font)
+	*atlas = atlas_get (glyph->font, pixel);
+      if (*atlas)
+	{
+	  slot = atlas_find_slot (*atlas, glyph);
+	  if (slot->glyph)
+	    font_cache_stats.atlas_hits++;
+	  else
+	    {
+	      /* Adding a glyph may free the page of the run.  */
+	      err = atlas_flush_run (run);
+	      if (err)
+		return err;
+	      slot = atlas_add (*atlas, glyph);
+	      if (slot)
+		font_cache_stats.atlas_misses++;
+	    }
+	}
+      /* Out of memory for the atlas: fall back to the bits.  */
+      if (!slot)
+	grub_errno = GRUB_ERR_NONE;
+    }
+
+  if (!slot || !slot->cell)
+    {
+      err = atlas_flush_run (run);
+      if (err)
+	return err;
+      if (!slot)
+	return draw_glyph_bits (glyph, color, left_x, baseline_y);
+
+      font_cache_stats.atlas_blits++;
+      return grub_video_blit_bitmap (&slot->page->bitmap,
+				     GRUB_VIDEO_BLIT_BLEND,
+				     left_x + glyph->offset_x,
+				     baseline_y - glyph->offset_y
+				     - glyph->height,
+				     slot->x, slot->y,
+				     glyph->width, glyph->height);
+    }
+
+  x = left_x;
+  y = baseline_y - (*atlas)->ascent;
+  if (run->page != slot->page || run->src_y != slot->y
+      || run->src_x + run->width != slot->x
+      || run->x + run->width != x || run->y != y)
+    {
+      err = atlas_flush_run (run);
+      if (err)
+	return err;
+      run->page = slot->page;
+      run->x = x;
+      run->y = y;
+      run->src_x = slot->x;
+      run->src_y = slot->y;
+      run->width = 0;
+      run->top = (*atlas)->ascent + (*atlas)->descent;
+      run->bottom = 0;
+    }
+
+  run->width += glyph->device_width;
+  if (glyph->width && glyph->height)
+    {
+      int top = (*atlas)->ascent - glyph->offset_y - glyph->height;
+
+      if (run->top > top)
+	run->top = top;
+      if (run->bottom < top + glyph->height)
+	run->bottom = top + glyph->height;
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Draw the specified glyph at (x, y).  The y coordinate designates the
+   baseline of the character, while the x coordinate designates the left
+   side location of the character.  */
+grub_err_t
+grub_font_draw_glyph (struct grub_font_glyph * glyph,
+		      grub_video_color_t color, int left_x, int baseline_y)
+{
+  struct font_atlas *atlas = 0;
+  struct font_atlas_run run = { .page = 0 };
+  grub_uint32_t pixel;
+  int have_pixel;
+  grub_err_t err;
+
+  /* Don't try to draw empty glyphs (U+0020, etc.).  */
+  if (glyph->width == 0 || glyph->height == 0)
+    return GRUB_ERR_NONE;
+
+  have_pixel = atlas_pixel (color, &pixel);
+  err = draw_glyph_atlas (glyph, color, have_pixel, pixel, &atlas, &run,
+			  left_x, baseline_y);
+  if (err)
+    return err;
+  return atlas_flush_run (&run);
+}
+
+grub_err_t
+grub_font_draw_glyphs (grub_font_t hinted_font,
+		       const struct grub_unicode_glyph *glyphs,
+		       grub_size_t count, grub_video_color_t color,
+		       int left_x, int baseline_y)
+{
+  struct font_atlas *atlas = 0;
+  struct font_atlas_run run = { .page = 0 };
+  grub_uint32_t pixel;
+  int have_pixel;
+  grub_size_t i;
+  grub_err_t err;
+
+  have_pixel = atlas_pixel (color, &pixel);
+  for (i = 0; i < count; i++)
+    {
+      struct grub_font_glyph *glyph;
+
+      glyph = grub_font_construct_glyph (hinted_font, &glyphs[i]);
+      if (!glyph)
+	return grub_errno;
+      err = draw_glyph_atlas (glyph, color, have_pixel, pixel, &atlas, &run,
+			      left_x, baseline_y);
+      if (err)
+	return err;
+      left_x += glyph->device_width;
+    }
+
+  return atlas_flush_run (&run);
+}
+
+void
+grub_font_get_cache_stats (struct grub_font_cache_stats *stats)
+{
+  *stats = font_cache_stats;
+  stats->atlas_bytes = font_atlas_size;
+}
@@ -48,6 +48,7 @@ lsfonts_command (grub_command_t cmd __attribute__ ((unused)),
                  char **args __attribute__ ((unused)))
 {
   struct grub_font_node *node;
+  struct grub_font_cache_stats stats;
 
   grub_puts_ (N_("Loaded fonts:"));
   for (node = grub_font_list; node; node = node->next)
@@ -56,6 +57,15 @@ lsfonts_command (grub_command_t cmd __attribute__ ((unused)),
       grub_printf ("%s\n", grub_font_get_name (font));
     }
 
+  grub_font_get_cache_stats (&stats);
+  grub_printf_ (N_("Glyphs loaded: %lu in %lu reads\n"),
+		stats.glyphs_loaded, stats.glyph_reads);
+  grub_printf_ (N_("Glyph atlases: %lu hits, %lu misses, %lu blits, "
+		   "%lu evictions, %lu KiB\n"),
+		stats.atlas_hits, stats.atlas_misses, stats.atlas_blits,
+		stats.atlas_evictions,
+		(unsigned long) (stats.atlas_bytes >> 10));
+
   return GRUB_ERR_NONE;
 }
 
@@ -21,6 +21,9 @@
 #include <grub/fs.h>
 #include <grub/disk.h>
 #include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -78,10 +81,9 @@ handle_symlink (struct grub_archelp_data *data,
   if (grub_memcmp (*name, fn, flen) != 0 
       || ((*name)[flen] != 0 && (*name)[flen] != '/'))
     return GRUB_ERR_NONE;
+  /* REST keeps its leading slash, if any.  */
   rest = *name + flen;
-  lastslash = rest;
-  if (*rest)
-    rest++;
+  lastslash = rest - 1;
   while (lastslash >= *name && *lastslash != '/')
     lastslash--;
   if (lastslash >= *name)
@@ -133,9 +135,373 @@ handle_symlink (struct grub_archelp_data *data,
   return GRUB_ERR_NONE;
 }
 
+struct grub_archelp_index_entry
+{
+  char *name;
+  grub_off_t pos;
+  grub_uint32_t mode;
+  grub_int32_t mtime;
+};
+
+/* The members sorted by canonical name, members of the same name in
+   archive order.  */
+struct grub_archelp_index
+{
+  struct grub_archelp_index_entry *entries;
+  grub_size_t n;
+};
+
+/* Compare NAME with the first LEN characters of KEY like strcmp, except
+   that '/' sorts before any other character, so that the members under
+   a directory directly follow it.  */
+static int
+name_cmp (const char *name, const char *key, grub_size_t len)
+{
+  grub_size_t i;
+
+  for (i = 0; ; i++)
+    {
+      int a = (grub_uint8_t) name[i];
+      int b = i < len ? (grub_uint8_t) key[i] : 0;
+
+      if (a != b || a == 0)
+	{
+	  if (a == '/')
+	    a = 1;
+	  else if (a)
+	    a++;
+	  if (b == '/')
+	    b = 1;
+	  else if (b)
+	    b++;
+	  return a - b;
+	}
+    }
+}
+
+/* Return the first entry not sorting before the first LEN characters of
+   KEY.  */
+static grub_size_t
+index_lower_bound (struct grub_archelp_index *index, const char *key,
+		   grub_size_t len)
+{
+  grub_size_t lo = 0, hi = index->n;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (name_cmp (index->entries[mid].name, key, len) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static struct grub_archelp_index_entry *
+index_find (struct grub_archelp_index *index, const char *key,
+	    grub_size_t len)
+{
+  grub_size_t i = index_lower_bound (index, key, len);
+
+  if (i < index->n && name_cmp (index->entries[i].name, key, len) == 0)
+    return &index->entries[i];
+  return NULL;
+}
+
+/* Stable merge sort, so that the first of several members of the same
+   name stays first like for a scan.  */
+static void
+index_sort (struct grub_archelp_index_entry *entries,
+	    struct grub_archelp_index_entry *tmp, grub_size_t n)
+{
+  grub_size_t width, i;
+
+  for (width = 1; width < n; width *= 2)
+    {
+      for (i = 0; i < n; i += 2 * width)
+	{
+	  grub_size_t l = i, lend, r, rend, o = i;
+
+	  lend = i + width < n ? i + width : n;
+	  rend = i + 2 * width < n ? i + 2 * width : n;
+	  r = lend;
+	  while (l < lend && r < rend)
+	    {
+	      if (name_cmp (entries[r].name, entries[l].name,
+			    GRUB_SIZE_MAX) < 0)
+		tmp[o++] = entries[r++];
+	      else
+		tmp[o++] = entries[l++];
+	    }
+	  while (l < lend)
+	    tmp[o++] = entries[l++];
+	  while (r < rend)
+	    tmp[o++] = entries[r++];
+	}
+      grub_memcpy (entries, tmp, n * sizeof (entries[0]));
+    }
+}
+
+void
+grub_archelp_index_free (void *data)
+{
+  struct grub_archelp_index *index = data;
+  grub_size_t i;
+
+  for (i = 0; i < index->n; i++)
+    grub_free (index->entries[i].name);
+  grub_free (index->entries);
+  grub_free (index);
+}
+
+static struct grub_archelp_index *
+index_build (struct grub_archelp_data *data,
+	     struct grub_archelp_ops *arcops)
+{
+  struct grub_archelp_index *index;
+  struct grub_archelp_index_entry *tmp;
+  grub_size_t alloc = 0;
+
+  index = grub_zalloc (sizeof (*index));
+  if (!index)
+    return NULL;
+
+  arcops->rewind (data);
+  while (1)
+    {
+      struct grub_archelp_index_entry *e;
+      grub_off_t pos = arcops->tell (data);
+      grub_uint32_t mode;
+      grub_int32_t mtime = 0;
+      char *name;
+
+      if (arcops->find_file (data, &name, &mtime, &mode))
+	goto fail;
+      if (mode == GRUB_ARCHELP_ATTR_END)
+	break;
+      canonicalize (name);
+
+      if (index->n == alloc)
+	{
+	  alloc = alloc ? 2 * alloc : 64;
+	  e = grub_realloc (index->entries, alloc * sizeof (*e));
+	  if (!e)
+	    {
+	      grub_free (name);
+	      goto fail;
+	    }
+	  index->entries = e;
+	}
+      e = &index->entries[index->n++];
+      e->name = name;
+      e->pos = pos;
+      e->mode = mode;
+      e->mtime = mtime;
+    }
+
+  tmp = grub_malloc (index->n * sizeof (*tmp) + 1);
+  if (!tmp)
+    goto fail;
+  index_sort (index->entries, tmp, index->n);
+  grub_free (tmp);
+
+  grub_dprintf ("archelp", "indexed %" PRIuGRUB_SIZE " members\n", index->n);
+  return index;
+
+ fail:
+  grub_archelp_index_free (index);
+  return NULL;
+}
+
+struct grub_archelp_index *
+grub_archelp_index_get (grub_fs_t fs, grub_disk_t disk,
+			struct grub_archelp_data *data,
+			struct grub_archelp_ops *arcops)
+{
+  struct grub_archelp_index *index;
+
+  if (!arcops->tell || !arcops->seek)
+    return NULL;
+
+  index = grub_fs_mount_cache_get (fs, disk);
+  if (index)
+    return index;
+
+  /* A damaged archive is still scanned as far as it goes.  */
+  index = index_build (data, arcops);
+  arcops->rewind (data);
+  if (!index)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  grub_fs_mount_cache_put (fs, disk, index);
+  return index;
+}
+
+void
+grub_archelp_index_release (struct grub_archelp_index *index)
+{
+  if (index && !grub_fs_mount_cache_release (index))
+    grub_archelp_index_free (index);
+}
+
+/* Make the archive read the member E next.  */
+static grub_err_t
+index_read_member (struct grub_archelp_data *data,
+		   struct grub_archelp_ops *arcops,
+		   struct grub_archelp_index_entry *e)
+{
+  grub_uint32_t mode;
+  grub_int32_t mtime;
+  char *name;
+
+  arcops->seek (data, e->pos);
+  if (arcops->find_file (data, &name, &mtime, &mode))
+    return grub_errno;
+  if (mode == GRUB_ARCHELP_ATTR_END)
+    return grub_error (GRUB_ERR_BAD_FS, "archive changed");
+  grub_free (name);
+  return GRUB_ERR_NONE;
+}
+
+/* Follow the symlinks among the leading components of *NAME.  */
+static grub_err_t
+index_resolve (struct grub_archelp_data *data,
+	       struct grub_archelp_ops *arcops,
+	       struct grub_archelp_index *index, char **name)
+{
+  int symlinknest = 0;
+  grub_size_t i;
+
+  if (!arcops->get_link_target)
+    return GRUB_ERR_NONE;
+
+ again:
+  for (i = 0; ; i++)
+    {
+      struct grub_archelp_index_entry *e;
+      int restart;
+
+      if ((*name)[i] != '/' && (*name)[i] != 0)
+	continue;
+      if (i == 0)
+	{
+	  if (!(*name)[i])
+	    break;
+	  continue;
+	}
+
+      e = index_find (index, *name, i);
+      if (e && (e->mode & GRUB_ARCHELP_ATTR_TYPE) == GRUB_ARCHELP_ATTR_LNK)
+	{
+	  if (index_read_member (data, arcops, e)
+	      || handle_symlink (data, arcops, e->name, name, e->mode,
+				 &restart))
+	    return grub_errno;
+	  if (restart)
+	    {
+	      if (++symlinknest == 8)
+		return grub_error (GRUB_ERR_SYMLINK_LOOP,
+				   N_("too deep nesting of symlinks"));
+	      goto again;
+	    }
+	}
+      if (!(*name)[i])
+	break;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+index_dir (struct grub_archelp_data *data,
+	   struct grub_archelp_ops *arcops,
+	   struct grub_archelp_index *index, char **path,
+	   grub_fs_dir_hook_t hook, void *hook_data)
+{
+  grub_size_t len, i;
+
+  if (index_resolve (data, arcops, index, path))
+    return grub_errno;
+
+  len = grub_strlen (*path);
+  i = index_lower_bound (index, *path, len);
+  while (i < index->n)
+    {
+      struct grub_archelp_index_entry *e = &index->entries[i];
+      struct grub_dirhook_info info;
+      const char *n;
+      char *child;
+      grub_size_t clen;
+
+      if (len && (grub_memcmp (e->name, *path, len) != 0
+		  || (e->name[len] != 0 && e->name[len] != '/')))
+	break;
+
+      n = e->name + len;
+      while (*n == '/')
+	n++;
+      if (*n == 0)
+	{
+	  i++;
+	  continue;
+	}
+      for (clen = 0; n[clen] && n[clen] != '/'; clen++);
+
+      grub_memset (&info, 0, sizeof (info));
+      info.dir = (n[clen] == '/'
+		  || (e->mode & GRUB_ARCHELP_ATTR_TYPE) == GRUB_ARCHELP_ATTR_DIR);
+      if (!(e->mode & GRUB_ARCHELP_ATTR_NOTIME))
+	{
+	  info.mtime = e->mtime;
+	  info.mtimeset = 1;
+	}
+
+      /* The rest of this child sorts right after it.  */
+      clen += n - e->name;
+      for (i++; i < index->n; i++)
+	if (grub_memcmp (index->entries[i].name, e->name, clen) != 0
+	    || (index->entries[i].name[clen] != 0
+		&& index->entries[i].name[clen] != '/'))
+	  break;
+
+      child = grub_strndup (n, e->name + clen - n);
+      if (!child)
+	return grub_errno;
+      if (hook (child, &info, hook_data))
+	{
+	  grub_free (child);
+	  break;
+	}
+      grub_free (child);
+    }
+  return grub_errno;
+}
+
+static grub_err_t
+index_open (struct grub_archelp_data *data,
+	    struct grub_archelp_ops *arcops,
+	    struct grub_archelp_index *index, char **name,
+	    const char *name_in)
+{
+  struct grub_archelp_index_entry *e;
+
+  if (index_resolve (data, arcops, index, name))
+    return grub_errno;
+
+  e = index_find (index, *name, grub_strlen (*name));
+  if (!e)
+    return grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"),
+		       name_in);
+  return index_read_member (data, arcops, e);
+}
+
 grub_err_t
 grub_archelp_dir (struct grub_archelp_data *data,
 		  struct grub_archelp_ops *arcops,
+		  struct grub_archelp_index *index,
 		  const char *path_in,
 		  grub_fs_dir_hook_t hook, void *hook_data)
 {
@@ -150,6 +516,13 @@ grub_archelp_dir (struct grub_archelp_data *data,
   for (ptr = path + grub_strlen (path) - 1; ptr >= path && *ptr == '/'; ptr--)
     *ptr = 0;
 
+  if (index)
+    {
+      index_dir (data, arcops, index, &path, hook, hook_data);
+      grub_free (path);
+      return grub_errno;
+    }
+
   prev = 0;
 
   len = grub_strlen (path);
@@ -235,6 +608,7 @@ fail:
 grub_err_t
 grub_archelp_open (struct grub_archelp_data *data,
 		   struct grub_archelp_ops *arcops,
+		   struct grub_archelp_index *index,
 		   const char *name_in)
 {
   char *fn;
@@ -246,6 +620,13 @@ grub_archelp_open (struct grub_archelp_data *data,
 
   canonicalize (name);
 
+  if (index)
+    {
+      index_open (data, arcops, index, &name, name_in);
+      grub_free (name);
+      return grub_errno;
+    }
+
   while (1)
     {
       grub_uint32_t mode;
@@ -27,6 +27,7 @@
 #include <grub/lib/crc.h>
 #include <grub/deflate.h>
 #include <minilzo.h>
+#include <zstd.h>
 #include <grub/i18n.h>
 #include <grub/btrfs.h>
 
@@ -45,6 +46,10 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE (GRUB_BTRFS_LZO_BLOCK_SIZE + \
 				     (GRUB_BTRFS_LZO_BLOCK_SIZE / 16) + 64 + 3)
 
+/* Compressed extents never hold more than 128 KiB of data.  */
+#define GRUB_BTRFS_MAX_DECODED (128 * 1024)
+#define GRUB_BTRFS_DECODED_CACHE_SIZE 4
+
 typedef grub_uint8_t grub_btrfs_checksum_t[0x20];
 typedef grub_uint16_t grub_btrfs_uuid_t[8];
 
@@ -66,7 +71,13 @@ struct grub_btrfs_superblock
   grub_uint64_t chunk_tree;
   grub_uint8_t dummy2[0x20];
   grub_uint64_t root_dir_objectid;
-  grub_uint8_t dummy3[0x41];
+  grub_uint64_t num_devices;
+  grub_uint32_t sectorsize;
+  grub_uint32_t nodesize;
+  grub_uint32_t leafsize;
+  grub_uint32_t stripesize;
+  grub_uint32_t sys_chunk_array_size;
+  grub_uint8_t dummy3[0x25];
   struct grub_btrfs_device this_device;
   char label[0x100];
   grub_uint8_t dummy4[0x100];
@@ -88,16 +99,70 @@ struct grub_btrfs_device_desc
   grub_uint64_t id;
 };
 
+/* A chunk in the chunk map: the chunk item followed by its stripes.  */
+struct grub_btrfs_chunk_map
+{
+  grub_uint64_t start;
+  grub_uint64_t size;
+  struct grub_btrfs_chunk_item *chunk;
+};
+
+/* A tree node in the node cache, valid when STAMP isn't zero.  */
+struct grub_btrfs_cached_node
+{
+  grub_disk_addr_t addr;
+  grub_uint64_t stamp;
+  grub_uint8_t *buf;
+};
+
+#define GRUB_BTRFS_NODE_CACHE_SIZE 32
+
+/* A decompressed extent, valid when STAMP isn't zero.  Extents are
+   identified by where their compressed data lies on disk, so files
+   sharing an extent share the entry too.  */
+struct grub_btrfs_decoded_extent
+{
+  grub_uint64_t laddr;
+  grub_uint64_t zsize;
+  grub_uint64_t stamp;
+  grub_size_t size;
+  char *buf;
+};
+
+struct grub_btrfs_leaf_descriptor
+{
+  unsigned depth;
+  unsigned allocated;
+  struct
+  {
+    grub_disk_addr_t addr;
+    unsigned iter;
+    unsigned maxiter;
+    int leaf;
+  } *data;
+};
+
 struct grub_btrfs_data
 {
   struct grub_btrfs_superblock sblock;
-  grub_uint64_t tree;
-  grub_uint64_t inode;
 
   struct grub_btrfs_device_desc *devices_attached;
   unsigned n_devices_attached;
   unsigned n_devices_allocated;
 
+  /* All chunks sorted by logical address, from the superblock and the
+     chunk tree.  */
+  struct grub_btrfs_chunk_map *chunks;
+  unsigned n_chunks;
+
+  grub_uint32_t nodesize;
+  struct grub_btrfs_cached_node nodes[GRUB_BTRFS_NODE_CACHE_SIZE];
+  grub_uint64_t node_stamp;
+
+  /* The leaf the last lookup ended in and the root of its tree.  */
+  grub_uint64_t hint_root;
+  grub_disk_addr_t hint_leaf;
+
   /* Cached extent data.  */
   grub_uint64_t extstart;
   grub_uint64_t extend;
@@ -105,6 +170,26 @@ struct grub_btrfs_data
   grub_uint64_t exttree;
   grub_size_t extsize;
   struct grub_btrfs_extent_data *extent;
+  /* Position of the cached extent in its tree, for moving on to the
+     next one.  */
+  struct grub_btrfs_leaf_descriptor extdesc;
+  int have_extdesc;
+
+  /* Recently decompressed extents.  */
+  struct grub_btrfs_decoded_extent decoded[GRUB_BTRFS_DECODED_CACHE_SIZE];
+  grub_uint64_t decoded_stamp;
+  /* Compressed data being decoded.  */
+  char *zbuf;
+  grub_size_t zbuf_size;
+  ZSTD_DCtx *zstd;
+};
+
+/* An open file.  */
+struct grub_btrfs_file
+{
+  struct grub_btrfs_data *data;
+  grub_uint64_t tree;
+  grub_uint64_t inode;
 };
 
 struct grub_btrfs_chunk_item
@@ -158,19 +243,6 @@ struct grub_btrfs_dir_item
   char name[0];
 } GRUB_PACKED;
 
-struct grub_btrfs_leaf_descriptor
-{
-  unsigned depth;
-  unsigned allocated;
-  struct
-  {
-    grub_disk_addr_t addr;
-    unsigned iter;
-    unsigned maxiter;
-    int leaf;
-  } *data;
-};
-
 struct grub_btrfs_time
 {
   grub_int64_t sec;
@@ -212,6 +284,7 @@ struct grub_btrfs_extent_data
 #define GRUB_BTRFS_COMPRESSION_NONE 0
 #define GRUB_BTRFS_COMPRESSION_ZLIB 1
 #define GRUB_BTRFS_COMPRESSION_LZO  2
+#define GRUB_BTRFS_COMPRESSION_ZSTD 3
 
 #define GRUB_BTRFS_OBJECT_ID_CHUNK 0x100
 
@@ -219,6 +292,8 @@ static grub_disk_addr_t superblock_sectors[] = { 64 * 2, 64 * 1024 * 2,
   256 * 1048576 * 2, 1048576ULL * 1048576ULL * 2
 };
 
+static struct grub_fs grub_btrfs_fs;
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data,
 			 grub_disk_addr_t addr, void *buf, grub_size_t size,
@@ -306,6 +381,90 @@ save_ref (struct grub_btrfs_leaf_descriptor *desc,
   return GRUB_ERR_NONE;
 }
 
+/* Return in *NODE the tree node at ADDR, reading it into the node cache
+   if it isn't there yet.  The buffer stays valid until the next call
+   that may read from disk.  */
+static grub_err_t
+get_node (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+	  const grub_uint8_t **node, int recursion_depth)
+{
+  struct grub_btrfs_cached_node *slot = NULL;
+  const struct btrfs_header *head;
+  grub_err_t err;
+  unsigned i;
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_SIZE; i++)
+    {
+      if (data->nodes[i].stamp && data->nodes[i].addr == addr)
+	{
+	  data->nodes[i].stamp = ++data->node_stamp;
+	  *node = data->nodes[i].buf;
+	  return GRUB_ERR_NONE;
+	}
+      /* Slots being filled have a zero stamp but a buffer; reading a
+	 node may need nodes of the chunk tree, so leave them alone.  */
+      if (!data->nodes[i].stamp && data->nodes[i].buf)
+	continue;
+      if (!slot || data->nodes[i].stamp < slot->stamp)
+	slot = &data->nodes[i];
+    }
+  if (!slot)
+    return grub_error (GRUB_ERR_BAD_FS, "too deep btrfs virtual nesting");
+
+  if (!slot->buf)
+    {
+      slot->buf = grub_malloc (data->nodesize);
+      if (!slot->buf)
+	return grub_errno;
+    }
+  slot->stamp = 0;
+
+  err = grub_btrfs_read_logical (data, addr, slot->buf, data->nodesize,
+				 recursion_depth);
+  if (err)
+    {
+      grub_free (slot->buf);
+      slot->buf = NULL;
+      return err;
+    }
+
+  head = (const struct btrfs_header *) slot->buf;
+  if (sizeof (*head) + (grub_size_t) grub_le_to_cpu32 (head->nitems)
+      * (head->level ? sizeof (struct grub_btrfs_internal_node)
+	 : sizeof (struct grub_btrfs_leaf_node)) > data->nodesize)
+    {
+      grub_free (slot->buf);
+      slot->buf = NULL;
+      return grub_error (GRUB_ERR_BAD_FS, "invalid btrfs node");
+    }
+
+  slot->addr = addr;
+  slot->stamp = ++data->node_stamp;
+  *node = slot->buf;
+  return GRUB_ERR_NONE;
+}
+
+/* Return the number of the N items of size STRIDE starting at ITEMS
+   whose key isn't larger than KEY.  */
+static unsigned
+node_search (const grub_uint8_t *items, grub_size_t stride, unsigned n,
+	     const struct grub_btrfs_key *key)
+{
+  unsigned lo = 0, hi = n;
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (key_cmp ((const struct grub_btrfs_key *) (items + mid * stride),
+		   key) <= 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
 static int
 next (struct grub_btrfs_data *data,
       struct grub_btrfs_leaf_descriptor *desc,
@@ -313,7 +472,9 @@ next (struct grub_btrfs_data *data,
       struct grub_btrfs_key *key_out)
 {
   grub_err_t err;
-  struct grub_btrfs_leaf_node leaf;
+  const grub_uint8_t *node;
+  const struct btrfs_header *head;
+  const struct grub_btrfs_leaf_node *leaf;
 
   for (; desc->depth > 0; desc->depth--)
     {
@@ -326,39 +487,84 @@ next (struct grub_btrfs_data *data,
     return 0;
   while (!desc->data[desc->depth - 1].leaf)
     {
-      struct grub_btrfs_internal_node node;
-      struct btrfs_header head;
-
-      err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				     * sizeof (node)
-				     + sizeof (struct btrfs_header)
-				     + desc->data[desc->depth - 1].addr,
-				     &node, sizeof (node), 0);
+      const struct grub_btrfs_internal_node *inode;
+      grub_disk_addr_t child;
+
+      err = get_node (data, desc->data[desc->depth - 1].addr, &node, 0);
       if (err)
 	return -err;
+      inode = (const struct grub_btrfs_internal_node *)
+	(node + sizeof (struct btrfs_header));
+      child = grub_le_to_cpu64 (inode[desc->data[desc->depth - 1].iter].addr);
 
-      err = grub_btrfs_read_logical (data, grub_le_to_cpu64 (node.addr),
-				     &head, sizeof (head), 0);
+      err = get_node (data, child, &node, 0);
       if (err)
 	return -err;
+      head = (const struct btrfs_header *) node;
+      if (head->nitems == 0)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "empty btrfs node");
+	  return -grub_errno;
+	}
 
-      save_ref (desc, grub_le_to_cpu64 (node.addr), 0,
-		grub_le_to_cpu32 (head.nitems), !head.level);
+      err = save_ref (desc, child, 0, grub_le_to_cpu32 (head->nitems),
+		      !head->level);
+      if (err)
+	return -err;
     }
-  err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				 * sizeof (leaf)
-				 + sizeof (struct btrfs_header)
-				 + desc->data[desc->depth - 1].addr, &leaf,
-				 sizeof (leaf), 0);
+  err = get_node (data, desc->data[desc->depth - 1].addr, &node, 0);
   if (err)
     return -err;
-  *outsize = grub_le_to_cpu32 (leaf.size);
+  leaf = (const struct grub_btrfs_leaf_node *)
+    (node + sizeof (struct btrfs_header));
+  leaf += desc->data[desc->depth - 1].iter;
+  *outsize = grub_le_to_cpu32 (leaf->size);
   *outaddr = desc->data[desc->depth - 1].addr + sizeof (struct btrfs_header)
-    + grub_le_to_cpu32 (leaf.offset);
-  *key_out = leaf.key;
+    + grub_le_to_cpu32 (leaf->offset);
+  *key_out = leaf->key;
   return 1;
 }
 
+/* Return in the outputs the item of the leaf NODE at ADDR with the
+   largest key not larger than KEY_IN, or nothing if there isn't one.  */
+static grub_err_t
+leaf_lower_bound (grub_disk_addr_t addr, const grub_uint8_t *node,
+		  const struct grub_btrfs_key *key_in,
+		  struct grub_btrfs_key *key_out,
+		  grub_disk_addr_t *outaddr, grub_size_t *outsize,
+		  struct grub_btrfs_leaf_descriptor *desc)
+{
+  const struct btrfs_header *head = (const struct btrfs_header *) node;
+  const struct grub_btrfs_leaf_node *leaf;
+  unsigned nitems = grub_le_to_cpu32 (head->nitems);
+  unsigned i;
+
+  leaf = (const struct grub_btrfs_leaf_node *) (node + sizeof (*head));
+  i = node_search ((const grub_uint8_t *) leaf, sizeof (*leaf), nitems,
+		   key_in);
+  if (i == 0)
+    {
+      *outsize = 0;
+      *outaddr = 0;
+      grub_memset (key_out, 0, sizeof (*key_out));
+      if (desc)
+	return save_ref (desc, addr, -1, nitems, 1);
+      return GRUB_ERR_NONE;
+    }
+
+  grub_dprintf ("btrfs",
+		"leaf %" PRIxGRUB_UINT64_T " %x %" PRIxGRUB_UINT64_T "\n",
+		leaf[i - 1].key.object_id, leaf[i - 1].key.type,
+		leaf[i - 1].key.offset);
+
+  grub_memcpy (key_out, &leaf[i - 1].key, sizeof (*key_out));
+  *outsize = grub_le_to_cpu32 (leaf[i - 1].size);
+  *outaddr = addr + sizeof (*head) + grub_le_to_cpu32 (leaf[i - 1].offset);
+  if (desc)
+    return save_ref (desc, addr, i - 1, nitems, 1);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 lower_bound (struct grub_btrfs_data *data,
 	     const struct grub_btrfs_key *key_in,
@@ -370,6 +576,9 @@ lower_bound (struct grub_btrfs_data *data,
 {
   grub_disk_addr_t addr = grub_le_to_cpu64 (root);
   int depth = -1;
+  const grub_uint8_t *node;
+  const struct btrfs_header *head;
+  grub_err_t err;
 
   if (desc)
     {
@@ -390,128 +599,76 @@ lower_bound (struct grub_btrfs_data *data,
 		" %x %" PRIxGRUB_UINT64_T "\n",
 		key_in->object_id, key_in->type, key_in->offset);
 
+  /* Lookups of nearby keys, like the items of one inode, usually end in
+     the same leaf.  If KEY_IN lies between its first and last key, the
+     answer is in there.  */
+  if (!desc && data->hint_leaf && data->hint_root == addr)
+    {
+      err = get_node (data, data->hint_leaf, &node, recursion_depth + 1);
+      if (err)
+	grub_errno = GRUB_ERR_NONE;
+      else
+	{
+	  const struct grub_btrfs_leaf_node *leaf;
+	  unsigned nitems;
+
+	  head = (const struct btrfs_header *) node;
+	  leaf = (const struct grub_btrfs_leaf_node *) (node + sizeof (*head));
+	  nitems = grub_le_to_cpu32 (head->nitems);
+	  if (!head->level && nitems
+	      && key_cmp (&leaf[0].key, key_in) <= 0
+	      && key_cmp (&leaf[nitems - 1].key, key_in) >= 0)
+	    return leaf_lower_bound (data->hint_leaf, node, key_in,
+				     key_out, outaddr, outsize, NULL);
+	}
+    }
+
   while (1)
     {
-      grub_err_t err;
-      struct btrfs_header head;
+      const struct grub_btrfs_internal_node *inode;
+      unsigned nitems, i;
 
-    reiter:
       depth++;
-      /* FIXME: preread few nodes into buffer. */
-      err = grub_btrfs_read_logical (data, addr, &head, sizeof (head),
-				     recursion_depth + 1);
+      err = get_node (data, addr, &node, recursion_depth + 1);
       if (err)
 	return err;
-      addr += sizeof (head);
-      if (head.level)
-	{
-	  unsigned i;
-	  struct grub_btrfs_internal_node node, node_last;
-	  int have_last = 0;
-	  grub_memset (&node_last, 0, sizeof (node_last));
-	  for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
-	    {
-	      err = grub_btrfs_read_logical (data, addr + i * sizeof (node),
-					     &node, sizeof (node),
-					     recursion_depth + 1);
-	      if (err)
-		return err;
-
-	      grub_dprintf ("btrfs",
-			    "internal node (depth %d) %" PRIxGRUB_UINT64_T
-			    " %x %" PRIxGRUB_UINT64_T "\n", depth,
-			    node.key.object_id, node.key.type,
-			    node.key.offset);
+      head = (const struct btrfs_header *) node;
+      nitems = grub_le_to_cpu32 (head->nitems);
+      if (!head->level)
+	break;
 
-	      if (key_cmp (&node.key, key_in) == 0)
-		{
-		  err = GRUB_ERR_NONE;
-		  if (desc)
-		    err = save_ref (desc, addr - sizeof (head), i,
-				    grub_le_to_cpu32 (head.nitems), 0);
-		  if (err)
-		    return err;
-		  addr = grub_le_to_cpu64 (node.addr);
-		  goto reiter;
-		}
-	      if (key_cmp (&node.key, key_in) > 0)
-		break;
-	      node_last = node;
-	      have_last = 1;
-	    }
-	  if (have_last)
-	    {
-	      err = GRUB_ERR_NONE;
-	      if (desc)
-		err = save_ref (desc, addr - sizeof (head), i - 1,
-				grub_le_to_cpu32 (head.nitems), 0);
-	      if (err)
-		return err;
-	      addr = grub_le_to_cpu64 (node_last.addr);
-	      goto reiter;
-	    }
+      inode = (const struct grub_btrfs_internal_node *) (node + sizeof (*head));
+      i = node_search ((const grub_uint8_t *) inode, sizeof (*inode), nitems,
+		       key_in);
+      if (i == 0)
+	{
 	  *outsize = 0;
 	  *outaddr = 0;
 	  grub_memset (key_out, 0, sizeof (*key_out));
 	  if (desc)
-	    return save_ref (desc, addr - sizeof (head), -1,
-			     grub_le_to_cpu32 (head.nitems), 0);
+	    return save_ref (desc, addr, -1, nitems, 0);
 	  return GRUB_ERR_NONE;
 	}
-      {
-	unsigned i;
-	struct grub_btrfs_leaf_node leaf, leaf_last;
-	int have_last = 0;
-	for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
-	  {
-	    err = grub_btrfs_read_logical (data, addr + i * sizeof (leaf),
-					   &leaf, sizeof (leaf),
-					   recursion_depth + 1);
-	    if (err)
-	      return err;
 
-	    grub_dprintf ("btrfs",
-			  "leaf (depth %d) %" PRIxGRUB_UINT64_T
-			  " %x %" PRIxGRUB_UINT64_T "\n", depth,
-			  leaf.key.object_id, leaf.key.type, leaf.key.offset);
+      grub_dprintf ("btrfs",
+		    "internal node (depth %d) %" PRIxGRUB_UINT64_T
+		    " %x %" PRIxGRUB_UINT64_T "\n", depth,
+		    inode[i - 1].key.object_id, inode[i - 1].key.type,
+		    inode[i - 1].key.offset);
 
-	    if (key_cmp (&leaf.key, key_in) == 0)
-	      {
-		grub_memcpy (key_out, &leaf.key, sizeof (*key_out));
-		*outsize = grub_le_to_cpu32 (leaf.size);
-		*outaddr = addr + grub_le_to_cpu32 (leaf.offset);
-		if (desc)
-		  return save_ref (desc, addr - sizeof (head), i,
-				   grub_le_to_cpu32 (head.nitems), 1);
-		return GRUB_ERR_NONE;
-	      }
-
-	    if (key_cmp (&leaf.key, key_in) > 0)
-	      break;
-
-	    have_last = 1;
-	    leaf_last = leaf;
-	  }
-
-	if (have_last)
-	  {
-	    grub_memcpy (key_out, &leaf_last.key, sizeof (*key_out));
-	    *outsize = grub_le_to_cpu32 (leaf_last.size);
-	    *outaddr = addr + grub_le_to_cpu32 (leaf_last.offset);
-	    if (desc)
-	      return save_ref (desc, addr - sizeof (head), i - 1,
-			       grub_le_to_cpu32 (head.nitems), 1);
-	    return GRUB_ERR_NONE;
-	  }
-	*outsize = 0;
-	*outaddr = 0;
-	grub_memset (key_out, 0, sizeof (*key_out));
-	if (desc)
-	  return save_ref (desc, addr - sizeof (head), -1,
-			   grub_le_to_cpu32 (head.nitems), 1);
-	return GRUB_ERR_NONE;
-      }
+      if (desc)
+	{
+	  err = save_ref (desc, addr, i - 1, nitems, 0);
+	  if (err)
+	    return err;
+	}
+      addr = grub_le_to_cpu64 (inode[i - 1].addr);
     }
+
+  data->hint_root = grub_le_to_cpu64 (root);
+  data->hint_leaf = addr;
+  return leaf_lower_bound (addr, node, key_in, key_out,
+			   outaddr, outsize, desc);
 }
 
 /* Context for find_device.  */
@@ -606,15 +763,50 @@ find_device (struct grub_btrfs_data *data, grub_uint64_t id, int do_rescan)
   return ctx.dev_found;
 }
 
+/* Return the chunk containing ADDR from the chunk map, or NULL.  */
+static struct grub_btrfs_chunk_map *
+find_chunk (struct grub_btrfs_data *data, grub_disk_addr_t addr)
+{
+  unsigned lo = 0, hi = data->n_chunks;
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (data->chunks[mid].start <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo == 0 || addr - data->chunks[lo - 1].start >= data->chunks[lo - 1].size)
+    return NULL;
+  return &data->chunks[lo - 1];
+}
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 void *buf, grub_size_t size, int recursion_depth)
 {
+  unsigned n;
+
+  /* Items are mostly read from the nodes just searched.  */
+  for (n = 0; n < GRUB_BTRFS_NODE_CACHE_SIZE; n++)
+    if (data->nodes[n].stamp && data->nodes[n].addr <= addr
+	&& addr - data->nodes[n].addr < data->nodesize
+	&& size <= data->nodesize - (addr - data->nodes[n].addr))
+      {
+	grub_memcpy (buf, data->nodes[n].buf + (addr - data->nodes[n].addr),
+		     size);
+	return GRUB_ERR_NONE;
+      }
+
   while (size > 0)
     {
       grub_uint8_t *ptr;
       struct grub_btrfs_key *key;
       struct grub_btrfs_chunk_item *chunk;
+      struct grub_btrfs_chunk_map *map;
+      grub_uint64_t chstart;
       grub_uint64_t csize;
       grub_err_t err = 0;
       struct grub_btrfs_key key_out;
@@ -626,6 +818,13 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 
       grub_dprintf ("btrfs", "searching for laddr %" PRIxGRUB_UINT64_T "\n",
 		    addr);
+      map = find_chunk (data, addr);
+      if (map)
+	{
+	  chunk = map->chunk;
+	  chstart = map->start;
+	  goto chunk_found;
+	}
       for (ptr = data->sblock.bootstrap_mapping;
 	   ptr < data->sblock.bootstrap_mapping
 	   + sizeof (data->sblock.bootstrap_mapping)
@@ -639,9 +838,8 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			"%" PRIxGRUB_UINT64_T " %" PRIxGRUB_UINT64_T " \n",
 			grub_le_to_cpu64 (key->offset),
 			grub_le_to_cpu64 (chunk->size));
-	  if (grub_le_to_cpu64 (key->offset) <= addr
-	      && addr < grub_le_to_cpu64 (key->offset)
-	      + grub_le_to_cpu64 (chunk->size))
+	  chstart = grub_le_to_cpu64 (key->offset);
+	  if (chstart <= addr && addr < chstart + grub_le_to_cpu64 (chunk->size))
 	    goto chunk_found;
 	  ptr += sizeof (*key) + sizeof (*chunk)
 	    + sizeof (struct grub_btrfs_chunk_stripe)
@@ -661,6 +859,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	  || !(grub_le_to_cpu64 (key->offset) <= addr))
 	return grub_error (GRUB_ERR_BAD_FS,
 			   "couldn't find the chunk descriptor");
+      chstart = grub_le_to_cpu64 (key->offset);
 
       chunk = grub_malloc (chsize);
       if (!chunk)
@@ -679,7 +878,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
       {
 	grub_uint64_t stripen;
 	grub_uint64_t stripe_offset;
-	grub_uint64_t off = addr - grub_le_to_cpu64 (key->offset);
+	grub_uint64_t off = addr - chstart;
 	grub_uint64_t chunk_stripe_length;
 	grub_uint16_t nstripes;
 	unsigned redundancy = 1;
@@ -698,7 +897,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 		      "+0x%" PRIxGRUB_UINT64_T
 		      " (%d stripes (%d substripes) of %"
 		      PRIxGRUB_UINT64_T ")\n",
-		      grub_le_to_cpu64 (key->offset),
+		      chstart,
 		      grub_le_to_cpu64 (chunk->size),
 		      nstripes,
 		      grub_le_to_cpu16 (chunk->nsubstripes),
@@ -797,7 +996,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			      " (%d stripes (%d substripes) of %"
 			      PRIxGRUB_UINT64_T ") stripe %" PRIxGRUB_UINT64_T
 			      " maps to 0x%" PRIxGRUB_UINT64_T "\n",
-			      grub_le_to_cpu64 (key->offset),
+			      chstart,
 			      grub_le_to_cpu64 (chunk->size),
 			      grub_le_to_cpu16 (chunk->nstripes),
 			      grub_le_to_cpu16 (chunk->nsubstripes),
@@ -837,6 +1036,142 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
   return GRUB_ERR_NONE;
 }
 
+/* Append the chunk starting at START described by CHUNK of SIZE bytes to
+   the map in *CHUNKS, which has *N entries.  */
+static grub_err_t
+add_chunk (struct grub_btrfs_chunk_map **chunks, unsigned *n,
+	   grub_uint64_t start, const struct grub_btrfs_chunk_item *chunk,
+	   grub_size_t size)
+{
+  struct grub_btrfs_chunk_map *map;
+
+  if (size < sizeof (*chunk)
+      || size < sizeof (*chunk) + grub_le_to_cpu16 (chunk->nstripes)
+      * sizeof (struct grub_btrfs_chunk_stripe)
+      || (*n && (*chunks)[*n - 1].start + (*chunks)[*n - 1].size > start))
+    return grub_error (GRUB_ERR_BAD_FS, "invalid chunk");
+
+  if ((*n & (*n - 1)) == 0)
+    {
+      map = grub_realloc (*chunks, (*n ? 2 * *n : 8) * sizeof (**chunks));
+      if (!map)
+	return grub_errno;
+      *chunks = map;
+    }
+  map = &(*chunks)[*n];
+  map->chunk = grub_malloc (size);
+  if (!map->chunk)
+    return grub_errno;
+  grub_memcpy (map->chunk, chunk, size);
+  map->start = start;
+  map->size = grub_le_to_cpu64 (chunk->size);
+  (*n)++;
+  return GRUB_ERR_NONE;
+}
+
+static void
+free_chunks (struct grub_btrfs_chunk_map *chunks, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++)
+    grub_free (chunks[i].chunk);
+  grub_free (chunks);
+}
+
+/* Build the chunk map: first from the chunks in the superblock, which
+   cover the chunk tree, then from the whole chunk tree.  Without a map
+   chunks are looked up in the chunk tree on every read.  */
+static void
+load_chunks (struct grub_btrfs_data *data)
+{
+  struct grub_btrfs_chunk_map *chunks = NULL;
+  unsigned n = 0;
+  grub_uint8_t *ptr, *end;
+  struct grub_btrfs_key key_in, key_out;
+  struct grub_btrfs_leaf_descriptor desc;
+  grub_disk_addr_t elemaddr;
+  grub_size_t elemsize;
+  struct grub_btrfs_chunk_item *chunk = NULL;
+  grub_size_t allocated = 0;
+  int r;
+
+  end = data->sblock.bootstrap_mapping + sizeof (data->sblock.bootstrap_mapping);
+  if (grub_le_to_cpu32 (data->sblock.sys_chunk_array_size)
+      < sizeof (data->sblock.bootstrap_mapping))
+    end = data->sblock.bootstrap_mapping
+      + grub_le_to_cpu32 (data->sblock.sys_chunk_array_size);
+  for (ptr = data->sblock.bootstrap_mapping;
+       ptr + sizeof (struct grub_btrfs_key)
+	 + sizeof (struct grub_btrfs_chunk_item) <= end;)
+    {
+      struct grub_btrfs_key *key = (struct grub_btrfs_key *) ptr;
+      grub_size_t size;
+
+      if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
+	break;
+      chunk = (struct grub_btrfs_chunk_item *) (key + 1);
+      size = sizeof (*chunk) + sizeof (struct grub_btrfs_chunk_stripe)
+	* grub_le_to_cpu16 (chunk->nstripes);
+      if ((grub_uint8_t *) chunk + size > end
+	  || add_chunk (&chunks, &n, grub_le_to_cpu64 (key->offset),
+			chunk, size))
+	goto fail;
+      ptr = (grub_uint8_t *) chunk + size;
+    }
+  data->chunks = chunks;
+  data->n_chunks = n;
+  chunks = NULL;
+  n = 0;
+  chunk = NULL;
+
+  key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
+  key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
+  key_in.offset = 0;
+  if (lower_bound (data, &key_in, &key_out, data->sblock.chunk_tree,
+		   &elemaddr, &elemsize, &desc, 0))
+    {
+      free_iterator (&desc);
+      goto fail;
+    }
+  if (key_out.object_id != key_in.object_id || key_out.type != key_in.type)
+    r = next (data, &desc, &elemaddr, &elemsize, &key_out);
+  else
+    r = 1;
+  for (; r > 0; r = next (data, &desc, &elemaddr, &elemsize, &key_out))
+    {
+      if (key_out.object_id != key_in.object_id
+	  || key_out.type != key_in.type)
+	break;
+      if (elemsize > allocated)
+	{
+	  allocated = 2 * elemsize;
+	  grub_free (chunk);
+	  chunk = grub_malloc (allocated);
+	  if (!chunk)
+	    break;
+	}
+      if (grub_btrfs_read_logical (data, elemaddr, chunk, elemsize, 0)
+	  || add_chunk (&chunks, &n, grub_le_to_cpu64 (key_out.offset),
+			chunk, elemsize))
+	break;
+    }
+  free_iterator (&desc);
+  grub_free (chunk);
+  chunk = NULL;
+  if (r < 0 || grub_errno || n == 0)
+    goto fail;
+
+  free_chunks (data->chunks, data->n_chunks);
+  data->chunks = chunks;
+  data->n_chunks = n;
+  return;
+
+ fail:
+  free_chunks (chunks, n);
+  grub_errno = GRUB_ERR_NONE;
+}
+
 static struct grub_btrfs_data *
 grub_btrfs_mount (grub_device_t dev)
 {
@@ -849,6 +1184,13 @@ grub_btrfs_mount (grub_device_t dev)
       return NULL;
     }
 
+  data = grub_fs_mount_cache_get (&grub_btrfs_fs, dev->disk);
+  if (data)
+    {
+      data->devices_attached[0].dev = dev;
+      return data;
+    }
+
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return NULL;
@@ -860,6 +1202,16 @@ grub_btrfs_mount (grub_device_t dev)
       return NULL;
     }
 
+  data->nodesize = grub_le_to_cpu32 (data->sblock.nodesize);
+  if (data->nodesize < sizeof (struct btrfs_header)
+      || data->nodesize > 0x10000
+      || (data->nodesize & (data->nodesize - 1)))
+    {
+      grub_free (data);
+      grub_error (GRUB_ERR_BAD_FS, "unsupported btrfs node size");
+      return NULL;
+    }
+
   data->n_devices_allocated = 16;
   data->devices_attached = grub_malloc (sizeof (data->devices_attached[0])
 					* data->n_devices_allocated);
@@ -872,21 +1224,42 @@ grub_btrfs_mount (grub_device_t dev)
   data->devices_attached[0].dev = dev;
   data->devices_attached[0].id = data->sblock.this_device.device_id;
 
+  load_chunks (data);
+
+  grub_fs_mount_cache_put (&grub_btrfs_fs, dev->disk, data);
+
   return data;
 }
 
 static void
-grub_btrfs_unmount (struct grub_btrfs_data *data)
+grub_btrfs_free_mount (void *mount)
 {
+  struct grub_btrfs_data *data = mount;
   unsigned i;
   /* The device 0 is closed one layer upper.  */
   for (i = 1; i < data->n_devices_attached; i++)
     grub_device_close (data->devices_attached[i].dev);
   grub_free (data->devices_attached);
+  free_chunks (data->chunks, data->n_chunks);
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_SIZE; i++)
+    grub_free (data->nodes[i].buf);
+  if (data->have_extdesc)
+    free_iterator (&data->extdesc);
   grub_free (data->extent);
+  for (i = 0; i < GRUB_BTRFS_DECODED_CACHE_SIZE; i++)
+    grub_free (data->decoded[i].buf);
+  grub_free (data->zbuf);
+  ZSTD_freeDCtx (data->zstd);
   grub_free (data);
 }
 
+static void
+grub_btrfs_unmount (struct grub_btrfs_data *data)
+{
+  if (!grub_fs_mount_cache_release (data))
+    grub_btrfs_free_mount (data);
+}
+
 static grub_err_t
 grub_btrfs_read_inode (struct grub_btrfs_data *data,
 		       struct grub_btrfs_inode *inode, grub_uint64_t num,
@@ -919,6 +1292,7 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
   grub_uint32_t total_size, cblock_size;
   grub_size_t ret = 0;
   char *ibuf0 = ibuf;
+  grub_uint8_t *buf = NULL;
 
   total_size = grub_le_to_cpu32 (grub_get_unaligned32 (ibuf));
   ibuf += sizeof (total_size);
@@ -961,14 +1335,16 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
       if (off > 0 || osize < GRUB_BTRFS_LZO_BLOCK_SIZE)
 	{
 	  grub_size_t to_copy = GRUB_BTRFS_LZO_BLOCK_SIZE - off;
-	  grub_uint8_t *buf;
 
 	  if (to_copy > osize)
 	    to_copy = osize;
 
-	  buf = grub_malloc (GRUB_BTRFS_LZO_BLOCK_SIZE);
 	  if (!buf)
-	    return -1;
+	    {
+	      buf = grub_malloc (GRUB_BTRFS_LZO_BLOCK_SIZE);
+	      if (!buf)
+		return -1;
+	    }
 
 	  if (lzo1x_decompress_safe ((lzo_bytep)ibuf, cblock_size, buf, &usize,
 	      NULL) != LZO_E_OK)
@@ -986,15 +1362,16 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
 	  obuf += to_copy;
 	  ibuf += cblock_size;
 	  off = 0;
-
-	  grub_free (buf);
 	  continue;
 	}
 
       /* Decompress whole block directly to output buffer.  */
       if (lzo1x_decompress_safe ((lzo_bytep)ibuf, cblock_size, (lzo_bytep)obuf,
 	  &usize, NULL) != LZO_E_OK)
-	return -1;
+	{
+	  grub_free (buf);
+	  return -1;
+	}
 
       osize -= usize;
       ret += usize;
@@ -1002,9 +1379,170 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
       ibuf += cblock_size;
     }
 
+  grub_free (buf);
   return ret;
 }
 
+static grub_ssize_t
+grub_btrfs_zstd_decompress (struct grub_btrfs_data *data,
+			    char *ibuf, grub_size_t isize, grub_off_t off,
+			    char *obuf, grub_size_t osize)
+{
+  char *tmp = NULL;
+  char *out = obuf;
+  grub_size_t outsize = osize;
+  grub_size_t zret;
+  grub_ssize_t ret = -1;
+
+  /* A frame is always decoded whole, so unless the caller wants all of
+     it, decode into a scratch buffer large enough for any extent.  */
+  if (off || ZSTD_getFrameContentSize (ibuf, isize) > osize)
+    {
+      tmp = grub_malloc (GRUB_BTRFS_MAX_DECODED);
+      if (!tmp)
+	return -1;
+      out = tmp;
+      outsize = GRUB_BTRFS_MAX_DECODED;
+    }
+
+  if (!data->zstd)
+    {
+      data->zstd = ZSTD_createDCtx ();
+      if (!data->zstd)
+	{
+	  grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+	  goto out;
+	}
+    }
+
+  /* The compressed data is padded to a whole sector.  */
+  isize = ZSTD_findFrameCompressedSize (ibuf, isize);
+  if (ZSTD_isError (isize))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+      goto out;
+    }
+
+  zret = ZSTD_decompressDCtx (data->zstd, out, outsize, ibuf, isize);
+  if (ZSTD_isError (zret))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+      goto out;
+    }
+
+  if (zret <= off)
+    ret = 0;
+  else
+    {
+      ret = zret - off;
+      if ((grub_size_t) ret > osize)
+	ret = osize;
+      if (tmp)
+	grub_memcpy (obuf, tmp + off, ret);
+    }
+
+ out:
+  grub_free (tmp);
+  return ret;
+}
+
+/* Decompress OSIZE bytes starting at OFF of the data in IBUF compressed
+   with COMPRESSION into OBUF.  Return the number of bytes decompressed or
+   -1 on error.  */
+static grub_ssize_t
+grub_btrfs_decompress (struct grub_btrfs_data *data, grub_uint8_t compression,
+		       char *ibuf, grub_size_t isize, grub_off_t off,
+		       char *obuf, grub_size_t osize)
+{
+  switch (compression)
+    {
+    case GRUB_BTRFS_COMPRESSION_ZLIB:
+      return grub_zlib_decompress (ibuf, isize, off, obuf, osize);
+    case GRUB_BTRFS_COMPRESSION_LZO:
+      return grub_btrfs_lzo_decompress (ibuf, isize, off, obuf, osize);
+    case GRUB_BTRFS_COMPRESSION_ZSTD:
+      return grub_btrfs_zstd_decompress (data, ibuf, isize, off, obuf, osize);
+    }
+  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+	      "compression type 0x%x not supported", compression);
+  return -1;
+}
+
+/* Read the compressed data of the current extent into data->zbuf.  */
+static grub_err_t
+read_compressed (struct grub_btrfs_data *data, grub_size_t *zsize)
+{
+  grub_uint64_t size = grub_le_to_cpu64 (data->extent->compressed_size);
+
+  if (size > data->zbuf_size)
+    {
+      char *zbuf;
+
+      zbuf = grub_malloc (size);
+      if (!zbuf)
+	return grub_errno;
+      grub_free (data->zbuf);
+      data->zbuf = zbuf;
+      data->zbuf_size = size;
+    }
+  *zsize = size;
+  return grub_btrfs_read_logical (data, grub_le_to_cpu64 (data->extent->laddr),
+				  data->zbuf, size, 0);
+}
+
+/* Return the whole decompressed data of the current extent, decoding it
+   only if it isn't in the cache yet.  */
+static const char *
+get_decoded_extent (struct grub_btrfs_data *data, grub_size_t *size)
+{
+  struct grub_btrfs_decoded_extent *slot = NULL;
+  grub_uint64_t laddr = grub_le_to_cpu64 (data->extent->laddr);
+  grub_uint64_t zsize = grub_le_to_cpu64 (data->extent->compressed_size);
+  grub_size_t isize;
+  grub_ssize_t ret;
+  unsigned i;
+
+  for (i = 0; i < GRUB_BTRFS_DECODED_CACHE_SIZE; i++)
+    {
+      if (data->decoded[i].stamp && data->decoded[i].laddr == laddr
+	  && data->decoded[i].zsize == zsize)
+	{
+	  data->decoded[i].stamp = ++data->decoded_stamp;
+	  *size = data->decoded[i].size;
+	  return data->decoded[i].buf;
+	}
+      if (!slot || data->decoded[i].stamp < slot->stamp)
+	slot = &data->decoded[i];
+    }
+
+  if (!slot->buf)
+    {
+      slot->buf = grub_malloc (GRUB_BTRFS_MAX_DECODED);
+      if (!slot->buf)
+	return NULL;
+    }
+  slot->stamp = 0;
+
+  if (read_compressed (data, &isize))
+    return NULL;
+  ret = grub_btrfs_decompress (data, data->extent->compression, data->zbuf,
+			       isize, 0, slot->buf,
+			       grub_le_to_cpu64 (data->extent->size));
+  if (ret < 0)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "corrupted compressed data");
+      return NULL;
+    }
+
+  slot->laddr = laddr;
+  slot->zsize = zsize;
+  slot->size = ret;
+  slot->stamp = ++data->decoded_stamp;
+  *size = slot->size;
+  return slot->buf;
+}
+
 static grub_ssize_t
 grub_btrfs_extent_read (struct grub_btrfs_data *data,
 			grub_uint64_t ino, grub_uint64_t tree,
@@ -1022,15 +1560,35 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 	  struct grub_btrfs_key key_in, key_out;
 	  grub_disk_addr_t elemaddr;
 	  grub_size_t elemsize;
+	  int found = 0;
+
+	  /* When reading on from the end of the cached extent, the next
+	     extent is normally the next item in the tree.  */
+	  if (data->extent && data->have_extdesc && data->extino == ino
+	      && data->exttree == tree && data->extend == pos
+	      && next (data, &data->extdesc, &elemaddr, &elemsize,
+		       &key_out) > 0
+	      && key_out.object_id == ino
+	      && key_out.type == GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM
+	      && grub_le_to_cpu64 (key_out.offset) <= pos)
+	    found = 1;
+	  grub_errno = GRUB_ERR_NONE;
 
 	  grub_free (data->extent);
-	  key_in.object_id = ino;
-	  key_in.type = GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM;
-	  key_in.offset = grub_cpu_to_le64 (pos);
-	  err = lower_bound (data, &key_in, &key_out, tree,
-			     &elemaddr, &elemsize, NULL, 0);
-	  if (err)
-	    return -1;
+	  data->extent = NULL;
+	  if (!found)
+	    {
+	      if (data->have_extdesc)
+		free_iterator (&data->extdesc);
+	      data->have_extdesc = 1;
+	      key_in.object_id = ino;
+	      key_in.type = GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM;
+	      key_in.offset = grub_cpu_to_le64 (pos);
+	      err = lower_bound (data, &key_in, &key_out, tree,
+				 &elemaddr, &elemsize, &data->extdesc, 0);
+	      if (err)
+		return -1;
+	    }
 	  if (key_out.object_id != ino
 	      || key_out.type != GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM)
 	    {
@@ -1087,7 +1645,8 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 
       if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE
 	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZLIB
-	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO)
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZSTD)
 	{
 	  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		      "compression type 0x%x not supported",
@@ -1104,12 +1663,13 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
       switch (data->extent->type)
 	{
 	case GRUB_BTRFS_EXTENT_INLINE:
-	  if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
+	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
 	    {
-	      if (grub_zlib_decompress (data->extent->inl, data->extsize -
-					((grub_uint8_t *) data->extent->inl
-					 - (grub_uint8_t *) data->extent),
-					extoff, buf, csize)
+	      if (grub_btrfs_decompress (data, data->extent->compression,
+					 data->extent->inl, data->extsize -
+					 ((grub_uint8_t *) data->extent->inl
+					  - (grub_uint8_t *) data->extent),
+					 extoff, buf, csize)
 		  != (grub_ssize_t) csize)
 		{
 		  if (!grub_errno)
@@ -1118,15 +1678,6 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		  return -1;
 		}
 	    }
-	  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
-	    {
-	      if (grub_btrfs_lzo_decompress(data->extent->inl, data->extsize -
-					   ((grub_uint8_t *) data->extent->inl
-					    - (grub_uint8_t *) data->extent),
-					   extoff, buf, csize)
-		  != (grub_ssize_t) csize)
-		return -1;
-	    }
 	  else
 	    grub_memcpy (buf, data->extent->inl + extoff, csize);
 	  break;
@@ -1139,36 +1690,36 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 
 	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
 	    {
-	      char *tmp;
-	      grub_uint64_t zsize;
+	      grub_uint64_t off = grub_le_to_cpu64 (data->extent->offset)
+		+ extoff;
+	      grub_size_t zsize;
 	      grub_ssize_t ret;
 
-	      zsize = grub_le_to_cpu64 (data->extent->compressed_size);
-	      tmp = grub_malloc (zsize);
-	      if (!tmp)
-		return -1;
-	      err = grub_btrfs_read_logical (data,
-					     grub_le_to_cpu64 (data->extent->laddr),
-					     tmp, zsize, 0);
-	      if (err)
+	      /* Sequential reads come in pieces much smaller than an
+		 extent, so decode it once and serve them from the cache.  */
+	      if (grub_le_to_cpu64 (data->extent->size)
+		  <= GRUB_BTRFS_MAX_DECODED)
 		{
-		  grub_free (tmp);
-		  return -1;
+		  const char *decoded;
+		  grub_size_t decoded_size;
+
+		  decoded = get_decoded_extent (data, &decoded_size);
+		  if (!decoded)
+		    return -1;
+		  if (off > decoded_size || decoded_size - off < csize)
+		    {
+		      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+				  "premature end of compressed");
+		      return -1;
+		    }
+		  grub_memcpy (buf, decoded + off, csize);
+		  break;
 		}
 
-	      if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
-		ret = grub_zlib_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
-	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
-		ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
-	      else
-		ret = -1;
-
-	      grub_free (tmp);
-
+	      if (read_compressed (data, &zsize))
+		return -1;
+	      ret = grub_btrfs_decompress (data, data->extent->compression,
+					   data->zbuf, zsize, off, buf, csize);
 	      if (ret != (grub_ssize_t) csize)
 		{
 		  if (!grub_errno)
@@ -1626,11 +2177,13 @@ grub_btrfs_open (struct grub_file *file, const char *name)
   struct grub_btrfs_inode inode;
   grub_uint8_t type;
   struct grub_btrfs_key key_in;
+  struct grub_btrfs_file *bfile;
+  grub_uint64_t tree;
 
   if (!data)
     return grub_errno;
 
-  err = find_path (data, name, &key_in, &data->tree, &type);
+  err = find_path (data, name, &key_in, &tree, &type);
   if (err)
     {
       grub_btrfs_unmount (data);
@@ -1642,15 +2195,25 @@ grub_btrfs_open (struct grub_file *file, const char *name)
       return grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("not a regular file"));
     }
 
-  data->inode = key_in.object_id;
-  err = grub_btrfs_read_inode (data, &inode, data->inode, data->tree);
+  err = grub_btrfs_read_inode (data, &inode, key_in.object_id, tree);
   if (err)
     {
       grub_btrfs_unmount (data);
       return err;
     }
 
-  file->data = data;
+  /* The mount data may be shared with other files.  */
+  bfile = grub_malloc (sizeof (*bfile));
+  if (!bfile)
+    {
+      grub_btrfs_unmount (data);
+      return grub_errno;
+    }
+  bfile->data = data;
+  bfile->tree = tree;
+  bfile->inode = key_in.object_id;
+
+  file->data = bfile;
   file->size = grub_le_to_cpu64 (inode.size);
 
   return err;
@@ -1659,7 +2222,10 @@ grub_btrfs_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_btrfs_close (grub_file_t file)
 {
-  grub_btrfs_unmount (file->data);
+  struct grub_btrfs_file *bfile = file->data;
+
+  grub_btrfs_unmount (bfile->data);
+  grub_free (bfile);
 
   return GRUB_ERR_NONE;
 }
@@ -1667,10 +2233,11 @@ grub_btrfs_close (grub_file_t file)
 static grub_ssize_t
 grub_btrfs_read (grub_file_t file, char *buf, grub_size_t len)
 {
-  struct grub_btrfs_data *data = file->data;
+  struct grub_btrfs_file *bfile = file->data;
 
-  return grub_btrfs_extent_read (data, data->inode,
-				 data->tree, file->offset, buf, len);
+  bfile->data->devices_attached[0].dev = file->device;
+  return grub_btrfs_extent_read (bfile->data, bfile->inode,
+				 bfile->tree, file->offset, buf, len);
 }
 
 static grub_err_t
@@ -1749,6 +2316,13 @@ grub_btrfs_embed (grub_device_t device __attribute__ ((unused)),
 }
 #endif
 
+static const struct grub_fs_signature grub_btrfs_signatures[] =
+  {
+    /* Signature of the primary superblock, which is always checked.  */
+    { 64 * 1024 + 0x40, sizeof (GRUB_BTRFS_SIGNATURE) - 1, GRUB_BTRFS_SIGNATURE },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_btrfs_fs = {
   .name = "btrfs",
   .dir = grub_btrfs_dir,
@@ -1757,6 +2331,8 @@ static struct grub_fs grub_btrfs_fs = {
   .close = grub_btrfs_close,
   .uuid = grub_btrfs_uuid,
   .label = grub_btrfs_label,
+  .signatures = grub_btrfs_signatures,
+  .unmount = grub_btrfs_free_mount,
 #ifdef GRUB_UTIL
   .embed = grub_btrfs_embed,
   .reserved_first_sector = 1,
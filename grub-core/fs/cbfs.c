@@ -211,7 +211,7 @@ grub_cbfs_dir (grub_device_t device, const char *path_in,
   if (!data)
     return grub_errno;
 
-  err = grub_archelp_dir (data, &arcops,
+  err = grub_archelp_dir (data, &arcops, NULL,
 			  path_in, hook, hook_data);
 
   grub_free (data);
@@ -229,7 +229,7 @@ grub_cbfs_open (grub_file_t file, const char *name_in)
   if (!data)
     return grub_errno;
 
-  err = grub_archelp_open (data, &arcops, name_in);
+  err = grub_archelp_open (data, &arcops, NULL, name_in);
   if (err)
     {
       grub_free (data);
@@ -125,13 +125,29 @@ grub_cpio_rewind (struct grub_archelp_data *data)
   data->next_hofs = 0;
 }
 
+static grub_off_t
+grub_cpio_tell (struct grub_archelp_data *data)
+{
+  return data->next_hofs;
+}
+
+static void
+grub_cpio_seek (struct grub_archelp_data *data, grub_off_t pos)
+{
+  data->next_hofs = pos;
+}
+
 static struct grub_archelp_ops arcops =
   {
     .find_file = grub_cpio_find_file,
     .get_link_target = grub_cpio_get_link_target,
-    .rewind = grub_cpio_rewind
+    .rewind = grub_cpio_rewind,
+    .tell = grub_cpio_tell,
+    .seek = grub_cpio_seek
   };
 
+static struct grub_fs grub_cpio_fs;
+
 static struct grub_archelp_data *
 grub_cpio_mount (grub_disk_t disk)
 {
@@ -166,14 +182,17 @@ grub_cpio_dir (grub_device_t device, const char *path_in,
 	       grub_fs_dir_hook_t hook, void *hook_data)
 {
   struct grub_archelp_data *data;
+  struct grub_archelp_index *index;
   grub_err_t err;
 
   data = grub_cpio_mount (device->disk);
   if (!data)
     return grub_errno;
 
-  err = grub_archelp_dir (data, &arcops,
+  index = grub_archelp_index_get (&grub_cpio_fs, device->disk, data, &arcops);
+  err = grub_archelp_dir (data, &arcops, index,
 			  path_in, hook, hook_data);
+  grub_archelp_index_release (index);
 
   grub_free (data);
 
@@ -184,13 +203,17 @@ static grub_err_t
 grub_cpio_open (grub_file_t file, const char *name_in)
 {
   struct grub_archelp_data *data;
+  struct grub_archelp_index *index;
   grub_err_t err;
 
   data = grub_cpio_mount (file->device->disk);
   if (!data)
     return grub_errno;
 
-  err = grub_archelp_open (data, &arcops, name_in);
+  index = grub_archelp_index_get (&grub_cpio_fs, file->device->disk, data,
+				  &arcops);
+  err = grub_archelp_open (data, &arcops, index, name_in);
+  grub_archelp_index_release (index);
   if (err)
     {
       grub_free (data);
@@ -237,6 +260,7 @@ static struct grub_fs grub_cpio_fs = {
   .open = grub_cpio_open,
   .read = grub_cpio_read,
   .close = grub_cpio_close,
+  .unmount = grub_archelp_index_free,
 #ifdef GRUB_UTIL
   .reserved_first_sector = 0,
   .blocklist_install = 0,
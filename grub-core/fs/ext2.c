@@ -139,6 +139,23 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define EXT3_JOURNAL_FLAG_LAST_TAG	8
 
 #define EXT4_EXTENTS_FLAG		0x80000
+#define EXT2_INDEX_FLAG			0x1000
+#define EXT4_ENCRYPT_FLAG		0x800
+#define EXT4_CASEFOLD_FLAG		0x40000000
+
+/* Superblock flags.  */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+/* Directory index hashes.  */
+#define EXT2_DX_HASH_LEGACY		0
+#define EXT2_DX_HASH_HALF_MD4		1
+#define EXT2_DX_HASH_TEA		2
+#define EXT2_DX_HASH_UNSIGNED		3
+
+/* Bytes of inode table read at once, and how many such chunks are kept
+   per mount.  */
+#define EXT2_ITAB_CHUNK_SIZE		16384
+#define EXT2_ITAB_CACHE_SIZE		8
 
 /* The ext2 superblock.  */
 struct grub_ext2_sblock
@@ -193,6 +210,12 @@ struct grub_ext2_sblock
   grub_uint32_t first_meta_bg;
   grub_uint32_t mkfs_time;
   grub_uint32_t jnl_blocks[17];
+  grub_uint32_t total_blocks_hi;
+  grub_uint32_t reserved_blocks_hi;
+  grub_uint32_t free_blocks_hi;
+  grub_uint16_t min_extra_isize;
+  grub_uint16_t want_extra_isize;
+  grub_uint32_t flags;
 };
 
 /* The ext2 blockgroup.  */
@@ -324,6 +347,14 @@ struct grub_fshelp_node
   int inode_read;
 };
 
+struct grub_ext2_itab_chunk
+{
+  /* First disk block of the chunk, 0 if the slot is free.  */
+  grub_disk_addr_t block;
+  grub_uint32_t stamp;
+  char *buf;
+};
+
 /* Information about a "mounted" ext2 filesystem.  */
 struct grub_ext2_data
 {
@@ -332,10 +363,18 @@ struct grub_ext2_data
   grub_disk_t disk;
   struct grub_ext2_inode *inode;
   struct grub_fshelp_node diropen;
+  /* Path lookups, kept as long as the mount is.  */
+  grub_fshelp_dcache_t dcache;
+  /* Blocks of the group descriptor table, each read on first use.  */
+  char **gdt;
+  grub_uint32_t gdt_blocks;
+  /* Recently used pieces of inode tables.  */
+  struct grub_ext2_itab_chunk itab[EXT2_ITAB_CACHE_SIZE];
+  grub_uint32_t itab_stamp;
 };
 
 static grub_dl_t my_mod;
-
+static struct grub_fs grub_ext2_fs;
 
 
 /* Check is a = b^x for some x.  */
@@ -374,9 +413,10 @@ grub_ext2_blockgroup (struct grub_ext2_data *data, grub_uint64_t group,
 		      struct grub_ext2_block_group *blkgrp)
 {
   grub_uint64_t full_offset = (group << data->log_group_desc_size);
-  grub_uint64_t block, offset;
+  grub_uint64_t block, offset, gdt_block;
   block = (full_offset >> LOG2_BLOCK_SIZE (data));
   offset = (full_offset & ((1 << LOG2_BLOCK_SIZE (data)) - 1));
+  gdt_block = block;
   if ((data->sblock.feature_incompat
        & grub_cpu_to_le32_compile_time (EXT2_FEATURE_INCOMPAT_META_BG))
       && block >= grub_le_to_cpu32(data->sblock.first_meta_bg))
@@ -396,6 +436,40 @@ grub_ext2_blockgroup (struct grub_ext2_data *data, grub_uint64_t group,
   else
     /* Superblock.  */
     block++;
+
+  if (gdt_block < data->gdt_blocks)
+    {
+      grub_size_t len = sizeof (struct grub_ext2_block_group);
+
+      if (!data->gdt[gdt_block])
+	{
+	  char *buf = grub_malloc (EXT2_BLOCK_SIZE (data));
+
+	  if (!buf)
+	    return grub_errno;
+	  if (grub_disk_read (data->disk,
+			      ((grub_le_to_cpu32 (data->sblock.first_data_block)
+				+ block)
+			       << LOG2_EXT2_BLOCK_SIZE (data)), 0,
+			      EXT2_BLOCK_SIZE (data), buf))
+	    {
+	      grub_free (buf);
+	      return grub_errno;
+	    }
+	  data->gdt[gdt_block] = buf;
+	}
+
+      /* 32-byte descriptors don't have the upper half, which isn't
+	 looked at then.  */
+      if (offset + len > EXT2_BLOCK_SIZE (data))
+	{
+	  len = EXT2_BLOCK_SIZE (data) - offset;
+	  grub_memset ((char *) blkgrp + len, 0, sizeof (*blkgrp) - len);
+	}
+      grub_memcpy (blkgrp, data->gdt[gdt_block] + offset, len);
+      return GRUB_ERR_NONE;
+    }
+
   return grub_disk_read (data->disk,
                          ((grub_le_to_cpu32 (data->sblock.first_data_block)
 			   + block)
@@ -451,6 +525,61 @@ grub_ext4_find_leaf (struct grub_ext2_data *data,
   return 0;
 }
 
+/* Map FILEBLOCK of the extent-mapped inode of NODE to the run of disk
+   blocks *START, *COUNT, *START being 0 for a hole.  */
+static grub_err_t
+grub_ext4_read_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		       grub_disk_addr_t *start, grub_disk_addr_t *count)
+{
+  struct grub_ext2_data *data = node->data;
+  struct grub_ext2_inode *inode = &node->inode;
+  struct grub_ext4_extent_header *leaf;
+  struct grub_ext4_extent *ext;
+  grub_err_t err = GRUB_ERR_NONE;
+  int i, entries;
+
+  leaf = grub_ext4_find_leaf (data, (struct grub_ext4_extent_header *) inode->blocks.dir_blocks, fileblock);
+  if (! leaf)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid extent");
+
+  ext = (struct grub_ext4_extent *) (leaf + 1);
+  entries = grub_le_to_cpu16 (leaf->entries);
+  for (i = 0; i < entries; i++)
+    {
+      if (fileblock < grub_le_to_cpu32 (ext[i].block))
+        break;
+    }
+
+  if (--i >= 0)
+    {
+      grub_disk_addr_t off = fileblock - grub_le_to_cpu32 (ext[i].block);
+
+      if (off >= grub_le_to_cpu16 (ext[i].len))
+	{
+	  *start = 0;
+	  /* The hole ends where the next extent of this leaf begins.  Past
+	     the last one we don't know without looking at the next leaf.  */
+	  if (i + 1 < entries)
+	    *count = grub_le_to_cpu32 (ext[i + 1].block) - fileblock;
+	  else
+	    *count = 1;
+	}
+      else
+        {
+          *start = grub_le_to_cpu16 (ext[i].start_hi);
+          *start = (*start << 32) + grub_le_to_cpu32 (ext[i].start) + off;
+	  *count = grub_le_to_cpu16 (ext[i].len) - off;
+        }
+    }
+  else
+    err = grub_error (GRUB_ERR_BAD_FS, "something wrong with extent");
+
+  if (leaf != (struct grub_ext4_extent_header *) inode->blocks.dir_blocks)
+    grub_free (leaf);
+
+  return err;
+}
+
 static grub_disk_addr_t
 grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 {
@@ -465,50 +594,11 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
   if (inode->flags & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG))
     {
-      struct grub_ext4_extent_header *leaf;
-      struct grub_ext4_extent *ext;
-      int i;
-      grub_disk_addr_t ret;
-
-      leaf = grub_ext4_find_leaf (data, (struct grub_ext4_extent_header *) inode->blocks.dir_blocks, fileblock);
-      if (! leaf)
-        {
-          grub_error (GRUB_ERR_BAD_FS, "invalid extent");
-          return -1;
-        }
+      grub_disk_addr_t start, count;
 
-      ext = (struct grub_ext4_extent *) (leaf + 1);
-      for (i = 0; i < grub_le_to_cpu16 (leaf->entries); i++)
-        {
-          if (fileblock < grub_le_to_cpu32 (ext[i].block))
-            break;
-        }
-
-      if (--i >= 0)
-        {
-          fileblock -= grub_le_to_cpu32 (ext[i].block);
-          if (fileblock >= grub_le_to_cpu16 (ext[i].len))
-	    ret = 0;
-          else
-            {
-              grub_disk_addr_t start;
-
-              start = grub_le_to_cpu16 (ext[i].start_hi);
-              start = (start << 32) + grub_le_to_cpu32 (ext[i].start);
-
-              ret = fileblock + start;
-            }
-        }
-      else
-        {
-          grub_error (GRUB_ERR_BAD_FS, "something wrong with extent");
-	  ret = -1;
-        }
-
-      if (leaf != (struct grub_ext4_extent_header *) inode->blocks.dir_blocks)
-	grub_free (leaf);
-
-      return ret;
+      if (grub_ext4_read_extent (node, fileblock, &start, &count))
+	return -1;
+      return start;
     }
 
   /* Direct blocks.  */
@@ -568,16 +658,83 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
+  grub_off_t size = grub_cpu_to_le32 (node->inode.size)
+    | (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32);
+
+  if (node->inode.flags & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG))
+    return grub_fshelp_read_file_extents (node->data->disk, node,
+					  read_hook, read_hook_data,
+					  pos, len, buf, grub_ext4_read_extent,
+					  size, LOG2_EXT2_BLOCK_SIZE (node->data),
+					  0);
+
   return grub_fshelp_read_file (node->data->disk, node,
 				read_hook, read_hook_data,
 				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+				size, LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 
 }
 
 
+/* Return the cached piece of the inode table at BASE that holds its block
+   BLKNO, reading it (and the blocks around) if needed.  The piece starts
+   with block *FIRST of the table.  */
+static char *
+grub_ext2_itab_chunk (struct grub_ext2_data *data, grub_disk_addr_t base,
+		      unsigned int blkno, unsigned int *first)
+{
+  struct grub_ext2_itab_chunk *slot = &data->itab[0];
+  unsigned int per_chunk, table_blocks, count;
+  grub_disk_addr_t start;
+  int i;
+
+  per_chunk = EXT2_ITAB_CHUNK_SIZE >> LOG2_BLOCK_SIZE (data);
+  if (per_chunk == 0)
+    per_chunk = 1;
+  *first = blkno - blkno % per_chunk;
+  start = base + *first;
+
+  for (i = 0; i < EXT2_ITAB_CACHE_SIZE; i++)
+    {
+      struct grub_ext2_itab_chunk *c = &data->itab[i];
+
+      if (c->buf && c->block == start)
+	{
+	  c->stamp = ++data->itab_stamp;
+	  return c->buf;
+	}
+      if (!c->buf || (slot->buf && c->stamp < slot->stamp))
+	slot = c;
+    }
+
+  /* Stay within the table of this group.  */
+  table_blocks = ((grub_uint64_t) grub_le_to_cpu32 (data->sblock.inodes_per_group)
+		  * EXT2_INODE_SIZE (data) + EXT2_BLOCK_SIZE (data) - 1)
+    >> LOG2_BLOCK_SIZE (data);
+  count = per_chunk;
+  if (*first + count > table_blocks)
+    count = table_blocks - *first;
+  if (blkno >= *first + count)
+    return NULL;
+
+  if (!slot->buf)
+    {
+      slot->buf = grub_malloc ((grub_size_t) per_chunk
+			       << LOG2_BLOCK_SIZE (data));
+      if (!slot->buf)
+	return NULL;
+    }
+
+  slot->block = 0;
+  if (grub_disk_read (data->disk, start << LOG2_EXT2_BLOCK_SIZE (data), 0,
+		      (grub_size_t) count << LOG2_BLOCK_SIZE (data),
+		      slot->buf))
+    return NULL;
+  slot->block = start;
+  slot->stamp = ++data->itab_stamp;
+  return slot->buf;
+}
+
 /* Read the inode INO for the file described by DATA into INODE.  */
 static grub_err_t
 grub_ext2_read_inode (struct grub_ext2_data *data,
@@ -589,6 +746,8 @@ grub_ext2_read_inode (struct grub_ext2_data *data,
   unsigned int blkno;
   unsigned int blkoff;
   grub_disk_addr_t base;
+  unsigned int first;
+  char *chunk;
 
   /* It is easier to calculate if the first inode is 0.  */
   ino--;
@@ -610,6 +769,18 @@ grub_ext2_read_inode (struct grub_ext2_data *data,
     base |= (((grub_disk_addr_t) grub_le_to_cpu32 (blkgrp.inode_table_id_hi))
 	     << 32);
 
+  chunk = grub_ext2_itab_chunk (data, base, blkno, &first);
+  if (chunk)
+    {
+      grub_memcpy (inode,
+		   chunk + ((grub_size_t) (blkno - first)
+			    << LOG2_BLOCK_SIZE (data))
+		   + EXT2_INODE_SIZE (data) * blkoff,
+		   sizeof (struct grub_ext2_inode));
+      return 0;
+    }
+  grub_errno = GRUB_ERR_NONE;
+
   /* Read the inode.  */
   if (grub_disk_read (data->disk,
 		      ((base + blkno) << LOG2_EXT2_BLOCK_SIZE (data)),
@@ -620,12 +791,27 @@ grub_ext2_read_inode (struct grub_ext2_data *data,
   return 0;
 }
 
+static void grub_ext2_free_mount (void *mount);
+
+static grub_uint64_t
+grub_ext2_node_id (grub_fshelp_node_t node)
+{
+  return node->ino;
+}
+
 static struct grub_ext2_data *
 grub_ext2_mount (grub_disk_t disk)
 {
   struct grub_ext2_data *data;
 
-  data = grub_malloc (sizeof (struct grub_ext2_data));
+  data = grub_fs_mount_cache_get (&grub_ext2_fs, disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
+  data = grub_zalloc (sizeof (struct grub_ext2_data));
   if (!data)
     return 0;
 
@@ -675,6 +861,18 @@ grub_ext2_mount (grub_disk_t disk)
 
   data->disk = disk;
 
+  /* Without the array descriptors are simply read every time.  */
+  data->gdt_blocks = ((((grub_uint64_t) (grub_le_to_cpu32 (data->sblock.total_inodes)
+					  / grub_le_to_cpu32 (data->sblock.inodes_per_group)))
+		       << data->log_group_desc_size)
+		      + EXT2_BLOCK_SIZE (data) - 1) >> LOG2_BLOCK_SIZE (data);
+  data->gdt = grub_zalloc (data->gdt_blocks * sizeof (data->gdt[0]));
+  if (!data->gdt)
+    {
+      data->gdt_blocks = 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
   data->diropen.data = data;
   data->diropen.ino = 2;
   data->diropen.inode_read = 1;
@@ -685,16 +883,47 @@ grub_ext2_mount (grub_disk_t disk)
   if (grub_errno)
     goto fail;
 
+  /* Lookups just go uncached without it.  */
+  data->dcache = grub_fshelp_dcache_new (sizeof (struct grub_fshelp_node),
+					 grub_ext2_node_id);
+  grub_errno = GRUB_ERR_NONE;
+
+  grub_fs_mount_cache_put (&grub_ext2_fs, disk, data);
+
   return data;
 
  fail:
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not an ext2 filesystem");
 
-  grub_free (data);
+  grub_ext2_free_mount (data);
   return 0;
 }
 
+static void
+grub_ext2_free_mount (void *mount)
+{
+  struct grub_ext2_data *data = mount;
+  grub_uint32_t i;
+
+  if (!data)
+    return;
+  grub_fshelp_dcache_free (data->dcache);
+  for (i = 0; i < data->gdt_blocks; i++)
+    grub_free (data->gdt[i]);
+  grub_free (data->gdt);
+  for (i = 0; i < EXT2_ITAB_CACHE_SIZE; i++)
+    grub_free (data->itab[i].buf);
+  grub_free (data);
+}
+
+static void
+grub_ext2_unmount (struct grub_ext2_data *data)
+{
+  if (data && !grub_fs_mount_cache_release (data))
+    grub_ext2_free_mount (data);
+}
+
 static char *
 grub_ext2_read_symlink (grub_fshelp_node_t node)
 {
@@ -735,6 +964,63 @@ grub_ext2_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Make a node for the directory entry DIRENT of DIRO.  */
+static struct grub_fshelp_node *
+grub_ext2_dirent_node (struct grub_fshelp_node *diro,
+		       const struct ext2_dirent *dirent,
+		       enum grub_fshelp_filetype *type)
+{
+  struct grub_fshelp_node *fdiro;
+
+  *type = GRUB_FSHELP_UNKNOWN;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! fdiro)
+    return 0;
+
+  fdiro->data = diro->data;
+  fdiro->ino = grub_le_to_cpu32 (dirent->inode);
+
+  if (dirent->filetype != FILETYPE_UNKNOWN)
+    {
+      fdiro->inode_read = 0;
+
+      if (dirent->filetype == FILETYPE_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if (dirent->filetype == FILETYPE_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if (dirent->filetype == FILETYPE_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+  else
+    {
+      /* The filetype can not be read from the dirent, read
+	 the inode to get more information.  */
+      grub_ext2_read_inode (diro->data,
+			    grub_le_to_cpu32 (dirent->inode),
+			    &fdiro->inode);
+      if (grub_errno)
+	{
+	  grub_free (fdiro);
+	  return 0;
+	}
+
+      fdiro->inode_read = 1;
+
+      if ((grub_le_to_cpu16 (fdiro->inode.mode)
+	   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+
+  return fdiro;
+}
+
 static int
 grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -766,58 +1052,18 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	{
 	  char filename[MAX_NAMELEN + 1];
 	  struct grub_fshelp_node *fdiro;
-	  enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
+	  enum grub_fshelp_filetype type;
 
 	  grub_ext2_read_file (diro, 0, 0, fpos + sizeof (struct ext2_dirent),
 			       dirent.namelen, filename);
 	  if (grub_errno)
 	    return 0;
 
-	  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
-	  if (! fdiro)
-	    return 0;
-
-	  fdiro->data = diro->data;
-	  fdiro->ino = grub_le_to_cpu32 (dirent.inode);
-
 	  filename[dirent.namelen] = '\0';
 
-	  if (dirent.filetype != FILETYPE_UNKNOWN)
-	    {
-	      fdiro->inode_read = 0;
-
-	      if (dirent.filetype == FILETYPE_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if (dirent.filetype == FILETYPE_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if (dirent.filetype == FILETYPE_REG)
-		type = GRUB_FSHELP_REG;
-	    }
-	  else
-	    {
-	      /* The filetype can not be read from the dirent, read
-		 the inode to get more information.  */
-	      grub_ext2_read_inode (diro->data,
-                                    grub_le_to_cpu32 (dirent.inode),
-				    &fdiro->inode);
-	      if (grub_errno)
-		{
-		  grub_free (fdiro);
-		  return 0;
-		}
-
-	      fdiro->inode_read = 1;
-
-	      if ((grub_le_to_cpu16 (fdiro->inode.mode)
-		   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
-		type = GRUB_FSHELP_REG;
-	    }
+	  fdiro = grub_ext2_dirent_node (diro, &dirent, &type);
+	  if (! fdiro)
+	    return 0;
 
 	  if (hook (filename, type, fdiro, hook_data))
 	    return 1;
@@ -829,6 +1075,344 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+/* Directory index hashes, as in Linux fs/ext4/hash.c.  */
+
+static inline grub_uint32_t
+grub_ext2_rol32 (grub_uint32_t x, int s)
+{
+  return (x << s) | (x >> (32 - s));
+}
+
+#define DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z) ((x) ^ (y) ^ (z))
+#define DX_ROUND(f, a, b, c, d, x, s) \
+  (a += f (b, c, d) + (x), a = grub_ext2_rol32 (a, s))
+#define DX_K2 013240474631U
+#define DX_K3 015666365641U
+
+static void
+grub_ext2_half_md4 (grub_uint32_t buf[4], const grub_uint32_t in[8])
+{
+  grub_uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  DX_ROUND (DX_F, a, b, c, d, in[0], 3);
+  DX_ROUND (DX_F, d, a, b, c, in[1], 7);
+  DX_ROUND (DX_F, c, d, a, b, in[2], 11);
+  DX_ROUND (DX_F, b, c, d, a, in[3], 19);
+  DX_ROUND (DX_F, a, b, c, d, in[4], 3);
+  DX_ROUND (DX_F, d, a, b, c, in[5], 7);
+  DX_ROUND (DX_F, c, d, a, b, in[6], 11);
+  DX_ROUND (DX_F, b, c, d, a, in[7], 19);
+
+  DX_ROUND (DX_G, a, b, c, d, in[1] + DX_K2, 3);
+  DX_ROUND (DX_G, d, a, b, c, in[3] + DX_K2, 5);
+  DX_ROUND (DX_G, c, d, a, b, in[5] + DX_K2, 9);
+  DX_ROUND (DX_G, b, c, d, a, in[7] + DX_K2, 13);
+  DX_ROUND (DX_G, a, b, c, d, in[0] + DX_K2, 3);
+  DX_ROUND (DX_G, d, a, b, c, in[2] + DX_K2, 5);
+  DX_ROUND (DX_G, c, d, a, b, in[4] + DX_K2, 9);
+  DX_ROUND (DX_G, b, c, d, a, in[6] + DX_K2, 13);
+
+  DX_ROUND (DX_H, a, b, c, d, in[3] + DX_K3, 3);
+  DX_ROUND (DX_H, d, a, b, c, in[7] + DX_K3, 9);
+  DX_ROUND (DX_H, c, d, a, b, in[2] + DX_K3, 11);
+  DX_ROUND (DX_H, b, c, d, a, in[6] + DX_K3, 15);
+  DX_ROUND (DX_H, a, b, c, d, in[1] + DX_K3, 3);
+  DX_ROUND (DX_H, d, a, b, c, in[5] + DX_K3, 9);
+  DX_ROUND (DX_H, c, d, a, b, in[0] + DX_K3, 11);
+  DX_ROUND (DX_H, b, c, d, a, in[4] + DX_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+static void
+grub_ext2_tea (grub_uint32_t buf[4], const grub_uint32_t in[4])
+{
+  grub_uint32_t sum = 0;
+  grub_uint32_t b0 = buf[0], b1 = buf[1];
+  int n;
+
+  for (n = 0; n < 16; n++)
+    {
+      sum += 0x9E3779B9;
+      b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+      b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* Chars are taken as signed or unsigned depending on the filesystem.  */
+static inline grub_uint32_t
+grub_ext2_hash_char (const char *name, int i, int is_unsigned)
+{
+  if (is_unsigned)
+    return (grub_uint8_t) name[i];
+  return (grub_uint32_t) (grub_int32_t) (grub_int8_t) name[i];
+}
+
+static void
+grub_ext2_str2hashbuf (const char *msg, int len, grub_uint32_t *buf, int num,
+		       int is_unsigned)
+{
+  grub_uint32_t pad, val;
+  int i;
+
+  pad = (grub_uint32_t) len | ((grub_uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      val = grub_ext2_hash_char (msg, i, is_unsigned) + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+static grub_uint32_t
+grub_ext2_dx_hash (struct grub_ext2_data *data, int version,
+		   const char *name, int len)
+{
+  grub_uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  grub_uint32_t in[8], hash;
+  int is_unsigned = version >= EXT2_DX_HASH_UNSIGNED;
+  int i;
+
+  for (i = 0; i < 4; i++)
+    if (data->sblock.hash_seed[i])
+      break;
+  if (i < 4)
+    for (i = 0; i < 4; i++)
+      buf[i] = grub_le_to_cpu32 (data->sblock.hash_seed[i]);
+
+  switch (version % EXT2_DX_HASH_UNSIGNED)
+    {
+    case EXT2_DX_HASH_LEGACY:
+      {
+	grub_uint32_t hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+
+	for (i = 0; i < len; i++)
+	  {
+	    hash = hash1 + (hash0 ^ (grub_ext2_hash_char (name, i, is_unsigned)
+				     * 7152373));
+	    if (hash & 0x80000000)
+	      hash -= 0x7fffffff;
+	    hash1 = hash0;
+	    hash0 = hash;
+	  }
+	hash = hash0 << 1;
+	break;
+      }
+    case EXT2_DX_HASH_HALF_MD4:
+      for (i = 0; i < len; i += 32)
+	{
+	  grub_ext2_str2hashbuf (name + i, len - i, in, 8, is_unsigned);
+	  grub_ext2_half_md4 (buf, in);
+	}
+      hash = buf[1];
+      break;
+    default:
+      for (i = 0; i < len; i += 16)
+	{
+	  grub_ext2_str2hashbuf (name + i, len - i, in, 4, is_unsigned);
+	  grub_ext2_tea (buf, in);
+	}
+      hash = buf[0];
+      break;
+    }
+
+  hash &= ~1;
+  if (hash == (0x7fffffffU << 1))
+    hash = (0x7fffffffU - 1) << 1;
+  return hash;
+}
+
+/* Look NAME up in the hash tree index of the directory DIRO.  Return 1
+   if found, 0 if it isn't there and -1 if the index can't answer.  */
+static int
+grub_ext2_dx_lookup (struct grub_fshelp_node *diro, const char *name,
+		     grub_fshelp_node_t *foundnode,
+		     enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_data *data = diro->data;
+  grub_uint32_t bs = EXT2_BLOCK_SIZE (data);
+  grub_uint32_t hash, block = 0, next_hash = 0;
+  int len = grub_strlen (name), version, levels, level, ret = -1;
+  int have_next = 0;
+  grub_uint8_t *buf, *entries;
+  grub_uint32_t off;
+
+  if (len > MAX_NAMELEN)
+    return 0;
+
+  buf = grub_malloc (bs);
+  if (!buf)
+    return -1;
+
+  if (grub_ext2_read_file (diro, 0, 0, 0, bs, (char *) buf) != (grub_ssize_t) bs)
+    goto out;
+
+  /* dx_root: "." and ".." followed by dx_root_info.  */
+  if (grub_get_unaligned32 (buf + 0x18) != 0 || buf[0x1D] < 8
+      || buf[0x1C] > EXT2_DX_HASH_TEA || buf[0x1E] > 2)
+    goto out;
+  version = buf[0x1C];
+  if (data->sblock.flags & grub_cpu_to_le32_compile_time (EXT2_FLAGS_UNSIGNED_HASH))
+    version += EXT2_DX_HASH_UNSIGNED;
+  levels = buf[0x1E];
+  entries = buf + 0x18 + buf[0x1D];
+
+  hash = grub_ext2_dx_hash (data, version, name, len);
+
+  for (level = 0; ; level++)
+    {
+      grub_uint16_t limit, count, lo, hi;
+
+      /* The first entry holds the limit and count instead of a hash.  */
+      limit = grub_le_to_cpu16 (grub_get_unaligned16 (entries));
+      count = grub_le_to_cpu16 (grub_get_unaligned16 (entries + 2));
+      if (count == 0 || count > limit
+	  || entries + (grub_size_t) count * 8 > buf + bs)
+	goto out;
+
+      /* Find the last entry whose hash isn't above HASH.  */
+      lo = 1;
+      hi = count;
+      while (lo < hi)
+	{
+	  grub_uint16_t mid = lo + (hi - lo) / 2;
+
+	  if (grub_le_to_cpu32 (grub_get_unaligned32 (entries + mid * 8)) > hash)
+	    hi = mid;
+	  else
+	    lo = mid + 1;
+	}
+      block = grub_le_to_cpu32 (grub_get_unaligned32 (entries + (lo - 1) * 8 + 4))
+	& 0x0fffffff;
+      /* Where the following leaf starts in hash order.  */
+      if (lo < count)
+	{
+	  next_hash = grub_le_to_cpu32 (grub_get_unaligned32 (entries + lo * 8));
+	  have_next = 1;
+	}
+
+      if (grub_ext2_read_file (diro, 0, 0, (grub_off_t) block << LOG2_BLOCK_SIZE (data),
+			       bs, (char *) buf) != (grub_ssize_t) bs)
+	goto out;
+
+      if (level == levels)
+	break;
+      /* dx_node: an empty dirent covering the block.  */
+      entries = buf + 8;
+    }
+
+  for (off = 0; off + sizeof (struct ext2_dirent) <= bs; )
+    {
+      struct ext2_dirent dirent;
+
+      grub_memcpy (&dirent, buf + off, sizeof (dirent));
+      if (grub_le_to_cpu16 (dirent.direntlen) < sizeof (dirent)
+	  || off + grub_le_to_cpu16 (dirent.direntlen) > bs
+	  || sizeof (dirent) + dirent.namelen > grub_le_to_cpu16 (dirent.direntlen))
+	goto out;
+
+      if (dirent.inode != 0 && dirent.namelen == len
+	  && grub_memcmp (buf + off + sizeof (dirent), name, len) == 0)
+	{
+	  *foundnode = grub_ext2_dirent_node (diro, &dirent, foundtype);
+	  ret = (*foundnode) ? 1 : -1;
+	  goto out;
+	}
+      off += grub_le_to_cpu16 (dirent.direntlen);
+    }
+
+  /* Entries with the same hash may go on in the next leaf, which is then
+     marked by the low bit of its hash.  */
+  if (have_next && (next_hash & 1) && (next_hash & ~1) == hash)
+    goto out;
+  ret = 0;
+
+ out:
+  grub_free (buf);
+  if (ret < 0)
+    grub_errno = GRUB_ERR_NONE;
+  return ret;
+}
+
+/* Context for grub_ext2_lookup_file.  */
+struct grub_ext2_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_ext2_lookup_file.  */
+static int
+grub_ext2_lookup_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		       grub_fshelp_node_t node, void *data)
+{
+  struct grub_ext2_lookup_ctx *ctx = data;
+
+  if (grub_strcmp (ctx->name, filename) != 0)
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+static grub_err_t
+grub_ext2_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+
+  if (! dir->inode_read)
+    {
+      grub_ext2_read_inode (dir->data, dir->ino, &dir->inode);
+      if (grub_errno)
+	return grub_errno;
+      dir->inode_read = 1;
+    }
+
+  /* Hashes of case-folded or encrypted names aren't computed here.  */
+  if ((dir->data->sblock.feature_compatibility
+       & grub_cpu_to_le32_compile_time (EXT2_FEATURE_COMPAT_DIR_INDEX))
+      && (dir->inode.flags & grub_cpu_to_le32_compile_time (EXT2_INDEX_FLAG))
+      && !(dir->inode.flags & grub_cpu_to_le32_compile_time (EXT4_CASEFOLD_FLAG
+							       | EXT4_ENCRYPT_FLAG))
+      && grub_ext2_dx_lookup (dir, name, foundnode, foundtype) >= 0)
+    return grub_errno;
+
+  grub_ext2_iterate_dir (dir, grub_ext2_lookup_iter, &ctx);
+  return grub_errno;
+}
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_ext2_open (struct grub_file *file, const char *name)
@@ -846,9 +1430,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				      NULL, grub_ext2_lookup_file,
+				      grub_ext2_read_symlink, GRUB_FSHELP_REG,
+				      data->dcache);
   if (err)
     goto fail;
 
@@ -859,20 +1444,30 @@ grub_ext2_open (struct grub_file *file, const char *name)
 	goto fail;
     }
 
-  grub_memcpy (data->inode, &fdiro->inode, sizeof (struct grub_ext2_inode));
-  grub_free (fdiro);
+  /* The mount data may be shared with other files, so the file gets a
+     node of its own.  */
+  if (fdiro == &data->diropen)
+    {
+      fdiro = grub_malloc (sizeof (*fdiro));
+      if (! fdiro)
+	{
+	  err = grub_errno;
+	  goto fail;
+	}
+      grub_memcpy (fdiro, &data->diropen, sizeof (*fdiro));
+    }
 
-  file->size = grub_le_to_cpu32 (data->inode->size);
-  file->size |= ((grub_off_t) grub_le_to_cpu32 (data->inode->size_high)) << 32;
-  file->data = data;
+  file->size = grub_le_to_cpu32 (fdiro->inode.size);
+  file->size |= ((grub_off_t) grub_le_to_cpu32 (fdiro->inode.size_high)) << 32;
+  file->data = fdiro;
   file->offset = 0;
 
   return 0;
 
  fail:
-  if (fdiro != &data->diropen)
+  if (data && fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_ext2_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -882,7 +1477,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_ext2_close (grub_file_t file)
 {
-  grub_free (file->data);
+  struct grub_fshelp_node *node = file->data;
+
+  grub_ext2_unmount (node->data);
+  grub_free (node);
 
   grub_dl_unref (my_mod);
 
@@ -893,9 +1491,10 @@ grub_ext2_close (grub_file_t file)
 static grub_ssize_t
 grub_ext2_read (grub_file_t file, char *buf, grub_size_t len)
 {
-  struct grub_ext2_data *data = (struct grub_ext2_data *) file->data;
+  struct grub_fshelp_node *node = file->data;
 
-  return grub_ext2_read_file (&data->diropen,
+  node->data->disk = file->device->disk;
+  return grub_ext2_read_file (node,
 			      file->read_hook, file->read_hook_data,
 			      file->offset, len, buf);
 }
@@ -952,18 +1551,19 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &ctx.data->diropen, &fdiro,
+				NULL, grub_ext2_lookup_file,
+				grub_ext2_read_symlink, GRUB_FSHELP_DIR,
+				ctx.data->dcache);
   if (grub_errno)
     goto fail;
 
   grub_ext2_iterate_dir (fdiro, grub_ext2_dir_iter, &ctx);
 
  fail:
-  if (fdiro != &ctx.data->diropen)
+  if (ctx.data && fdiro != &ctx.data->diropen)
     grub_free (fdiro);
-  grub_free (ctx.data);
+  grub_ext2_unmount (ctx.data);
 
   grub_dl_unref (my_mod);
 
@@ -985,9 +1585,9 @@ grub_ext2_label (grub_device_t device, char **label)
   else
     *label = NULL;
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 }
@@ -1016,9 +1616,9 @@ grub_ext2_uuid (grub_device_t device, char **uuid)
   else
     *uuid = NULL;
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 }
@@ -1038,9 +1638,9 @@ grub_ext2_mtime (grub_device_t device, grub_int32_t *tm)
   else
     *tm = grub_le_to_cpu32 (data->sblock.utime);
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 
@@ -1048,6 +1648,13 @@ grub_ext2_mtime (grub_device_t device, grub_int32_t *tm)
 
 
 
+static const struct grub_fs_signature grub_ext2_signatures[] =
+  {
+    /* Superblock magic.  */
+    { 1024 + 0x38, 2, "\x53\xef" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_ext2_fs =
   {
     .name = "ext2",
@@ -1058,6 +1665,8 @@ static struct grub_fs grub_ext2_fs =
     .label = grub_ext2_label,
     .uuid = grub_ext2_uuid,
     .mtime = grub_ext2_mtime,
+    .signatures = grub_ext2_signatures,
+    .unmount = grub_ext2_free_mount,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -1294,6 +1294,14 @@ grub_f2fs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_signature grub_f2fs_signatures[] =
+  {
+    /* Either superblock copy.  */
+    { F2FS_SUPER_OFFSET, 4, "\x10\x20\xf5\xf2" },
+    { F2FS_BLKSIZE + F2FS_SUPER_OFFSET, 4, "\x10\x20\xf5\xf2" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_f2fs_fs = {
   .name = "f2fs",
   .dir = grub_f2fs_dir,
@@ -1302,6 +1310,7 @@ static struct grub_fs grub_f2fs_fs = {
   .close = grub_f2fs_close,
   .label = grub_f2fs_label,
   .uuid = grub_f2fs_uuid,
+  .signatures = grub_f2fs_signatures,
 #ifdef GRUB_UTIL
   .reserved_first_sector = 1,
   .blocklist_install = 0,
@@ -201,8 +201,27 @@ struct grub_fshelp_node {
 #ifdef MODE_EXFAT
   int is_contiguous;
 #endif
+
+  /* Opened files map their cluster chain to runs of consecutive
+     clusters, decoded as far as reads have needed so far.  */
+  int map_chain;
+  int chain_end;
+  struct grub_fat_run *runs;
+  grub_uint32_t nruns;
+  grub_uint32_t runs_alloc;
+};
+
+struct grub_fat_run
+{
+  /* First logical cluster of the run in the file.  */
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t len;
 };
 
+/* Amount of FAT read at once when decoding a chain.  */
+#define GRUB_FAT_MAP_WINDOW	0x8000
+
 static grub_dl_t my_mod;
 
 #ifndef MODE_EXFAT
@@ -448,6 +467,197 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+static grub_uint32_t
+grub_fat_entry_offset (struct grub_fat_data *data, grub_uint32_t cluster)
+{
+  switch (data->fat_size)
+    {
+    case 32:
+      return cluster << 2;
+    case 16:
+      return cluster << 1;
+    default:
+      /* case 12: */
+      return cluster + (cluster >> 1);
+    }
+}
+
+/* Extract the entry of CLUSTER from RAW, the little-endian bytes found
+   at its offset in the FAT.  */
+static grub_uint32_t
+grub_fat_entry_value (struct grub_fat_data *data, grub_uint32_t cluster,
+		      grub_uint32_t raw)
+{
+  grub_uint32_t next_cluster = grub_le_to_cpu32 (raw);
+
+  switch (data->fat_size)
+    {
+    case 16:
+      next_cluster &= 0xFFFF;
+      break;
+    case 12:
+      if (cluster & 1)
+	next_cluster >>= 4;
+
+      next_cluster &= 0x0FFF;
+      break;
+    }
+
+  return next_cluster;
+}
+
+/* Look up the FAT entry of CLUSTER, which is the cluster following it
+   in its chain.  */
+static grub_err_t
+grub_fat_next_cluster (grub_disk_t disk, struct grub_fat_data *data,
+		       grub_uint32_t cluster, grub_uint32_t *next)
+{
+  grub_uint32_t raw = 0;
+
+  /* Read the FAT.  */
+  if (grub_disk_read (disk, data->fat_sector,
+		      grub_fat_entry_offset (data, cluster),
+		      (data->fat_size + 7) >> 3, (char *) &raw))
+    return grub_errno;
+
+  *next = grub_fat_entry_value (data, cluster, raw);
+
+  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
+		data->fat_size, *next);
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_fat_add_run (grub_fshelp_node_t node, grub_uint32_t logical,
+		  grub_uint32_t cluster)
+{
+  struct grub_fat_run *run;
+
+  if (node->nruns == node->runs_alloc)
+    {
+      grub_uint32_t alloc = node->runs_alloc ? node->runs_alloc * 2 : 8;
+
+      run = grub_realloc (node->runs, alloc * sizeof (*run));
+      if (!run)
+	return grub_errno;
+      node->runs = run;
+      node->runs_alloc = alloc;
+    }
+
+  run = &node->runs[node->nruns++];
+  run->logical = logical;
+  run->cluster = cluster;
+  run->len = 1;
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the cluster chain of NODE until it covers the logical cluster
+   LOGICAL or ends.  The FAT is read GRUB_FAT_MAP_WINDOW bytes at a
+   time, which for files allocated in one go usually means a single
+   read for the whole chain.  */
+static grub_err_t
+grub_fat_map_chain (grub_disk_t disk, grub_fshelp_node_t node,
+		    grub_uint32_t logical)
+{
+  struct grub_fat_data *data = node->data;
+  unsigned entry_size = (data->fat_size + 7) >> 3;
+  grub_uint32_t fat_end, window_start = 0, window_len = 0;
+  grub_uint8_t *window = NULL;
+  struct grub_fat_run *run;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (!node->nruns)
+    {
+      if (node->file_cluster < 2 || node->file_cluster >= data->num_clusters)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+			   node->file_cluster);
+      if (grub_fat_add_run (node, 0, node->file_cluster))
+	return grub_errno;
+    }
+
+  fat_end = grub_fat_entry_offset (data, data->num_clusters - 1) + entry_size;
+  run = &node->runs[node->nruns - 1];
+  while (!node->chain_end && run->logical + run->len <= logical)
+    {
+      grub_uint32_t cluster = run->cluster + run->len - 1;
+      grub_uint32_t offset = grub_fat_entry_offset (data, cluster);
+      grub_uint32_t raw = 0, next_cluster;
+
+      if (!window || offset < window_start
+	  || offset + entry_size > window_start + window_len)
+	{
+	  if (!window)
+	    {
+	      window = grub_malloc (GRUB_FAT_MAP_WINDOW + sizeof (raw));
+	      if (!window)
+		return grub_errno;
+	    }
+	  window_start = offset & ~(GRUB_FAT_MAP_WINDOW - 1);
+	  /* Have FAT12 entries straddling the end in the window too.  */
+	  window_len = GRUB_FAT_MAP_WINDOW + sizeof (raw);
+	  if (window_len > fat_end - window_start)
+	    window_len = fat_end - window_start;
+	  err = grub_disk_read (disk, data->fat_sector, window_start,
+				window_len, window);
+	  if (err)
+	    break;
+	}
+
+      grub_memcpy (&raw, window + offset - window_start, entry_size);
+      next_cluster = grub_fat_entry_value (data, cluster, raw);
+
+      /* Check the end.  */
+      if (next_cluster >= data->cluster_eof_mark)
+	{
+	  node->chain_end = 1;
+	  break;
+	}
+
+      if (next_cluster < 2 || next_cluster >= data->num_clusters)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+			    next_cluster);
+	  break;
+	}
+
+      if (next_cluster == cluster + 1)
+	run->len++;
+      else
+	{
+	  err = grub_fat_add_run (node, run->logical + run->len, next_cluster);
+	  if (err)
+	    break;
+	  run = &node->runs[node->nruns - 1];
+	}
+    }
+
+  grub_free (window);
+  return err;
+}
+
+/* Find the run holding the logical cluster LOGICAL, NULL past the end of
+   the chain.  */
+static struct grub_fat_run *
+grub_fat_find_run (grub_fshelp_node_t node, grub_uint32_t logical)
+{
+  grub_uint32_t lo = 0, hi = node->nruns;
+
+  while (lo < hi)
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+      struct grub_fat_run *run = &node->runs[mid];
+
+      if (logical < run->logical)
+	hi = mid;
+      else if (logical - run->logical >= run->len)
+	lo = mid + 1;
+      else
+	return run;
+    }
+  return NULL;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
@@ -501,6 +711,60 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
   logical_cluster = offset >> logical_cluster_bits;
   offset &= (1ULL << logical_cluster_bits) - 1;
 
+  if (node->map_chain && len)
+    {
+      grub_uint64_t last;
+
+      last = logical_cluster + ((offset + len - 1) >> logical_cluster_bits);
+      if (last > ~0U)
+	last = ~0U;
+      if (grub_fat_map_chain (disk, node, last))
+	return -1;
+
+      while (len)
+	{
+	  struct grub_fat_run *run;
+	  grub_disk_addr_t start;
+	  grub_uint64_t left;
+	  grub_uint32_t skip;
+
+	  run = grub_fat_find_run (node, logical_cluster);
+	  if (!run)
+	    return ret;
+
+	  /* The rest of a run may be 4 GiB or more, which doesn't fit a
+	     32-bit grub_size_t.  */
+	  skip = logical_cluster - run->logical;
+	  left = ((grub_uint64_t) (run->len - skip) << logical_cluster_bits)
+	    - offset;
+	  size = left < len ? left : len;
+	  /* Reading nothing would never get to the end.  */
+	  if (size == 0)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "empty cluster run");
+	      return -1;
+	    }
+	  start = node->data->cluster_sector
+	    + ((grub_disk_addr_t) (run->cluster + skip - 2)
+	       << node->data->cluster_bits);
+
+	  disk->read_hook = read_hook;
+	  disk->read_hook_data = read_hook_data;
+	  grub_disk_read (disk, start, offset, size, buf);
+	  disk->read_hook = 0;
+	  if (grub_errno)
+	    return -1;
+
+	  len -= size;
+	  buf += size;
+	  ret += size;
+	  logical_cluster += (offset + size) >> logical_cluster_bits;
+	  offset = (offset + size) & ((1ULL << logical_cluster_bits) - 1);
+	}
+
+      return ret;
+    }
+
   if (logical_cluster < node->cur_cluster_num)
     {
       node->cur_cluster_num = 0;
@@ -509,49 +773,17 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 
   while (len)
     {
+      grub_uint32_t first_cluster, run;
+
       while (logical_cluster > node->cur_cluster_num)
 	{
 	  /* Find next cluster.  */
 	  grub_uint32_t next_cluster;
-	  grub_uint32_t fat_offset;
-
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
 
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
-			      (node->data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
+	  if (grub_fat_next_cluster (disk, node->data, node->cur_cluster,
+				     &next_cluster))
 	    return -1;
 
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
-	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
-			node->data->fat_size, next_cluster);
-
 	  /* Check the end.  */
 	  if (next_cluster >= node->data->cluster_eof_mark)
 	    return ret;
@@ -567,11 +799,35 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 	  node->cur_cluster_num++;
 	}
 
+      /* Extend the read over the following clusters for as long as they
+	 are contiguous on disk.  A cluster which isn't becomes the current
+	 one for the next round; the end of the chain and invalid entries
+	 are left for the loop above to deal with.  */
+      first_cluster = node->cur_cluster;
+      size = (1 << logical_cluster_bits) - offset;
+      for (run = 1; size < len; run++)
+	{
+	  grub_uint32_t next_cluster;
+
+	  if (grub_fat_next_cluster (disk, node->data, node->cur_cluster,
+				     &next_cluster))
+	    return -1;
+
+	  if (next_cluster >= node->data->cluster_eof_mark
+	      || next_cluster < 2 || next_cluster >= node->data->num_clusters)
+	    break;
+
+	  node->cur_cluster = next_cluster;
+	  node->cur_cluster_num++;
+	  if (next_cluster != first_cluster + run)
+	    break;
+	  size += 1 << logical_cluster_bits;
+	}
+
       /* Read the data here.  */
       sector = (node->data->cluster_sector
-		+ ((node->cur_cluster - 2)
+		+ ((first_cluster - 2)
 		   << node->data->cluster_bits));
-      size = (1 << logical_cluster_bits) - offset;
       if (size > len)
 	size = len;
 
@@ -585,7 +841,7 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
       len -= size;
       buf += size;
       ret += size;
-      logical_cluster++;
+      logical_cluster += run;
       offset = 0;
     }
 
@@ -902,6 +1158,11 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	  (*foundnode)->cur_cluster_num = ~0U;
 	  (*foundnode)->data = node->data;
 	  (*foundnode)->disk = node->disk;
+	  (*foundnode)->map_chain = 0;
+	  (*foundnode)->chain_end = 0;
+	  (*foundnode)->runs = NULL;
+	  (*foundnode)->nruns = 0;
+	  (*foundnode)->runs_alloc = 0;
 
 	  *foundtype = ((*foundnode)->attr & GRUB_FAT_ATTR_DIRECTORY) ? GRUB_FSHELP_DIR : GRUB_FSHELP_REG;
 
@@ -1019,6 +1280,7 @@ grub_fat_open (grub_file_t file, const char *name)
   if (err)
     goto fail;
 
+  found->map_chain = 1;
   file->data = found;
   file->size = found->file_size;
 
@@ -1049,6 +1311,7 @@ grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
+  grub_free (node->runs);
   grub_free (node->data);
   grub_free (node);
 
@@ -1222,6 +1485,14 @@ grub_disk_addr_t
 }
 #endif
 
+#ifdef MODE_EXFAT
+static const struct grub_fs_signature grub_exfat_signatures[] =
+  {
+    { 3, 8, "EXFAT   " },
+    { 0, 0, 0 }
+  };
+#endif
+
 static struct grub_fs grub_fat_fs =
   {
 #ifdef MODE_EXFAT
@@ -1235,6 +1506,9 @@ static struct grub_fs grub_fat_fs =
     .close = grub_fat_close,
     .label = grub_fat_label,
     .uuid = grub_fat_uuid,
+#ifdef MODE_EXFAT
+    .signatures = grub_exfat_signatures,
+#endif
 #ifdef GRUB_UTIL
 #ifdef MODE_EXFAT
     /* ExFAT BPB is 30 larger than FAT32 one.  */
@@ -36,6 +36,33 @@ typedef grub_err_t (*lookup_file_func) (grub_fshelp_node_t dir,
 					enum grub_fshelp_filetype *foundtype);
 typedef char *(*read_symlink_func) (grub_fshelp_node_t node);
 
+/* Bounds of a lookup cache.  */
+#define DCACHE_BUCKETS	256
+#define DCACHE_MAX	1024
+
+struct dentry
+{
+  /* Hash chain.  */
+  struct dentry *next;
+  /* Least recently used order, most recent first.  */
+  struct dentry *lru_prev, *lru_next;
+  grub_uint64_t dir_id;
+  grub_uint32_t hash;
+  enum grub_fshelp_filetype type;
+  /* Copy of the node found, NULL if the name doesn't exist.  */
+  grub_fshelp_node_t node;
+  char *name;
+};
+
+struct grub_fshelp_dcache
+{
+  grub_size_t node_size;
+  grub_uint64_t (*node_id) (grub_fshelp_node_t node);
+  struct dentry *buckets[DCACHE_BUCKETS];
+  struct dentry *lru_first, *lru_last;
+  unsigned count;
+};
+
 struct stack_element {
   struct stack_element *parent;
   grub_fshelp_node_t node;
@@ -52,6 +79,8 @@ struct grub_fshelp_find_file_ctx
   /* Global options. */
   int symlinknest;
 
+  grub_fshelp_dcache_t dcache;
+
   /* Current file being traversed and its parents.  */
   struct stack_element *currnode;
 };
@@ -158,6 +187,154 @@ directory_find_file (grub_fshelp_node_t node, const char *name, grub_fshelp_node
   return GRUB_ERR_NONE;
 }
 
+grub_fshelp_dcache_t
+grub_fshelp_dcache_new (grub_size_t node_size,
+			grub_uint64_t (*node_id) (grub_fshelp_node_t node))
+{
+  grub_fshelp_dcache_t dcache;
+
+  dcache = grub_zalloc (sizeof (*dcache));
+  if (!dcache)
+    return NULL;
+  dcache->node_size = node_size;
+  dcache->node_id = node_id;
+  return dcache;
+}
+
+static void
+dcache_unlink_lru (grub_fshelp_dcache_t dcache, struct dentry *e)
+{
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    dcache->lru_first = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    dcache->lru_last = e->lru_prev;
+}
+
+static void
+dcache_link_lru (grub_fshelp_dcache_t dcache, struct dentry *e)
+{
+  e->lru_prev = NULL;
+  e->lru_next = dcache->lru_first;
+  if (dcache->lru_first)
+    dcache->lru_first->lru_prev = e;
+  else
+    dcache->lru_last = e;
+  dcache->lru_first = e;
+}
+
+static void
+dcache_evict (grub_fshelp_dcache_t dcache, struct dentry *e)
+{
+  struct dentry **p;
+
+  for (p = &dcache->buckets[e->hash % DCACHE_BUCKETS]; *p != e;
+       p = &(*p)->next);
+  *p = e->next;
+  dcache_unlink_lru (dcache, e);
+  dcache->count--;
+  grub_free (e);
+}
+
+void
+grub_fshelp_dcache_free (grub_fshelp_dcache_t dcache)
+{
+  struct dentry *e, *next;
+
+  if (!dcache)
+    return;
+  for (e = dcache->lru_first; e; e = next)
+    {
+      next = e->lru_next;
+      grub_free (e);
+    }
+  grub_free (dcache);
+}
+
+static grub_uint32_t
+dcache_hash (grub_uint64_t dir_id, const char *name)
+{
+  grub_uint32_t hash = 2166136261U ^ (grub_uint32_t) dir_id
+    ^ (grub_uint32_t) (dir_id >> 32);
+
+  for (; *name; name++)
+    hash = (hash ^ (grub_uint8_t) *name) * 16777619U;
+  return hash;
+}
+
+/* Look NAME up in the current directory through CTX->dcache, falling back
+   to the filesystem on a miss.  */
+static grub_err_t
+dcache_find_file (struct grub_fshelp_find_file_ctx *ctx, const char *name,
+		  grub_fshelp_node_t *foundnode,
+		  enum grub_fshelp_filetype *foundtype,
+		  iterate_dir_func iterate_dir, lookup_file_func lookup_file)
+{
+  grub_fshelp_dcache_t dcache = ctx->dcache;
+  grub_uint64_t dir_id = dcache->node_id (ctx->currnode->node);
+  grub_uint32_t hash = dcache_hash (dir_id, name);
+  grub_size_t namelen = grub_strlen (name);
+  struct dentry *e;
+  grub_err_t err;
+
+  for (e = dcache->buckets[hash % DCACHE_BUCKETS]; e; e = e->next)
+    if (e->hash == hash && e->dir_id == dir_id
+	&& grub_strcmp (e->name, name) == 0)
+      {
+	dcache_unlink_lru (dcache, e);
+	dcache_link_lru (dcache, e);
+	if (!e->node)
+	  return GRUB_ERR_NONE;
+	*foundnode = grub_malloc (dcache->node_size);
+	if (!*foundnode)
+	  return grub_errno;
+	grub_memcpy (*foundnode, e->node, dcache->node_size);
+	*foundtype = e->type;
+	return GRUB_ERR_NONE;
+      }
+
+  if (lookup_file)
+    err = lookup_file (ctx->currnode->node, name, foundnode, foundtype);
+  else
+    err = directory_find_file (ctx->currnode->node, name, foundnode,
+			       foundtype, iterate_dir);
+  if (err || *foundnode == ctx->rootnode)
+    return err;
+
+  if (dcache->count >= DCACHE_MAX)
+    dcache_evict (dcache, dcache->lru_last);
+
+  /* The node copy comes first to keep it aligned.  */
+  e = grub_malloc (sizeof (*e)
+		   + ALIGN_UP (dcache->node_size, sizeof (grub_uint64_t))
+		   + namelen + 1);
+  if (!e)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  e->dir_id = dir_id;
+  e->hash = hash;
+  e->type = *foundtype;
+  e->node = NULL;
+  if (*foundnode)
+    {
+      e->node = (grub_fshelp_node_t) (e + 1);
+      grub_memcpy (e->node, *foundnode, dcache->node_size);
+    }
+  e->name = ((char *) (e + 1)
+	     + ALIGN_UP (dcache->node_size, sizeof (grub_uint64_t)));
+  grub_memcpy (e->name, name, namelen + 1);
+  e->next = dcache->buckets[hash % DCACHE_BUCKETS];
+  dcache->buckets[hash % DCACHE_BUCKETS] = e;
+  dcache_link_lru (dcache, e);
+  dcache->count++;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 find_file (char *currpath,
 	   iterate_dir_func iterate_dir, lookup_file_func lookup_file,
@@ -202,7 +379,10 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
+      if (ctx->dcache)
+	err = dcache_find_file (ctx, name, &foundnode, &foundtype,
+				iterate_dir, lookup_file);
+      else if (lookup_file)
 	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
       else
 	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
@@ -264,12 +444,14 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    grub_fshelp_dcache_t dcache)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
     .symlinknest = 0,
+    .dcache = dcache,
     .currnode = 0
   };
   grub_err_t err;
@@ -327,7 +509,7 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL);
 
 }
 
@@ -340,27 +522,42 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL);
 
 }
 
-/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
-   beginning with the block POS.  READ_HOOK should be set before
-   reading a block from the file.  READ_HOOK_DATA is passed through as
-   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
-   file blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
-grub_ssize_t
-grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
-		       grub_disk_read_hook_t read_hook, void *read_hook_data,
-		       grub_off_t pos, grub_size_t len, char *buf,
-		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
-                                                      grub_disk_addr_t block),
-		       grub_off_t filesize, int log2blocksize,
-		       grub_disk_addr_t blocks_start)
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      lookup_file_func lookup_file,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      grub_fshelp_dcache_t dcache)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, lookup_file,
+				     read_symlink, expecttype, dcache);
+}
+
+/* Read LEN bytes from the file NODE starting at byte POS, mapping file
+   blocks either with GET_EXTENT or, block by block, with GET_BLOCK.
+   Every run of contiguous (or unallocated) blocks is handled with a
+   single disk read (or memset), straight into BUF.  */
+static grub_ssize_t
+read_file_real (grub_disk_t disk, grub_fshelp_node_t node,
+		grub_disk_read_hook_t read_hook, void *read_hook_data,
+		grub_off_t pos, grub_size_t len, char *buf,
+		grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					       grub_disk_addr_t block),
+		grub_fshelp_get_extent_t get_extent,
+		grub_off_t filesize, int log2blocksize,
+		grub_disk_addr_t blocks_start)
 {
-  grub_disk_addr_t i, blockcnt;
-  int blocksize = 1 << (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  int shift = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  grub_disk_addr_t i, blockcnt, next = 0;
+  int have_next = 0;
+  grub_off_t end;
 
   if (pos > filesize)
     {
@@ -373,57 +570,118 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
   if (pos + len > filesize)
     len = filesize - pos;
 
-  blockcnt = ((len + pos) + blocksize - 1) >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  end = pos + len;
+  blockcnt = (end + ((grub_off_t) 1 << shift) - 1) >> shift;
 
-  for (i = pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS); i < blockcnt; i++)
+  for (i = pos >> shift; i < blockcnt; )
     {
-      grub_disk_addr_t blknr;
-      int blockoff = pos & (blocksize - 1);
-      int blockend = blocksize;
+      grub_disk_addr_t start, count;
+      grub_off_t from, to;
 
-      int skipfirst = 0;
-
-      blknr = get_block (node, i);
-      if (grub_errno)
-	return -1;
-
-      blknr = blknr << log2blocksize;
-
-      /* Last block.  */
-      if (i == blockcnt - 1)
+      if (get_extent)
 	{
-	  blockend = (len + pos) & (blocksize - 1);
-
-	  /* The last portion is exactly blocksize.  */
-	  if (! blockend)
-	    blockend = blocksize;
+	  if (get_extent (node, i, &start, &count))
+	    return -1;
+	  if (count == 0)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "invalid extent");
+	      return -1;
+	    }
+	  if (count > blockcnt - i)
+	    count = blockcnt - i;
 	}
-
-      /* First block.  */
-      if (i == (pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS)))
+      else
 	{
-	  skipfirst = blockoff;
-	  blockend -= skipfirst;
+	  if (have_next)
+	    start = next;
+	  else
+	    {
+	      start = get_block (node, i);
+	      if (grub_errno)
+		return -1;
+	    }
+	  have_next = 0;
+
+	  /* Extend the run as long as the following blocks are contiguous.
+	     The first block which isn't is kept for the next run, so that
+	     GET_BLOCK is still called once per block, in order.  */
+	  for (count = 1; i + count < blockcnt; count++)
+	    {
+	      next = get_block (node, i + count);
+	      if (grub_errno)
+		return -1;
+	      if (next != (start ? start + count : 0))
+		{
+		  have_next = 1;
+		  break;
+		}
+	    }
 	}
 
-      /* If the block number is 0 this block is not stored on disk but
+      from = i << shift;
+      if (from < pos)
+	from = pos;
+      to = (i + count) << shift;
+      if (to > end)
+	to = end;
+
+      /* If the block number is 0 the run is not stored on disk but
 	 is zero filled instead.  */
-      if (blknr)
+      if (start)
 	{
+	  grub_off_t off = from - (i << shift);
+
 	  disk->read_hook = read_hook;
 	  disk->read_hook_data = read_hook_data;
-
-	  grub_disk_read (disk, blknr + blocks_start, skipfirst,
-			  blockend, buf);
+	  grub_disk_read (disk, (start << log2blocksize) + blocks_start
+			  + (off >> GRUB_DISK_SECTOR_BITS),
+			  off & (GRUB_DISK_SECTOR_SIZE - 1),
+			  to - from, buf + (from - pos));
 	  disk->read_hook = 0;
 	  if (grub_errno)
 	    return -1;
 	}
       else
-	grub_memset (buf, 0, blockend);
+	grub_memset (buf + (from - pos), 0, to - from);
 
-      buf += blocksize - skipfirst;
+      i += count;
     }
 
   return len;
 }
+
+/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
+   beginning with the block POS.  READ_HOOK should be set before
+   reading a block from the file.  READ_HOOK_DATA is passed through as
+   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
+   file blocks to disk blocks.  The file is FILESIZE bytes big and the
+   blocks have a size of LOG2BLOCKSIZE (in log2).  */
+grub_ssize_t
+grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_disk_read_hook_t read_hook, void *read_hook_data,
+		       grub_off_t pos, grub_size_t len, char *buf,
+		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+                                                      grub_disk_addr_t block),
+		       grub_off_t filesize, int log2blocksize,
+		       grub_disk_addr_t blocks_start)
+{
+  return read_file_real (disk, node, read_hook, read_hook_data, pos, len,
+			 buf, get_block, NULL, filesize, log2blocksize,
+			 blocks_start);
+}
+
+/* Same as grub_fshelp_read_file, but with GET_EXTENT translating a
+   whole run of file blocks at a time.  */
+grub_ssize_t
+grub_fshelp_read_file_extents (grub_disk_t disk, grub_fshelp_node_t node,
+			       grub_disk_read_hook_t read_hook,
+			       void *read_hook_data,
+			       grub_off_t pos, grub_size_t len, char *buf,
+			       grub_fshelp_get_extent_t get_extent,
+			       grub_off_t filesize, int log2blocksize,
+			       grub_disk_addr_t blocks_start)
+{
+  return read_file_real (disk, node, read_hook, read_hook_data, pos, len,
+			 buf, NULL, get_extent, filesize, log2blocksize,
+			 blocks_start);
+}
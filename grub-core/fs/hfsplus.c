@@ -825,6 +825,108 @@ grub_hfsplus_iterate_dir (grub_fshelp_node_t dir,
   return ctx.ret;
 }
 
+/* Context for grub_hfsplus_lookup_file.  */
+struct grub_hfsplus_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_hfsplus_lookup_file.  */
+static int
+grub_hfsplus_lookup_iter (const char *filename,
+			  enum grub_fshelp_filetype filetype,
+			  grub_fshelp_node_t node, void *data)
+{
+  struct grub_hfsplus_lookup_ctx *ctx = data;
+
+  if (grub_strcmp (ctx->name, filename) != 0)
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Find NAME in DIR with a single catalog search.  Only valid on case
+   sensitive volumes, whose catalog is sorted by binary comparison.  */
+static grub_err_t
+grub_hfsplus_lookup_file (grub_fshelp_node_t dir, const char *name,
+			  grub_fshelp_node_t *foundnode,
+			  enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_hfsplus_lookup_ctx lctx =
+  {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+  struct list_nodes_ctx ctx =
+  {
+    .ret = 0,
+    .dir = dir,
+    .hook = grub_hfsplus_lookup_iter,
+    .hook_data = &lctx
+  };
+  struct grub_hfsplus_key_internal intern;
+  struct grub_hfsplus_btnode *node = NULL;
+  grub_disk_addr_t ptr = 0;
+  grub_size_t len = grub_strlen (name), namelen, i;
+  grub_uint16_t *name16;
+
+  name16 = grub_malloc ((len + 1) * sizeof (name16[0]));
+  if (!name16)
+    return grub_errno;
+
+  namelen = grub_utf8_to_utf16 (name16, len, (const grub_uint8_t *) name,
+				len, NULL);
+  if (namelen == (grub_size_t) -1)
+    {
+      grub_free (name16);
+      return GRUB_ERR_NONE;
+    }
+  for (i = 0; i < namelen; i++)
+    {
+      if (name16[i] == ':')
+	name16[i] = '/';
+      name16[i] = grub_cpu_to_be16 (name16[i]);
+    }
+
+  intern.catkey.parent = dir->fileid;
+  intern.catkey.name = name16;
+  intern.catkey.namelen = namelen;
+
+  if (grub_hfsplus_btree_search (&dir->data->catalog_tree, &intern,
+				 grub_hfsplus_cmp_catkey, &node, &ptr) == 0
+      && node)
+    list_nodes (grub_hfsplus_btree_recptr (&dir->data->catalog_tree,
+					   node, ptr), &ctx);
+
+  grub_free (node);
+  grub_free (name16);
+  return grub_errno;
+}
+
+static grub_err_t
+grub_hfsplus_find_file (struct grub_hfsplus_data *data, const char *path,
+			grub_fshelp_node_t *foundnode,
+			enum grub_fshelp_filetype expect)
+{
+  /* Case insensitive catalogs are sorted by Unicode case folding, which
+     a binary key search can't follow.  */
+  return grub_fshelp_find_file_cached (path, &data->dirroot, foundnode,
+				       data->case_sensitive
+				       ? NULL : grub_hfsplus_iterate_dir,
+				       data->case_sensitive
+				       ? grub_hfsplus_lookup_file : NULL,
+				       grub_hfsplus_read_symlink, expect,
+				       NULL);
+}
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_hfsplus_open (struct grub_file *file, const char *name)
@@ -838,9 +940,7 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->dirroot, &fdiro,
-			 grub_hfsplus_iterate_dir,
-			 grub_hfsplus_read_symlink, GRUB_FSHELP_REG);
+  grub_hfsplus_find_file (data, name, &fdiro, GRUB_FSHELP_REG);
   if (grub_errno)
     goto fail;
 
@@ -948,9 +1048,7 @@ grub_hfsplus_dir (grub_device_t device, const char *path,
     goto fail;
 
   /* Find the directory that should be opened.  */
-  grub_fshelp_find_file (path, &data->dirroot, &fdiro,
-			 grub_hfsplus_iterate_dir,
-			 grub_hfsplus_read_symlink, GRUB_FSHELP_DIR);
+  grub_hfsplus_find_file (data, path, &fdiro, GRUB_FSHELP_DIR);
   if (grub_errno)
     goto fail;
 
@@ -1075,6 +1173,15 @@ grub_hfsplus_uuid (grub_device_t device, char **uuid)
 
 
 
+static const struct grub_fs_signature grub_hfsplus_signatures[] =
+  {
+    /* HFS+, HFSX and HFS wrapping an HFS+ volume.  */
+    { 1024, 2, "H+" },
+    { 1024, 2, "HX" },
+    { 1024, 2, "BD" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_hfsplus_fs =
   {
     .name = "hfsplus",
@@ -1085,6 +1192,7 @@ static struct grub_fs grub_hfsplus_fs =
     .label = grub_hfsplus_label,
     .mtime = grub_hfsplus_mtime,
     .uuid = grub_hfsplus_uuid,
+    .signatures = grub_hfsplus_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -48,6 +48,11 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_ISO9660_VOLDESC_PART	3
 #define GRUB_ISO9660_VOLDESC_END	255
 
+/* Path tables larger than this are not loaded.  */
+#define GRUB_ISO9660_MAX_PATH_TABLE	(4 << 20)
+/* Number of decoded directories kept per mount.  */
+#define GRUB_ISO9660_DIRCACHE_SIZE	16
+
 /* The head of a volume descriptor.  */
 struct grub_iso9660_voldesc
 {
@@ -146,6 +151,38 @@ struct grub_iso9660_susp_ce
   grub_uint32_t len_be;
 } GRUB_PACKED;
 
+/* A directory listed in the path table.  DIRENT is its "." entry, once
+   read (LEN is non-zero then).  */
+struct grub_iso9660_ptentry
+{
+  grub_uint32_t sector;
+  grub_uint32_t parent;
+  char *name;
+  struct grub_iso9660_dir dirent;
+};
+
+/* A decoded directory entry: the name as passed to the iterate hook,
+   the extents of the node and its symlink target, if any.  */
+struct grub_iso9660_dentry
+{
+  char *name;
+  char *symlink;
+  enum grub_fshelp_filetype type;
+  grub_size_t have_dirents;
+  struct grub_iso9660_dir dirents[0];
+};
+
+/* The decoded entries of the directory starting at SECTOR.  */
+struct grub_iso9660_dircache
+{
+  grub_uint32_t sector;
+  grub_off_t size;
+  grub_uint64_t stamp;
+  int busy;
+  grub_size_t count;
+  struct grub_iso9660_dentry **entries;
+};
+
 struct grub_iso9660_data
 {
   struct grub_iso9660_primary_voldesc voldesc;
@@ -153,7 +190,15 @@ struct grub_iso9660_data
   int rockridge;
   int susp_skip;
   int joliet;
-  struct grub_fshelp_node *node;
+
+  /* The path table, used to find subdirectories without reading their
+     parents.  Only loaded when the names in it are those the
+     directories are listed with, that is without Rock Ridge.  */
+  struct grub_iso9660_ptentry *ptable;
+  grub_uint32_t ptable_count;
+
+  struct grub_iso9660_dircache dircache[GRUB_ISO9660_DIRCACHE_SIZE];
+  grub_uint64_t dircache_stamp;
 };
 
 struct grub_fshelp_node
@@ -161,6 +206,9 @@ struct grub_fshelp_node
   struct grub_iso9660_data *data;
   grub_size_t have_dirents, alloc_dirents;
   int have_symlink;
+  /* Index of the directory in the path table, counting from 1, or 0 if
+     unknown.  */
+  grub_uint32_t ptidx;
   struct grub_iso9660_dir dirents[8];
   char symlink[0];
 };
@@ -174,6 +222,7 @@ enum
   };
 
 static grub_dl_t my_mod;
+static struct grub_fs grub_iso9660_fs;
 
 
 static grub_err_t
@@ -225,11 +274,12 @@ iso9660_to_unixtime2 (const struct grub_iso9660_date2 *i, grub_int32_t *nix)
 static grub_err_t
 read_node (grub_fshelp_node_t node, grub_off_t off, grub_size_t len, char *buf)
 {
-  grub_size_t i = 0;
+  grub_size_t i = 0, j;
 
   while (len > 0)
     {
-      grub_size_t toread;
+      grub_off_t toread;
+      grub_uint32_t start;
       grub_err_t err;
       while (i < node->have_dirents
 	     && off >= grub_le_to_cpu32 (node->dirents[i].size))
@@ -239,11 +289,25 @@ read_node (grub_fshelp_node_t node, grub_off_t off, grub_size_t len, char *buf)
 	}
       if (i == node->have_dirents)
 	return grub_error (GRUB_ERR_OUT_OF_RANGE, "read out of range");
-      toread = grub_le_to_cpu32 (node->dirents[i].size);
+      start = grub_le_to_cpu32 (node->dirents[i].first_sector);
+      toread = grub_le_to_cpu32 (node->dirents[i].size) - off;
+      /* The sections of a multi-extent file are normally laid out back
+	 to back; read them all in one go.  */
+      for (j = i; toread < len && j + 1 < node->have_dirents; j++)
+	{
+	  grub_uint32_t size = grub_le_to_cpu32 (node->dirents[j].size);
+
+	  if ((size & (GRUB_ISO9660_BLKSZ - 1))
+	      || grub_le_to_cpu32 (node->dirents[j + 1].first_sector)
+	      != grub_le_to_cpu32 (node->dirents[j].first_sector)
+	      + size / GRUB_ISO9660_BLKSZ)
+	    break;
+	  toread += grub_le_to_cpu32 (node->dirents[j + 1].size);
+	}
       if (toread > len)
 	toread = len;
       err = grub_disk_read (node->data->disk,
-			    ((grub_disk_addr_t) grub_le_to_cpu32 (node->dirents[i].first_sector)) << GRUB_ISO9660_LOG2_BLKSZ,
+			    ((grub_disk_addr_t) start) << GRUB_ISO9660_LOG2_BLKSZ,
 			    off, toread, buf);
       if (err)
 	return err;
@@ -408,6 +472,7 @@ set_rockridge (struct grub_iso9660_data *data)
       rootnode.alloc_dirents = ARRAY_SIZE (rootnode.dirents);
       rootnode.have_dirents = 1;
       rootnode.have_symlink = 0;
+      rootnode.ptidx = 0;
       rootnode.dirents[0] = data->voldesc.rootdir;
 
       /* The 2nd data byte stored how many bytes are skipped every time
@@ -429,6 +494,161 @@ set_rockridge (struct grub_iso9660_data *data)
   return GRUB_ERR_NONE;
 }
 
+/* Convert the name NAME of LEN bytes of a path table entry the way
+   grub_iso9660_iterate_dir converts the names of directories.  */
+static char *
+grub_iso9660_ptable_name (struct grub_iso9660_data *data,
+			  grub_uint8_t *name, int len)
+{
+  char *ret, *ptr;
+
+  if (data->joliet)
+    {
+      ret = grub_iso9660_convert_string (name, len >> 1);
+      if (!ret)
+	return NULL;
+      ptr = grub_strrchr (ret, ';');
+      if (ptr)
+	*ptr = '\0';
+      return ret;
+    }
+
+  ret = grub_strndup ((char *) name, len);
+  if (!ret)
+    return NULL;
+  ptr = grub_strrchr (ret, ';');
+  if (ptr)
+    *ptr = '\0';
+  for (ptr = ret; *ptr; ptr++)
+    *ptr = grub_tolower (*ptr);
+  if (ptr != ret && *(ptr - 1) == '.')
+    *(ptr - 1) = 0;
+  return ret;
+}
+
+static void
+grub_iso9660_free_ptable (struct grub_iso9660_data *data)
+{
+  grub_uint32_t i;
+
+  if (!data->ptable)
+    return;
+  for (i = 0; i < data->ptable_count; i++)
+    grub_free (data->ptable[i].name);
+  grub_free (data->ptable);
+  data->ptable = NULL;
+  data->ptable_count = 0;
+}
+
+/* Load the little endian path table.  Entries are sorted by the number
+   of their parent, which is what grub_iso9660_ptable_find relies on.
+   Without a usable table directories are simply found by reading their
+   parents.  */
+static void
+grub_iso9660_load_ptable (struct grub_iso9660_data *data)
+{
+  grub_uint32_t size = grub_le_to_cpu32 (data->voldesc.path_table_size);
+  grub_uint8_t *buf;
+  grub_uint32_t pos, count, i;
+
+  if (data->rockridge || size < sizeof (struct grub_iso9660_path)
+      || size > GRUB_ISO9660_MAX_PATH_TABLE)
+    return;
+
+  buf = grub_malloc (size);
+  if (!buf)
+    goto fail;
+  if (grub_disk_read (data->disk,
+		      ((grub_disk_addr_t) grub_le_to_cpu32 (data->voldesc.path_table))
+		      << GRUB_ISO9660_LOG2_BLKSZ, 0, size, buf))
+    goto fail;
+
+  for (pos = 0, count = 0; pos + sizeof (struct grub_iso9660_path) <= size;
+       count++)
+    {
+      struct grub_iso9660_path *path = (struct grub_iso9660_path *) (buf + pos);
+
+      if (path->len == 0)
+	break;
+      pos += sizeof (*path) + path->len + (path->len & 1);
+    }
+  /* Parent numbers are 16-bit.  */
+  if (count == 0 || count > 0xffff || pos > size)
+    goto fail;
+
+  data->ptable = grub_zalloc (count * sizeof (data->ptable[0]));
+  if (!data->ptable)
+    goto fail;
+  data->ptable_count = count;
+
+  for (pos = 0, i = 0; i < count; i++)
+    {
+      struct grub_iso9660_path *path = (struct grub_iso9660_path *) (buf + pos);
+      grub_uint32_t parent = grub_le_to_cpu16 (path->parentdir);
+
+      data->ptable[i].sector = grub_le_to_cpu32 (path->first_sector);
+      data->ptable[i].parent = parent;
+      if (parent == 0 || parent > i + 1
+	  || (i > 0 && parent < data->ptable[i - 1].parent))
+	goto fail;
+      /* The first entry is the root directory.  */
+      if (i == 0)
+	data->ptable[i].name = grub_strdup ("");
+      else
+	data->ptable[i].name = grub_iso9660_ptable_name (data, path->name,
+							 path->len);
+      if (!data->ptable[i].name)
+	goto fail;
+      pos += sizeof (*path) + path->len + (path->len & 1);
+    }
+
+  if (data->ptable[0].sector
+      != grub_le_to_cpu32 (data->voldesc.rootdir.first_sector))
+    goto fail;
+
+  grub_free (buf);
+  return;
+
+ fail:
+  grub_free (buf);
+  grub_iso9660_free_ptable (data);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static void
+grub_iso9660_free_dircache (struct grub_iso9660_dircache *dc)
+{
+  grub_size_t i;
+
+  for (i = 0; i < dc->count; i++)
+    grub_free (dc->entries[i]);
+  grub_free (dc->entries);
+  dc->entries = NULL;
+  dc->count = 0;
+  dc->stamp = 0;
+}
+
+static void
+grub_iso9660_free_mount (void *mount)
+{
+  struct grub_iso9660_data *data = mount;
+  int i;
+
+  if (!data)
+    return;
+  grub_iso9660_free_ptable (data);
+  for (i = 0; i < GRUB_ISO9660_DIRCACHE_SIZE; i++)
+    grub_iso9660_free_dircache (&data->dircache[i]);
+  grub_free (data);
+}
+
+static void
+grub_iso9660_unmount (struct grub_iso9660_data *data)
+{
+  if (data && !grub_fs_mount_cache_release (data))
+    grub_iso9660_free_mount (data);
+}
+
 static struct grub_iso9660_data *
 grub_iso9660_mount (grub_disk_t disk)
 {
@@ -436,6 +656,13 @@ grub_iso9660_mount (grub_disk_t disk)
   struct grub_iso9660_primary_voldesc voldesc;
   int block;
 
+  data = grub_fs_mount_cache_get (&grub_iso9660_fs, disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
   data = grub_zalloc (sizeof (struct grub_iso9660_data));
   if (! data)
     return 0;
@@ -487,6 +714,10 @@ grub_iso9660_mount (grub_disk_t disk)
       block++;
     } while (voldesc.voldesc.type != GRUB_ISO9660_VOLDESC_END);
 
+  grub_iso9660_load_ptable (data);
+
+  grub_fs_mount_cache_put (&grub_iso9660_fs, disk, data);
+
   return data;
 
  fail:
@@ -653,9 +884,10 @@ susp_iterate_dir (struct grub_iso9660_susp_entry *entry,
   return 0;
 }
 
+/* Read the directory DIR from disk, calling HOOK for every entry.  */
 static int
-grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
-			  grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
+grub_iso9660_read_dir (grub_fshelp_node_t dir,
+		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
 {
   struct grub_iso9660_dir dirent;
   grub_off_t offset = 0;
@@ -712,6 +944,7 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 	/* Setup a new node.  */
 	node->data = dir->data;
 	node->have_symlink = 0;
+	node->ptidx = 0;
 
 	/* If the filetype was not stored using rockridge, use
 	   whatever is stored in the iso9660 filesystem.  */
@@ -836,6 +1069,353 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+/* Helper for grub_iso9660_get_dircache.  */
+static int
+grub_iso9660_dircache_add (const char *filename,
+			   enum grub_fshelp_filetype filetype,
+			   grub_fshelp_node_t node, void *data)
+{
+  struct grub_iso9660_dircache *dc = data;
+  struct grub_iso9660_dentry *e;
+  grub_size_t namelen, symlen = 0, extsize;
+  const char *symlink = NULL;
+
+  if (node->have_symlink)
+    {
+      symlink = node->symlink + node->have_dirents * sizeof (node->dirents[0])
+	- sizeof (node->dirents);
+      symlen = grub_strlen (symlink) + 1;
+    }
+  namelen = grub_strlen (filename) + 1;
+  extsize = node->have_dirents * sizeof (node->dirents[0]);
+
+  /* The array grows in powers of two, starting with 16 entries.  */
+  if (dc->count >= 16 && (dc->count & (dc->count - 1)) == 0)
+    {
+      struct grub_iso9660_dentry **entries;
+
+      entries = grub_realloc (dc->entries,
+			      2 * dc->count * sizeof (dc->entries[0]));
+      if (!entries)
+	{
+	  grub_free (node);
+	  return 1;
+	}
+      dc->entries = entries;
+    }
+  else if (!dc->entries)
+    {
+      dc->entries = grub_malloc (16 * sizeof (dc->entries[0]));
+      if (!dc->entries)
+	{
+	  grub_free (node);
+	  return 1;
+	}
+    }
+
+  e = grub_malloc (sizeof (*e) + extsize + namelen + symlen);
+  if (!e)
+    {
+      grub_free (node);
+      return 1;
+    }
+  e->type = filetype;
+  e->have_dirents = node->have_dirents;
+  grub_memcpy (e->dirents, node->dirents, extsize);
+  e->name = (char *) e->dirents + extsize;
+  grub_memcpy (e->name, filename, namelen);
+  e->symlink = NULL;
+  if (symlink)
+    {
+      e->symlink = e->name + namelen;
+      grub_memcpy (e->symlink, symlink, symlen);
+    }
+  dc->entries[dc->count++] = e;
+
+  grub_free (node);
+  return 0;
+}
+
+/* Return the decoded entries of DIR, reading the directory if it isn't
+   cached yet.  Return NULL with grub_errno set if that fails, or with
+   grub_errno clear if all cache slots are in use.  */
+static struct grub_iso9660_dircache *
+grub_iso9660_get_dircache (grub_fshelp_node_t dir)
+{
+  struct grub_iso9660_data *data = dir->data;
+  struct grub_iso9660_dircache *dc, *victim = NULL;
+  grub_uint32_t sector = grub_le_to_cpu32 (dir->dirents[0].first_sector);
+  grub_off_t size = get_node_size (dir);
+  int i;
+
+  for (i = 0; i < GRUB_ISO9660_DIRCACHE_SIZE; i++)
+    {
+      dc = &data->dircache[i];
+      if (dc->stamp && dc->sector == sector && dc->size == size)
+	{
+	  dc->stamp = ++data->dircache_stamp;
+	  return dc;
+	}
+      if (!dc->busy && (!victim || dc->stamp < victim->stamp))
+	victim = dc;
+    }
+  if (!victim)
+    return NULL;
+
+  dc = victim;
+  grub_iso9660_free_dircache (dc);
+  grub_iso9660_read_dir (dir, grub_iso9660_dircache_add, dc);
+  if (grub_errno)
+    {
+      grub_iso9660_free_dircache (dc);
+      return NULL;
+    }
+  dc->sector = sector;
+  dc->size = size;
+  dc->stamp = ++data->dircache_stamp;
+  return dc;
+}
+
+/* Make a node for the cached entry E.  */
+static grub_fshelp_node_t
+grub_iso9660_dentry_node (struct grub_iso9660_data *data,
+			  struct grub_iso9660_dentry *e)
+{
+  struct grub_fshelp_node *node;
+  grub_size_t alloc_dirents = ARRAY_SIZE (node->dirents);
+
+  if (e->have_dirents > alloc_dirents)
+    alloc_dirents = e->have_dirents;
+
+  node = grub_malloc (sizeof (struct grub_fshelp_node)
+		      + ((alloc_dirents - ARRAY_SIZE (node->dirents))
+			 * sizeof (node->dirents[0]))
+		      + (e->symlink ? grub_strlen (e->symlink) + 1 : 0));
+  if (!node)
+    return NULL;
+
+  node->data = data;
+  node->alloc_dirents = alloc_dirents;
+  node->have_dirents = e->have_dirents;
+  node->have_symlink = !!e->symlink;
+  node->ptidx = 0;
+  grub_memcpy (node->dirents, e->dirents,
+	       e->have_dirents * sizeof (node->dirents[0]));
+  if (e->symlink)
+    grub_strcpy (node->symlink
+		 + node->have_dirents * sizeof (node->dirents[0])
+		 - sizeof (node->dirents), e->symlink);
+  return node;
+}
+
+/* Directories are decoded once, together with their Rock Ridge or Joliet
+   names, and then listed from the cache.  */
+static int
+grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
+			  grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
+{
+  struct grub_iso9660_dircache *dc;
+  grub_size_t i;
+  int ret = 0;
+
+  dc = grub_iso9660_get_dircache (dir);
+  if (!dc)
+    {
+      if (grub_errno && grub_errno != GRUB_ERR_OUT_OF_MEMORY)
+	return 0;
+      grub_errno = GRUB_ERR_NONE;
+      return grub_iso9660_read_dir (dir, hook, hook_data);
+    }
+
+  /* The hook may look up other files, keep the entries around.  */
+  dc->busy++;
+  for (i = 0; i < dc->count; i++)
+    {
+      grub_fshelp_node_t node;
+
+      node = grub_iso9660_dentry_node (dir->data, dc->entries[i]);
+      if (!node)
+	break;
+      if (hook (dc->entries[i]->name, dc->entries[i]->type, node, hook_data))
+	{
+	  ret = 1;
+	  break;
+	}
+    }
+  dc->busy--;
+
+  return ret;
+}
+
+/* Find the subdirectory NAME of the directory with the path table index
+   PARENT, or the one starting at SECTOR if NAME is NULL.  Return its
+   index or 0.  */
+static grub_uint32_t
+grub_iso9660_ptable_find (struct grub_iso9660_data *data,
+			  grub_uint32_t parent, const char *name,
+			  grub_uint32_t sector)
+{
+  grub_uint32_t lo = 1, hi = data->ptable_count;
+
+  /* Skip to the first child of PARENT.  The root is its own parent and
+     comes first, so the search starts after it.  */
+  while (lo < hi)
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+
+      if (data->ptable[mid].parent < parent)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (; lo < data->ptable_count && data->ptable[lo].parent == parent; lo++)
+    {
+      struct grub_iso9660_ptentry *p = &data->ptable[lo];
+
+      if (name ? ((data->joliet ? grub_strcmp (name, p->name)
+		   : grub_strcasecmp (name, p->name)) == 0)
+	  : p->sector == sector)
+	return lo + 1;
+    }
+  return 0;
+}
+
+/* Make a node for the directory with the path table index IDX, using
+   the "." entry of the directory itself.  */
+static grub_fshelp_node_t
+grub_iso9660_ptable_node (struct grub_iso9660_data *data, grub_uint32_t idx)
+{
+  struct grub_iso9660_ptentry *p = &data->ptable[idx - 1];
+  struct grub_iso9660_dir dirent;
+  struct grub_fshelp_node *node;
+
+  if (!p->dirent.len)
+    {
+      if (grub_disk_read (data->disk,
+			  ((grub_disk_addr_t) p->sector) << GRUB_ISO9660_LOG2_BLKSZ,
+			  0, sizeof (dirent), &dirent))
+	return NULL;
+      if (dirent.len < sizeof (dirent)
+	  || grub_le_to_cpu32 (dirent.first_sector) != p->sector
+	  || (dirent.flags & FLAG_TYPE) != FLAG_TYPE_DIR
+	  || (dirent.flags & FLAG_MORE_EXTENTS))
+	return NULL;
+      p->dirent = dirent;
+    }
+
+  node = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (!node)
+    return NULL;
+  node->data = data;
+  node->alloc_dirents = ARRAY_SIZE (node->dirents);
+  node->have_dirents = 1;
+  node->have_symlink = 0;
+  node->ptidx = idx;
+  node->dirents[0] = p->dirent;
+  return node;
+}
+
+/* Context for grub_iso9660_lookup_file.  */
+struct grub_iso9660_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_iso9660_lookup_file.  */
+static int
+grub_iso9660_lookup_iter (const char *filename,
+			  enum grub_fshelp_filetype filetype,
+			  grub_fshelp_node_t node, void *data)
+{
+  struct grub_iso9660_lookup_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN
+      || ((filetype & GRUB_FSHELP_CASE_INSENSITIVE)
+	  ? grub_strcasecmp (ctx->name, filename)
+	  : grub_strcmp (ctx->name, filename)))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Look NAME up in DIR.  Subdirectories are found through the path table
+   when possible; everything else, including names that don't exist, is
+   answered from the decoded directory.  */
+static grub_err_t
+grub_iso9660_lookup_file (grub_fshelp_node_t dir, const char *name,
+			  grub_fshelp_node_t *foundnode,
+			  enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_iso9660_data *data = dir->data;
+  struct grub_iso9660_dircache *dc;
+  grub_size_t i;
+
+  *foundnode = NULL;
+
+  if (dir->ptidx)
+    {
+      grub_uint32_t idx = grub_iso9660_ptable_find (data, dir->ptidx, name, 0);
+
+      if (idx)
+	{
+	  *foundnode = grub_iso9660_ptable_node (data, idx);
+	  if (*foundnode)
+	    {
+	      *foundtype = GRUB_FSHELP_DIR;
+	      if (!data->joliet)
+		*foundtype |= GRUB_FSHELP_CASE_INSENSITIVE;
+	      return GRUB_ERR_NONE;
+	    }
+	  if (grub_errno == GRUB_ERR_OUT_OF_MEMORY)
+	    return grub_errno;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+
+  dc = grub_iso9660_get_dircache (dir);
+  if (!dc)
+    {
+      struct grub_iso9660_lookup_ctx ctx = { name, foundnode, foundtype };
+
+      if (grub_errno && grub_errno != GRUB_ERR_OUT_OF_MEMORY)
+	return grub_errno;
+      grub_errno = GRUB_ERR_NONE;
+      grub_iso9660_read_dir (dir, grub_iso9660_lookup_iter, &ctx);
+      return grub_errno;
+    }
+
+  for (i = 0; i < dc->count; i++)
+    {
+      struct grub_iso9660_dentry *e = dc->entries[i];
+
+      if (e->type == GRUB_FSHELP_UNKNOWN
+	  || ((e->type & GRUB_FSHELP_CASE_INSENSITIVE)
+	      ? grub_strcasecmp (name, e->name)
+	      : grub_strcmp (name, e->name)))
+	continue;
+
+      *foundnode = grub_iso9660_dentry_node (data, e);
+      if (!*foundnode)
+	return grub_errno;
+      *foundtype = e->type;
+      if (dir->ptidx && (e->type & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR)
+	(*foundnode)->ptidx
+	  = grub_iso9660_ptable_find (data, dir->ptidx, NULL,
+				      grub_le_to_cpu32 (e->dirents[0].first_sector));
+      break;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 
 
 /* Context for grub_iso9660_dir.  */
@@ -881,14 +1461,15 @@ grub_iso9660_dir (grub_device_t device, const char *path,
   rootnode.alloc_dirents = 0;
   rootnode.have_dirents = 1;
   rootnode.have_symlink = 0;
+  rootnode.ptidx = data->ptable ? 1 : 0;
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_lookup (path, &rootnode,
+				    &foundnode,
+				    grub_iso9660_lookup_file,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_DIR))
     goto fail;
 
   /* List the files in the directory.  */
@@ -898,7 +1479,7 @@ grub_iso9660_dir (grub_device_t device, const char *path,
     grub_free (foundnode);
 
  fail:
-  grub_free (data);
+  grub_iso9660_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -924,18 +1505,28 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   rootnode.alloc_dirents = 0;
   rootnode.have_dirents = 1;
   rootnode.have_symlink = 0;
+  rootnode.ptidx = data->ptable ? 1 : 0;
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_lookup (name, &rootnode,
+				    &foundnode,
+				    grub_iso9660_lookup_file,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_REG))
     goto fail;
 
-  data->node = foundnode;
-  file->data = data;
+  /* The mount data may be shared with other files, so the file gets a
+     node of its own.  */
+  if (foundnode == &rootnode)
+    {
+      foundnode = grub_malloc (sizeof (rootnode));
+      if (!foundnode)
+	goto fail;
+      grub_memcpy (foundnode, &rootnode, sizeof (rootnode));
+    }
+
+  file->data = foundnode;
   file->size = get_node_size (foundnode);
   file->offset = 0;
 
@@ -944,7 +1535,7 @@ grub_iso9660_open (struct grub_file *file, const char *name)
  fail:
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_unmount (data);
 
   return grub_errno;
 }
@@ -953,14 +1544,16 @@ grub_iso9660_open (struct grub_file *file, const char *name)
 static grub_ssize_t
 grub_iso9660_read (grub_file_t file, char *buf, grub_size_t len)
 {
-  struct grub_iso9660_data *data =
-    (struct grub_iso9660_data *) file->data;
+  struct grub_fshelp_node *node = file->data;
+  struct grub_iso9660_data *data = node->data;
   grub_err_t err;
 
+  data->disk = file->device->disk;
+
   /* XXX: The file is stored in as a single extent.  */
   data->disk->read_hook = file->read_hook;
   data->disk->read_hook_data = file->read_hook_data;
-  err = read_node (data->node, file->offset, len, buf);
+  err = read_node (node, file->offset, len, buf);
   data->disk->read_hook = NULL;
 
   if (err || grub_errno)
@@ -973,10 +1566,10 @@ grub_iso9660_read (grub_file_t file, char *buf, grub_size_t len)
 static grub_err_t
 grub_iso9660_close (grub_file_t file)
 {
-  struct grub_iso9660_data *data =
-    (struct grub_iso9660_data *) file->data;
-  grub_free (data->node);
-  grub_free (data);
+  struct grub_fshelp_node *node = file->data;
+
+  grub_iso9660_unmount (node->data);
+  grub_free (node);
 
   grub_dl_unref (my_mod);
 
@@ -1005,7 +1598,7 @@ grub_iso9660_label (grub_device_t device, char **label)
 	    *ptr-- = 0;
 	}
 
-      grub_free (data);
+      grub_iso9660_unmount (data);
     }
   else
     *label = 0;
@@ -1063,7 +1656,7 @@ grub_iso9660_uuid (grub_device_t device, char **uuid)
 
 	grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_unmount (data);
 
   return grub_errno;
 }
@@ -1088,7 +1681,7 @@ grub_iso9660_mtime (grub_device_t device, grub_int32_t *timebuf)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_unmount (data);
 
   return err;
 }
@@ -1096,6 +1689,13 @@ grub_iso9660_mtime (grub_device_t device, grub_int32_t *timebuf)
 
 
 
+static const struct grub_fs_signature grub_iso9660_signatures[] =
+  {
+    /* First volume descriptor.  */
+    { 16 * 2048 + 1, 5, "CD001" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_iso9660_fs =
   {
     .name = "iso9660",
@@ -1106,6 +1706,8 @@ static struct grub_fs grub_iso9660_fs =
     .label = grub_iso9660_label,
     .uuid = grub_iso9660_uuid,
     .mtime = grub_iso9660_mtime,
+    .signatures = grub_iso9660_signatures,
+    .unmount = grub_iso9660_free_mount,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -108,6 +108,9 @@ init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
   at->flags = (mft == &mft->data->mmft) ? GRUB_NTFS_AF_MMFT : 0;
   at->attr_nxt = mft->buf + u16at (mft->buf, 0x14);
   at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->map_attr = NULL;
+  at->runs = NULL;
+  at->nruns = 0;
 }
 
 static void
@@ -116,6 +119,7 @@ free_attr (struct grub_ntfs_attr *at)
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
   grub_free (at->sbuf);
+  grub_free (at->runs);
 }
 
 static grub_uint8_t *
@@ -345,21 +349,147 @@ retry:
   return 0;
 }
 
-static grub_disk_addr_t
-grub_ntfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t block)
+static grub_err_t
+grub_ntfs_read_extent (grub_fshelp_node_t node, grub_disk_addr_t block,
+		       grub_disk_addr_t *start, grub_disk_addr_t *count)
 {
   struct grub_ntfs_rlst *ctx;
 
   ctx = (struct grub_ntfs_rlst *) node;
-  if (block >= ctx->next_vcn)
+  while (block >= ctx->next_vcn)
     {
       if (grub_ntfs_read_run_list (ctx))
-	return -1;
-      return ctx->curr_lcn;
+	return grub_errno;
     }
-  else
-    return (ctx->flags & GRUB_NTFS_RF_BLNK) ? 0 : (block -
+
+  *count = ctx->next_vcn - block;
+  *start = (ctx->flags & GRUB_NTFS_RF_BLNK) ? 0 : (block -
 					 ctx->curr_vcn + ctx->curr_lcn);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_ntfs_map_extent (grub_fshelp_node_t node, grub_disk_addr_t block,
+		      grub_disk_addr_t *start, grub_disk_addr_t *count)
+{
+  struct grub_ntfs_attr *at = (struct grub_ntfs_attr *) node;
+  grub_size_t lo = 0, hi = at->nruns;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+      struct grub_ntfs_run *run = &at->runs[mid];
+
+      if (block < run->vcn)
+	hi = mid;
+      else if (block - run->vcn >= run->len)
+	lo = mid + 1;
+      else
+	{
+	  *count = run->len - (block - run->vcn);
+	  *start = run->lcn ? run->lcn + (block - run->vcn) : 0;
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  return grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+}
+
+static grub_err_t
+add_run (struct grub_ntfs_attr *at, grub_size_t *alloc,
+	 struct grub_ntfs_rlst *ctx)
+{
+  struct grub_ntfs_run *run;
+  grub_disk_addr_t lcn;
+
+  lcn = (ctx->flags & GRUB_NTFS_RF_BLNK) ? 0 : ctx->curr_lcn;
+  if (at->nruns)
+    {
+      run = &at->runs[at->nruns - 1];
+      if (run->vcn + run->len == ctx->curr_vcn
+	  && ((!run->lcn && !lcn) || (run->lcn && run->lcn + run->len == lcn)))
+	{
+	  run->len += ctx->next_vcn - ctx->curr_vcn;
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  if (at->nruns == *alloc)
+    {
+      *alloc = *alloc ? *alloc * 2 : 16;
+      run = grub_realloc (at->runs, *alloc * sizeof (*run));
+      if (!run)
+	return grub_errno;
+      at->runs = run;
+    }
+
+  run = &at->runs[at->nruns++];
+  run->vcn = ctx->curr_vcn;
+  run->lcn = lcn;
+  run->len = ctx->next_vcn - ctx->curr_vcn;
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the whole run list of the attribute at AT->attr_cur, following
+   it across the attribute list if needed, so that later reads map
+   clusters by binary search instead of decoding the list from its start
+   every time.  Resident and compressed attributes are left unmapped.  */
+static grub_err_t
+map_runs (struct grub_ntfs_attr *at)
+{
+  struct grub_ntfs_rlst cc;
+  grub_disk_addr_t total;
+  grub_size_t alloc = 0;
+  grub_uint8_t *pa;
+
+  grub_free (at->runs);
+  at->runs = NULL;
+  at->nruns = 0;
+  at->map_attr = at->attr_cur;
+
+  at->attr_nxt = at->attr_cur;
+  pa = find_attr (at, *at->attr_cur);
+  if (!pa)
+    return (grub_errno) ? grub_errno : grub_error (GRUB_ERR_BAD_FS,
+						   "attribute not found");
+
+  if (pa[8] == 0 || (pa[0xC] & GRUB_NTFS_FLAG_COMPRESSED)
+      || u64at (pa, 0x10) != 0)
+    return GRUB_ERR_NONE;
+
+  grub_memset (&cc, 0, sizeof (cc));
+  cc.attr = at;
+  cc.comp.log_spc = at->mft->data->log_spc;
+  cc.comp.disk = at->mft->data->disk;
+  cc.cur_run = pa + u16at (pa, 0x20);
+
+  total = u64at (pa, 0x28) >> (GRUB_NTFS_BLK_SHR + cc.comp.log_spc);
+  while (cc.next_vcn < total)
+    {
+      if (grub_ntfs_read_run_list (&cc))
+	{
+	  /* Reads past what could be decoded fail when they get there,
+	     just like without the map.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  break;
+	}
+      if (add_run (at, &alloc, &cc))
+	{
+	  grub_free (at->runs);
+	  at->runs = NULL;
+	  at->nruns = 0;
+	  return grub_errno;
+	}
+    }
+
+  if (!at->runs)
+    {
+      /* Empty, but mapped all the same.  */
+      at->runs = grub_malloc (sizeof (*at->runs));
+      if (!at->runs)
+	return grub_errno;
+    }
+  return GRUB_ERR_NONE;
 }
 
 static grub_err_t
@@ -434,11 +564,11 @@ read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
       return 0;
     }
 
-  grub_fshelp_read_file (ctx->comp.disk, (grub_fshelp_node_t) ctx,
-			 read_hook, read_hook_data, ofs, len,
-			 (char *) dest,
-			 grub_ntfs_read_block, ofs + len,
-			 ctx->comp.log_spc, 0);
+  grub_fshelp_read_file_extents (ctx->comp.disk, (grub_fshelp_node_t) ctx,
+				 read_hook, read_hook_data, ofs, len,
+				 (char *) dest,
+				 grub_ntfs_read_extent, ofs + len,
+				 ctx->comp.log_spc, 0);
   return grub_errno;
 }
 
@@ -453,6 +583,29 @@ read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
   grub_err_t ret;
 
   save_cur = at->attr_cur;
+
+  if (!(at->flags & GRUB_NTFS_AF_GPOS))
+    {
+      if (at->map_attr != save_cur && map_runs (at))
+	{
+	  at->map_attr = NULL;
+	  at->attr_cur = save_cur;
+	  return grub_errno;
+	}
+      at->attr_cur = save_cur;
+      if (at->runs)
+	{
+	  if (len)
+	    grub_fshelp_read_file_extents (at->mft->data->disk,
+					   (grub_fshelp_node_t) at,
+					   read_hook, read_hook_data, ofs, len,
+					   (char *) dest, grub_ntfs_map_extent,
+					   ofs + len, at->mft->data->log_spc,
+					   0);
+	  return grub_errno;
+	}
+    }
+
   at->attr_nxt = at->attr_cur;
   attr = *at->attr_nxt;
   if (at->flags & GRUB_NTFS_AF_ALST)
@@ -490,13 +643,101 @@ read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
   return ret;
 }
 
+/* Put the raw record MFTNO from BUF into the cache, evicting the least
+   recently used entry.  Records that don't fix up aren't kept.  */
+static void
+cache_mft (struct grub_ntfs_data *data, const grub_uint8_t *buf,
+	   grub_uint64_t mftno)
+{
+  struct grub_ntfs_mft_cache *ent = &data->mft_cache[0];
+  grub_size_t rec_size = data->mft_size << GRUB_NTFS_BLK_SHR;
+  int i;
+
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_SIZE; i++)
+    {
+      struct grub_ntfs_mft_cache *e = &data->mft_cache[i];
+
+      if (e->buf && e->mftno == mftno)
+	return;
+      if (!e->buf || (ent->buf && e->stamp < ent->stamp))
+	ent = e;
+    }
+
+  if (!ent->buf)
+    {
+      ent->buf = grub_malloc (rec_size);
+      if (!ent->buf)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+    }
+
+  grub_memcpy (ent->buf, buf, rec_size);
+  if (fixup (ent->buf, data->mft_size, (const grub_uint8_t *) "FILE"))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (ent->buf);
+      ent->buf = NULL;
+      return;
+    }
+  ent->mftno = mftno;
+  ent->stamp = ++data->mft_stamp;
+}
+
 static grub_err_t
 read_mft (struct grub_ntfs_data *data, grub_uint8_t *buf, grub_uint64_t mftno)
 {
+  grub_size_t rec_size = data->mft_size << GRUB_NTFS_BLK_SHR;
+  grub_uint64_t first, count, records, i;
+  grub_uint8_t *group = NULL;
+  int j;
+
+  for (j = 0; j < GRUB_NTFS_MFT_CACHE_SIZE; j++)
+    if (data->mft_cache[j].buf && data->mft_cache[j].mftno == mftno)
+      {
+	data->mft_cache[j].stamp = ++data->mft_stamp;
+	grub_memcpy (buf, data->mft_cache[j].buf, rec_size);
+	return GRUB_ERR_NONE;
+      }
+
+  /* Records of one directory tend to be allocated together, so read the
+     neighbours of MFTNO along with it.  */
+  first = mftno & ~(grub_uint64_t) (GRUB_NTFS_MFT_READAHEAD - 1);
+  count = GRUB_NTFS_MFT_READAHEAD;
+  records = grub_divmod64 (data->mmft.size, rec_size, 0);
+  if (first + count > records)
+    count = (records > first) ? records - first : 0;
+
+  if (count > 1 && mftno - first < count)
+    {
+      group = grub_malloc (count * rec_size);
+      if (!group)
+	grub_errno = GRUB_ERR_NONE;
+    }
+  if (group)
+    {
+      if (read_attr (&data->mmft.attr, group, first * rec_size,
+		     count * rec_size, 0, 0, 0) == GRUB_ERR_NONE)
+	{
+	  for (i = 0; i < count; i++)
+	    if (first + i != mftno)
+	      cache_mft (data, group + i * rec_size, first + i);
+	  grub_memcpy (buf, group + (mftno - first) * rec_size, rec_size);
+	  grub_free (group);
+	  goto fix;
+	}
+      grub_free (group);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
   if (read_attr
       (&data->mmft.attr, buf, mftno * ((grub_disk_addr_t) data->mft_size << GRUB_NTFS_BLK_SHR),
        data->mft_size << GRUB_NTFS_BLK_SHR, 0, 0, 0))
     return grub_error (GRUB_ERR_BAD_FS, "read MFT 0x%llx fails", (unsigned long long) mftno);
+
+ fix:
+  cache_mft (data, buf, mftno);
   return fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE");
 }
 
@@ -549,6 +790,18 @@ free_file (struct grub_ntfs_file *mft)
   grub_free (mft->buf);
 }
 
+static void
+free_data (struct grub_ntfs_data *data)
+{
+  int i;
+
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_SIZE; i++)
+    grub_free (data->mft_cache[i].buf);
+  free_file (&data->mmft);
+  free_file (&data->cmft);
+  grub_free (data);
+}
+
 static char *
 get_utf8 (grub_uint8_t *in, grub_size_t len)
 {
@@ -571,6 +824,34 @@ get_utf8 (grub_uint8_t *in, grub_size_t len)
   return (char *) buf;
 }
 
+/* Make a node for the file of the index entry at POS.  */
+static struct grub_ntfs_file *
+entry_node (struct grub_ntfs_file *diro, grub_uint8_t *pos,
+	    enum grub_fshelp_filetype *type)
+{
+  struct grub_ntfs_file *fdiro;
+  grub_uint32_t attr;
+
+  attr = u32at (pos, 0x48);
+  if (attr & GRUB_NTFS_ATTR_REPARSE)
+    *type = GRUB_FSHELP_SYMLINK;
+  else if (attr & GRUB_NTFS_ATTR_DIRECTORY)
+    *type = GRUB_FSHELP_DIR;
+  else
+    *type = GRUB_FSHELP_REG;
+  if (pos[0x51])
+    *type |= GRUB_FSHELP_CASE_INSENSITIVE;
+
+  fdiro = grub_zalloc (sizeof (struct grub_ntfs_file));
+  if (!fdiro)
+    return NULL;
+
+  fdiro->data = diro->data;
+  fdiro->ino = u64at (pos, 0) & 0xffffffffffffULL;
+  fdiro->mtime = u64at (pos, 0x20);
+  return fdiro;
+}
+
 static int
 list_file (struct grub_ntfs_file *diro, grub_uint8_t *pos,
 	   grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -598,32 +879,17 @@ list_file (struct grub_ntfs_file *diro, grub_uint8_t *pos,
 	{
 	  enum grub_fshelp_filetype type;
 	  struct grub_ntfs_file *fdiro;
-	  grub_uint32_t attr;
-
-	  attr = u32at (pos, 0x48);
-	  if (attr & GRUB_NTFS_ATTR_REPARSE)
-	    type = GRUB_FSHELP_SYMLINK;
-	  else if (attr & GRUB_NTFS_ATTR_DIRECTORY)
-	    type = GRUB_FSHELP_DIR;
-	  else
-	    type = GRUB_FSHELP_REG;
 
-	  fdiro = grub_zalloc (sizeof (struct grub_ntfs_file));
+	  fdiro = entry_node (diro, pos, &type);
 	  if (!fdiro)
 	    return 0;
 
-	  fdiro->data = diro->data;
-	  fdiro->ino = u64at (pos, 0) & 0xffffffffffffULL;
-	  fdiro->mtime = u64at (pos, 0x20);
-
 	  ustr = get_utf8 (np, ns);
 	  if (ustr == NULL)
 	    {
 	      grub_free (fdiro);
 	      return 0;
 	    }
-          if (namespace)
-            type |= GRUB_FSHELP_CASE_INSENSITIVE;
 
 	  if (hook (ustr, type, fdiro, hook_data))
 	    {
@@ -730,6 +996,54 @@ grub_ntfs_read_symlink (grub_fshelp_node_t node)
   return buf;
 }
 
+/* Find the $I30 index root of the file AT was initialized for and return
+   its index node header.  */
+static grub_uint8_t *
+find_index_root (struct grub_ntfs_attr *at)
+{
+  grub_uint8_t *cur_pos;
+
+  while (1)
+    {
+      cur_pos = find_attr (at, GRUB_NTFS_AT_INDEX_ROOT);
+      if (cur_pos == NULL)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "no $INDEX_ROOT");
+	  return NULL;
+	}
+
+      /* Resident, Namelen=4, Offset=0x18, Flags=0x00, Name="$I30" */
+      if ((u32at (cur_pos, 8) != 0x180400) ||
+	  (u32at (cur_pos, 0x18) != 0x490024) ||
+	  (u32at (cur_pos, 0x1C) != 0x300033))
+	continue;
+      cur_pos += u16at (cur_pos, 0x14);
+      if (*cur_pos != 0x30)	/* Not filename index */
+	continue;
+      break;
+    }
+
+  return cur_pos + 0x10;	/* Skip index root */
+}
+
+static grub_uint8_t *
+find_index_allocation (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
+{
+  grub_uint8_t *cur_pos;
+
+  cur_pos = locate_attr (at, mft, GRUB_NTFS_AT_INDEX_ALLOCATION);
+  while (cur_pos != NULL)
+    {
+      /* Non-resident, Namelen=4, Offset=0x40, Flags=0, Name="$I30" */
+      if ((u32at (cur_pos, 8) == 0x400401) &&
+	  (u32at (cur_pos, 0x40) == 0x490024) &&
+	  (u32at (cur_pos, 0x44) == 0x300033))
+	break;
+      cur_pos = find_attr (at, GRUB_NTFS_AT_INDEX_ALLOCATION);
+    }
+  return cur_pos;
+}
+
 static int
 grub_ntfs_iterate_dir (grub_fshelp_node_t dir,
 		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -754,27 +1068,10 @@ grub_ntfs_iterate_dir (grub_fshelp_node_t dir,
 
   at = &attr;
   init_attr (at, mft);
-  while (1)
-    {
-      cur_pos = find_attr (at, GRUB_NTFS_AT_INDEX_ROOT);
-      if (cur_pos == NULL)
-	{
-	  grub_error (GRUB_ERR_BAD_FS, "no $INDEX_ROOT");
-	  goto done;
-	}
-
-      /* Resident, Namelen=4, Offset=0x18, Flags=0x00, Name="$I30" */
-      if ((u32at (cur_pos, 8) != 0x180400) ||
-	  (u32at (cur_pos, 0x18) != 0x490024) ||
-	  (u32at (cur_pos, 0x1C) != 0x300033))
-	continue;
-      cur_pos += u16at (cur_pos, 0x14);
-      if (*cur_pos != 0x30)	/* Not filename index */
-	continue;
-      break;
-    }
+  cur_pos = find_index_root (at);
+  if (cur_pos == NULL)
+    goto done;
 
-  cur_pos += 0x10;		/* Skip index root */
   ret = list_file (mft, cur_pos + u16at (cur_pos, 0), hook, hook_data);
   if (ret)
     goto done;
@@ -824,16 +1121,7 @@ grub_ntfs_iterate_dir (grub_fshelp_node_t dir,
     }
 
   free_attr (at);
-  cur_pos = locate_attr (at, mft, GRUB_NTFS_AT_INDEX_ALLOCATION);
-  while (cur_pos != NULL)
-    {
-      /* Non-resident, Namelen=4, Offset=0x40, Flags=0, Name="$I30" */
-      if ((u32at (cur_pos, 8) == 0x400401) &&
-	  (u32at (cur_pos, 0x40) == 0x490024) &&
-	  (u32at (cur_pos, 0x44) == 0x300033))
-	break;
-      cur_pos = find_attr (at, GRUB_NTFS_AT_INDEX_ALLOCATION);
-    }
+  cur_pos = find_index_allocation (at, mft);
 
   if ((!cur_pos) && (bitmap))
     {
@@ -883,12 +1171,197 @@ done:
   return ret;
 }
 
+/* Compare the ASCII name KEY with the index entry name NAME the way the
+   index is sorted, upcasing both.  Only ASCII is upcased without the
+   $UpCase table, so clear *EXACT if a non-ASCII character decided it.  */
+static int
+index_name_cmp (const char *key, grub_size_t keylen, grub_uint8_t *name,
+		grub_size_t ns, int *exact)
+{
+  grub_size_t i;
+
+  for (i = 0; i < keylen && i < ns; i++)
+    {
+      grub_uint16_t a = grub_toupper (key[i]);
+      grub_uint16_t b = u16at (name, 2 * i);
+
+      if (b < 0x80)
+	b = grub_toupper (b);
+      else
+	*exact = 0;
+      if (a != b)
+	return (a < b) ? -1 : 1;
+    }
+
+  if (keylen == ns)
+    return 0;
+  return (keylen < ns) ? -1 : 1;
+}
+
+/* Look NAME up in the $I30 index of MFT by descending the B+tree.
+   Return 1 if found, 0 if it isn't there and -1 if only a scan of the
+   whole index can tell.  */
+static int
+index_lookup (struct grub_ntfs_file *mft, const char *name,
+	      grub_fshelp_node_t *foundnode,
+	      enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ntfs_attr attr, *at = &attr;
+  struct grub_ntfs_data *data = mft->data;
+  grub_size_t keylen = grub_strlen (name), idx_bytes, i;
+  grub_uint8_t *hdr, *pos, *end, *indx = NULL;
+  grub_disk_addr_t vcn;
+  int exact = 1, depth, ret = -1, have_alloc = 0, vcn_bits;
+
+  for (i = 0; i < keylen; i++)
+    if ((grub_uint8_t) name[i] >= 0x80)
+      return -1;
+
+  idx_bytes = data->idx_size << GRUB_NTFS_BLK_SHR;
+  if (data->idx_size >= (1U << data->log_spc))
+    vcn_bits = data->log_spc + GRUB_NTFS_BLK_SHR;
+  else
+    vcn_bits = GRUB_NTFS_BLK_SHR;
+
+  init_attr (at, mft);
+  hdr = find_index_root (at);
+  if (!hdr)
+    goto done;
+
+  for (depth = 0; depth < 32; depth++)
+    {
+      pos = hdr + u32at (hdr, 0);
+      end = hdr + u32at (hdr, 4);
+
+      while (1)
+	{
+	  grub_uint16_t len;
+	  grub_uint8_t ns;
+	  int cmp;
+
+	  if (pos + 0x10 > end)
+	    goto done;
+	  len = u16at (pos, 8);
+	  if (len < 0x10 || pos + len > end)
+	    goto done;
+	  if (pos[0xC] & 2)		/* end signature */
+	    break;
+
+	  ns = pos[0x50];
+	  if (len < 0x52 + 2 * ns)
+	    goto done;
+	  cmp = index_name_cmp (name, keylen, pos + 0x52, ns, &exact);
+	  if (cmp < 0)
+	    break;
+	  if (cmp == 0)
+	    {
+	      /* DOS names aren't listed, and POSIX ones are case
+		 sensitive: leave those to the scan.  */
+	      if (pos[0x51] == 2)
+		goto done;
+	      if (pos[0x51] == 0)
+		for (i = 0; i < keylen; i++)
+		  if (u16at (pos + 0x52, 2 * i) != (grub_uint8_t) name[i])
+		    goto done;
+
+	      *foundnode = entry_node (mft, pos, foundtype);
+	      ret = (*foundnode) ? 1 : -1;
+	      goto done;
+	    }
+	  pos += len;
+	}
+
+      if (!(pos[0xC] & 1))
+	{
+	  ret = exact ? 0 : -1;
+	  goto done;
+	}
+      /* Take the subnode VCN before the root goes away with AT.  */
+      vcn = u64at (pos, u16at (pos, 8) - 8);
+
+      if (!have_alloc)
+	{
+	  free_attr (at);
+	  if (!find_index_allocation (at, mft))
+	    goto done;
+	  have_alloc = 1;
+	  indx = grub_malloc (idx_bytes);
+	  if (!indx)
+	    goto done;
+	}
+
+      if (read_attr (at, indx, vcn << vcn_bits,
+		     idx_bytes, 0, 0, 0)
+	  || fixup (indx, data->idx_size, (const grub_uint8_t *) "INDX"))
+	goto done;
+      hdr = indx + 0x18;
+    }
+
+ done:
+  free_attr (at);
+  grub_free (indx);
+  if (ret < 0)
+    grub_errno = GRUB_ERR_NONE;
+  return ret;
+}
+
+/* Context for grub_ntfs_lookup_file.  */
+struct grub_ntfs_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_ntfs_lookup_file.  */
+static int
+grub_ntfs_lookup_iter (const char *filename,
+		       enum grub_fshelp_filetype filetype,
+		       grub_fshelp_node_t node, void *data)
+{
+  struct grub_ntfs_lookup_ctx *ctx = data;
+
+  if ((filetype & GRUB_FSHELP_CASE_INSENSITIVE)
+      ? grub_strcasecmp (ctx->name, filename)
+      : grub_strcmp (ctx->name, filename))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+static grub_err_t
+grub_ntfs_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ntfs_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+
+  if (!dir->inode_read && init_file (dir, dir->ino))
+    return grub_errno;
+
+  if (index_lookup (dir, name, foundnode, foundtype) >= 0)
+    return grub_errno;
+
+  grub_ntfs_iterate_dir (dir, grub_ntfs_lookup_iter, &ctx);
+  return grub_errno;
+}
+
 static struct grub_ntfs_data *
 grub_ntfs_mount (grub_disk_t disk)
 {
   struct grub_ntfs_bpb bpb;
   struct grub_ntfs_data *data = 0;
   grub_uint32_t spc;
+  grub_uint8_t *pa;
 
   if (!disk)
     goto fail;
@@ -954,8 +1427,12 @@ grub_ntfs_mount (grub_disk_t disk)
   if (fixup (data->mmft.buf, data->mft_size, (const grub_uint8_t *) "FILE"))
     goto fail;
 
-  if (!locate_attr (&data->mmft.attr, &data->mmft, GRUB_NTFS_AT_DATA))
+  pa = locate_attr (&data->mmft.attr, &data->mmft, GRUB_NTFS_AT_DATA);
+  if (!pa)
     goto fail;
+  /* Bounds the read-ahead of MFT records.  */
+  if (pa[8])
+    data->mmft.size = u64at (pa, 0x30);
 
   if (init_file (&data->cmft, GRUB_NTFS_FILE_ROOT))
     goto fail;
@@ -967,9 +1444,7 @@ fail:
 
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
   return 0;
 }
@@ -1013,8 +1488,9 @@ grub_ntfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (path, &data->cmft, &fdiro, grub_ntfs_iterate_dir,
-			 grub_ntfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_lookup (path, &data->cmft, &fdiro,
+				grub_ntfs_lookup_file, grub_ntfs_read_symlink,
+				GRUB_FSHELP_DIR);
 
   if (grub_errno)
     goto fail;
@@ -1029,9 +1505,7 @@ fail:
     }
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1051,8 +1525,9 @@ grub_ntfs_open (grub_file_t file, const char *name)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->cmft, &mft, grub_ntfs_iterate_dir,
-			 grub_ntfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_lookup (name, &data->cmft, &mft,
+				grub_ntfs_lookup_file, grub_ntfs_read_symlink,
+				GRUB_FSHELP_REG);
 
   if (grub_errno)
     goto fail;
@@ -1078,9 +1553,7 @@ grub_ntfs_open (grub_file_t file, const char *name)
 fail:
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1111,9 +1584,7 @@ grub_ntfs_close (grub_file_t file)
 
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1136,8 +1607,8 @@ grub_ntfs_label (grub_device_t device, char **label)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file ("/$Volume", &data->cmft, &mft, grub_ntfs_iterate_dir,
-			 0, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_lookup ("/$Volume", &data->cmft, &mft,
+				grub_ntfs_lookup_file, 0, GRUB_FSHELP_REG);
 
   if (grub_errno)
     goto fail;
@@ -1171,9 +1642,7 @@ fail:
     }
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1197,9 +1666,7 @@ grub_ntfs_uuid (grub_device_t device, char **uuid)
       if (*uuid)
 	for (ptr = *uuid; *ptr; ptr++)
 	  *ptr = grub_toupper (*ptr);
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
   else
     *uuid = NULL;
@@ -1209,6 +1676,12 @@ grub_ntfs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_signature grub_ntfs_signatures[] =
+  {
+    { 3, 4, "NTFS" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_ntfs_fs =
   {
     .name = "ntfs",
@@ -1218,6 +1691,7 @@ static struct grub_fs grub_ntfs_fs =
     .close = grub_ntfs_close,
     .label = grub_ntfs_label,
     .uuid = grub_ntfs_uuid,
+    .signatures = grub_ntfs_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
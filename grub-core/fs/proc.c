@@ -146,7 +146,7 @@ grub_procfs_dir (grub_device_t device, const char *path,
 
   grub_procfs_rewind (&data);
 
-  return grub_archelp_dir (&data, &arcops,
+  return grub_archelp_dir (&data, &arcops, NULL,
 			   path, hook, hook_data);
 }
 
@@ -159,7 +159,7 @@ grub_procfs_open (struct grub_file *file, const char *path)
 
   grub_procfs_rewind (&data);
 
-  err = grub_archelp_open (&data, &arcops, path);
+  err = grub_archelp_open (&data, &arcops, NULL, path);
   if (err)
     return err;
   file->data = data.entry->get_contents (&sz);
@@ -30,6 +30,7 @@
 
 #include "xz.h"
 #include "xz_stream.h"
+#include <zstd.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -183,6 +184,7 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_ZSTD = 6,
   };
 
 
@@ -202,6 +204,8 @@ struct grub_squash_data
 			      struct grub_squash_data *data);
   struct xz_dec *xzdec;
   char *xzbuf;
+  ZSTD_DCtx *zstd;
+  char *zstdbuf;
 };
 
 struct grub_fshelp_node
@@ -377,6 +381,49 @@ xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_size_t usize = data->blksz;
+  char *out = outbuf;
+  grub_size_t outsize = len;
+  grub_size_t ret;
+
+  if (usize < SQUASH_CHUNK_SIZE)
+    usize = SQUASH_CHUNK_SIZE;
+
+  /* Frames are decoded whole, so go through a buffer unless all of this
+     one is wanted.  */
+  if (off || ZSTD_getFrameContentSize (inbuf, insize) > len)
+    {
+      if (!data->zstdbuf)
+	{
+	  data->zstdbuf = grub_malloc (usize);
+	  if (!data->zstdbuf)
+	    return -1;
+	}
+      out = data->zstdbuf;
+      outsize = usize;
+    }
+
+  ret = ZSTD_decompressDCtx (data->zstd, out, outsize, inbuf, insize);
+  if (ZSTD_isError (ret))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid zstd chunk");
+      return -1;
+    }
+  if (out == outbuf)
+    return ret;
+  if (ret <= off)
+    return 0;
+  ret -= off;
+  if (ret > len)
+    ret = len;
+  grub_memcpy (outbuf, out + off, ret);
+  return ret;
+}
+
 static struct grub_squash_data *
 squash_mount (grub_disk_t disk)
 {
@@ -439,6 +486,15 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      data->decompress = zstd_decompress;
+      data->zstd = ZSTD_createDCtx ();
+      if (!data->zstd)
+	{
+	  grub_free (data);
+	  return NULL;
+	}
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -631,6 +687,8 @@ squash_unmount (struct grub_squash_data *data)
   if (data->xzdec)
     xz_dec_end (data->xzdec);
   grub_free (data->xzbuf);
+  ZSTD_freeDCtx (data->zstd);
+  grub_free (data->zstdbuf);
   grub_free (data->ino.cumulated_block_sizes);
   grub_free (data->ino.block_sizes);
   grub_free (data);
@@ -992,6 +1050,12 @@ grub_squash_mtime (grub_device_t dev, grub_int32_t *tm)
   return GRUB_ERR_NONE;
 } 
 
+static const struct grub_fs_signature grub_squash_signatures[] =
+  {
+    { 0, 4, "hsqs" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_squash_fs =
   {
     .name = "squash4",
@@ -1000,6 +1064,7 @@ static struct grub_fs grub_squash_fs =
     .read = grub_squash_read,
     .close = grub_squash_close,
     .mtime = grub_squash_mtime,
+    .signatures = grub_squash_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 0,
     .blocklist_install = 0,
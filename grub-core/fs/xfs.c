@@ -500,13 +500,20 @@ get_fsb (const void *keys, int idx)
   return grub_be_to_cpu64 (grub_get_unaligned64 (p));
 }
 
-static grub_disk_addr_t
-grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+/* Map FILEBLOCK of NODE to the run of disk blocks *START, *COUNT,
+   *START being 0 for a hole.  */
+static grub_err_t
+grub_xfs_read_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		      grub_disk_addr_t *start, grub_disk_addr_t *count)
 {
   struct grub_xfs_btree_node *leaf = 0;
   int ex, nrec;
   struct grub_xfs_extent *exts;
-  grub_uint64_t ret = 0;
+
+  *start = 0;
+  /* Past the last extent the rest of the file is sparse, unless there
+     are more extents in another leaf.  */
+  *count = (grub_disk_addr_t) -1;
 
   if (node->inode.format == XFS_INODE_FORMAT_BTREE)
     {
@@ -516,7 +523,7 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
       leaf = grub_malloc (node->data->bsize);
       if (leaf == 0)
-        return 0;
+        return grub_errno;
 
       root = (struct grub_xfs_btree_root *) grub_xfs_inode_data(&node->inode);
       nrec = grub_be_to_cpu16 (root->numrecs);
@@ -540,14 +547,18 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
           /* Sparse block.  */
           if (i == 0)
             {
+              *count = get_fsb (keys, 0) - fileblock;
               grub_free (leaf);
-              return 0;
+              return GRUB_ERR_NONE;
             }
 
           if (grub_disk_read (node->data->disk,
                               GRUB_XFS_FSB_TO_BLOCK (node->data, get_fsb (keys, i - 1 + recoffset)) << (node->data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
                               0, node->data->bsize, leaf))
-            return 0;
+            {
+              grub_free (leaf);
+              return grub_errno;
+            }
 
 	  if ((!node->data->hascrc &&
 	       grub_strncmp ((char *) leaf->magic, "BMAP", 4)) ||
@@ -555,8 +566,7 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 	       grub_strncmp ((char *) leaf->magic, "BMA3", 4)))
             {
               grub_free (leaf);
-              grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
-              return 0;
+              return grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
             }
 
           nrec = grub_be_to_cpu16 (leaf->numrecs);
@@ -567,6 +577,7 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 	}
       while (leaf->level);
       exts = (struct grub_xfs_extent *) keys;
+      *count = 1;
     }
   else if (node->inode.format == XFS_INODE_FORMAT_EXT)
     {
@@ -575,33 +586,39 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
     }
   else
     {
-      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
-		  "XFS does not support inode format %d yet",
-		  node->inode.format);
-      return 0;
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 "XFS does not support inode format %d yet",
+			 node->inode.format);
     }
 
   /* Iterate over each extent to figure out which extent has
      the block we are looking for.  */
   for (ex = 0; ex < nrec; ex++)
     {
-      grub_uint64_t start = GRUB_XFS_EXTENT_BLOCK (exts, ex);
+      grub_uint64_t start_fsb = GRUB_XFS_EXTENT_BLOCK (exts, ex);
       grub_uint64_t offset = GRUB_XFS_EXTENT_OFFSET (exts, ex);
       grub_uint64_t size = GRUB_XFS_EXTENT_SIZE (exts, ex);
 
       /* Sparse block.  */
       if (fileblock < offset)
-        break;
+        {
+          *count = offset - fileblock;
+          break;
+        }
       else if (fileblock < offset + size)
         {
-          ret = (fileblock - offset + start);
+          /* An extent never crosses an AG boundary, so it is contiguous
+             on disk as well.  */
+          *start = GRUB_XFS_FSB_TO_BLOCK (node->data,
+                                          fileblock - offset + start_fsb);
+          *count = offset + size - fileblock;
           break;
         }
     }
 
   grub_free (leaf);
 
-  return GRUB_XFS_FSB_TO_BLOCK(node->data, ret);
+  return GRUB_ERR_NONE;
 }
 
 
@@ -612,12 +629,13 @@ grub_xfs_read_file (grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t pos, grub_size_t len, char *buf, grub_uint32_t header_size)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_xfs_read_block,
-				grub_be_to_cpu64 (node->inode.size) + header_size,
-				node->data->sblock.log2_bsize
-				- GRUB_DISK_SECTOR_BITS, 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_xfs_read_extent,
+					grub_be_to_cpu64 (node->inode.size)
+					+ header_size,
+					node->data->sblock.log2_bsize
+					- GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
@@ -1122,6 +1140,12 @@ grub_xfs_uuid (grub_device_t device, char **uuid)
 
 
 
+static const struct grub_fs_signature grub_xfs_signatures[] =
+  {
+    { 0, 4, "XFSB" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_xfs_fs =
   {
     .name = "xfs",
@@ -1131,6 +1155,7 @@ static struct grub_fs grub_xfs_fs =
     .close = grub_xfs_close,
     .label = grub_xfs_label,
     .uuid = grub_xfs_uuid,
+    .signatures = grub_xfs_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 0,
     .blocklist_install = 1,
@@ -76,6 +76,8 @@ GRUB_MOD_LICENSE ("GPLv3+");
 static grub_dl_t my_mod;
 #endif
 
+static struct grub_fs grub_zfs_fs;
+
 #define	P2PHASE(x, align)		((x) & ((align) - 1))
 
 static inline grub_disk_addr_t
@@ -154,13 +156,16 @@ ZAP_LEAF_ENTRY(zap_leaf_phys_t *l, int bs, int idx)
 
 
 /*
- * Decompression Entry - lzjb & lz4
+ * Decompression Entry - lzjb, lz4 & zstd
  */
 
 extern grub_err_t lzjb_decompress (void *, void *, grub_size_t, grub_size_t);
 
 extern grub_err_t lz4_decompress (void *, void *, grub_size_t, grub_size_t);
 
+extern grub_err_t zstd_decompress (void *, void *, grub_size_t, grub_size_t);
+extern void zstd_fini (void);
+
 typedef grub_err_t zfs_decomp_func_t (void *s_start, void *d_start,
 				      grub_size_t s_len, grub_size_t d_len);
 typedef struct decomp_entry
@@ -227,6 +232,31 @@ struct subvolume
   } *keyring;
 };
 
+/* Limits of the block cache.  */
+#define ZFS_BLOCK_CACHE_ENTRIES 64
+#define ZFS_BLOCK_CACHE_BYTES (4 << 20)
+
+/* A block in the block cache, valid when BUF isn't NULL.  Blocks are
+   never overwritten in place, so the first DVA together with the birth
+   txg identifies the contents.  */
+struct zfs_cached_block
+{
+  dva_t dva;
+  grub_uint64_t birth;
+  grub_uint64_t stamp;
+  grub_size_t size;
+  void *buf;
+};
+
+/* Decompressed, verified and decrypted metadata blocks, kept in the
+   mount cache across mounts from the same device.  */
+struct zfs_block_cache
+{
+  struct zfs_cached_block blocks[ZFS_BLOCK_CACHE_ENTRIES];
+  grub_size_t total;
+  grub_uint64_t stamp;
+};
+
 struct grub_zfs_data
 {
   /* cache for a file block of the currently zfs_open()-ed file */
@@ -253,6 +283,8 @@ struct grub_zfs_data
   uberblock_t current_uberblock;
 
   grub_uint64_t guid;
+
+  struct zfs_block_cache *block_cache;
 };
 
 /* Context for grub_zfs_dir.  */
@@ -285,6 +317,7 @@ static const char *spa_feature_names[] = {
   "com.delphix:embedded_data",
   "com.delphix:extensible_dataset",
   "org.open-zfs:large_blocks",
+  "org.freebsd:zstd_compress",
   NULL
 };
 
@@ -356,6 +389,7 @@ static decomp_entry_t decomp_table[ZIO_COMPRESS_FUNCTIONS] = {
   {"gzip-9", zlib_decompress},  /* ZIO_COMPRESS_GZIP9 */
   {"zle", zle_decompress},      /* ZIO_COMPRESS_ZLE   */
   {"lz4", lz4_decompress},      /* ZIO_COMPRESS_LZ4   */
+  {"zstd", zstd_decompress},    /* ZIO_COMPRESS_ZSTD  */
 };
 
 static grub_err_t zio_read_data (blkptr_t * bp, grub_zfs_endian_t endian,
@@ -1843,8 +1877,8 @@ decode_embedded_bp_compressed(const blkptr_t *bp, void *buf)
  * and put the uncompressed data in buf.
  */
 static grub_err_t
-zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf, 
-	  grub_size_t *size, struct grub_zfs_data *data)
+zio_read_block (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
+		grub_size_t *size, struct grub_zfs_data *data)
 {
   grub_size_t lsize, psize;
   unsigned int comp, encrypted;
@@ -1995,6 +2029,121 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   return GRUB_ERR_NONE;
 }
 
+static void
+zfs_free_block_cache (void *mount)
+{
+  struct zfs_block_cache *cache = mount;
+  unsigned i;
+
+  for (i = 0; i < ZFS_BLOCK_CACHE_ENTRIES; i++)
+    grub_free (cache->blocks[i].buf);
+  grub_free (cache);
+}
+
+/* Whether the block BP points to goes through the block cache.  File
+   data is usually read once and grub_zfs_read keeps the last block
+   anyway, so only indirect blocks and metadata are cached.  */
+static int
+zio_cacheable (blkptr_t *bp, grub_zfs_endian_t endian,
+	       struct grub_zfs_data *data)
+{
+  grub_uint64_t prop = grub_zfs_to_cpu64 (bp->blk_prop, endian);
+
+  if (!data->block_cache || BP_IS_EMBEDDED (bp) || BP_IS_HOLE (bp))
+    return 0;
+  return ((prop >> 56) & 0x1f) != 0
+    || ((prop >> 48) & 0xff) != DMU_OT_PLAIN_FILE_CONTENTS;
+}
+
+/* Return in *BUF the cacheable block BP points to, reading it into the
+   block cache first if it isn't there.  The buffer belongs to the cache
+   and is only valid until the next read.  */
+static grub_err_t
+zio_read_cached (blkptr_t *bp, grub_zfs_endian_t endian, const void **buf,
+		 grub_size_t *size, struct grub_zfs_data *data)
+{
+  struct zfs_block_cache *cache = data->block_cache;
+  struct zfs_cached_block *slot, *lru;
+  void *block;
+  grub_size_t lsize;
+  grub_err_t err;
+  unsigned i;
+
+  for (i = 0; i < ZFS_BLOCK_CACHE_ENTRIES; i++)
+    if (cache->blocks[i].buf && cache->blocks[i].birth == bp->blk_birth
+	&& grub_memcmp (&cache->blocks[i].dva, &bp->blk_dva[0],
+			sizeof (dva_t)) == 0)
+      {
+	cache->blocks[i].stamp = ++cache->stamp;
+	*buf = cache->blocks[i].buf;
+	if (size)
+	  *size = cache->blocks[i].size;
+	return GRUB_ERR_NONE;
+      }
+
+  err = zio_read_block (bp, endian, &block, &lsize, data);
+  if (err)
+    return err;
+
+  /* Drop the least recently used blocks until there is room.  */
+  while (1)
+    {
+      slot = lru = NULL;
+      for (i = 0; i < ZFS_BLOCK_CACHE_ENTRIES; i++)
+	if (!cache->blocks[i].buf)
+	  {
+	    if (!slot)
+	      slot = &cache->blocks[i];
+	  }
+	else if (!lru || cache->blocks[i].stamp < lru->stamp)
+	  lru = &cache->blocks[i];
+      if (slot && (!lru || cache->total + lsize <= ZFS_BLOCK_CACHE_BYTES))
+	break;
+      cache->total -= lru->size;
+      grub_free (lru->buf);
+      lru->buf = NULL;
+    }
+
+  slot->dva = bp->blk_dva[0];
+  slot->birth = bp->blk_birth;
+  slot->stamp = ++cache->stamp;
+  slot->size = lsize;
+  slot->buf = block;
+  cache->total += lsize;
+
+  *buf = block;
+  if (size)
+    *size = lsize;
+  return GRUB_ERR_NONE;
+}
+
+/*
+ * Read in a block and return it in a new buffer in *BUF.
+ */
+static grub_err_t
+zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
+	  grub_size_t *size, struct grub_zfs_data *data)
+{
+  const void *cached;
+  grub_size_t lsize;
+  grub_err_t err;
+
+  if (!zio_cacheable (bp, endian, data))
+    return zio_read_block (bp, endian, buf, size, data);
+
+  *buf = NULL;
+  err = zio_read_cached (bp, endian, &cached, &lsize, data);
+  if (err)
+    return err;
+  *buf = grub_malloc (lsize);
+  if (!*buf)
+    return grub_errno;
+  grub_memcpy (*buf, cached, lsize);
+  if (size)
+    *size = lsize;
+  return GRUB_ERR_NONE;
+}
+
 /*
  * Get the block from a block id.
  * push the block onto the stack.
@@ -2006,10 +2155,11 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
 {
   int level;
   grub_off_t idx;
-  blkptr_t *bp_array = dn->dn.dn_blkptr;
+  const blkptr_t *bp_array = dn->dn.dn_blkptr;
   int epbs = dn->dn.dn_indblkshift - SPA_BLKPTRSHIFT;
   blkptr_t *bp;
   void *tmpbuf = 0;
+  const void *cached;
   grub_zfs_endian_t endian;
   grub_err_t err = GRUB_ERR_NONE;
 
@@ -2023,11 +2173,8 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
       grub_dprintf ("zfs", "endian = %d\n", endian);
       idx = (blkid >> (epbs * level)) & ((1 << epbs) - 1);
       *bp = bp_array[idx];
-      if (bp_array != dn->dn.dn_blkptr)
-	{
-	  grub_free (bp_array);
-	  bp_array = 0;
-	}
+      grub_free (tmpbuf);
+      tmpbuf = 0;
 
       if (BP_IS_HOLE (bp))
 	{
@@ -2052,14 +2199,23 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
 	  break;
 	}
       grub_dprintf ("zfs", "endian = %d\n", endian);
-      err = zio_read (bp, endian, &tmpbuf, 0, data);
+      /* Indirect blocks are used straight from the block cache, so
+	 sequential reads only fetch each of them once.  */
+      if (zio_cacheable (bp, endian, data))
+	{
+	  err = zio_read_cached (bp, endian, &cached, 0, data);
+	  bp_array = cached;
+	}
+      else
+	{
+	  err = zio_read (bp, endian, &tmpbuf, 0, data);
+	  bp_array = tmpbuf;
+	}
       endian = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
       if (err)
 	break;
-      bp_array = tmpbuf;
     }
-  if (bp_array != dn->dn.dn_blkptr)
-    grub_free (bp_array);
+  grub_free (tmpbuf);
   if (endian_out)
     *endian_out = endian;
 
@@ -3600,6 +3756,9 @@ zfs_unmount (struct grub_zfs_data *data)
   for (i = 0; i < data->subvol.nkeys; i++)
     grub_crypto_cipher_close (data->subvol.keyring[i].cipher);
   grub_free (data->subvol.keyring);
+  if (data->block_cache
+      && !grub_fs_mount_cache_release (data->block_cache))
+    zfs_free_block_cache (data->block_cache);
   grub_free (data);
 }
 
@@ -3628,6 +3787,16 @@ zfs_mount (grub_device_t dev)
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return 0;
+
+  /* Without a block cache everything is read from disk.  */
+  data->block_cache = grub_fs_mount_cache_get (&grub_zfs_fs, dev->disk);
+  if (!data->block_cache)
+    {
+      data->block_cache = grub_zalloc (sizeof (*data->block_cache));
+      if (data->block_cache)
+	grub_fs_mount_cache_put (&grub_zfs_fs, dev->disk, data->block_cache);
+      grub_errno = GRUB_ERR_NONE;
+    }
 #if 0
   /* if it's our first time here, zero the best uberblock out */
   if (data->best_drive == 0 && data->best_part == 0 && find_best_root)
@@ -4355,6 +4524,7 @@ static struct grub_fs grub_zfs_fs = {
   .label = zfs_label,
   .uuid = zfs_uuid,
   .mtime = zfs_mtime,
+  .unmount = zfs_free_block_cache,
 #ifdef GRUB_UTIL
   .embed = grub_zfs_embed,
   .reserved_first_sector = 1,
@@ -4375,4 +4545,5 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  zstd_fini ();
 }
@@ -38,6 +38,12 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 
+#ifdef GRUB_CPU_WORDS_BIGENDIAN
+#define GRUB_ZFS_NATIVE_ENDIAN GRUB_ZFS_BIG_ENDIAN
+#else
+#define GRUB_ZFS_NATIVE_ENDIAN GRUB_ZFS_LITTLE_ENDIAN
+#endif
+
 void
 fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	   zio_cksum_t *zcp)
@@ -45,14 +51,24 @@ fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   const grub_uint64_t *ip = buf;
   const grub_uint64_t *ipend = ip + (size / sizeof (grub_uint64_t));
   grub_uint64_t a0, b0, a1, b1;
-  
-  for (a0 = b0 = a1 = b1 = 0; ip < ipend; ip += 2) 
-    {
-      a0 += grub_zfs_to_cpu64 (ip[0], endian);
-      a1 += grub_zfs_to_cpu64 (ip[1], endian);
-      b0 += a0;
-      b1 += a1;
-    }
+
+  a0 = b0 = a1 = b1 = 0;
+  if (endian == GRUB_ZFS_NATIVE_ENDIAN)
+    for (; ip < ipend; ip += 2)
+      {
+	a0 += ip[0];
+	a1 += ip[1];
+	b0 += a0;
+	b1 += a1;
+      }
+  else
+    for (; ip < ipend; ip += 2)
+      {
+	a0 += grub_swap_bytes64 (ip[0]);
+	a1 += grub_swap_bytes64 (ip[1]);
+	b0 += a0;
+	b1 += a1;
+      }
 
   zcp->zc_word[0] = grub_cpu_to_zfs64 (a0, endian);
   zcp->zc_word[1] = grub_cpu_to_zfs64 (a1, endian);
@@ -60,20 +76,46 @@ fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[3] = grub_cpu_to_zfs64 (b1, endian);
 }
 
+#define FLETCHER_4_STEP(x) \
+  do { a += (x); b += a; c += b; d += c; } while (0)
+
+/* The sums form a single dependency chain, so unlike with vector
+   registers, splitting them into interleaved lanes doesn't pay off.
+   What does is keeping the byte order test out of the loop and
+   unrolling it.  */
 void
 fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	    zio_cksum_t *zcp)
 {
   const grub_uint32_t *ip = buf;
   const grub_uint32_t *ipend = ip + (size / sizeof (grub_uint32_t));
+  const grub_uint32_t *ipend4 = ip + (size / (4 * sizeof (grub_uint32_t))) * 4;
   grub_uint64_t a, b, c, d;
-  
-  for (a = b = c = d = 0; ip < ipend; ip++) 
+
+  a = b = c = d = 0;
+  if (endian == GRUB_ZFS_NATIVE_ENDIAN)
+    {
+      for (; ip < ipend4; ip += 4)
+	{
+	  FLETCHER_4_STEP (ip[0]);
+	  FLETCHER_4_STEP (ip[1]);
+	  FLETCHER_4_STEP (ip[2]);
+	  FLETCHER_4_STEP (ip[3]);
+	}
+      for (; ip < ipend; ip++)
+	FLETCHER_4_STEP (ip[0]);
+    }
+  else
     {
-      a += grub_zfs_to_cpu32 (ip[0], endian);;
-      b += a;
-      c += b;
-      d += c;
+      for (; ip < ipend4; ip += 4)
+	{
+	  FLETCHER_4_STEP (grub_swap_bytes32 (ip[0]));
+	  FLETCHER_4_STEP (grub_swap_bytes32 (ip[1]));
+	  FLETCHER_4_STEP (grub_swap_bytes32 (ip[2]));
+	  FLETCHER_4_STEP (grub_swap_bytes32 (ip[3]));
+	}
+      for (; ip < ipend; ip++)
+	FLETCHER_4_STEP (grub_swap_bytes32 (ip[0]));
     }
 
   zcp->zc_word[0] = grub_cpu_to_zfs64 (a, endian);
@@ -81,4 +123,3 @@ fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[2] = grub_cpu_to_zfs64 (c, endian);
   zcp->zc_word[3] = grub_cpu_to_zfs64 (d, endian);
 }
-
@@ -42,8 +42,10 @@
  * SHA-256 checksum, as specified in FIPS 180-2, available at:
  * http://csrc.nist.gov/cryptval
  *
- * This is a very compact implementation of SHA-256.
- * It is designed to be simple and portable, not to be fast.
+ * This is a compact and portable implementation of SHA-256.  The rounds
+ * are unrolled eight at a time so that the working variables rotate by
+ * renaming instead of by copying, and the message schedule is kept in
+ * a 16-word ring, which matters when verifying every block read.
  */
 
 /*
@@ -81,27 +83,44 @@ static const grub_uint32_t SHA256_K[64] = {
 	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
+#define	W16(t)	(W[(t) & 15] += sigma1(W[((t) - 2) & 15]) + \
+	    W[((t) - 7) & 15] + sigma0(W[((t) - 15) & 15]))
+
+#define	ROUND(a, b, c, d, e, f, g, h, t, w) do {			\
+		grub_uint32_t T1 = (h) + SIGMA1(e) + Ch(e, f, g) +	\
+		    SHA256_K[t] + (w);					\
+		(d) += T1;						\
+		(h) = T1 + SIGMA0(a) + Maj(a, b, c);			\
+	} while (0)
+
+#define	ROUNDS8(t, w) do {						\
+		ROUND(a, b, c, d, e, f, g, h, (t), w((t)));		\
+		ROUND(h, a, b, c, d, e, f, g, (t) + 1, w((t) + 1));	\
+		ROUND(g, h, a, b, c, d, e, f, (t) + 2, w((t) + 2));	\
+		ROUND(f, g, h, a, b, c, d, e, (t) + 3, w((t) + 3));	\
+		ROUND(e, f, g, h, a, b, c, d, (t) + 4, w((t) + 4));	\
+		ROUND(d, e, f, g, h, a, b, c, (t) + 5, w((t) + 5));	\
+		ROUND(c, d, e, f, g, h, a, b, (t) + 6, w((t) + 6));	\
+		ROUND(b, c, d, e, f, g, h, a, (t) + 7, w((t) + 7));	\
+	} while (0)
+
+#define	W0(t)	(W[(t)])
+
 static void
 SHA256Transform(grub_uint32_t *H, const grub_uint8_t *cp)
 {
-	grub_uint32_t a, b, c, d, e, f, g, h, t, T1, T2, W[64];
+	grub_uint32_t a, b, c, d, e, f, g, h, t, W[16];
 
 	for (t = 0; t < 16; t++, cp += 4)
-		W[t] = (cp[0] << 24) | (cp[1] << 16) | (cp[2] << 8) | cp[3];
-
-	for (t = 16; t < 64; t++)
-		W[t] = sigma1(W[t - 2]) + W[t - 7] +
-		    sigma0(W[t - 15]) + W[t - 16];
+		W[t] = grub_be_to_cpu32(grub_get_unaligned32(cp));
 
 	a = H[0]; b = H[1]; c = H[2]; d = H[3];
 	e = H[4]; f = H[5]; g = H[6]; h = H[7];
 
-	for (t = 0; t < 64; t++) {
-		T1 = h + SIGMA1(e) + Ch(e, f, g) + SHA256_K[t] + W[t];
-		T2 = SIGMA0(a) + Maj(a, b, c);
-		h = g; g = f; f = e; e = d + T1;
-		d = c; c = b; b = a; a = T1 + T2;
-	}
+	ROUNDS8(0, W0);
+	ROUNDS8(8, W0);
+	for (t = 16; t < 64; t += 8)
+		ROUNDS8(t, W16);
 
 	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
 	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
@@ -121,7 +140,7 @@ zio_checksum_SHA256(const void *buf, grub_uint64_t size,
     SHA256Transform(H, (grub_uint8_t *)buf + i);
   
   for (i = 0; i < padsize; i++)
-    pad[i] = ((grub_uint8_t *)buf)[i];
+    pad[i] = ((grub_uint8_t *)buf)[size - padsize + i];
   
   for (pad[padsize++] = 0x80; (padsize & 63) != 56; padsize++)
     pad[padsize] = 0;
@@ -0,0 +1,87 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/types.h>
+
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+/*
+ * ZFS stores zstd blocks as a magicless frame behind a header giving
+ * the length of the frame and the version and level it was made with,
+ * both as big endian 32-bit numbers.
+ */
+struct zfs_zstd_header
+{
+  grub_uint32_t c_len;
+  grub_uint32_t raw_version_level;
+} GRUB_PACKED;
+
+/* The context is big, so it's kept for all blocks until zfs goes away.  */
+static ZSTD_DCtx *zfs_zstd_dctx;
+
+grub_err_t
+zstd_decompress (void *s_start, void *d_start, grub_size_t s_len,
+		 grub_size_t d_len);
+void
+zstd_fini (void);
+
+grub_err_t
+zstd_decompress (void *s_start, void *d_start, grub_size_t s_len,
+		 grub_size_t d_len)
+{
+  const struct zfs_zstd_header *hdr = s_start;
+  grub_size_t c_len, ret;
+
+  if (s_len < sizeof (*hdr))
+    return grub_error (GRUB_ERR_BAD_FS, "zstd decompression failed");
+  c_len = grub_be_to_cpu32 (hdr->c_len);
+  if (c_len > s_len - sizeof (*hdr))
+    return grub_error (GRUB_ERR_BAD_FS, "zstd decompression failed");
+
+  if (!zfs_zstd_dctx)
+    {
+      zfs_zstd_dctx = ZSTD_createDCtx ();
+      if (!zfs_zstd_dctx)
+	return grub_errno;
+      if (ZSTD_isError (ZSTD_DCtx_setParameter (zfs_zstd_dctx, ZSTD_d_format,
+						ZSTD_f_zstd1_magicless)))
+	{
+	  ZSTD_freeDCtx (zfs_zstd_dctx);
+	  zfs_zstd_dctx = NULL;
+	  return grub_error (GRUB_ERR_BUG, "couldn't set up zstd");
+	}
+    }
+
+  ret = ZSTD_decompressDCtx (zfs_zstd_dctx, d_start, d_len, hdr + 1, c_len);
+  if (ZSTD_isError (ret))
+    return grub_error (GRUB_ERR_BAD_FS, "zstd decompression failed");
+  if (ret < d_len)
+    grub_memset ((grub_uint8_t *) d_start + ret, 0, d_len - ret);
+  return GRUB_ERR_NONE;
+}
+
+void
+zstd_fini (void)
+{
+  ZSTD_freeDCtx (zfs_zstd_dctx);
+  zfs_zstd_dctx = NULL;
+}
@@ -263,7 +263,7 @@ to_loading_picture (animation_class_t vself, const char *dir,
   *pstr = '\0';
 
   struct grub_video_bitmap *original_bitmap;
-  grub_video_bitmap_load (&original_bitmap, path);
+  grub_video_bitmap_load_cached (&original_bitmap, path);
   grub_free (path);
   grub_errno = GRUB_ERR_NONE;
 
@@ -41,10 +41,10 @@ grub_font_draw_string (const char *str, grub_font_t font,
                        grub_video_color_t color,
                        int left_x, int baseline_y)
 {
-  int x;
   grub_uint32_t *logical;
   grub_ssize_t logical_len, visual_len;
   struct grub_unicode_glyph *visual, *ptr;
+  grub_err_t err;
 
   logical_len = grub_utf8_to_ucs4_alloc (str, &logical, 0);
   if (logical_len < 0)
@@ -56,24 +56,16 @@ grub_font_draw_string (const char *str, grub_font_t font,
   if (visual_len < 0)
     return grub_errno;
 
-  for (ptr = visual, x = left_x; ptr < visual + visual_len; ptr++)
-    {
-      grub_err_t err;
-      struct grub_font_glyph *glyph;
-      glyph = grub_font_construct_glyph (font, ptr);
-      if (!glyph)
-	return grub_errno;
-      err = grub_font_draw_glyph (glyph, color, x, baseline_y);
-      x += glyph->device_width;
-      if (err)
-	return err;
-    }
+  /* Draw the whole string at once, so that runs of glyphs are blitted
+     together.  */
+  err = grub_font_draw_glyphs (font, visual, visual_len, color,
+			       left_x, baseline_y);
 
   for (ptr = visual; ptr < visual + visual_len; ptr++)
     grub_unicode_destroy_glyph (ptr);
   grub_free (visual);
 
-  return GRUB_ERR_NONE;
+  return err;
 }
 
 /* Get the width in pixels of the specified UTF-8 string, when rendered in
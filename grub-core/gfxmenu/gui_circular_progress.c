@@ -88,7 +88,7 @@ load_bitmap (const char *dir, const char *file)
 
   /* Load the image.  */
   grub_errno = GRUB_ERR_NONE;
-  grub_video_bitmap_load (&bitmap, abspath);
+  grub_video_bitmap_load_cached (&bitmap, abspath);
   grub_errno = GRUB_ERR_NONE;
 
   grub_free (abspath);
@@ -191,7 +191,7 @@ static grub_err_t
 load_image (grub_gui_image_t self, const char *path)
 {
   struct grub_video_bitmap *bitmap;
-  if (grub_video_bitmap_load (&bitmap, path) != GRUB_ERR_NONE)
+  if (grub_video_bitmap_load_cached (&bitmap, path) != GRUB_ERR_NONE)
     return grub_errno;
 
   if (self->bitmap && (self->bitmap != self->raw_bitmap))
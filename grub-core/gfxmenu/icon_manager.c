@@ -152,7 +152,7 @@ try_loading_icon (grub_gfxmenu_icon_manager_t mgr,
   *ptr = '\0';
 
   struct grub_video_bitmap *raw_bitmap;
-  grub_video_bitmap_load (&raw_bitmap, path);
+  grub_video_bitmap_load_cached (&raw_bitmap, path);
   grub_free (path);
   grub_errno = GRUB_ERR_NONE;  /* Critical to clear the error!!  */
   if (! raw_bitmap)
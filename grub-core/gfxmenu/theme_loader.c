@@ -169,7 +169,7 @@ theme_set_string (grub_gfxmenu_view_t view,
       path = grub_resolve_relative_path (theme_dir, value);
       if (! path)
         return grub_errno;
-      if (grub_video_bitmap_load (&raw_bitmap, path) != GRUB_ERR_NONE)
+      if (grub_video_bitmap_load_cached (&raw_bitmap, path) != GRUB_ERR_NONE)
         {
           grub_free (path);
           return grub_errno;
@@ -335,7 +335,7 @@ grub_gfxmenu_create_box (const char *pixmaps_prefix,
           path_end = grub_stpcpy (path_end, box_pixmap_names[i]);
           path_end = grub_stpcpy (path_end, pixmaps_suffix);
 
-          grub_video_bitmap_load (&box->raw_pixmaps[i], path);
+          grub_video_bitmap_load_cached (&box->raw_pixmaps[i], path);
           grub_free (path);
 
           /* Ignore missing pixmaps.  */
@@ -0,0 +1,316 @@
+/* zstdio.c - decompression support for zstd */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+#define ZSTDBUFSIZ 0x8000
+#define ZSTD_BLOCK_HEADER_SIZE 3
+#define ZSTD_CHECKSUM_SIZE 4
+
+enum
+  {
+    ZSTD_BLOCK_RAW,
+    ZSTD_BLOCK_RLE,
+    ZSTD_BLOCK_COMPRESSED,
+    ZSTD_BLOCK_RESERVED
+  };
+
+struct grub_zstdio
+{
+  grub_file_t file;
+  ZSTD_DCtx *dctx;
+  ZSTD_inBuffer in;
+  grub_uint8_t inbuf[ZSTDBUFSIZ];
+  grub_uint8_t outbuf[ZSTDBUFSIZ];
+  grub_off_t saved_offset;
+  /* Whether the decoder stopped at the end of a frame.  */
+  int frame_end;
+};
+
+typedef struct grub_zstdio *grub_zstdio_t;
+static struct grub_fs grub_zstdio_fs;
+
+/* Walk the frames of the compressed file, skipping over their blocks,
+   to add up the sizes they decompress to.  Return 0 if the file isn't
+   made of zstd frames, or 1 with FILE->size set, left unknown if some
+   frame doesn't record its size.  */
+static int
+scan_frames (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+  grub_uint8_t hdr[ZSTD_FRAMEHEADERSIZE_MAX];
+  grub_uint64_t size = 0;
+  grub_off_t pos = 0;
+  grub_off_t end = grub_file_size (zstdio->file);
+  int nframes = 0;
+
+  if (end == GRUB_FILE_SIZE_UNKNOWN)
+    return 0;
+
+  while (pos < end)
+    {
+      ZSTD_FrameHeader zfh;
+      grub_ssize_t got;
+
+      grub_file_seek (zstdio->file, pos);
+      got = grub_file_read (zstdio->file, hdr, sizeof (hdr));
+      if (got <= 0
+	  || ZSTD_getFrameHeader (&zfh, hdr, got) != 0)
+	return 0;
+
+      if (zfh.frameType == ZSTD_skippableFrame)
+	{
+	  pos += ZSTD_SKIPPABLEHEADERSIZE + zfh.frameContentSize;
+	  continue;
+	}
+
+      if (zfh.frameContentSize == ZSTD_CONTENTSIZE_UNKNOWN)
+	size = GRUB_FILE_SIZE_UNKNOWN;
+      else if (size != GRUB_FILE_SIZE_UNKNOWN)
+	size += zfh.frameContentSize;
+
+      pos += zfh.headerSize;
+      while (1)
+	{
+	  grub_uint8_t bh[ZSTD_BLOCK_HEADER_SIZE];
+	  grub_uint32_t h;
+	  unsigned type;
+
+	  grub_file_seek (zstdio->file, pos);
+	  if (grub_file_read (zstdio->file, bh, sizeof (bh)) != sizeof (bh))
+	    return 0;
+	  h = bh[0] | (bh[1] << 8) | ((grub_uint32_t) bh[2] << 16);
+	  type = (h >> 1) & 3;
+	  if (type == ZSTD_BLOCK_RESERVED)
+	    return 0;
+	  pos += sizeof (bh) + (type == ZSTD_BLOCK_RLE ? 1 : h >> 3);
+	  if (h & 1)
+	    break;
+	}
+      if (zfh.checksumFlag)
+	pos += ZSTD_CHECKSUM_SIZE;
+      nframes++;
+    }
+
+  if (pos != end || nframes == 0)
+    return 0;
+
+  file->size = size;
+  grub_file_seek (zstdio->file, 0);
+  return 1;
+}
+
+static grub_file_t
+grub_zstdio_open (grub_file_t io,
+		  const char *name __attribute__ ((unused)))
+{
+  grub_file_t file;
+  grub_zstdio_t zstdio;
+  grub_uint32_t magic;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+
+  /* Check the magic before allocating the large decoder state.  */
+  if (grub_file_read (io, &magic, sizeof (magic)) != sizeof (magic)
+      || (magic != grub_cpu_to_le32_compile_time (ZSTD_MAGICNUMBER)
+	  && (grub_le_to_cpu32 (magic) & ZSTD_MAGIC_SKIPPABLE_MASK)
+	  != ZSTD_MAGIC_SKIPPABLE_START))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  zstdio = grub_zalloc (sizeof (*zstdio));
+  if (!zstdio)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  zstdio->file = io;
+
+  file->device = io->device;
+  file->data = zstdio;
+  file->fs = &grub_zstdio_fs;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 1;
+
+  /* Walking the frames seeks all over the file, which costs more than
+     decoding it when the file is not easily seekable.  Such files are
+     taken on their magic, and their size is left unknown.  */
+  if (io->not_easily_seekable)
+    grub_file_seek (io, 0);
+  else if (!scan_frames (file))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      grub_free (zstdio);
+      grub_free (file);
+
+      return io;
+    }
+
+  zstdio->dctx = ZSTD_createDCtx ();
+  if (!zstdio->dctx)
+    {
+      grub_free (zstdio);
+      grub_free (file);
+      return 0;
+    }
+
+  zstdio->in.src = zstdio->inbuf;
+  zstdio->frame_end = 1;
+
+  return file;
+}
+
+static grub_ssize_t
+grub_zstdio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_ssize_t ret = 0;
+  grub_ssize_t readret;
+  grub_size_t zret;
+  grub_zstdio_t zstdio = file->data;
+  grub_off_t current_offset;
+  ZSTD_outBuffer out;
+  int eof;
+
+  /* If seek backward need to reset decoder and start from beginning of
+     file.  */
+  if (file->offset < zstdio->saved_offset)
+    {
+      ZSTD_DCtx_reset (zstdio->dctx, ZSTD_reset_session_only);
+      zstdio->saved_offset = 0;
+      zstdio->in.pos = 0;
+      zstdio->in.size = 0;
+      zstdio->frame_end = 1;
+      grub_file_seek (zstdio->file, 0);
+    }
+
+  current_offset = zstdio->saved_offset;
+
+  while (len > 0)
+    {
+      /* Data before FILE->offset is decoded into the internal buffer
+	 and dropped, the rest straight into BUF.  */
+      if (current_offset < file->offset)
+	{
+	  out.dst = zstdio->outbuf;
+	  out.size = file->offset - current_offset;
+	  if (out.size > ZSTDBUFSIZ)
+	    out.size = ZSTDBUFSIZ;
+	}
+      else
+	{
+	  out.dst = buf;
+	  out.size = len;
+	}
+      out.pos = 0;
+
+      /* Feed input.  */
+      eof = 0;
+      if (zstdio->in.pos == zstdio->in.size)
+	{
+	  readret = grub_file_read (zstdio->file, zstdio->inbuf, ZSTDBUFSIZ);
+	  if (readret < 0)
+	    return -1;
+	  zstdio->in.size = readret;
+	  zstdio->in.pos = 0;
+	  eof = (readret == 0);
+	  if (eof && zstdio->frame_end)
+	    break;
+	}
+
+      /* Without input the decoder may still have output to flush.  */
+      zret = ZSTD_decompressStream (zstdio->dctx, &out, &zstdio->in);
+      if (ZSTD_isError (zret) || (eof && out.pos == 0))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      N_("zstd file corrupted or unsupported options"));
+	  return -1;
+	}
+      zstdio->frame_end = (zret == 0);
+
+      if (out.dst == buf)
+	{
+	  len -= out.pos;
+	  buf += out.pos;
+	  ret += out.pos;
+	}
+      current_offset += out.pos;
+    }
+
+  zstdio->saved_offset = current_offset;
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_zstdio_close (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+
+  ZSTD_freeDCtx (zstdio->dctx);
+
+  grub_file_close (zstdio->file);
+  grub_free (zstdio);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_zstdio_fs = {
+  .name = "zstdio",
+  .dir = 0,
+  .open = 0,
+  .read = grub_zstdio_read,
+  .close = grub_zstdio_close,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (zstdio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_ZSTDIO, grub_zstdio_open);
+}
+
+GRUB_MOD_FINI (zstdio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_ZSTDIO);
+}
@@ -24,6 +24,7 @@
 #include <grub/misc.h>
 #include <grub/time.h>
 #include <grub/file.h>
+#include <grub/fs.h>
 #include <grub/i18n.h>
 
 #define	GRUB_CACHE_TIMEOUT	2
@@ -60,6 +61,9 @@ grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
+  /* Mounted filesystems are only as good as the cached disk contents.  */
+  grub_fs_cache_invalidate_all ();
+
   for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
@@ -38,9 +38,32 @@
    a multiplier of 4KB.  */
 #define MEMORY_MAP_SIZE	0x3000
 
-/* The minimum and maximum heap size for GRUB itself.  */
+/* The minimum and initial heap size for GRUB itself.  The heap grows
+   on demand beyond the initial size, see grub_efi_mm_add_regions.  */
 #define MIN_HEAP_SIZE	0x100000
-#define MAX_HEAP_SIZE	(1600 * 0x100000)
+#define DEFAULT_HEAP_SIZE	(16 * 0x100000)
+
+/* Regions added after startup, which are handed back to the firmware
+   before exiting boot services if they are empty by then.  The list
+   starts in a static array and moves to firmware pages when it outgrows
+   it; it cannot live on the heap, as it is extended while the heap is
+   being grown.  */
+#define INITIAL_ADDED_REGIONS	64
+
+struct added_region
+{
+  void *addr;
+  grub_efi_uint64_t pages;
+};
+
+static struct added_region initial_added_regions[INITIAL_ADDED_REGIONS];
+static struct added_region *added_regions = initial_added_regions;
+static grub_efi_uintn_t added_regions_pages;
+static int num_added_regions;
+static int max_added_regions = INITIAL_ADDED_REGIONS;
+static int heap_initialized;
+
+static void release_added_regions (void);
 
 static void *finish_mmap_buf = 0;
 static grub_efi_uintn_t finish_mmap_size = 0;
@@ -194,6 +217,8 @@ grub_efi_finish_boot_services (grub_efi_uintn_t *outbuf_size, void *outbuf,
 			   apple, sizeof (apple)) == 0);
 #endif
 
+  release_added_regions ();
+
   while (1)
     {
       if (grub_efi_get_memory_map (&finish_mmap_size, finish_mmap_buf, &finish_key,
@@ -392,29 +417,38 @@ filter_memory_map (grub_efi_memory_descriptor_t *memory_map,
   return filtered_desc;
 }
 
-/* Return the total number of pages.  */
-static grub_efi_uint64_t
-get_total_pages (grub_efi_memory_descriptor_t *memory_map,
-		 grub_efi_uintn_t desc_size,
-		 grub_efi_memory_descriptor_t *memory_map_end)
+/* Make room for twice as many added regions.  Return 0 if the firmware
+   has no pages for it.  */
+static int
+grow_added_regions (void)
 {
-  grub_efi_memory_descriptor_t *desc;
-  grub_efi_uint64_t total = 0;
+  struct added_region *regions;
+  grub_efi_uintn_t pages;
 
-  for (desc = memory_map;
-       desc < memory_map_end;
-       desc = NEXT_MEMORY_DESCRIPTOR (desc, desc_size))
-    total += desc->num_pages;
+  pages = BYTES_TO_PAGES (2 * max_added_regions * sizeof (*regions));
+  regions = grub_efi_allocate_pages (0, pages);
+  if (! regions)
+    return 0;
 
-  return total;
+  grub_memcpy (regions, added_regions,
+	       num_added_regions * sizeof (*regions));
+  if (added_regions_pages)
+    grub_efi_free_pages ((grub_addr_t) added_regions, added_regions_pages);
+
+  added_regions = regions;
+  added_regions_pages = pages;
+  max_added_regions = PAGES_TO_BYTES (pages) / sizeof (*regions);
+  return 1;
 }
 
-/* Add memory regions.  */
-static void
+/* Add memory regions.  Return the number of pages which could not be
+   allocated.  */
+static grub_efi_uint64_t
 add_memory_regions (grub_efi_memory_descriptor_t *memory_map,
 		    grub_efi_uintn_t desc_size,
 		    grub_efi_memory_descriptor_t *memory_map_end,
-		    grub_efi_uint64_t required_pages)
+		    grub_efi_uint64_t required_pages,
+		    unsigned int flags)
 {
   grub_efi_memory_descriptor_t *desc;
 
@@ -428,6 +462,10 @@ add_memory_regions (grub_efi_memory_descriptor_t *memory_map,
 
       start = desc->physical_start;
       pages = desc->num_pages;
+
+      if (pages < required_pages && (flags & GRUB_MM_ADD_REGION_CONSECUTIVE))
+	continue;
+
       if (pages > required_pages)
 	{
 	  start += PAGES_TO_BYTES (pages - required_pages);
@@ -436,19 +474,59 @@ add_memory_regions (grub_efi_memory_descriptor_t *memory_map,
 
       addr = grub_efi_allocate_pages (start, pages);
       if (! addr)
-	grub_fatal ("cannot allocate conventional memory %p with %u pages",
-		    (void *) ((grub_addr_t) start),
-		    (unsigned) pages);
+	{
+	  if (! heap_initialized)
+	    grub_fatal ("cannot allocate conventional memory %p with %u pages",
+			(void *) ((grub_addr_t) start),
+			(unsigned) pages);
+	  continue;
+	}
 
-      grub_mm_init_region (addr, PAGES_TO_BYTES (pages));
+      if (! heap_initialized)
+	grub_mm_init_region (addr, PAGES_TO_BYTES (pages));
+      else
+	{
+	  /* Regions are taken from the top of a descriptor, so a new one
+	     often ends where an earlier one starts.  Keep them apart, so
+	     that each can be removed by its own address.  */
+	  grub_mm_init_region_flags (addr, PAGES_TO_BYTES (pages),
+				     GRUB_MM_INIT_REGION_NO_MERGE);
+
+	  /* Without room to record it, the region simply stays in the
+	     heap.  */
+	  if (num_added_regions < max_added_regions
+	      || grow_added_regions ())
+	    {
+	      added_regions[num_added_regions].addr = addr;
+	      added_regions[num_added_regions].pages = pages;
+	      num_added_regions++;
+	    }
+	}
 
       required_pages -= pages;
       if (required_pages == 0)
 	break;
     }
 
-  if (required_pages > 0)
-    grub_fatal ("too little memory");
+  return required_pages;
+}
+
+/* Hand the regions added since startup which are completely free back to
+   the firmware.  */
+static void
+release_added_regions (void)
+{
+  int i, j;
+
+  for (i = 0, j = 0; i < num_added_regions; i++)
+    {
+      if (grub_mm_remove_region (added_regions[i].addr))
+	grub_efi_free_pages ((grub_addr_t) added_regions[i].addr,
+			     added_regions[i].pages);
+      else
+	added_regions[j++] = added_regions[i];
+    }
+  num_added_regions = j;
 }
 
 #if 0
@@ -472,24 +550,36 @@ print_memory_map (grub_efi_memory_descriptor_t *memory_map,
 }
 #endif
 
-void
-grub_efi_mm_init (void)
+/* Allocate at least BYTES of heap from the firmware.  This also serves as
+   the heap growth callback, so it reports failure through its return
+   value only and leaves grub_errno alone.  */
+static grub_err_t
+grub_efi_mm_add_regions (grub_size_t bytes, unsigned int flags)
 {
   grub_efi_memory_descriptor_t *memory_map;
   grub_efi_memory_descriptor_t *memory_map_end;
   grub_efi_memory_descriptor_t *filtered_memory_map;
   grub_efi_memory_descriptor_t *filtered_memory_map_end;
   grub_efi_uintn_t map_size;
+  grub_efi_uintn_t map_pages;
   grub_efi_uintn_t desc_size;
-  grub_efi_uint64_t total_pages;
   grub_efi_uint64_t required_pages;
+  grub_efi_uint64_t missing_pages;
   int mm_status;
 
+  /* The firmware cannot allocate anything any more.  */
+  if (grub_efi_is_finished)
+    return GRUB_ERR_OUT_OF_MEMORY;
+
   /* Prepare a memory region to store two memory maps.  */
-  memory_map = grub_efi_allocate_pages (0,
-					2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+  map_pages = 2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE);
+  memory_map = grub_efi_allocate_pages (0, map_pages);
   if (! memory_map)
-    grub_fatal ("cannot allocate memory");
+    {
+      if (! heap_initialized)
+	grub_fatal ("cannot allocate memory");
+      return GRUB_ERR_OUT_OF_MEMORY;
+    }
 
   /* Obtain descriptors for available memory.  */
   map_size = MEMORY_MAP_SIZE;
@@ -500,21 +590,31 @@ grub_efi_mm_init (void)
     {
       grub_efi_free_pages
 	((grub_efi_physical_address_t) ((grub_addr_t) memory_map),
-	 2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+	 map_pages);
 
       /* Freeing/allocating operations may increase memory map size.  */
       map_size += desc_size * 32;
 
-      memory_map = grub_efi_allocate_pages (0, 2 * BYTES_TO_PAGES (map_size));
+      map_pages = 2 * BYTES_TO_PAGES (map_size);
+      memory_map = grub_efi_allocate_pages (0, map_pages);
       if (! memory_map)
-	grub_fatal ("cannot allocate memory");
+	{
+	  if (! heap_initialized)
+	    grub_fatal ("cannot allocate memory");
+	  return GRUB_ERR_OUT_OF_MEMORY;
+	}
 
       mm_status = grub_efi_get_memory_map (&map_size, memory_map, 0,
 					   &desc_size, 0);
     }
 
   if (mm_status < 0)
-    grub_fatal ("cannot get memory map");
+    {
+      if (! heap_initialized)
+	grub_fatal ("cannot get memory map");
+      grub_efi_free_pages ((grub_addr_t) memory_map, map_pages);
+      return GRUB_ERR_IO;
+    }
 
   memory_map_end = NEXT_MEMORY_DESCRIPTOR (memory_map, map_size);
 
@@ -523,22 +623,16 @@ grub_efi_mm_init (void)
   filtered_memory_map_end = filter_memory_map (memory_map, filtered_memory_map,
 					       desc_size, memory_map_end);
 
-  /* By default, request a quarter of the available memory.  */
-  total_pages = get_total_pages (filtered_memory_map, desc_size,
-				 filtered_memory_map_end);
-  required_pages = (total_pages >> 2);
-  if (required_pages < BYTES_TO_PAGES (MIN_HEAP_SIZE))
-    required_pages = BYTES_TO_PAGES (MIN_HEAP_SIZE);
-  else if (required_pages > BYTES_TO_PAGES (MAX_HEAP_SIZE))
-    required_pages = BYTES_TO_PAGES (MAX_HEAP_SIZE);
+  required_pages = BYTES_TO_PAGES (bytes);
 
   /* Sort the filtered descriptors, so that GRUB can allocate pages
      from smaller regions.  */
   sort_memory_map (filtered_memory_map, desc_size, filtered_memory_map_end);
 
   /* Allocate memory regions for GRUB's memory management.  */
-  add_memory_regions (filtered_memory_map, desc_size,
-		      filtered_memory_map_end, required_pages);
+  missing_pages = add_memory_regions (filtered_memory_map, desc_size,
+				      filtered_memory_map_end,
+				      required_pages, flags);
 
 #if 0
   /* For debug.  */
@@ -554,6 +648,26 @@ grub_efi_mm_init (void)
 #endif
 
   /* Release the memory maps.  */
-  grub_efi_free_pages ((grub_addr_t) memory_map,
-		       2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+  grub_efi_free_pages ((grub_addr_t) memory_map, map_pages);
+
+  if (missing_pages == required_pages
+      || (missing_pages && (flags & GRUB_MM_ADD_REGION_CONSECUTIVE)))
+    return GRUB_ERR_OUT_OF_MEMORY;
+
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_efi_mm_init (void)
+{
+  /* Start with a modest heap and grow it as needed rather than reserving
+     a large share of memory up front.  */
+  if (grub_efi_mm_add_regions (DEFAULT_HEAP_SIZE, GRUB_MM_ADD_REGION_NONE)
+      != GRUB_ERR_NONE
+      && grub_efi_mm_add_regions (MIN_HEAP_SIZE, GRUB_MM_ADD_REGION_NONE)
+      != GRUB_ERR_NONE)
+    grub_fatal ("too little memory");
+
+  heap_initialized = 1;
+  grub_mm_add_region_fn = grub_efi_mm_add_regions;
 }
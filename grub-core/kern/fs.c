@@ -18,6 +18,7 @@
  */
 
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/net.h>
 #include <grub/fs.h>
 #include <grub/file.h>
@@ -32,6 +33,169 @@ grub_fs_t grub_fs_list = 0;
 
 grub_fs_autoload_hook_t grub_fs_autoload_hook = 0;
 
+/* A filesystem found on a device, identified by its disk and partition
+   start, with the mount data if the filesystem keeps it cached.  */
+struct grub_fs_cache
+{
+  struct grub_fs_cache *next;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_fs_t fs;
+  void *data;
+  /* The users of DATA, plus one as long as the entry is valid.  */
+  int refcnt;
+  int valid;
+};
+
+static struct grub_fs_cache *grub_fs_cache_list;
+
+static struct grub_fs_cache *
+fs_cache_find (grub_disk_t disk)
+{
+  struct grub_fs_cache *c;
+  grub_disk_addr_t start = grub_partition_get_start (disk->partition);
+
+  for (c = grub_fs_cache_list; c; c = c->next)
+    if (c->valid && c->dev_id == disk->dev->id && c->disk_id == disk->id
+	&& c->start == start)
+      return c;
+  return 0;
+}
+
+static struct grub_fs_cache *
+fs_cache_add (grub_fs_t fs, grub_disk_t disk)
+{
+  struct grub_fs_cache *c;
+
+  c = grub_malloc (sizeof (*c));
+  if (!c)
+    {
+      /* Not being able to cache isn't an error.  */
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  c->dev_id = disk->dev->id;
+  c->disk_id = disk->id;
+  c->start = grub_partition_get_start (disk->partition);
+  c->fs = fs;
+  c->data = 0;
+  c->refcnt = 1;
+  c->valid = 1;
+  c->next = grub_fs_cache_list;
+  grub_fs_cache_list = c;
+  return c;
+}
+
+static void
+fs_cache_unref (struct grub_fs_cache *c)
+{
+  struct grub_fs_cache **p;
+
+  if (--c->refcnt)
+    return;
+
+  for (p = &grub_fs_cache_list; *p != c; p = &(*p)->next);
+  *p = c->next;
+  if (c->data)
+    c->fs->unmount (c->data);
+  grub_free (c);
+}
+
+static void
+fs_cache_invalidate (struct grub_fs_cache *c)
+{
+  if (!c->valid)
+    return;
+  c->valid = 0;
+  fs_cache_unref (c);
+}
+
+void *
+grub_fs_mount_cache_get (grub_fs_t fs, grub_disk_t disk)
+{
+  struct grub_fs_cache *c = fs_cache_find (disk);
+
+  if (!c || c->fs != fs || !c->data)
+    return 0;
+  c->refcnt++;
+  return c->data;
+}
+
+int
+grub_fs_mount_cache_put (grub_fs_t fs, grub_disk_t disk, void *data)
+{
+  struct grub_fs_cache *c = fs_cache_find (disk);
+
+  if (c && (c->fs != fs || c->data))
+    {
+      /* Someone mounted it meanwhile; keep what is there.  */
+      if (c->fs == fs)
+	return 0;
+      fs_cache_invalidate (c);
+      c = 0;
+    }
+  if (!c)
+    c = fs_cache_add (fs, disk);
+  if (!c)
+    return 0;
+  c->data = data;
+  c->refcnt++;
+  return 1;
+}
+
+int
+grub_fs_mount_cache_release (void *data)
+{
+  struct grub_fs_cache *c;
+
+  for (c = grub_fs_cache_list; c; c = c->next)
+    if (c->data == data)
+      {
+	fs_cache_unref (c);
+	return 1;
+      }
+  return 0;
+}
+
+void
+grub_fs_cache_invalidate (grub_disk_t disk)
+{
+  struct grub_fs_cache *c, *next;
+
+  for (c = grub_fs_cache_list; c; c = next)
+    {
+      next = c->next;
+      if (c->dev_id == disk->dev->id && c->disk_id == disk->id)
+	fs_cache_invalidate (c);
+    }
+}
+
+void
+grub_fs_cache_invalidate_fs (grub_fs_t fs)
+{
+  struct grub_fs_cache *c, *next;
+
+  for (c = grub_fs_cache_list; c; c = next)
+    {
+      next = c->next;
+      if (c->fs == fs)
+	fs_cache_invalidate (c);
+    }
+}
+
+void
+grub_fs_cache_invalidate_all (void)
+{
+  struct grub_fs_cache *c, *next;
+
+  for (c = grub_fs_cache_list; c; c = next)
+    {
+      next = c->next;
+      fs_cache_invalidate (c);
+    }
+}
+
 /* Helper for grub_fs_probe.  */
 static int
 probe_dummy_iter (const char *filename __attribute__ ((unused)),
@@ -41,6 +205,44 @@ probe_dummy_iter (const char *filename __attribute__ ((unused)),
   return 1;
 }
 
+/* Return non-zero if FS may be present on DISK, that is if it doesn't
+   declare any signatures or if one of them matches.  Signatures are
+   close to each other, so the disk cache turns all of them into a
+   handful of actual reads.  */
+static int
+fs_signature_match (grub_fs_t fs, grub_disk_t disk)
+{
+  const struct grub_fs_signature *sig;
+  char buf[16];
+
+  if (!fs->signatures)
+    return 1;
+
+  for (sig = fs->signatures; sig->len; sig++)
+    {
+      if (sig->len > sizeof (buf))
+	return 1;
+
+      if (grub_disk_read (disk, sig->offset >> GRUB_DISK_SECTOR_BITS,
+			  sig->offset & (GRUB_DISK_SECTOR_SIZE - 1),
+			  sig->len, buf))
+	{
+	  grub_err_t err = grub_errno;
+
+	  grub_errno = GRUB_ERR_NONE;
+	  /* Leave reporting real read errors to the filesystem.  */
+	  if (err != GRUB_ERR_OUT_OF_RANGE)
+	    return 1;
+	  continue;
+	}
+
+      if (grub_memcmp (buf, sig->magic, sig->len) == 0)
+	return 1;
+    }
+
+  return 0;
+}
+
 grub_fs_t
 grub_fs_probe (grub_device_t device)
 {
@@ -50,9 +252,17 @@ grub_fs_probe (grub_device_t device)
     {
       /* Make it sure not to have an infinite recursive calls.  */
       static int count = 0;
+      struct grub_fs_cache *c;
+
+      c = fs_cache_find (device->disk);
+      if (c)
+	return c->fs;
 
       for (p = grub_fs_list; p; p = p->next)
 	{
+	  if (!fs_signature_match (p, device->disk))
+	    continue;
+
 	  grub_dprintf ("fs", "Detecting %s...\n", p->name);
 
 	  /* This is evil: newly-created just mounted BtrFS after copying all
@@ -72,7 +282,11 @@ grub_fs_probe (grub_device_t device)
 #endif
 	    (p->dir) (device, "/", probe_dummy_iter, NULL);
 	  if (grub_errno == GRUB_ERR_NONE)
-	    return p;
+	    {
+	      if (!fs_cache_find (device->disk))
+		fs_cache_add (p, device->disk);
+	      return p;
+	    }
 
 	  grub_error_push ();
 	  grub_dprintf ("fs", "%s detection failed.\n", p->name);
@@ -94,10 +308,15 @@ grub_fs_probe (grub_device_t device)
 	    {
 	      p = grub_fs_list;
 
+	      if (!fs_signature_match (p, device->disk))
+		continue;
+
 	      (p->dir) (device, "/", probe_dummy_iter, NULL);
 	      if (grub_errno == GRUB_ERR_NONE)
 		{
 		  count--;
+		  if (!fs_cache_find (device->disk))
+		    fs_cache_add (p, device->disk);
 		  return p;
 		}
 
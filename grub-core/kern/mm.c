@@ -56,6 +56,13 @@
   For safety, both allocated blocks and free ones are marked by magic
   numbers. Whenever anything unexpected is detected, GRUB aborts the
   operation.
+
+  Requests of up to GRUB_MM_SLAB_MAX bytes without special alignment are
+  served from slabs instead. A slab is an ordinary allocated block of
+  GRUB_MM_SLAB_SIZE bytes split into objects of one size class, each with
+  its own one-cell header, so that allocating and freeing them is a list
+  operation regardless of how fragmented the regions are. Slabs which
+  become empty are handed back to the regions.
  */
 
 #include <config.h>
@@ -79,6 +86,27 @@
 
 
 grub_mm_region_t grub_mm_base;
+grub_mm_add_region_func_t grub_mm_add_region_fn;
+
+/* Heap added on demand is requested in steps of at least this size, so
+   that a series of small allocations does not ask the firmware every
+   time.  */
+#define GRUB_MM_HEAP_GROW_MIN	0x100000
+
+#define SLAB_CLASS(bytes) { .size = ((bytes) >> GRUB_MM_ALIGN_LOG2) + 1 }
+
+struct grub_mm_slab_class grub_mm_slab_classes[GRUB_MM_SLAB_CLASSES] =
+  {
+    SLAB_CLASS (32), SLAB_CLASS (64), SLAB_CLASS (96), SLAB_CLASS (128),
+    SLAB_CLASS (192), SLAB_CLASS (256), SLAB_CLASS (384), SLAB_CLASS (512),
+    SLAB_CLASS (768), SLAB_CLASS (1024), SLAB_CLASS (1536),
+    SLAB_CLASS (GRUB_MM_SLAB_MAX)
+  };
+
+grub_mm_profiler_t grub_mm_profiler;
+
+static void *region_memalign (grub_size_t align, grub_size_t size);
+static void free_real (void *ptr);
 
 /* Get a header from the pointer PTR, and set *P and *R to a pointer
    to the header and a pointer to its region, respectively. PTR must
@@ -109,6 +137,14 @@ get_header_from_pointer (void *ptr, grub_mm_header_t *p, grub_mm_region_t *r)
    to use it as free space.  */
 void
 grub_mm_init_region (void *addr, grub_size_t size)
+{
+  grub_mm_init_region_flags (addr, size, GRUB_MM_INIT_REGION_NONE);
+}
+
+/* The same as grub_mm_init_region, with FLAGS being a combination of
+   GRUB_MM_INIT_REGION_* values.  */
+void
+grub_mm_init_region_flags (void *addr, grub_size_t size, unsigned int flags)
 {
   grub_mm_header_t h;
   grub_mm_region_t r, *p, q;
@@ -127,7 +163,8 @@ grub_mm_init_region (void *addr, grub_size_t size)
     size = ((grub_addr_t) -0x1000) - (grub_addr_t) addr;
 
   for (p = &grub_mm_base, q = *p; q; p = &(q->next), q = *p)
-    if ((grub_uint8_t *) addr + size + q->pre_size == (grub_uint8_t *) q)
+    if (!(flags & GRUB_MM_INIT_REGION_NO_MERGE)
+	&& (grub_uint8_t *) addr + size + q->pre_size == (grub_uint8_t *) q)
       {
 	r = (grub_mm_region_t) ALIGN_UP ((grub_addr_t) addr, GRUB_MM_ALIGN);
 	*r = *q;
@@ -141,7 +178,7 @@ grub_mm_init_region (void *addr, grub_size_t size)
 	    r->size += h->size << GRUB_MM_ALIGN_LOG2;
 	    r->pre_size &= (GRUB_MM_ALIGN - 1);
 	    *p = r;
-	    grub_free (h + 1);
+	    free_real (h + 1);
 	  }
 	*p = r;
 	return;
@@ -175,6 +212,26 @@ grub_mm_init_region (void *addr, grub_size_t size)
   r->next = q;
 }
 
+/* Remove the region which was added at ADDR from the heap, provided
+   nothing in it is allocated.  Return 1 if it was removed.  */
+int
+grub_mm_remove_region (void *addr)
+{
+  grub_mm_region_t r, *p;
+
+  for (p = &grub_mm_base, r = *p; r; p = &(r->next), r = *p)
+    if ((grub_addr_t) r - r->pre_size == (grub_addr_t) addr)
+      break;
+
+  if (!r || r->first->magic != GRUB_MM_FREE_MAGIC
+      || r->first->next != r->first
+      || (r->first->size << GRUB_MM_ALIGN_LOG2) != r->size)
+    return 0;
+
+  *p = r->next;
+  return 1;
+}
+
 /* Allocate the number of units N with the alignment ALIGN from the ring
    buffer starting from *FIRST.  ALIGN must be a power of two. Both N and
    ALIGN are in units of GRUB_MM_ALIGN.  Return a non-NULL if successful,
@@ -314,25 +371,183 @@ grub_real_malloc (grub_mm_header_t *first, grub_size_t n, grub_size_t align)
   return 0;
 }
 
-/* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
-void *
-grub_memalign (grub_size_t align, grub_size_t size)
+static void
+slab_unlink (grub_mm_slab_t s)
+{
+  *s->prev = s->next;
+  if (s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+slab_link (grub_mm_slab_t s, grub_mm_slab_t *list)
+{
+  s->next = *list;
+  s->prev = list;
+  if (*list)
+    (*list)->prev = &s->next;
+  *list = s;
+}
+
+static grub_mm_slab_t
+slab_new (struct grub_mm_slab_class *c)
+{
+  grub_mm_slab_t s;
+  grub_mm_header_t h;
+  grub_size_t i;
+
+  if (!c->count)
+    c->count = ((GRUB_MM_SLAB_SIZE >> GRUB_MM_ALIGN_LOG2) - 1
+		- (ALIGN_UP (sizeof (*s), GRUB_MM_ALIGN) >> GRUB_MM_ALIGN_LOG2))
+      / c->size;
+
+  /* Leave room for the block header so that the whole slab occupies
+     exactly GRUB_MM_SLAB_SIZE bytes of the region.  */
+  s = region_memalign (0, GRUB_MM_SLAB_SIZE - GRUB_MM_ALIGN);
+  if (!s)
+    return NULL;
+
+  s->class = c;
+  s->used = 0;
+  s->free = NULL;
+  h = (grub_mm_header_t) ALIGN_UP ((grub_addr_t) (s + 1), GRUB_MM_ALIGN);
+  h += c->size * c->count;
+  for (i = 0; i < c->count; i++)
+    {
+      h -= c->size;
+      h->magic = GRUB_MM_SLAB_FREE_MAGIC;
+      h->size = c->size;
+      h->next = s->free;
+      s->free = h;
+    }
+
+  slab_link (s, &c->partial);
+  c->slabs++;
+  return s;
+}
+
+static void *
+slab_alloc (grub_size_t size)
+{
+  struct grub_mm_slab_class *c;
+  grub_mm_slab_t s;
+  grub_mm_header_t h;
+  grub_size_t n = ((size + GRUB_MM_ALIGN - 1) >> GRUB_MM_ALIGN_LOG2) + 1;
+
+  for (c = grub_mm_slab_classes; c->size < n; c++);
+
+  s = c->partial;
+  if (!s)
+    {
+      s = slab_new (c);
+      if (!s)
+	return NULL;
+    }
+
+  h = s->free;
+  if (h->magic != GRUB_MM_SLAB_FREE_MAGIC)
+    grub_fatal ("slab free magic is broken at %p: 0x%x", h, h->magic);
+  s->free = h->next;
+  h->next = (grub_mm_header_t) s;
+  h->magic = GRUB_MM_SLAB_MAGIC;
+  s->used++;
+  c->used++;
+
+  if (!s->free)
+    {
+      slab_unlink (s);
+      slab_link (s, &c->full);
+    }
+
+  return h + 1;
+}
+
+static void
+slab_release (grub_mm_slab_t s)
+{
+  slab_unlink (s);
+  s->class->slabs--;
+  free_real (s);
+}
+
+static void
+slab_free (grub_mm_header_t h)
+{
+  grub_mm_slab_t s = (grub_mm_slab_t) h->next;
+  struct grub_mm_slab_class *c = s->class;
+
+  h->magic = GRUB_MM_SLAB_FREE_MAGIC;
+  h->next = s->free;
+
+  if (!s->free)
+    {
+      slab_unlink (s);
+      slab_link (s, &c->partial);
+    }
+  s->free = h;
+  s->used--;
+  c->used--;
+
+  /* Keep an empty slab only while it is the sole one with free objects,
+     to avoid thrashing when a single object is allocated and freed
+     repeatedly.  */
+  if (!s->used && (c->partial != s || s->next))
+    slab_release (s);
+}
+
+/* Give the empty slabs kept around by slab_free back to the regions.  */
+static int
+slab_reclaim (void)
+{
+  struct grub_mm_slab_class *c;
+  int ret = 0;
+
+  for (c = grub_mm_slab_classes;
+       c < grub_mm_slab_classes + GRUB_MM_SLAB_CLASSES; c++)
+    {
+      grub_mm_slab_t s, next;
+
+      for (s = c->partial; s; s = next)
+	{
+	  next = s->next;
+	  if (!s->used)
+	    {
+	      slab_release (s);
+	      ret = 1;
+	    }
+	}
+    }
+
+  return ret;
+}
+
+/* Allocate SIZE bytes with the alignment ALIGN from the regions.  Return
+   NULL without setting an error on failure.  */
+static void *
+region_memalign (grub_size_t align, grub_size_t size)
 {
   grub_mm_region_t r;
   grub_size_t n = ((size + GRUB_MM_ALIGN - 1) >> GRUB_MM_ALIGN_LOG2) + 1;
+  grub_size_t grow;
   int count = 0;
 
   if (!grub_mm_base)
-    goto fail;
+    return 0;
 
   if (size > ~(grub_size_t) align)
-    goto fail;
+    return 0;
 
   /* We currently assume at least a 32-bit grub_size_t,
      so limiting allocations to <adress space size> - 1MiB
      in name of sanity is beneficial. */
   if ((size + align) > ~(grub_size_t) 0x100000)
-    goto fail;
+    return 0;
+
+  /* Room for the block, its alignment and the region header.  */
+  grow = (n << GRUB_MM_ALIGN_LOG2) + align + 2 * GRUB_MM_ALIGN
+    + sizeof (struct grub_mm_region);
+  if (grow < GRUB_MM_HEAP_GROW_MIN)
+    grow = GRUB_MM_HEAP_GROW_MIN;
 
   align = (align >> GRUB_MM_ALIGN_LOG2);
   if (align == 0)
@@ -358,8 +573,34 @@ grub_memalign (grub_size_t align, grub_size_t size)
       count++;
       goto again;
 
-#if 0
     case 1:
+      /* Release empty slabs.  */
+      count++;
+      if (slab_reclaim ())
+	goto again;
+      /* Fallthrough.  */
+
+    case 2:
+      /* Ask the platform for a new region large enough for the block.  */
+      count++;
+      if (grub_mm_add_region_fn
+	  && grub_mm_add_region_fn (grow, GRUB_MM_ADD_REGION_CONSECUTIVE)
+	  == GRUB_ERR_NONE)
+	goto again;
+      /* Fallthrough.  */
+
+    case 3:
+      /* Take whatever the platform can give; this may still let a
+	 smaller block fit into the enlarged free space.  */
+      count++;
+      if (grub_mm_add_region_fn
+	  && grub_mm_add_region_fn (grow, GRUB_MM_ADD_REGION_NONE)
+	  == GRUB_ERR_NONE)
+	goto again;
+      break;
+
+#if 0
+    case 4:
       /* Unload unneeded modules.  */
       grub_dl_unload_unneeded ();
       count++;
@@ -370,34 +611,29 @@ grub_memalign (grub_size_t align, grub_size_t size)
       break;
     }
 
- fail:
-  grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
   return 0;
 }
 
-/* Allocate SIZE bytes and return the pointer.  */
-void *
-grub_malloc (grub_size_t size)
+static void *
+memalign_real (grub_size_t align, grub_size_t size)
 {
-  return grub_memalign (0, size);
-}
+  void *p = NULL;
 
-/* Allocate SIZE bytes, clear them and return the pointer.  */
-void *
-grub_zalloc (grub_size_t size)
-{
-  void *ret;
+  if (size <= GRUB_MM_SLAB_MAX && align <= GRUB_MM_ALIGN && grub_mm_base)
+    p = slab_alloc (size);
 
-  ret = grub_memalign (0, size);
-  if (ret)
-    grub_memset (ret, 0, size);
+  /* Fall back to the regions, which may still have room for a small
+     object when a whole slab does not fit.  */
+  if (!p)
+    p = region_memalign (align, size);
 
-  return ret;
+  if (!p)
+    grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+  return p;
 }
 
-/* Deallocate the pointer PTR.  */
-void
-grub_free (void *ptr)
+static void
+free_real (void *ptr)
 {
   grub_mm_header_t p;
   grub_mm_region_t r;
@@ -405,6 +641,18 @@ grub_free (void *ptr)
   if (! ptr)
     return;
 
+  if (!((grub_addr_t) ptr & (GRUB_MM_ALIGN - 1)))
+    {
+      p = (grub_mm_header_t) ptr - 1;
+      if (p->magic == GRUB_MM_SLAB_MAGIC)
+	{
+	  slab_free (p);
+	  return;
+	}
+      if (p->magic == GRUB_MM_SLAB_FREE_MAGIC)
+	grub_fatal ("double free at %p", p);
+    }
+
   get_header_from_pointer (ptr, &p, &r);
 
   if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
@@ -465,42 +713,173 @@ grub_free (void *ptr)
     }
 }
 
-/* Reallocate SIZE bytes and return the pointer. The contents will be
-   the same as that of PTR.  */
-void *
-grub_realloc (void *ptr, grub_size_t size)
+static void *
+realloc_real (void *ptr, grub_size_t size)
 {
   grub_mm_header_t p;
   grub_mm_region_t r;
   void *q;
   grub_size_t n;
 
-  if (! ptr)
-    return grub_malloc (size);
-
-  if (! size)
-    {
-      grub_free (ptr);
-      return 0;
-    }
-
   /* FIXME: Not optimal.  */
   n = ((size + GRUB_MM_ALIGN - 1) >> GRUB_MM_ALIGN_LOG2) + 1;
-  get_header_from_pointer (ptr, &p, &r);
+
+  p = (grub_mm_header_t) ptr - 1;
+  if (((grub_addr_t) ptr & (GRUB_MM_ALIGN - 1))
+      || p->magic != GRUB_MM_SLAB_MAGIC)
+    get_header_from_pointer (ptr, &p, &r);
 
   if (p->size >= n)
     return ptr;
 
-  q = grub_malloc (size);
+  q = memalign_real (0, size);
   if (! q)
     return q;
 
   /* We've already checked that p->size < n.  */
   grub_memcpy (q, ptr, p->size << GRUB_MM_ALIGN_LOG2);
-  grub_free (ptr);
+  free_real (ptr);
   return q;
 }
 
+/* The entry points below only differ from the functions above by
+   reporting to the allocation profiler, if one is installed, on behalf
+   of CALLER (and FILE:LINE with MM_DEBUG).  */
+
+static void
+profile_alloc (void *ptr, grub_size_t size, grub_uint64_t start,
+	       void *caller, const char *file, int line)
+{
+  grub_mm_header_t h = (grub_mm_header_t) ptr - 1;
+  grub_uint32_t tag;
+
+  tag = grub_mm_profiler->alloc (size, ptr ? h->size << GRUB_MM_ALIGN_LOG2 : 0,
+				 caller, file, line,
+				 grub_mm_profiler->clock () - start);
+  if (ptr)
+    h->tag = tag;
+}
+
+static void *
+do_memalign (grub_size_t align, grub_size_t size, int zero,
+	     void *caller, const char *file, int line)
+{
+  grub_uint64_t start = 0;
+  void *ret;
+
+  if (grub_mm_profiler)
+    start = grub_mm_profiler->clock ();
+
+  ret = memalign_real (align, size);
+  if (ret && zero)
+    grub_memset (ret, 0, size);
+
+  if (grub_mm_profiler)
+    profile_alloc (ret, size, start, caller, file, line);
+  else if (ret)
+    /* Do not let a stale tag be attributed once profiling starts.  */
+    ((grub_mm_header_t) ret - 1)->tag = 0;
+  return ret;
+}
+
+static void
+do_free (void *ptr, void *caller)
+{
+  grub_mm_header_t h = (grub_mm_header_t) ptr - 1;
+  grub_uint64_t start;
+  grub_uint32_t tag;
+  grub_size_t size;
+
+  if (!grub_mm_profiler || !ptr || ((grub_addr_t) ptr & (GRUB_MM_ALIGN - 1)))
+    {
+      free_real (ptr);
+      return;
+    }
+
+  tag = h->tag;
+  size = h->size << GRUB_MM_ALIGN_LOG2;
+  start = grub_mm_profiler->clock ();
+  free_real (ptr);
+  grub_mm_profiler->free (tag, size, caller,
+			  grub_mm_profiler->clock () - start);
+}
+
+static void *
+do_realloc (void *ptr, grub_size_t size,
+	    void *caller, const char *file, int line)
+{
+  grub_mm_header_t h = (grub_mm_header_t) ptr - 1;
+  grub_uint64_t start;
+  grub_uint32_t tag;
+  grub_size_t old_size;
+  void *ret;
+
+  if (! ptr)
+    return do_memalign (0, size, 0, caller, file, line);
+
+  if (! size)
+    {
+      do_free (ptr, caller);
+      return 0;
+    }
+
+  if (!grub_mm_profiler || ((grub_addr_t) ptr & (GRUB_MM_ALIGN - 1)))
+    {
+      ret = realloc_real (ptr, size);
+      if (ret && ret != ptr)
+	((grub_mm_header_t) ret - 1)->tag = 0;
+      return ret;
+    }
+
+  tag = h->tag;
+  old_size = h->size << GRUB_MM_ALIGN_LOG2;
+  start = grub_mm_profiler->clock ();
+  ret = realloc_real (ptr, size);
+  if (ret != ptr)
+    {
+      if (ret)
+	grub_mm_profiler->free (tag, old_size, caller, 0);
+      profile_alloc (ret, size, start, caller, file, line);
+    }
+  return ret;
+}
+
+/* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
+void *
+grub_memalign (grub_size_t align, grub_size_t size)
+{
+  return do_memalign (align, size, 0, __builtin_return_address (0), NULL, 0);
+}
+
+/* Allocate SIZE bytes and return the pointer.  */
+void *
+grub_malloc (grub_size_t size)
+{
+  return do_memalign (0, size, 0, __builtin_return_address (0), NULL, 0);
+}
+
+/* Allocate SIZE bytes, clear them and return the pointer.  */
+void *
+grub_zalloc (grub_size_t size)
+{
+  return do_memalign (0, size, 1, __builtin_return_address (0), NULL, 0);
+}
+
+/* Deallocate the pointer PTR.  */
+void
+grub_free (void *ptr)
+{
+  do_free (ptr, __builtin_return_address (0));
+}
+
+/* Reallocate SIZE bytes and return the pointer. The contents will be
+   the same as that of PTR.  */
+void *
+grub_realloc (void *ptr, grub_size_t size)
+{
+  return do_realloc (ptr, size, __builtin_return_address (0), NULL, 0);
+}
+
 #ifdef MM_DEBUG
 int grub_mm_debug = 0;
 
@@ -568,7 +947,7 @@ grub_debug_malloc (const char *file, int line, grub_size_t size)
 
   if (grub_mm_debug)
     grub_printf ("%s:%d: malloc (0x%" PRIxGRUB_SIZE ") = ", file, line, size);
-  ptr = grub_malloc (size);
+  ptr = do_memalign (0, size, 0, __builtin_return_address (0), file, line);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -581,7 +960,7 @@ grub_debug_zalloc (const char *file, int line, grub_size_t size)
 
   if (grub_mm_debug)
     grub_printf ("%s:%d: zalloc (0x%" PRIxGRUB_SIZE ") = ", file, line, size);
-  ptr = grub_zalloc (size);
+  ptr = do_memalign (0, size, 1, __builtin_return_address (0), file, line);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -592,7 +971,7 @@ grub_debug_free (const char *file, int line, void *ptr)
 {
   if (grub_mm_debug)
     grub_printf ("%s:%d: free (%p)\n", file, line, ptr);
-  grub_free (ptr);
+  do_free (ptr, __builtin_return_address (0));
 }
 
 void *
@@ -600,7 +979,7 @@ grub_debug_realloc (const char *file, int line, void *ptr, grub_size_t size)
 {
   if (grub_mm_debug)
     grub_printf ("%s:%d: realloc (%p, 0x%" PRIxGRUB_SIZE ") = ", file, line, ptr, size);
-  ptr = grub_realloc (ptr, size);
+  ptr = do_realloc (ptr, size, __builtin_return_address (0), file, line);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -615,7 +994,8 @@ grub_debug_memalign (const char *file, int line, grub_size_t align,
   if (grub_mm_debug)
     grub_printf ("%s:%d: memalign (0x%" PRIxGRUB_SIZE  ", 0x%" PRIxGRUB_SIZE  
 		 ") = ", file, line, align, size);
-  ptr = grub_memalign (align, size);
+  ptr = do_memalign (align, size, 0, __builtin_return_address (0),
+		     file, line);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
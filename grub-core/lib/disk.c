@@ -147,6 +147,9 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
 
  finish:
 
+  /* Whatever was mounted from this disk may be out of date now.  */
+  grub_fs_cache_invalidate (disk);
+
   return grub_errno;
 }
 
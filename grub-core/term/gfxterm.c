@@ -37,14 +37,6 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define DEFAULT_STANDARD_COLOR  0x07
 
-struct grub_dirty_region
-{
-  int top_left_x;
-  int top_left_y;
-  int bottom_right_x;
-  int bottom_right_y;
-};
-
 struct grub_colored_char
 {
   /* An Unicode codepoint.  */
@@ -123,7 +115,7 @@ static struct grub_video_render_target *text_layer;
 
 struct grub_gfxterm_background grub_gfxterm_background;
 
-static struct grub_dirty_region dirty_region;
+static struct grub_video_damage dirty_region;
 
 static void dirty_region_reset (void);
 
@@ -514,45 +506,14 @@ redraw_screen_rect (unsigned int x, unsigned int y,
 static void
 dirty_region_reset (void)
 {
-  dirty_region.top_left_x = -1;
-  dirty_region.top_left_y = -1;
-  dirty_region.bottom_right_x = -1;
-  dirty_region.bottom_right_y = -1;
+  grub_video_damage_reset (&dirty_region);
   repaint_was_scheduled = 0;
 }
 
 static int
 dirty_region_is_empty (void)
 {
-  if ((dirty_region.top_left_x == -1)
-      || (dirty_region.top_left_y == -1)
-      || (dirty_region.bottom_right_x == -1)
-      || (dirty_region.bottom_right_y == -1))
-    return 1;
-  return 0;
-}
-
-static void
-dirty_region_add_real (int x, int y, unsigned int width, unsigned int height)
-{
-  if (dirty_region_is_empty ())
-    {
-      dirty_region.top_left_x = x;
-      dirty_region.top_left_y = y;
-      dirty_region.bottom_right_x = x + width - 1;
-      dirty_region.bottom_right_y = y + height - 1;
-    }
-  else
-    {
-      if (x < dirty_region.top_left_x)
-        dirty_region.top_left_x = x;
-      if (y < dirty_region.top_left_y)
-        dirty_region.top_left_y = y;
-      if ((x + (int)width - 1) > dirty_region.bottom_right_x)
-        dirty_region.bottom_right_x = x + width - 1;
-      if ((y + (int)height - 1) > dirty_region.bottom_right_y)
-        dirty_region.bottom_right_y = y + height - 1;
-    }
+  return dirty_region.count == 0;
 }
 
 static void
@@ -563,12 +524,12 @@ dirty_region_add (int x, int y, unsigned int width, unsigned int height)
 
   if (repaint_scheduled)
     {
-      dirty_region_add_real (0, 0,
+      grub_video_damage_add (&dirty_region, 0, 0,
 			     window.width, window.height);
       repaint_scheduled = 0;
       repaint_was_scheduled = 1;
     }
-  dirty_region_add_real (x, y, width, height);
+  grub_video_damage_add (&dirty_region, x, y, width, height);
 }
 
 static void
@@ -583,24 +544,18 @@ dirty_region_add_virtualscreen (void)
 static void
 dirty_region_redraw (void)
 {
-  int x;
-  int y;
-  int width;
-  int height;
+  unsigned i;
 
   if (dirty_region_is_empty ())
     return;
 
-  x = dirty_region.top_left_x;
-  y = dirty_region.top_left_y;
-
-  width = dirty_region.bottom_right_x - x + 1;
-  height = dirty_region.bottom_right_y - y + 1;
-
   if (repaint_was_scheduled && grub_gfxterm_decorator_hook)
     grub_gfxterm_decorator_hook ();
 
-  redraw_screen_rect (x, y, width, height);
+  for (i = 0; i < dirty_region.count; i++)
+    redraw_screen_rect (dirty_region.rects[i].x, dirty_region.rects[i].y,
+			dirty_region.rects[i].width,
+			dirty_region.rects[i].height);
 }
 
 static inline void
@@ -82,7 +82,7 @@ grub_gfxterm_background_image_cmd (grub_extcmd_context_t ctxt,
   if (argc >= 1)
     {
       /* Try to load new one.  */
-      grub_video_bitmap_load (&grub_gfxterm_background.bitmap, args[0]);
+      grub_video_bitmap_load_cached (&grub_gfxterm_background.bitmap, args[0]);
       if (grub_errno != GRUB_ERR_NONE)
         return grub_errno;
 
@@ -0,0 +1,295 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compare the optimized 32-bit blitters against a plain per-pixel
+   computation.  */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/video.h>
+#include <grub/video_fb.h>
+#include <grub/bitmap.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define WIDTH 61
+#define HEIGHT 23
+
+struct pixel
+{
+  grub_uint8_t r, g, b, a;
+};
+
+static struct grub_video_mode_info modes[2] = {
+  {
+    .width = WIDTH,
+    .height = HEIGHT,
+    .pitch = WIDTH * 4,
+    GRUB_VIDEO_MI_RGBA8888 ()
+  },
+  {
+    .width = WIDTH,
+    .height = HEIGHT,
+    .pitch = WIDTH * 4,
+    GRUB_VIDEO_MI_BGRA8888 ()
+  }
+};
+
+static grub_uint32_t seed;
+
+static grub_uint8_t
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+/* Mostly transparent or opaque, like real images.  */
+static grub_uint8_t
+rnd_alpha (void)
+{
+  grub_uint8_t v = rnd ();
+
+  if (v < 80)
+    return 0;
+  if (v < 160)
+    return 255;
+  return rnd ();
+}
+
+static grub_uint8_t
+ref_dilute (grub_uint8_t bg, grub_uint8_t fg, grub_uint8_t a)
+{
+  return (fg * a + bg * (255 - a)) / 255;
+}
+
+static void
+ref_blend (struct pixel *dst, const struct pixel *src)
+{
+  if (src->a == 0)
+    return;
+  if (src->a == 255)
+    {
+      *dst = *src;
+      return;
+    }
+  dst->r = ref_dilute (dst->r, src->r, src->a);
+  dst->g = ref_dilute (dst->g, src->g, src->a);
+  dst->b = ref_dilute (dst->b, src->b, src->a);
+  dst->a = src->a;
+}
+
+static int
+count_differences (const struct grub_video_mode_info *mode,
+		   const struct pixel *expected)
+{
+  const grub_uint32_t *fb = grub_video_capture_get_framebuffer ();
+  int bad = 0;
+  unsigned i;
+
+  for (i = 0; i < WIDTH * HEIGHT; i++)
+    {
+      const struct pixel *p = &expected[i];
+      grub_uint32_t v = ((p->r << mode->red_field_pos)
+			 | (p->g << mode->green_field_pos)
+			 | (p->b << mode->blue_field_pos)
+			 | ((grub_uint32_t) p->a << mode->reserved_field_pos));
+      if (fb[i] != v)
+	bad++;
+    }
+  return bad;
+}
+
+/* Fill BITMAP, an RGBA8888 one, with random pixels, and put them in
+   PIXELS too.  */
+static void
+random_rgba (struct grub_video_bitmap *bitmap, struct pixel *pixels)
+{
+  grub_uint32_t *data = bitmap->data;
+  unsigned i;
+
+  for (i = 0; i < WIDTH * HEIGHT; i++)
+    {
+      pixels[i].r = rnd ();
+      pixels[i].g = rnd ();
+      pixels[i].b = rnd ();
+      pixels[i].a = rnd_alpha ();
+      data[i] = (pixels[i].r | (pixels[i].g << 8) | (pixels[i].b << 16)
+		 | ((grub_uint32_t) pixels[i].a << 24));
+    }
+}
+
+static void
+test_mode (const struct grub_video_mode_info *mode, struct pixel *expected,
+	   struct pixel *pixels)
+{
+  struct grub_video_bitmap *bitmap;
+  struct grub_video_bitmap glyph;
+  grub_uint8_t bits[(WIDTH * HEIGHT + 7) / 8];
+  grub_uint8_t *rgb;
+  unsigned i, x, y;
+
+  if (grub_video_capture_start (mode, grub_video_fbstd_colors,
+				mode->number_of_colors))
+    {
+      grub_test_assert (0, "can't start capture: %s", grub_errmsg);
+      return;
+    }
+
+  if (grub_video_bitmap_create (&bitmap, WIDTH, HEIGHT,
+				GRUB_VIDEO_BLIT_FORMAT_RGBA_8888))
+    {
+      grub_test_assert (0, "can't create bitmap: %s", grub_errmsg);
+      grub_video_capture_end ();
+      return;
+    }
+
+  /* Replacing keeps the alpha of the source.  */
+  random_rgba (bitmap, expected);
+  grub_video_blit_bitmap (bitmap, GRUB_VIDEO_BLIT_REPLACE, 0, 0, 0, 0,
+			  WIDTH, HEIGHT);
+  grub_test_assert (count_differences (mode, expected) == 0,
+		    "RGBA replace differs in mode with red at %d",
+		    mode->red_field_pos);
+
+  random_rgba (bitmap, pixels);
+  grub_video_blit_bitmap (bitmap, GRUB_VIDEO_BLIT_BLEND, 0, 0, 0, 0,
+			  WIDTH, HEIGHT);
+  for (i = 0; i < WIDTH * HEIGHT; i++)
+    ref_blend (&expected[i], &pixels[i]);
+  grub_test_assert (count_differences (mode, expected) == 0,
+		    "RGBA blend differs in mode with red at %d",
+		    mode->red_field_pos);
+  grub_video_bitmap_destroy (bitmap);
+
+  /* RGB888 is blended by replacing, with opaque alpha.  */
+  if (grub_video_bitmap_create (&bitmap, WIDTH, HEIGHT,
+				GRUB_VIDEO_BLIT_FORMAT_RGB_888))
+    {
+      grub_test_assert (0, "can't create bitmap: %s", grub_errmsg);
+      grub_video_capture_end ();
+      return;
+    }
+  rgb = bitmap->data;
+  for (i = 0; i < WIDTH * HEIGHT; i++)
+    {
+      pixels[i].r = rnd ();
+      pixels[i].g = rnd ();
+      pixels[i].b = rnd ();
+      pixels[i].a = 255;
+#ifdef GRUB_CPU_WORDS_BIGENDIAN
+      rgb[3 * i] = pixels[i].b;
+      rgb[3 * i + 2] = pixels[i].r;
+#else
+      rgb[3 * i] = pixels[i].r;
+      rgb[3 * i + 2] = pixels[i].b;
+#endif
+      rgb[3 * i + 1] = pixels[i].g;
+    }
+  grub_video_blit_bitmap (bitmap, GRUB_VIDEO_BLIT_BLEND, 5, 3, 2, 1, 20, 7);
+  for (y = 0; y < 7; y++)
+    for (x = 0; x < 20; x++)
+      expected[(y + 3) * WIDTH + x + 5] = pixels[(y + 1) * WIDTH + x + 2];
+  grub_test_assert (count_differences (mode, expected) == 0,
+		    "RGB888 blend differs in mode with red at %d",
+		    mode->red_field_pos);
+  grub_video_bitmap_destroy (bitmap);
+
+  /* Glyphs, with runs of whole bytes of each color as well as mixed
+     ones, drawn at offsets that don't fall on byte boundaries.  */
+  for (i = 0; i < sizeof (bits); i++)
+    {
+      grub_uint8_t v = rnd ();
+      bits[i] = v < 64 ? 0 : v < 128 ? 0xff : rnd ();
+    }
+  grub_memset (&glyph, 0, sizeof (glyph));
+  glyph.mode_info.width = WIDTH;
+  glyph.mode_info.height = HEIGHT;
+  glyph.mode_info.mode_type = ((1 << GRUB_VIDEO_MODE_TYPE_DEPTH_POS)
+			       | GRUB_VIDEO_MODE_TYPE_1BIT_BITMAP);
+  glyph.mode_info.blit_format = GRUB_VIDEO_BLIT_FORMAT_1BIT_PACKED;
+  glyph.mode_info.bpp = 1;
+  glyph.mode_info.pitch = WIDTH;
+  glyph.mode_info.number_of_colors = 2;
+  glyph.data = bits;
+
+  for (i = 0; i < 4; i++)
+    {
+      struct pixel fg = { rnd (), rnd (), rnd (), 255 };
+      struct pixel bg = { rnd (), rnd (), rnd (), 0 };
+      unsigned ox = 3 * i, oy = i, w = WIDTH - 3 * i - i, h = HEIGHT - 2 * i;
+
+      if (i & 1)
+	fg.a = rnd ();
+      if (i & 2)
+	bg.a = i == 2 ? 255 : rnd ();
+
+      glyph.mode_info.fg_red = fg.r;
+      glyph.mode_info.fg_green = fg.g;
+      glyph.mode_info.fg_blue = fg.b;
+      glyph.mode_info.fg_alpha = fg.a;
+      glyph.mode_info.bg_red = bg.r;
+      glyph.mode_info.bg_green = bg.g;
+      glyph.mode_info.bg_blue = bg.b;
+      glyph.mode_info.bg_alpha = bg.a;
+
+      grub_video_blit_bitmap (&glyph, GRUB_VIDEO_BLIT_BLEND, i, i, ox, oy,
+			      w, h);
+      for (y = 0; y < h; y++)
+	for (x = 0; x < w; x++)
+	  {
+	    unsigned bit = (y + oy) * WIDTH + x + ox;
+	    ref_blend (&expected[(y + i) * WIDTH + x + i],
+		       (bits[bit >> 3] & (0x80 >> (bit & 7))) ? &fg : &bg);
+	  }
+      grub_test_assert (count_differences (mode, expected) == 0,
+			"glyph blend %d differs in mode with red at %d",
+			i, mode->red_field_pos);
+    }
+
+  grub_video_capture_end ();
+}
+
+static void
+fbblit_test (void)
+{
+  struct pixel *expected, *pixels;
+  unsigned i;
+
+  expected = grub_malloc (WIDTH * HEIGHT * sizeof (*expected));
+  pixels = grub_malloc (WIDTH * HEIGHT * sizeof (*pixels));
+  if (!expected || !pixels)
+    {
+      grub_test_assert (0, "out of memory");
+      grub_free (expected);
+      grub_free (pixels);
+      return;
+    }
+
+  seed = 1;
+  for (i = 0; i < ARRAY_SIZE (modes); i++)
+    test_mode (&modes[i], expected, pixels);
+
+  grub_free (expected);
+  grub_free (pixels);
+}
+
+/* Register fbblit_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (fbblit_test, fbblit_test);
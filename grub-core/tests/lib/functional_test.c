@@ -70,6 +70,8 @@ grub_functional_all_tests (grub_extcmd_context_t ctxt __attribute__ ((unused)),
   grub_dl_load ("cmp_test");
   grub_dl_load ("mul_test");
   grub_dl_load ("shift_test");
+  grub_dl_load ("zfs_checksum_test");
+  grub_dl_load ("fbblit_test");
 
   FOR_LIST_ELEMENTS (test, grub_test_list)
     ok = !grub_test_run (test) && ok;
@@ -0,0 +1,196 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/zfs/zfs.h>
+#include <grub/zfs/zio.h>
+#include <grub/zfs/zio_checksum.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static struct
+{
+  const char *msg;
+  grub_size_t len;
+  grub_uint64_t sum[4];
+} sha256_vectors[] = {
+  /* FIPS 180-2.  */
+  {
+    "abc", 3,
+    { 0xba7816bf8f01cfeaULL, 0x414140de5dae2223ULL,
+      0xb00361a396177a9cULL, 0xb410ff61f20015adULL }
+  },
+  {
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+    { 0x248d6a61d20638b8ULL, 0xe5c026930c3e6039ULL,
+      0xa33ce45964ff2167ULL, 0xf6ecedd419db06c1ULL }
+  }
+};
+
+/* Checksums of the bytes 0 to 99, which don't fill the last block or
+   the last unrolled iteration.  */
+static const grub_uint64_t sha256_seq[4] = {
+  0xbce0aff19cf5aa6aULL, 0x7469a30d61d04e43ULL,
+  0x76e4bbf6381052eeULL, 0x9e7f33925c954d52ULL
+};
+
+static const grub_uint64_t fletcher4_seq[2][4] = {
+  /* Little endian.  */
+  { 0x4ffe6cdb0ULL, 0x2c9a540da0ULL, 0x135a930b738ULL, 0x6f636eb9aa0ULL },
+  /* Big endian.  */
+  { 0x4b4cde6fbULL, 0x28ca10566fULL, 0x11356cf467fULL, 0x605f6418591ULL }
+};
+
+/* Of the bytes 0 to 95.  */
+static const grub_uint64_t fletcher2_seq[2][4] = {
+  { 0x1b150f0902fcf6f0ULL, 0x4b453f39332d2720ULL,
+    0xc5b09b86715c4730ULL, 0x6e59442f1a04efd8ULL },
+  { 0xf0f6fd03090f151aULL, 0x21272d33393f454aULL,
+    0x32475c71869bb0c3ULL, 0xdaf0051a2f44596bULL }
+};
+
+/* The throughput check runs each checksum over a buffer of SPEED_BUF_SIZE
+   bytes for at least SPEED_MIN_MS.  The floors, in KiB/s, are far below
+   what even an emulated machine manages, so that only a checksum which
+   has become pathologically slow fails.  */
+#define SPEED_BUF_SIZE	(128 * 1024)
+#define SPEED_MIN_MS	100
+
+typedef void (*checksum_func_t) (const void *, grub_uint64_t,
+				 grub_zfs_endian_t, zio_cksum_t *);
+
+static struct
+{
+  const char *name;
+  checksum_func_t func;
+  grub_uint64_t floor;
+} speed_checks[] = {
+  { "fletcher2", fletcher_2, 16384 },
+  { "fletcher4", fletcher_4, 16384 },
+  { "SHA-256", zio_checksum_SHA256, 2048 }
+};
+
+static int
+check_sum (const zio_cksum_t *zc, grub_zfs_endian_t endian,
+	   const grub_uint64_t *expected)
+{
+  unsigned i;
+
+  for (i = 0; i < 4; i++)
+    if (grub_zfs_to_cpu64 (zc->zc_word[i], endian) != expected[i])
+      return 0;
+  return 1;
+}
+
+/* Return the throughput of FUNC over BUF in KiB/s.  */
+static grub_uint64_t
+measure_speed (checksum_func_t func, const void *buf)
+{
+  grub_uint64_t start, elapsed;
+  grub_uint64_t bytes = 0;
+  zio_cksum_t zc;
+
+  start = grub_get_time_ms ();
+  do
+    {
+      func (buf, SPEED_BUF_SIZE, GRUB_ZFS_LITTLE_ENDIAN, &zc);
+      bytes += SPEED_BUF_SIZE;
+      elapsed = grub_get_time_ms () - start;
+    }
+  while (elapsed < SPEED_MIN_MS);
+
+  return grub_divmod64 (bytes * 1000 / 1024, elapsed, 0);
+}
+
+static void
+speed_test (void)
+{
+  grub_uint8_t *buf;
+  grub_uint64_t speed;
+  unsigned i;
+
+  buf = grub_malloc (SPEED_BUF_SIZE);
+  if (!buf)
+    {
+      grub_test_assert (0, "out of memory");
+      return;
+    }
+
+  for (i = 0; i < SPEED_BUF_SIZE; i++)
+    buf[i] = i * 7 + (i >> 8);
+
+  for (i = 0; i < ARRAY_SIZE (speed_checks); i++)
+    {
+      speed = measure_speed (speed_checks[i].func, buf);
+      grub_dprintf ("zfs", "%s: %llu KiB/s\n", speed_checks[i].name,
+		    (unsigned long long) speed);
+      grub_test_assert (speed >= speed_checks[i].floor,
+			"%s is too slow: %llu KiB/s", speed_checks[i].name,
+			(unsigned long long) speed);
+    }
+
+  grub_free (buf);
+}
+
+static void
+zfs_checksum_test (void)
+{
+  grub_uint32_t words[25];
+  grub_uint8_t *seq = (grub_uint8_t *) words;
+  zio_cksum_t zc;
+  unsigned i;
+
+  for (i = 0; i < 100; i++)
+    seq[i] = i;
+
+  for (i = 0; i < ARRAY_SIZE (sha256_vectors); i++)
+    {
+      zio_checksum_SHA256 (sha256_vectors[i].msg, sha256_vectors[i].len,
+			   GRUB_ZFS_BIG_ENDIAN, &zc);
+      grub_test_assert (check_sum (&zc, GRUB_ZFS_BIG_ENDIAN,
+				   sha256_vectors[i].sum),
+			"SHA-256 test %d failed", i);
+    }
+
+  zio_checksum_SHA256 (seq, 100, GRUB_ZFS_LITTLE_ENDIAN, &zc);
+  grub_test_assert (check_sum (&zc, GRUB_ZFS_LITTLE_ENDIAN, sha256_seq),
+		    "SHA-256 of a partial block failed");
+
+  fletcher_4 (seq, 100, GRUB_ZFS_LITTLE_ENDIAN, &zc);
+  grub_test_assert (check_sum (&zc, GRUB_ZFS_LITTLE_ENDIAN, fletcher4_seq[0]),
+		    "little endian fletcher4 failed");
+  fletcher_4 (seq, 100, GRUB_ZFS_BIG_ENDIAN, &zc);
+  grub_test_assert (check_sum (&zc, GRUB_ZFS_BIG_ENDIAN, fletcher4_seq[1]),
+		    "big endian fletcher4 failed");
+
+  fletcher_2 (seq, 96, GRUB_ZFS_LITTLE_ENDIAN, &zc);
+  grub_test_assert (check_sum (&zc, GRUB_ZFS_LITTLE_ENDIAN, fletcher2_seq[0]),
+		    "little endian fletcher2 failed");
+  fletcher_2 (seq, 96, GRUB_ZFS_BIG_ENDIAN, &zc);
+  grub_test_assert (check_sum (&zc, GRUB_ZFS_BIG_ENDIAN, fletcher2_seq[1]),
+		    "big endian fletcher2 failed");
+
+  speed_test ();
+}
+
+/* Register zfs_checksum_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (zfs_checksum_test, zfs_checksum_test);
@@ -23,12 +23,143 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 /* List of bitmap readers registered to system.  */
 static grub_video_bitmap_reader_t bitmap_readers_list;
 
+/* Bitmaps not used by anyone else are dropped from the cache, least
+   recently used first, beyond this many bytes.  */
+#define BITMAP_CACHE_BYTES	(16 << 20)
+
+/* A bitmap shared through the cache.  It is made from the file PATH,
+   and is either the bitmap as loaded, with WIDTH and HEIGHT of 0, or a
+   variant of it that size, VARIANT telling how it was made.  */
+struct bitmap_cache_entry
+{
+  struct bitmap_cache_entry *next;
+  char *path;
+  unsigned int width;
+  unsigned int height;
+  grub_uint32_t variant;
+  struct grub_video_bitmap *bitmap;
+  grub_size_t size;
+  grub_uint64_t stamp;
+};
+
+static struct bitmap_cache_entry *bitmap_cache;
+static grub_size_t bitmap_cache_total;
+static grub_uint64_t bitmap_cache_stamp;
+
+/* Drop the least recently used bitmaps that only the cache holds until
+   it is down to GOAL bytes.  Return whether any was dropped.  */
+static int
+bitmap_cache_evict (grub_size_t goal)
+{
+  struct bitmap_cache_entry **p, **lru, *e;
+  int dropped = 0;
+
+  while (bitmap_cache_total > goal)
+    {
+      lru = 0;
+      for (p = &bitmap_cache; *p; p = &(*p)->next)
+        if ((*p)->bitmap->refcnt == 1 && (!lru || (*p)->stamp < (*lru)->stamp))
+          lru = p;
+      if (!lru)
+        break;
+
+      e = *lru;
+      *lru = e->next;
+      bitmap_cache_total -= e->size;
+      grub_video_bitmap_destroy (e->bitmap);
+      grub_free (e->path);
+      grub_free (e);
+      dropped = 1;
+    }
+
+  return dropped;
+}
+
+static struct bitmap_cache_entry *
+bitmap_cache_lookup (const char *path, unsigned int width,
+                     unsigned int height, grub_uint32_t variant)
+{
+  struct bitmap_cache_entry *e;
+
+  for (e = bitmap_cache; e; e = e->next)
+    if (e->width == width && e->height == height && e->variant == variant
+        && grub_strcmp (e->path, path) == 0)
+      {
+        e->stamp = ++bitmap_cache_stamp;
+        return e;
+      }
+
+  return 0;
+}
+
+/* Find the entry of BITMAP as loaded from its file.  */
+static struct bitmap_cache_entry *
+bitmap_cache_find_source (struct grub_video_bitmap *bitmap)
+{
+  struct bitmap_cache_entry *e;
+
+  if (!bitmap || bitmap->refcnt < 2)
+    return 0;
+
+  for (e = bitmap_cache; e; e = e->next)
+    if (e->bitmap == bitmap)
+      return e->width == 0 ? e : 0;
+
+  return 0;
+}
+
+/* Share BITMAP through the cache, which takes over PATH.  Failing that
+   the bitmap simply stays private.  */
+static void
+bitmap_cache_insert (char *path, unsigned int width, unsigned int height,
+                     grub_uint32_t variant, struct grub_video_bitmap *bitmap)
+{
+  struct bitmap_cache_entry *e;
+
+  e = grub_malloc (sizeof (*e));
+  if (!e)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (path);
+      return;
+    }
+
+  e->path = path;
+  e->width = width;
+  e->height = height;
+  e->variant = variant;
+  e->bitmap = bitmap;
+  e->size = (grub_size_t) bitmap->mode_info.pitch * bitmap->mode_info.height;
+  e->stamp = ++bitmap_cache_stamp;
+  e->next = bitmap_cache;
+  bitmap_cache = e;
+  bitmap->refcnt++;
+
+  bitmap_cache_total += e->size;
+  bitmap_cache_evict (BITMAP_CACHE_BYTES);
+}
+
+/* The same file can be named relative to the root device or with its
+   own, so key the cache on the latter.  */
+static char *
+bitmap_cache_path (const char *filename)
+{
+  const char *root;
+
+  root = grub_env_get ("root");
+  if (filename[0] != '/' || !root)
+    return grub_strdup (filename);
+
+  return grub_xasprintf ("(%s)%s", root, filename);
+}
+
 /* Register bitmap reader.  */
 void
 grub_video_bitmap_reader_register (grub_video_bitmap_reader_t reader)
@@ -72,6 +203,7 @@ grub_video_bitmap_create (struct grub_video_bitmap **bitmap,
   if (! *bitmap)
     return grub_errno;
 
+  (*bitmap)->refcnt = 1;
   mode_info = &((*bitmap)->mode_info);
 
   /* Populate mode_info.  */
@@ -141,6 +273,12 @@ grub_video_bitmap_create (struct grub_video_bitmap **bitmap,
   size = (width * mode_info->bytes_per_pixel) * height;
 
   (*bitmap)->data = grub_zalloc (size);
+  if (! (*bitmap)->data && bitmap_cache_evict (0))
+    {
+      /* Room was made by dropping unused cached bitmaps.  */
+      grub_errno = GRUB_ERR_NONE;
+      (*bitmap)->data = grub_zalloc (size);
+    }
   if (! (*bitmap)->data)
     {
       grub_free (*bitmap);
@@ -152,13 +290,19 @@ grub_video_bitmap_create (struct grub_video_bitmap **bitmap,
   return GRUB_ERR_NONE;
 }
 
-/* Frees all resources allocated by bitmap.  */
+/* Drops a reference to bitmap, freeing it with the last one.  */
 grub_err_t
 grub_video_bitmap_destroy (struct grub_video_bitmap *bitmap)
 {
   if (! bitmap)
     return GRUB_ERR_NONE;
 
+  if (bitmap->refcnt > 1)
+    {
+      bitmap->refcnt--;
+      return GRUB_ERR_NONE;
+    }
+
   grub_free (bitmap->data);
   grub_free (bitmap);
 
@@ -210,6 +354,90 @@ grub_video_bitmap_load (struct grub_video_bitmap **bitmap,
 			" unsupported format"), filename);
 }
 
+/* Loads bitmap, sharing it with everyone else who loads the same file
+   through the bitmap cache.  The bitmap must not be modified.  */
+grub_err_t
+grub_video_bitmap_load_cached (struct grub_video_bitmap **bitmap,
+                               const char *filename)
+{
+  struct bitmap_cache_entry *e;
+  char *path;
+
+  if (!bitmap)
+    return grub_error (GRUB_ERR_BUG, "invalid argument");
+
+  *bitmap = 0;
+
+  path = bitmap_cache_path (filename);
+  if (!path)
+    return grub_errno;
+
+  e = bitmap_cache_lookup (path, 0, 0, 0);
+  if (e)
+    {
+      grub_free (path);
+      e->bitmap->refcnt++;
+      *bitmap = e->bitmap;
+      return GRUB_ERR_NONE;
+    }
+
+  if (grub_video_bitmap_load (bitmap, filename) != GRUB_ERR_NONE)
+    {
+      grub_free (path);
+      return grub_errno;
+    }
+
+  bitmap_cache_insert (path, 0, 0, 0, *bitmap);
+  return GRUB_ERR_NONE;
+}
+
+/* Return a new reference to the variant of SRC, a bitmap from
+   grub_video_bitmap_load_cached, that is WIDTH by HEIGHT and was made
+   as VARIANT says, or 0 if it isn't cached.  */
+struct grub_video_bitmap *
+grub_video_bitmap_cache_find (struct grub_video_bitmap *src,
+                              unsigned int width, unsigned int height,
+                              grub_uint32_t variant)
+{
+  struct bitmap_cache_entry *source, *e;
+
+  source = bitmap_cache_find_source (src);
+  if (!source)
+    return 0;
+
+  e = bitmap_cache_lookup (source->path, width, height, variant);
+  if (!e)
+    return 0;
+
+  e->bitmap->refcnt++;
+  return e->bitmap;
+}
+
+/* Share BITMAP, a variant of SRC as given to grub_video_bitmap_cache_find,
+   through the cache if SRC is shared.  */
+void
+grub_video_bitmap_cache_add (struct grub_video_bitmap *src,
+                             struct grub_video_bitmap *bitmap,
+                             unsigned int width, unsigned int height,
+                             grub_uint32_t variant)
+{
+  struct bitmap_cache_entry *source;
+  char *path;
+
+  source = bitmap_cache_find_source (src);
+  if (!source || !bitmap)
+    return;
+
+  path = grub_strdup (source->path);
+  if (!path)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  bitmap_cache_insert (path, width, height, variant, bitmap);
+}
+
 /* Return mode info for bitmap.  */
 void grub_video_bitmap_get_mode_info (struct grub_video_bitmap *bitmap,
                                       struct grub_video_mode_info *mode_info)
@@ -78,6 +78,13 @@ grub_video_bitmap_create_scaled (
     return grub_error (GRUB_ERR_BUG,
 		       "requested to scale to a size w/ a zero dimension");
 
+  /* Bitmaps shared through the cache have their scaled versions
+     shared too.  */
+  *dst = grub_video_bitmap_cache_find (src, dst_width, dst_height,
+				       scale_method);
+  if (*dst)
+    return GRUB_ERR_NONE;
+
   /* Create the new bitmap. */
   grub_err_t ret;
   ret = grub_video_bitmap_create (dst, dst_width, dst_height,
@@ -90,6 +97,8 @@ grub_video_bitmap_create_scaled (
   if (ret == GRUB_ERR_NONE)
     {
       /* Success:  *dst is now a pointer to the scaled bitmap. */
+      grub_video_bitmap_cache_add (src, *dst, dst_width, dst_height,
+				   scale_method);
       return GRUB_ERR_NONE;
     }
   else
@@ -177,6 +186,13 @@ grub_video_bitmap_scale_proportional (
     return grub_error (GRUB_ERR_BUG,
 		       "requested to scale to a size w/ a zero dimension");
 
+  /* Tell the cache about the selection, apart from plain scaling.  */
+  grub_uint32_t variant = (scale_method | ((selection_method + 1) << 8)
+			   | (v_align << 16) | (h_align << 24));
+  *dst = grub_video_bitmap_cache_find (src, dst_width, dst_height, variant);
+  if (*dst)
+    return GRUB_ERR_NONE;
+
   ret = grub_video_bitmap_create (dst, dst_width, dst_height,
 				  src->mode_info.blit_format);
   if (ret != GRUB_ERR_NONE)
@@ -263,6 +279,7 @@ grub_video_bitmap_scale_proportional (
   if (ret == GRUB_ERR_NONE)
     {
       /* Success:  *dst is now a pointer to the scaled bitmap. */
+      grub_video_bitmap_cache_add (src, *dst, dst_width, dst_height, variant);
       return GRUB_ERR_NONE;
     }
   else
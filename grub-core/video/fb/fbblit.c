@@ -759,6 +759,15 @@ grub_video_fbblit_blend_8bit_indexa (struct grub_video_fbblit_info *dst,
 }
 
 
+/* Exchange the bytes at bits 0-7 and 16-23 of a 32-bit pixel, turning
+   RGBA into BGRA and back.  */
+static inline grub_uint32_t
+swap_red_blue (grub_uint32_t color)
+{
+  return ((color & 0xff00ff00) | ((color >> 16) & 0xff)
+	  | ((color & 0xff) << 16));
+}
+
 /* Optimized replacing blitter for RGBX8888 to BGRX8888.  */
 static void
 grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
@@ -769,8 +778,8 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
 {
   int i;
   int j;
-  grub_uint8_t *srcptr;
-  grub_uint8_t *dstptr;
+  grub_uint32_t *srcptr;
+  grub_uint32_t *dstptr;
   unsigned int srcrowskip;
   unsigned int dstrowskip;
 
@@ -785,30 +794,10 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
   for (j = 0; j < height; j++)
     {
       for (i = 0; i < width; i++)
-        {
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-          grub_uint8_t a = *srcptr++;
-#endif
-          grub_uint8_t r = *srcptr++;
-          grub_uint8_t g = *srcptr++;
-          grub_uint8_t b = *srcptr++;
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          grub_uint8_t a = *srcptr++;
-#endif
+	*dstptr++ = swap_red_blue (*srcptr++);
 
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-          *dstptr++ = a;
-#endif
-          *dstptr++ = b;
-          *dstptr++ = g;
-          *dstptr++ = r;
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          *dstptr++ = a;
-#endif
-        }
-
-      srcptr += srcrowskip;
-      dstptr += dstrowskip;
+      GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
+      GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
     }
 }
 
@@ -823,7 +812,7 @@ grub_video_fbblit_replace_BGRX8888_RGB888 (struct grub_video_fbblit_info *dst,
   int i;
   int j;
   grub_uint8_t *srcptr;
-  grub_uint8_t *dstptr;
+  grub_uint32_t *dstptr;
   unsigned int srcrowskip;
   unsigned int dstrowskip;
 
@@ -839,27 +828,23 @@ grub_video_fbblit_replace_BGRX8888_RGB888 (struct grub_video_fbblit_info *dst,
     {
       for (i = 0; i < width; i++)
         {
-          grub_uint8_t r = *srcptr++;
-          grub_uint8_t g = *srcptr++;
-          grub_uint8_t b = *srcptr++;
-
 #ifdef GRUB_CPU_WORDS_BIGENDIAN
-          /* Set alpha component as opaque.  */
-          *dstptr++ = 255;
+          grub_uint32_t b = *srcptr++;
+          grub_uint32_t g = *srcptr++;
+          grub_uint32_t r = *srcptr++;
+#else
+          grub_uint32_t r = *srcptr++;
+          grub_uint32_t g = *srcptr++;
+          grub_uint32_t b = *srcptr++;
 #endif
 
-          *dstptr++ = b;
-          *dstptr++ = g;
-          *dstptr++ = r;
-
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          /* Set alpha component as opaque.  */
-          *dstptr++ = 255;
-#endif
+          /* Set alpha component as opaque.  Whole words are written, as
+             the target is often video memory.  */
+          *dstptr++ = 0xff000000 | (r << 16) | (g << 8) | b;
         }
 
       srcptr += srcrowskip;
-      dstptr += dstrowskip;
+      GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
     }
 }
 
@@ -1159,6 +1144,28 @@ alpha_dilute (grub_uint8_t bg, grub_uint8_t fg, grub_uint8_t alpha)
   return h;
 }
 
+/* Like alpha_dilute, for the two channels in bits 0-7 and 16-23 of BG
+   and FG at once.  The halves of the sum are at most 255 * 255, so the
+   division below doesn't carry from one into the other.  */
+static inline grub_uint32_t
+alpha_dilute2 (grub_uint32_t bg, grub_uint32_t fg, grub_uint32_t alpha)
+{
+  grub_uint32_t s;
+
+  s = fg * alpha + bg * (255 ^ alpha);
+  return ((s + 0x00010001 + ((s >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
+/* Blend the colors of two 32-bit pixels in the same format, with alpha
+   in the top byte.  The result takes the alpha of FG.  */
+static inline grub_uint32_t
+blend_pixel32 (grub_uint32_t bg, grub_uint32_t fg, grub_uint32_t alpha)
+{
+  return ((alpha << 24)
+	  | alpha_dilute2 (bg & 0x00ff00ff, fg & 0x00ff00ff, alpha)
+	  | (alpha_dilute2 ((bg >> 8) & 0xff, (fg >> 8) & 0xff, alpha) << 8));
+}
+
 /* Generic blending blitter.  Works for every supported format.  */
 static void
 grub_video_fbblit_blend (struct grub_video_fbblit_info *dst,
@@ -1245,52 +1252,21 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
       for (i = 0; i < width; i++)
         {
           grub_uint32_t color;
-          unsigned int sr;
-          unsigned int sg;
-          unsigned int sb;
           unsigned int a;
-          unsigned int dr;
-          unsigned int dg;
-          unsigned int db;
 
           color = *srcptr++;
 
           a = color >> 24;
 
-          if (a == 0)
-            {
-              /* Skip transparent source pixels.  */
-              dstptr++;
-              continue;
-            }
-
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
-
           if (a == 255)
-            {
-              /* Opaque pixel shortcut.  */
-              dr = sr;
-              dg = sg;
-              db = sb;
-            }
-          else
-            {
-              /* General pixel color blending.  */
-              color = *dstptr;
-
-              dr = (color >> 16) & 0xFF;
-              dr = alpha_dilute (dr, sr, a);
-              dg = (color >> 8) & 0xFF;
-              dg = alpha_dilute (dg, sg, a);
-              db = (color >> 0) & 0xFF;
-              db = alpha_dilute (db, sb, a);
-            }
-
-          color = (a << 24) | (dr << 16) | (dg << 8) | db;
-
-          *dstptr++ = color;
+            /* Opaque pixel shortcut.  */
+            *dstptr = swap_red_blue (color);
+          else if (a != 0)
+            /* General pixel color blending.  Transparent source pixels
+               are skipped.  */
+            *dstptr = blend_pixel32 (*dstptr, swap_red_blue (color), a);
+
+          dstptr++;
         }
 
       GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
@@ -1405,13 +1381,7 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
   int j;
   grub_uint32_t *srcptr;
   grub_uint32_t *dstptr;
-  unsigned int sr;
-  unsigned int sg;
-  unsigned int sb;
   unsigned int a;
-  unsigned int dr;
-  unsigned int dg;
-  unsigned int db;
   grub_size_t srcrowskip;
   grub_size_t dstrowskip;
 
@@ -1429,35 +1399,12 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
 
           a = color >> 24;
 
-          if (a == 0)
-            {
-              dstptr++;
-              continue;
-            }
-
           if (a == 255)
-            {
-              *dstptr++ = color;
-              continue;
-            }
-
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
-
-          color = *dstptr;
-
-          dr = (color >> 0) & 0xFF;
-          dg = (color >> 8) & 0xFF;
-          db = (color >> 16) & 0xFF;
+            *dstptr = color;
+          else if (a != 0)
+            *dstptr = blend_pixel32 (*dstptr, color, a);
 
-          dr = alpha_dilute (dr, sr, a);
-          dg = alpha_dilute (dg, sg, a);
-          db = alpha_dilute (db, sb, a);
-
-          color = (a << 24) | (db << 16) | (dg << 8) | dr;
-
-          *dstptr++ = color;
+          dstptr++;
         }
       GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
       GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
@@ -1641,6 +1588,7 @@ grub_video_fbblit_blend_XXXA8888_1bit (struct grub_video_fbblit_info *dst,
   unsigned int dstrowskip;
   unsigned int srcrowskipbyte, srcrowskipbit;
   grub_uint32_t fgcolor, bgcolor;
+  grub_uint8_t fgalpha, bgalpha;
   int bit_index;
 
   /* Calculate the number of bytes to advance from the end of one line
@@ -1664,42 +1612,63 @@ grub_video_fbblit_blend_XXXA8888_1bit (struct grub_video_fbblit_info *dst,
 				    src->mode_info->bg_blue,
 				    src->mode_info->bg_alpha);
 
+  fgalpha = src->mode_info->fg_alpha;
+  bgalpha = src->mode_info->bg_alpha;
+
   for (j = 0; j < height; j++)
     {
-      for (i = 0; i < width; i++)
+      i = 0;
+      while (i < width)
         {
 	  grub_uint32_t color;
 	  grub_uint8_t a;
 
+	  /* Glyphs are mostly transparent background: skip it and solid
+	     runs a byte at a time.  */
+	  if (srcmask == 0x80 && width - i >= 8)
+	    {
+	      if ((*srcptr == 0x00 && bgalpha == 0)
+		  || (*srcptr == 0xff && fgalpha == 0))
+		{
+		  srcptr++;
+		  dstptr += 8;
+		  i += 8;
+		  continue;
+		}
+	      if ((*srcptr == 0x00 && bgalpha == 255)
+		  || (*srcptr == 0xff && fgalpha == 255))
+		{
+		  color = *srcptr ? fgcolor : bgcolor;
+		  dstptr[0] = color;
+		  dstptr[1] = color;
+		  dstptr[2] = color;
+		  dstptr[3] = color;
+		  dstptr[4] = color;
+		  dstptr[5] = color;
+		  dstptr[6] = color;
+		  dstptr[7] = color;
+		  srcptr++;
+		  dstptr += 8;
+		  i += 8;
+		  continue;
+		}
+	    }
+
 	  if (*srcptr & srcmask)
 	    {
 	      color = fgcolor;
-	      a = src->mode_info->fg_alpha;
+	      a = fgalpha;
 	    }
 	  else
 	    {
 	      color = bgcolor;
-	      a = src->mode_info->bg_alpha;
+	      a = bgalpha;
 	    }
 
 	  if (a == 255)
 	    *dstptr = color;
 	  else if (a != 0)
-	    {
-	      grub_uint8_t s1 = (color >> 0) & 0xFF;
-	      grub_uint8_t s2 = (color >> 8) & 0xFF;
-	      grub_uint8_t s3 = (color >> 16) & 0xFF;
-
-	      grub_uint8_t d1 = (*dstptr >> 0) & 0xFF;
-	      grub_uint8_t d2 = (*dstptr >> 8) & 0xFF;
-	      grub_uint8_t d3 = (*dstptr >> 16) & 0xFF;
-
-	      d1 = alpha_dilute (d1, s1, a);
-	      d2 = alpha_dilute (d2, s2, a);
-	      d3 = alpha_dilute (d3, s3, a);
-
-	      *dstptr = (a << 24) | (d3 << 16) | (d2 << 8) | d1;
-	    }
+	    *dstptr = blend_pixel32 (*dstptr, color, a);
 
 	  srcmask >>= 1;
 	  if (!srcmask)
@@ -1709,6 +1678,7 @@ grub_video_fbblit_blend_XXXA8888_1bit (struct grub_video_fbblit_info *dst,
 	    }
 
 	  dstptr++;
+	  i++;
         }
 
       srcptr += srcrowskipbyte;
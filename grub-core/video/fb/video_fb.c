@@ -31,12 +31,6 @@ GRUB_MOD_LICENSE ("GPLv3+");
 typedef grub_err_t (*grub_video_fb_doublebuf_update_screen_t) (void);
 typedef volatile void *framebuf_t;
 
-struct dirty
-{
-  int first_line;
-  int last_line;
-};
-
 static struct
 {
   struct grub_video_fbrender_target *render_target;
@@ -46,8 +40,8 @@ static struct
 
   unsigned int palette_size;
 
-  struct dirty current_dirty;
-  struct dirty previous_dirty;
+  struct grub_video_damage current_dirty;
+  struct grub_video_damage previous_dirty;
 
   /* For page flipping strategy.  */
   int displayed_page;           /* The page # that is the front buffer.  */
@@ -830,14 +824,11 @@ grub_video_fb_unmap_color_int (struct grub_video_fbblit_info * source,
 }
 
 static void
-dirty (int y, int height)
+dirty (int x, int y, unsigned int width, unsigned int height)
 {
   if (framebuffer.render_target != framebuffer.back_target)
     return;
-  if (framebuffer.current_dirty.first_line > y)
-    framebuffer.current_dirty.first_line = y;
-  if (framebuffer.current_dirty.last_line < y + height)
-    framebuffer.current_dirty.last_line = y + height;
+  grub_video_damage_add (&framebuffer.current_dirty, x, y, width, height);
 }
 
 grub_err_t
@@ -895,7 +886,7 @@ grub_video_fb_fill_rect (grub_video_color_t color, int x, int y,
   x += area_x;
   y += area_y;
 
-  dirty (y, height);
+  dirty (x, y, width, height);
 
   /* Use fbblit_info to encapsulate rendering.  */
   target.mode_info = &framebuffer.render_target->mode_info;
@@ -1008,7 +999,7 @@ grub_video_fb_blit_source (struct grub_video_fbblit_info *source,
   target.data = framebuffer.render_target->data;
 
   /* Do actual blitting.  */
-  dirty (y, height);
+  dirty (x, y, width, height);
   grub_video_fb_dispatch_blit (&target, source, oper, x, y, width, height,
                                offset_x, offset_y);
 
@@ -1060,7 +1051,9 @@ grub_video_fb_scroll (grub_video_color_t color, int dx, int dy)
   width = framebuffer.render_target->viewport.width - grub_abs (dx);
   height = framebuffer.render_target->viewport.height - grub_abs (dy);
 
-  dirty (framebuffer.render_target->viewport.y,
+  dirty (framebuffer.render_target->viewport.x,
+	 framebuffer.render_target->viewport.y,
+	 framebuffer.render_target->viewport.width,
 	 framebuffer.render_target->viewport.height);
 
   if (dx < 0)
@@ -1412,23 +1405,80 @@ grub_video_fb_get_active_render_target (struct grub_video_fbrender_target **targ
   return GRUB_ERR_NONE;
 }
 
+/* Video memory is uncached or write-combined, where byte stores, as
+   grub_memcpy does, are many times slower than word stores.  */
+static void
+copy_to_video (grub_uint8_t *dst, const grub_uint8_t *src, grub_size_t len)
+{
+  if (((grub_addr_t) dst ^ (grub_addr_t) src) & (sizeof (grub_addr_t) - 1))
+    {
+      grub_memcpy (dst, src, len);
+      return;
+    }
+
+  for (; len && ((grub_addr_t) dst & (sizeof (grub_addr_t) - 1)); len--)
+    *dst++ = *src++;
+  for (; len >= 4 * sizeof (grub_addr_t); len -= 4 * sizeof (grub_addr_t))
+    {
+      ((grub_addr_t *) dst)[0] = ((const grub_addr_t *) src)[0];
+      ((grub_addr_t *) dst)[1] = ((const grub_addr_t *) src)[1];
+      ((grub_addr_t *) dst)[2] = ((const grub_addr_t *) src)[2];
+      ((grub_addr_t *) dst)[3] = ((const grub_addr_t *) src)[3];
+      dst += 4 * sizeof (grub_addr_t);
+      src += 4 * sizeof (grub_addr_t);
+    }
+  for (; len >= sizeof (grub_addr_t); len -= sizeof (grub_addr_t))
+    {
+      *(grub_addr_t *) dst = *(const grub_addr_t *) src;
+      dst += sizeof (grub_addr_t);
+      src += sizeof (grub_addr_t);
+    }
+  while (len--)
+    *dst++ = *src++;
+}
+
+/* Copy the damaged parts of the back buffer to PAGE.  Rows are widened
+   to whole 64-byte blocks so that the stores fill the write-combining
+   buffers.  */
+static void
+update_page (framebuf_t page, const struct grub_video_damage *damage)
+{
+  const struct grub_video_mode_info *mode_info
+    = &framebuffer.back_target->mode_info;
+  grub_uint8_t *dst = (grub_uint8_t *) page;
+  const grub_uint8_t *src = framebuffer.back_target->data;
+  unsigned i, y;
+
+  for (i = 0; i < damage->count; i++)
+    {
+      const grub_video_rect_t *r = &damage->rects[i];
+      grub_size_t start, end, offset;
+
+      start = ((grub_size_t) r->x * mode_info->bpp / 8) & ~(grub_size_t) 63;
+      end = ALIGN_UP (((grub_size_t) (r->x + r->width) * mode_info->bpp
+		       + 7) / 8, 64);
+      if (end > mode_info->pitch)
+	end = mode_info->pitch;
+      offset = (grub_size_t) r->y * mode_info->pitch;
+
+      if (start == 0 && end == mode_info->pitch)
+	{
+	  copy_to_video (dst + offset, src + offset,
+			 (grub_size_t) r->height * mode_info->pitch);
+	  continue;
+	}
+
+      for (y = 0; y < r->height; y++, offset += mode_info->pitch)
+	copy_to_video (dst + offset + start, src + offset + start,
+		       end - start);
+    }
+}
+
 static grub_err_t
 doublebuf_blit_update_screen (void)
 {
-  if (framebuffer.current_dirty.first_line
-      <= framebuffer.current_dirty.last_line)
-    grub_memcpy ((char *) framebuffer.pages[0]
-		 + framebuffer.current_dirty.first_line
-		 * framebuffer.back_target->mode_info.pitch,
-		 (char *) framebuffer.back_target->data
-		 + framebuffer.current_dirty.first_line
-		 * framebuffer.back_target->mode_info.pitch,
-		 framebuffer.back_target->mode_info.pitch
-		 * (framebuffer.current_dirty.last_line
-		    - framebuffer.current_dirty.first_line));
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  update_page (framebuffer.pages[0], &framebuffer.current_dirty);
+  grub_video_damage_reset (&framebuffer.current_dirty);
 
   return GRUB_ERR_NONE;
 }
@@ -1461,8 +1511,7 @@ grub_video_fb_doublebuf_blit_init (struct grub_video_fbrender_target **back,
   framebuffer.pages[0] = framebuf;
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
-  framebuffer.current_dirty.first_line = mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  grub_video_damage_reset (&framebuffer.current_dirty);
 
   return GRUB_ERR_NONE;
 }
@@ -1472,26 +1521,20 @@ doublebuf_pageflipping_update_screen (void)
 {
   int new_displayed_page;
   grub_err_t err;
-  int first_line, last_line;
-
-  first_line = framebuffer.current_dirty.first_line;
-  last_line = framebuffer.current_dirty.last_line;
-  if (first_line > framebuffer.previous_dirty.first_line)
-    first_line = framebuffer.previous_dirty.first_line;
-  if (last_line < framebuffer.previous_dirty.last_line)
-    last_line = framebuffer.previous_dirty.last_line;
-
-  if (first_line <= last_line)
-    grub_memcpy ((char *) framebuffer.pages[framebuffer.render_page]
-		 + first_line * framebuffer.back_target->mode_info.pitch,
-		 (char *) framebuffer.back_target->data
-		 + first_line * framebuffer.back_target->mode_info.pitch,
-		 framebuffer.back_target->mode_info.pitch
-		 * (last_line - first_line));
+  struct grub_video_damage damage;
+  unsigned i;
+
+  /* The page being rendered to also misses what changed on the other
+     one last time.  */
+  damage = framebuffer.previous_dirty;
+  for (i = 0; i < framebuffer.current_dirty.count; i++)
+    grub_video_damage_add (&damage, framebuffer.current_dirty.rects[i].x,
+			   framebuffer.current_dirty.rects[i].y,
+			   framebuffer.current_dirty.rects[i].width,
+			   framebuffer.current_dirty.rects[i].height);
+  update_page (framebuffer.pages[framebuffer.render_page], &damage);
   framebuffer.previous_dirty = framebuffer.current_dirty;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  grub_video_damage_reset (&framebuffer.current_dirty);
 
   /* Swap the page numbers in the framebuffer struct.  */
   new_displayed_page = framebuffer.render_page;
@@ -1544,12 +1587,8 @@ doublebuf_pageflipping_init (struct grub_video_mode_info *mode_info,
   framebuffer.pages[0] = page0_ptr;
   framebuffer.pages[1] = page1_ptr;
 
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
-  framebuffer.previous_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.previous_dirty.last_line = 0;
+  grub_video_damage_reset (&framebuffer.current_dirty);
+  grub_video_damage_reset (&framebuffer.previous_dirty);
 
   /* Set the framebuffer memory data pointer and display the right page.  */
   err = set_page_in (framebuffer.displayed_page);
@@ -1635,9 +1674,7 @@ grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
   framebuffer.set_page = 0;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  grub_video_damage_reset (&framebuffer.current_dirty);
 
   mode_info->mode_type &= ~GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED;
 
@@ -31,12 +31,22 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define JPEG_ESC_CHAR		0xFF
 
-#define JPEG_SAMPLING_1x1	0x11
-
 enum
   {
     JPEG_MARKER_SOF0 = 0xc0,
+    JPEG_MARKER_SOF1 = 0xc1,
+    JPEG_MARKER_SOF2 = 0xc2,
+    JPEG_MARKER_SOF3 = 0xc3,
     JPEG_MARKER_DHT  = 0xc4,
+    JPEG_MARKER_SOF5 = 0xc5,
+    JPEG_MARKER_SOF6 = 0xc6,
+    JPEG_MARKER_SOF7 = 0xc7,
+    JPEG_MARKER_SOF9 = 0xc9,
+    JPEG_MARKER_SOF10 = 0xca,
+    JPEG_MARKER_SOF11 = 0xcb,
+    JPEG_MARKER_SOF13 = 0xcd,
+    JPEG_MARKER_SOF14 = 0xce,
+    JPEG_MARKER_SOF15 = 0xcf,
     JPEG_MARKER_SOI  = 0xd8,
     JPEG_MARKER_EOI  = 0xd9,
     JPEG_MARKER_RST0 = 0xd0,
@@ -57,6 +67,15 @@ enum
 
 #define JPEG_UNIT_SIZE		8
 
+/* Huffman codes up to this long are decoded with a single lookup.  */
+#define JPEG_HUFF_FAST_BITS	9
+
+/* Entropy coded data is read in blocks of this size.  */
+#define JPEG_INBUF_SIZE		0x2000
+
+#define JPEG_MAX_COMPONENTS	3
+#define JPEG_MAX_SAMPLING	4
+
 static const grub_uint8_t jpeg_zigzag_order[64] = {
   0, 1, 8, 16, 9, 2, 3, 10,
   17, 24, 32, 25, 18, 11, 4, 5,
@@ -74,35 +93,75 @@ static grub_command_t cmd;
 
 typedef int jpeg_data_unit_t[64];
 
+struct grub_jpeg_component
+{
+  int id;
+  /* Sampling factors, and the shifts from image to component
+     coordinates they amount to.  */
+  unsigned hs, vs;
+  unsigned log_h, log_v;
+  int qt, dc_table, ac_table;
+  int dc_value;
+
+  /* Blocks in the component, rounded up to whole MCUs, and those
+     actually covering the image.  */
+  unsigned blocks_w, blocks_h;
+  unsigned real_blocks_w, real_blocks_h;
+
+  /* Coefficients of all blocks in natural order, for images that take
+     several scans.  */
+  grub_int16_t *coefs;
+
+  /* Samples of the current MCU row.  */
+  grub_uint8_t *plane;
+  unsigned pitch;
+};
+
 struct grub_jpeg_data
 {
   grub_file_t file;
   struct grub_video_bitmap **bitmap;
-  grub_uint8_t *bitmap_ptr;
 
   unsigned image_width;
   unsigned image_height;
 
-  grub_uint8_t *huff_value[4];
-  int huff_offset[4][16];
-  int huff_maxval[4][16];
+  /* DC tables come first, then AC ones.  */
+  grub_uint8_t *huff_value[8];
+  int huff_offset[8][16];
+  int huff_maxval[8][16];
+  /* Indexed by the next JPEG_HUFF_FAST_BITS bits of input, the value
+     in the low byte and the code length above, or 0 for longer
+     codes.  */
+  grub_uint16_t huff_fast[8][1 << JPEG_HUFF_FAST_BITS];
 
-  grub_uint8_t quan_table[2][64];
-  int comp_index[3][3];
+  /* In natural order.  */
+  grub_uint8_t quan_table[4][64];
 
-  jpeg_data_unit_t ydu[4];
-  jpeg_data_unit_t crdu;
-  jpeg_data_unit_t cbdu;
+  struct grub_jpeg_component comp[JPEG_MAX_COMPONENTS];
+  int color_components;
+  unsigned max_hs, max_vs;
+  unsigned mcus_w, mcus_h;
+  int progressive;
+
+  /* The current scan.  */
+  struct grub_jpeg_component *scan_comp[JPEG_MAX_COMPONENTS];
+  int scan_components;
+  int ss, se, ah, al;
+  unsigned eobrun;
 
-  unsigned log_vs, log_hs;
   int dri;
-  unsigned r1;
 
-  int dc_value[3];
+  grub_uint8_t inbuf[JPEG_INBUF_SIZE];
+  unsigned in_pos, in_len;
+  /* Zero bits added past the end of the entropy coded data.  */
+  int pad_bits;
 
-  int color_components;
+  grub_uint32_t bit_save;
+  int bit_count;
 
-  int bit_mask, bit_save;
+  grub_int16_t block[64];
+
+  int cr_r[256], cb_b[256], cr_g[256], cb_g[256];
 };
 
 static grub_uint8_t
@@ -127,43 +186,103 @@ grub_jpeg_get_word (struct grub_jpeg_data *data)
   return grub_be_to_cpu16 (r);
 }
 
+/* Make sure N bytes of entropy coded data are buffered, if the file
+   has them.  */
 static int
-grub_jpeg_get_bit (struct grub_jpeg_data *data)
+grub_jpeg_input_avail (struct grub_jpeg_data *data, unsigned n)
 {
-  int ret;
+  if (data->in_len - data->in_pos < n)
+    {
+      grub_ssize_t r;
+
+      grub_memmove (data->inbuf, data->inbuf + data->in_pos,
+		    data->in_len - data->in_pos);
+      data->in_len -= data->in_pos;
+      data->in_pos = 0;
+
+      r = grub_file_read (data->file, data->inbuf + data->in_len,
+			  JPEG_INBUF_SIZE - data->in_len);
+      if (r > 0)
+	data->in_len += r;
+    }
 
-  if (data->bit_mask == 0)
+  return data->in_len - data->in_pos >= n;
+}
+
+/* Give back what was read ahead, so that markers can be read from the
+   file again.  */
+static void
+grub_jpeg_release_input (struct grub_jpeg_data *data)
+{
+  grub_file_seek (data->file,
+		  data->file->offset - (data->in_len - data->in_pos));
+  data->in_pos = data->in_len = 0;
+  data->bit_save = 0;
+  data->bit_count = 0;
+  data->pad_bits = 0;
+}
+
+/* Have at least 25 bits at hand.  The data ends at a marker or at the
+   end of the file, past which the bits are zero.  */
+static void
+grub_jpeg_fill_bits (struct grub_jpeg_data *data)
+{
+  while (data->bit_count <= 24)
     {
-      data->bit_save = grub_jpeg_get_byte (data);
-      if (data->bit_save == JPEG_ESC_CHAR)
+      grub_uint32_t b = 0;
+
+      if (data->pad_bits
+	  || (data->in_pos == data->in_len && !grub_jpeg_input_avail (data, 1)))
+	data->pad_bits += 8;
+      else
 	{
-	  if (grub_jpeg_get_byte (data) != 0)
+	  b = data->inbuf[data->in_pos];
+	  if (b != JPEG_ESC_CHAR)
+	    data->in_pos++;
+	  else if (grub_jpeg_input_avail (data, 2)
+		   && data->inbuf[data->in_pos + 1] == 0)
+	    data->in_pos += 2;
+	  else
 	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			  "jpeg: invalid 0xFF in data stream");
-	      return 0;
+	      data->pad_bits += 8;
+	      b = 0;
 	    }
 	}
-      data->bit_mask = 0x80;
+
+      data->bit_save |= b << (24 - data->bit_count);
+      data->bit_count += 8;
     }
+}
+
+static int
+grub_jpeg_get_bits (struct grub_jpeg_data *data, int num)
+{
+  int ret;
 
-  ret = ((data->bit_save & data->bit_mask) != 0);
-  data->bit_mask >>= 1;
+  if (data->bit_count < num)
+    grub_jpeg_fill_bits (data);
+
+  ret = data->bit_save >> (32 - num);
+  data->bit_save <<= num;
+  data->bit_count -= num;
   return ret;
 }
 
 static int
 grub_jpeg_get_number (struct grub_jpeg_data *data, int num)
 {
-  int value, i, msb;
+  int value;
 
   if (num == 0)
     return 0;
+  if (num > 16)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid coefficient size");
+      return 0;
+    }
 
-  msb = value = grub_jpeg_get_bit (data);
-  for (i = 1; i < num; i++)
-    value = (value << 1) + (grub_jpeg_get_bit (data) != 0);
-  if (!msb)
+  value = grub_jpeg_get_bits (data, num);
+  if (value < (1 << (num - 1)))
     value += 1 - (1 << num);
 
   return value;
@@ -172,17 +291,33 @@ grub_jpeg_get_number (struct grub_jpeg_data *data, int num)
 static int
 grub_jpeg_get_huff_code (struct grub_jpeg_data *data, int id)
 {
-  int code;
+  int entry, code, len;
   unsigned i;
 
-  code = 0;
-  for (i = 0; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
+  if (data->bit_count < 16)
+    grub_jpeg_fill_bits (data);
+
+  entry = data->huff_fast[id][data->bit_save >> (32 - JPEG_HUFF_FAST_BITS)];
+  if (entry)
     {
-      code <<= 1;
-      if (grub_jpeg_get_bit (data))
-	code++;
+      len = entry >> 8;
+      data->bit_save <<= len;
+      data->bit_count -= len;
+      return entry & 0xff;
+    }
+
+  for (i = JPEG_HUFF_FAST_BITS; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
+    {
+      code = data->bit_save >> (31 - i);
       if (code < data->huff_maxval[id][i])
-	return data->huff_value[id][code + data->huff_offset[id][i]];
+	{
+	  /* Only broken tables have codes below those of this length.  */
+	  if (code + data->huff_offset[id][i] < 0)
+	    break;
+	  data->bit_save <<= i + 1;
+	  data->bit_count -= i + 1;
+	  return data->huff_value[id][code + data->huff_offset[id][i]];
+	}
     }
   grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: huffman decode fails");
   return 0;
@@ -194,7 +329,7 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
   int id, ac, n, base, ofs;
   grub_uint32_t next_marker;
   grub_uint8_t count[16];
-  unsigned i;
+  unsigned i, j;
 
   next_marker = data->file->offset;
   next_marker += grub_jpeg_get_word (data);
@@ -204,7 +339,7 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
       id = grub_jpeg_get_byte (data);
       ac = (id >> 4) & 1;
       id &= 0xF;
-      if (id > 1)
+      if (id > 3)
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: too many huffman tables");
 
@@ -216,7 +351,8 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
       for (i = 0; i < ARRAY_SIZE (count); i++)
 	n += count[i];
 
-      id += ac * 2;
+      id += ac * 4;
+      grub_free (data->huff_value[id]);
       data->huff_value[id] = grub_malloc (n);
       if (grub_errno)
 	return grub_errno;
@@ -224,10 +360,27 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
       if (grub_file_read (data->file, data->huff_value[id], n) != n)
 	return grub_errno;
 
+      grub_memset (data->huff_fast[id], 0, sizeof (data->huff_fast[id]));
+
       base = 0;
       ofs = 0;
       for (i = 0; i < ARRAY_SIZE (count); i++)
 	{
+	  unsigned len = i + 1;
+
+	  /* Codes are read from their high bit, so a short code fills
+	     all the entries it is a prefix of.  */
+	  if (len <= JPEG_HUFF_FAST_BITS
+	      && (unsigned) (base + count[i]) <= (1U << len))
+	    for (j = 0; j < count[i]; j++)
+	      {
+		unsigned k, shift = JPEG_HUFF_FAST_BITS - len;
+
+		for (k = (base + j) << shift; k < (base + j + 1U) << shift; k++)
+		  data->huff_fast[id][k] = (len << 8)
+		    | data->huff_value[id][ofs + j];
+	      }
+
 	  base += count[i];
 	  ofs += count[i];
 
@@ -253,23 +406,27 @@ grub_jpeg_decode_quan_table (struct grub_jpeg_data *data)
   next_marker = data->file->offset;
   next_marker += grub_jpeg_get_word (data);
 
-  while (data->file->offset + sizeof (data->quan_table[id]) + 1
+  while (data->file->offset + sizeof (data->quan_table[0]) + 1
 	 <= next_marker)
     {
+      grub_uint8_t table[64];
+      unsigned i;
+
       id = grub_jpeg_get_byte (data);
       if (id >= 0x10)		/* Upper 4-bit is precision.  */
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: only 8-bit precision is supported");
 
-      if (id > 1)
+      if (id > 3)
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: too many quantization tables");
 
-      if (grub_file_read (data->file, &data->quan_table[id],
-			  sizeof (data->quan_table[id]))
-	  != sizeof (data->quan_table[id]))
+      if (grub_file_read (data->file, table, sizeof (table))
+	  != sizeof (table))
 	return grub_errno;
 
+      for (i = 0; i < ARRAY_SIZE (table); i++)
+	data->quan_table[id][jpeg_zigzag_order[i]] = table[i];
     }
 
   if (data->file->offset != next_marker)
@@ -285,6 +442,9 @@ grub_jpeg_decode_sof (struct grub_jpeg_data *data)
   int i, cc;
   grub_uint32_t next_marker;
 
+  if (*data->bitmap)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: more than one frame");
+
   next_marker = data->file->offset;
   next_marker += grub_jpeg_get_word (data);
 
@@ -304,36 +464,100 @@ grub_jpeg_decode_sof (struct grub_jpeg_data *data)
 		       "jpeg: component count must be 1 or 3");
   data->color_components = cc;
 
+  data->max_hs = data->max_vs = 1;
   for (i = 0; i < cc; i++)
     {
-      int id, ss;
-
-      id = grub_jpeg_get_byte (data) - 1;
-      if ((id < 0) || (id >= 3))
-	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid index");
+      struct grub_jpeg_component *comp = &data->comp[i];
+      int ss;
 
+      comp->id = grub_jpeg_get_byte (data);
       ss = grub_jpeg_get_byte (data);	/* Sampling factor.  */
-      if (!id)
-	{
-	  grub_uint8_t vs, hs;
-	  vs = ss & 0xF;	/* Vertical sampling.  */
-	  hs = ss >> 4;	/* Horizontal sampling.  */
-	  if ((vs > 2) || (hs > 2) || (vs == 0) || (hs == 0))
-	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			       "jpeg: sampling method not supported");
-	  data->log_vs = (vs == 2);
-	  data->log_hs = (hs == 2);
-	}
-      else if (ss != JPEG_SAMPLING_1x1)
+      comp->vs = ss & 0xF;	/* Vertical sampling.  */
+      comp->hs = ss >> 4;	/* Horizontal sampling.  */
+      comp->qt = grub_jpeg_get_byte (data);
+      if ((comp->vs > JPEG_MAX_SAMPLING) || (comp->hs > JPEG_MAX_SAMPLING)
+	  || (comp->vs == 0) || (comp->hs == 0))
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: sampling method not supported");
-      data->comp_index[id][0] = grub_jpeg_get_byte (data);
+      if (comp->qt > 3)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid index");
+
+      /* A single component is always coded a block at a time.  */
+      if (cc == 1)
+	comp->hs = comp->vs = 1;
+
+      if (comp->hs > data->max_hs)
+	data->max_hs = comp->hs;
+      if (comp->vs > data->max_vs)
+	data->max_vs = comp->vs;
     }
 
   if (data->file->offset != next_marker)
-    grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in sof");
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in sof");
 
-  return grub_errno;
+  data->mcus_w = ((data->image_width + data->max_hs * JPEG_UNIT_SIZE - 1)
+		  / (data->max_hs * JPEG_UNIT_SIZE));
+  data->mcus_h = ((data->image_height + data->max_vs * JPEG_UNIT_SIZE - 1)
+		  / (data->max_vs * JPEG_UNIT_SIZE));
+
+  /* The bitmap, and the image padded to whole MCUs, must stay within
+     an int.  */
+  if ((grub_uint64_t) data->mcus_w * data->max_hs * JPEG_UNIT_SIZE
+      * data->mcus_h * data->max_vs * JPEG_UNIT_SIZE * 3 > GRUB_INT_MAX)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid image size");
+
+  for (i = 0; i < cc; i++)
+    {
+      struct grub_jpeg_component *comp = &data->comp[i];
+      unsigned w, h;
+
+      /* Components are upsampled by replicating their samples, which
+	 takes whole powers of two.  */
+      for (comp->log_h = 0; (comp->hs << comp->log_h) < data->max_hs;
+	   comp->log_h++);
+      for (comp->log_v = 0; (comp->vs << comp->log_v) < data->max_vs;
+	   comp->log_v++);
+      if ((comp->hs << comp->log_h) != data->max_hs
+	  || (comp->vs << comp->log_v) != data->max_vs)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: sampling method not supported");
+
+      comp->blocks_w = data->mcus_w * comp->hs;
+      comp->blocks_h = data->mcus_h * comp->vs;
+      w = (data->image_width * comp->hs + data->max_hs - 1) / data->max_hs;
+      h = (data->image_height * comp->vs + data->max_vs - 1) / data->max_vs;
+      comp->real_blocks_w = (w + JPEG_UNIT_SIZE - 1) / JPEG_UNIT_SIZE;
+      comp->real_blocks_h = (h + JPEG_UNIT_SIZE - 1) / JPEG_UNIT_SIZE;
+
+      comp->pitch = comp->blocks_w * JPEG_UNIT_SIZE;
+      comp->plane = grub_malloc (comp->pitch * comp->vs * JPEG_UNIT_SIZE);
+      if (!comp->plane)
+	return grub_errno;
+
+      if (data->progressive)
+	{
+	  grub_size_t n = comp->blocks_w * comp->blocks_h;
+
+	  if (n > GRUB_SIZE_MAX / sizeof (data->block))
+	    return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+	  comp->coefs = grub_zalloc (n * sizeof (data->block));
+	  if (!comp->coefs)
+	    return grub_errno;
+	}
+    }
+
+  if (cc == 3)
+    for (i = 0; i < 256; i++)
+      {
+	data->cr_r[i] = ((i - 128) * CONST (1.402)) >> SHIFT_BITS;
+	data->cb_b[i] = ((i - 128) * CONST (1.772)) >> SHIFT_BITS;
+	data->cr_g[i] = (i - 128) * CONST (0.71414);
+	data->cb_g[i] = (i - 128) * CONST (0.34414);
+      }
+
+  return grub_video_bitmap_create (data->bitmap, data->image_width,
+				   data->image_height,
+				   GRUB_VIDEO_BLIT_FORMAT_RGB_888);
 }
 
 static grub_err_t
@@ -348,8 +572,18 @@ grub_jpeg_decode_dri (struct grub_jpeg_data *data)
   return grub_errno;
 }
 
+static inline grub_uint8_t __attribute__ ((always_inline))
+grub_jpeg_clamp (int v)
+{
+  if ((unsigned) v > 255)
+    return v < 0 ? 0 : 255;
+  return v;
+}
+
+/* Transform DU and store the samples at OUT, PITCH bytes apart.  */
 static void
-grub_jpeg_idct_transform (jpeg_data_unit_t du)
+grub_jpeg_idct_transform (jpeg_data_unit_t du, grub_uint8_t *out,
+			  unsigned pitch)
 {
   int *pd;
   int i;
@@ -364,7 +598,7 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
 	   pd[JPEG_UNIT_SIZE * 5] | pd[JPEG_UNIT_SIZE * 6] |
 	   pd[JPEG_UNIT_SIZE * 7]) == 0)
 	{
-	  pd[JPEG_UNIT_SIZE * 0] <<= SHIFT_BITS;
+	  pd[JPEG_UNIT_SIZE * 0] *= 1 << SHIFT_BITS;
 
 	  pd[JPEG_UNIT_SIZE * 1] = pd[JPEG_UNIT_SIZE * 2]
 	    = pd[JPEG_UNIT_SIZE * 3] = pd[JPEG_UNIT_SIZE * 4]
@@ -381,8 +615,8 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
 
       v4 = (t1 + t3) * CONST (0.541196100);
 
-      v0 = ((t0 + t2) << SHIFT_BITS);
-      v1 = ((t0 - t2) << SHIFT_BITS);
+      v0 = (t0 + t2) * (1 << SHIFT_BITS);
+      v1 = (t0 - t2) * (1 << SHIFT_BITS);
       v2 = v4 - t3 * CONST (1.847759065);
       v3 = v4 + t1 * CONST (0.765366865);
 
@@ -424,19 +658,20 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
     }
 
   pd = du;
-  for (i = 0; i < JPEG_UNIT_SIZE; i++, pd += JPEG_UNIT_SIZE)
+  for (i = 0; i < JPEG_UNIT_SIZE; i++, pd += JPEG_UNIT_SIZE, out += pitch)
     {
       if ((pd[1] | pd[2] | pd[3] | pd[4] | pd[5] | pd[6] | pd[7]) == 0)
 	{
-	  pd[0] >>= (SHIFT_BITS + 3);
-	  pd[1] = pd[2] = pd[3] = pd[4] = pd[5] = pd[6] = pd[7] = pd[0];
+	  out[0] = grub_jpeg_clamp ((pd[0] >> (SHIFT_BITS + 3)) + 128);
+	  out[1] = out[2] = out[3] = out[4] = out[5] = out[6] = out[7]
+	    = out[0];
 	  continue;
 	}
 
       v4 = (pd[2] + pd[6]) * CONST (0.541196100);
 
-      v0 = (pd[0] + pd[4]) << SHIFT_BITS;
-      v1 = (pd[0] - pd[4]) << SHIFT_BITS;
+      v0 = (pd[0] + pd[4]) * (1 << SHIFT_BITS);
+      v1 = (pd[0] - pd[4]) * (1 << SHIFT_BITS);
       v2 = v4 - pd[6] * CONST (1.847759065);
       v3 = v4 + pd[2] * CONST (0.765366865);
 
@@ -467,224 +702,542 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
       t6 = t6 * CONST (3.072711026) - v1 - v2;
       t7 = t7 * CONST (1.501321110) - v0 - v3;
 
-      pd[0] = (t0 + t7) >> (SHIFT_BITS * 2 + 3);
-      pd[7] = (t0 - t7) >> (SHIFT_BITS * 2 + 3);
-      pd[1] = (t1 + t6) >> (SHIFT_BITS * 2 + 3);
-      pd[6] = (t1 - t6) >> (SHIFT_BITS * 2 + 3);
-      pd[2] = (t2 + t5) >> (SHIFT_BITS * 2 + 3);
-      pd[5] = (t2 - t5) >> (SHIFT_BITS * 2 + 3);
-      pd[3] = (t3 + t4) >> (SHIFT_BITS * 2 + 3);
-      pd[4] = (t3 - t4) >> (SHIFT_BITS * 2 + 3);
+      out[0] = grub_jpeg_clamp (((t0 + t7) >> (SHIFT_BITS * 2 + 3)) + 128);
+      out[7] = grub_jpeg_clamp (((t0 - t7) >> (SHIFT_BITS * 2 + 3)) + 128);
+      out[1] = grub_jpeg_clamp (((t1 + t6) >> (SHIFT_BITS * 2 + 3)) + 128);
+      out[6] = grub_jpeg_clamp (((t1 - t6) >> (SHIFT_BITS * 2 + 3)) + 128);
+      out[2] = grub_jpeg_clamp (((t2 + t5) >> (SHIFT_BITS * 2 + 3)) + 128);
+      out[5] = grub_jpeg_clamp (((t2 - t5) >> (SHIFT_BITS * 2 + 3)) + 128);
+      out[3] = grub_jpeg_clamp (((t3 + t4) >> (SHIFT_BITS * 2 + 3)) + 128);
+      out[4] = grub_jpeg_clamp (((t3 - t4) >> (SHIFT_BITS * 2 + 3)) + 128);
     }
+}
+
+/* Dequantize the coefficients of a block and transform them into
+   samples.  */
+static void
+grub_jpeg_output_block (struct grub_jpeg_data *data,
+			struct grub_jpeg_component *comp,
+			const grub_int16_t *coefs, grub_uint8_t *out)
+{
+  const grub_uint8_t *qt = data->quan_table[comp->qt];
+  jpeg_data_unit_t du;
+  int ac = 0;
+  unsigned i;
+
+  for (i = 1; i < 64; i++)
+    ac |= coefs[i];
 
-  for (i = 0; i < JPEG_UNIT_SIZE * JPEG_UNIT_SIZE; i++)
+  /* Most blocks of smooth areas only have a DC coefficient, which
+     makes all samples the same.  */
+  if (!ac)
     {
-      du[i] += 128;
+      grub_uint8_t v = grub_jpeg_clamp ((coefs[0] * qt[0] >> 3) + 128);
 
-      if (du[i] < 0)
-	du[i] = 0;
-      if (du[i] > 255)
-	du[i] = 255;
+      for (i = 0; i < JPEG_UNIT_SIZE; i++, out += comp->pitch)
+	grub_memset (out, v, JPEG_UNIT_SIZE);
+      return;
     }
+
+  for (i = 0; i < 64; i++)
+    du[i] = coefs[i] * qt[i];
+
+  grub_jpeg_idct_transform (du, out, comp->pitch);
 }
 
 static void
-grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
+grub_jpeg_decode_block_baseline (struct grub_jpeg_data *data,
+				 struct grub_jpeg_component *comp,
+				 grub_int16_t *coefs)
 {
-  int h1, h2, qt;
   unsigned pos;
 
-  grub_memset (du, 0, sizeof (jpeg_data_unit_t));
-
-  qt = data->comp_index[id][0];
-  h1 = data->comp_index[id][1];
-  h2 = data->comp_index[id][2];
+  grub_memset (coefs, 0, sizeof (data->block));
 
-  data->dc_value[id] +=
-    grub_jpeg_get_number (data, grub_jpeg_get_huff_code (data, h1));
+  comp->dc_value +=
+    grub_jpeg_get_number (data, grub_jpeg_get_huff_code (data,
+							 comp->dc_table));
+  coefs[0] = comp->dc_value;
 
-  du[0] = data->dc_value[id] * (int) data->quan_table[qt][0];
-  pos = 1;
-  while (pos < ARRAY_SIZE (data->quan_table[qt]))
+  for (pos = 1; pos < 64; pos++)
     {
-      int num, val;
+      int num;
 
-      num = grub_jpeg_get_huff_code (data, h2);
-      if (!num)
+      num = grub_jpeg_get_huff_code (data, comp->ac_table);
+      if (!(num & 0xF))
+	{
+	  /* End of block, or a run of 16 zeros.  */
+	  if (num != 0xF0)
+	    break;
+	  pos += 15;
+	  continue;
+	}
+
+      pos += num >> 4;
+      if (pos >= 64)
 	break;
+      coefs[jpeg_zigzag_order[pos]] = grub_jpeg_get_number (data, num & 0xF);
+    }
+}
+
+static void
+grub_jpeg_decode_block_dc (struct grub_jpeg_data *data,
+			   struct grub_jpeg_component *comp,
+			   grub_int16_t *coefs)
+{
+  if (data->ah)
+    {
+      if (grub_jpeg_get_bits (data, 1))
+	coefs[0] |= 1 << data->al;
+      return;
+    }
 
-      val = grub_jpeg_get_number (data, num & 0xF);
-      num >>= 4;
-      pos += num;
-      du[jpeg_zigzag_order[pos]] = val * (int) data->quan_table[qt][pos];
-      pos++;
+  comp->dc_value +=
+    grub_jpeg_get_number (data, grub_jpeg_get_huff_code (data,
+							 comp->dc_table));
+  coefs[0] = comp->dc_value * (1 << data->al);
+}
+
+static void
+grub_jpeg_decode_block_ac_first (struct grub_jpeg_data *data,
+				 struct grub_jpeg_component *comp,
+				 grub_int16_t *coefs)
+{
+  int k;
+
+  if (data->eobrun)
+    {
+      data->eobrun--;
+      return;
     }
 
-  grub_jpeg_idct_transform (du);
+  for (k = data->ss; k <= data->se; k++)
+    {
+      int rs, r, s;
+
+      rs = grub_jpeg_get_huff_code (data, comp->ac_table);
+      r = rs >> 4;
+      s = rs & 0xF;
+      if (s)
+	{
+	  k += r;
+	  if (k > data->se)
+	    break;
+	  coefs[jpeg_zigzag_order[k]] = grub_jpeg_get_number (data, s)
+	    * (1 << data->al);
+	}
+      else if (r == 15)
+	k += 15;
+      else
+	{
+	  /* A run of blocks without more coefficients in this band.  */
+	  data->eobrun = (1 << r) - 1;
+	  if (r)
+	    data->eobrun += grub_jpeg_get_bits (data, r);
+	  break;
+	}
+    }
+}
+
+/* Add a correction bit to a coefficient that already is nonzero.  */
+static inline void
+grub_jpeg_refine_coef (struct grub_jpeg_data *data, grub_int16_t *coef)
+{
+  int bit = 1 << data->al;
+
+  if (grub_jpeg_get_bits (data, 1) && (*coef & bit) == 0)
+    {
+      if (*coef >= 0)
+	*coef += bit;
+      else
+	*coef -= bit;
+    }
 }
 
 static void
-grub_jpeg_ycrcb_to_rgb (int yy, int cr, int cb, grub_uint8_t * rgb)
+grub_jpeg_decode_block_ac_refine (struct grub_jpeg_data *data,
+				  struct grub_jpeg_component *comp,
+				  grub_int16_t *coefs)
 {
-  int dd;
+  int k = data->ss;
 
-  cr -= 128;
-  cb -= 128;
+  if (!data->eobrun)
+    for (; k <= data->se; k++)
+      {
+	int rs, r, s;
+
+	rs = grub_jpeg_get_huff_code (data, comp->ac_table);
+	r = rs >> 4;
+	s = rs & 0xF;
+	if (s)
+	  /* The new coefficient can only be 1 or -1.  */
+	  s = grub_jpeg_get_bits (data, 1) ? 1 << data->al : -(1 << data->al);
+	else if (r != 15)
+	  {
+	    data->eobrun = 1 << r;
+	    if (r)
+	      data->eobrun += grub_jpeg_get_bits (data, r);
+	    break;
+	  }
 
-  /* Red  */
-  dd = yy + ((cr * CONST (1.402)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[2] = dd;
-#else
-  *(rgb++) = dd;
-#endif
+	/* Skip R zero coefficients, refining the nonzero ones on the
+	   way.  */
+	for (; k <= data->se; k++)
+	  {
+	    grub_int16_t *coef = &coefs[jpeg_zigzag_order[k]];
 
-  /* Green  */
-  dd = yy - ((cb * CONST (0.34414) + cr * CONST (0.71414)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[1] = dd;
-#else
-  *(rgb++) = dd;
-#endif
+	    if (*coef)
+	      grub_jpeg_refine_coef (data, coef);
+	    else if (--r < 0)
+	      break;
+	  }
 
-  /* Blue  */
-  dd = yy + ((cb * CONST (1.772)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
+	if (s && k <= data->se)
+	  coefs[jpeg_zigzag_order[k]] = s;
+      }
+
+  if (data->eobrun)
+    {
+      for (; k <= data->se; k++)
+	if (coefs[jpeg_zigzag_order[k]])
+	  grub_jpeg_refine_coef (data, &coefs[jpeg_zigzag_order[k]]);
+      data->eobrun--;
+    }
+}
+
+static void
+grub_jpeg_decode_block (struct grub_jpeg_data *data,
+			struct grub_jpeg_component *comp,
+			grub_int16_t *coefs)
+{
+  if (!data->progressive)
+    grub_jpeg_decode_block_baseline (data, comp, coefs);
+  else if (data->ss == 0)
+    grub_jpeg_decode_block_dc (data, comp, coefs);
+  else if (data->ah == 0)
+    grub_jpeg_decode_block_ac_first (data, comp, coefs);
+  else
+    grub_jpeg_decode_block_ac_refine (data, comp, coefs);
+}
+
+static inline void __attribute__ ((always_inline))
+grub_jpeg_put_pixel (grub_uint8_t *p, int r, int g, int b)
+{
 #ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[0] = dd;
-  rgb += 3;
+  p[0] = grub_jpeg_clamp (b);
+  p[1] = grub_jpeg_clamp (g);
+  p[2] = grub_jpeg_clamp (r);
 #else
-  *(rgb++) = dd;
+  p[0] = grub_jpeg_clamp (r);
+  p[1] = grub_jpeg_clamp (g);
+  p[2] = grub_jpeg_clamp (b);
 #endif
 }
 
-static grub_err_t
-grub_jpeg_decode_sos (struct grub_jpeg_data *data)
+/* Convert the samples of the MCU row MR into the bitmap.  */
+static void
+grub_jpeg_output_mcu_row (struct grub_jpeg_data *data, unsigned mr)
 {
-  int i, cc;
-  grub_uint32_t data_offset;
+  struct grub_jpeg_component *c0 = &data->comp[0];
+  struct grub_jpeg_component *c1 = &data->comp[1];
+  struct grub_jpeg_component *c2 = &data->comp[2];
+  unsigned y, y0, nr, width = data->image_width;
+  grub_uint8_t *out;
+
+  y0 = mr * data->max_vs * JPEG_UNIT_SIZE;
+  nr = data->image_height - y0;
+  if (nr > data->max_vs * JPEG_UNIT_SIZE)
+    nr = data->max_vs * JPEG_UNIT_SIZE;
+
+  out = (grub_uint8_t *) (*data->bitmap)->data
+    + y0 * (*data->bitmap)->mode_info.pitch;
+  for (y = 0; y < nr; y++, out += (*data->bitmap)->mode_info.pitch)
+    {
+      const grub_uint8_t *yp = c0->plane + (y >> c0->log_v) * c0->pitch;
+      const grub_uint8_t *cbp, *crp;
+      grub_uint8_t *p = out;
+      unsigned x;
 
-  data_offset = data->file->offset;
-  data_offset += grub_jpeg_get_word (data);
+      if (data->color_components == 1)
+	{
+	  for (x = 0; x < width; x++, p += 3)
+	    p[0] = p[1] = p[2] = yp[x];
+	  continue;
+	}
 
-  cc = grub_jpeg_get_byte (data);
+      cbp = c1->plane + (y >> c1->log_v) * c1->pitch;
+      crp = c2->plane + (y >> c2->log_v) * c2->pitch;
 
-  if (cc != 3 && cc != 1)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
-		       "jpeg: component count must be 1 or 3");
-  data->color_components = cc;
+      if (c0->log_h == 0 && c1->log_h == c2->log_h)
+	{
+	  /* Work out the chroma terms once for all the pixels a chroma
+	     sample covers.  */
+	  unsigned n = 1 << c1->log_h, cx, end;
 
-  for (i = 0; i < cc; i++)
-    {
-      int id, ht;
+	  for (x = 0, cx = 0; x < width; cx++)
+	    {
+	      int dr = data->cr_r[crp[cx]];
+	      int dg = (data->cb_g[cbp[cx]] + data->cr_g[crp[cx]]) >> SHIFT_BITS;
+	      int db = data->cb_b[cbp[cx]];
 
-      id = grub_jpeg_get_byte (data) - 1;
-      if ((id < 0) || (id >= 3))
-	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid index");
+	      end = x + n < width ? x + n : width;
+	      for (; x < end; x++, p += 3)
+		grub_jpeg_put_pixel (p, yp[x] + dr, yp[x] - dg, yp[x] + db);
+	    }
+	  continue;
+	}
 
-      ht = grub_jpeg_get_byte (data);
-      data->comp_index[id][1] = (ht >> 4);
-      data->comp_index[id][2] = (ht & 0xF) + 2;
+      for (x = 0; x < width; x++, p += 3)
+	{
+	  int yy = yp[x >> c0->log_h];
+	  int cb = cbp[x >> c1->log_h];
+	  int cr = crp[x >> c2->log_h];
+
+	  grub_jpeg_put_pixel (p, yy + data->cr_r[cr],
+			       yy - ((data->cb_g[cb] + data->cr_g[cr])
+				     >> SHIFT_BITS),
+			       yy + data->cb_b[cb]);
+	}
     }
+}
 
-  grub_jpeg_get_byte (data);	/* Skip 3 unused bytes.  */
-  grub_jpeg_get_word (data);
+/* Expect a restart marker, and start over from it.  */
+static grub_err_t
+grub_jpeg_restart (struct grub_jpeg_data *data)
+{
+  int i;
 
-  if (data->file->offset != data_offset)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in sos");
+  /* The rest of the byte is padding.  */
+  data->bit_save = 0;
+  data->bit_count = 0;
+  data->pad_bits = 0;
 
-  if (grub_video_bitmap_create (data->bitmap, data->image_width,
-				data->image_height,
-				GRUB_VIDEO_BLIT_FORMAT_RGB_888))
-    return grub_errno;
+  /* Markers may be preceded by any number of 0xFF.  */
+  while (grub_jpeg_input_avail (data, 2)
+	 && data->inbuf[data->in_pos] == JPEG_ESC_CHAR
+	 && data->inbuf[data->in_pos + 1] == JPEG_ESC_CHAR)
+    data->in_pos++;
+
+  if (!grub_jpeg_input_avail (data, 2)
+      || data->inbuf[data->in_pos] != JPEG_ESC_CHAR
+      || (data->inbuf[data->in_pos + 1] & ~7) != JPEG_MARKER_RST0)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+		       "jpeg: restart marker expected");
+  data->in_pos += 2;
+
+  for (i = 0; i < data->color_components; i++)
+    data->comp[i].dc_value = 0;
+  data->eobrun = 0;
 
-  data->bitmap_ptr = (*data->bitmap)->data;
   return GRUB_ERR_NONE;
 }
 
+/* Decode the entropy coded data of a scan.  Images that come in a
+   single scan are output an MCU row at a time, others once all their
+   coefficients are known.  */
 static grub_err_t
 grub_jpeg_decode_data (struct grub_jpeg_data *data)
 {
-  unsigned c1, vb, hb, nr1, nc1;
-  int rst = data->dri;
-
-  vb = 8 << data->log_vs;
-  hb = 8 << data->log_hs;
-  nr1 = (data->image_height + vb - 1) >> (3 + data->log_vs);
-  nc1 = (data->image_width + hb - 1)  >> (3 + data->log_hs);
-
-  for (; data->r1 < nr1 && (!data->dri || rst);
-       data->r1++, data->bitmap_ptr += (vb * data->image_width - hb * nc1) * 3)
-    for (c1 = 0;  c1 < nc1 && (!data->dri || rst);
-	c1++, rst--, data->bitmap_ptr += hb * 3)
-      {
-	unsigned r2, c2, nr2, nc2;
-	grub_uint8_t *ptr2;
-
-	for (r2 = 0; r2 < (1U << data->log_vs); r2++)
-	  for (c2 = 0; c2 < (1U << data->log_hs); c2++)
-	    grub_jpeg_decode_du (data, 0, data->ydu[r2 * 2 + c2]);
+  struct grub_jpeg_component *comp;
+  unsigned mr, mc, nr, nc, r2, c2;
+  int i, stream, rst = data->dri;
 
-	if (data->color_components >= 3)
-	  {
-	    grub_jpeg_decode_du (data, 1, data->cbdu);
-	    grub_jpeg_decode_du (data, 2, data->crdu);
-	  }
+  stream = !data->comp[0].coefs;
 
-	if (grub_errno)
-	  return grub_errno;
-
-	nr2 = (data->r1 == nr1 - 1) ? (data->image_height - data->r1 * vb) : vb;
-	nc2 = (c1 == nc1 - 1) ? (data->image_width - c1 * hb) : hb;
+  /* The MCU of a scan of a single component is a block, whatever the
+     sampling.  */
+  if (data->scan_components == 1)
+    {
+      nr = data->scan_comp[0]->real_blocks_h;
+      nc = data->scan_comp[0]->real_blocks_w;
+    }
+  else
+    {
+      nr = data->mcus_h;
+      nc = data->mcus_w;
+    }
 
-	ptr2 = data->bitmap_ptr;
-	for (r2 = 0; r2 < nr2; r2++, ptr2 += (data->image_width - nc2) * 3)
-	  for (c2 = 0; c2 < nc2; c2++, ptr2 += 3)
+  for (mr = 0; mr < nr; mr++)
+    {
+      for (mc = 0; mc < nc; mc++)
+	{
+	  if (data->dri && !rst--)
 	    {
-	      unsigned i0;
-	      int yy;
+	      if (grub_jpeg_restart (data))
+		return grub_errno;
+	      rst = data->dri - 1;
+	    }
 
-	      i0 = (r2 >> data->log_vs) * 8 + (c2 >> data->log_hs);
-	      yy = data->ydu[(r2 / 8) * 2 + (c2 / 8)][(r2 % 8) * 8 + (c2 % 8)];
+	  for (i = 0; i < data->scan_components; i++)
+	    {
+	      unsigned hs, vs, bx, by;
 
-	      if (data->color_components >= 3)
+	      comp = data->scan_comp[i];
+	      if (data->scan_components == 1)
 		{
-		  int cr, cb;
-		  cr = data->crdu[i0];
-		  cb = data->cbdu[i0];
-		  grub_jpeg_ycrcb_to_rgb (yy, cr, cb, ptr2);
+		  hs = vs = 1;
+		  bx = mc;
+		  by = mr;
 		}
 	      else
 		{
-		  ptr2[0] = yy;
-		  ptr2[1] = yy;
-		  ptr2[2] = yy;
+		  hs = comp->hs;
+		  vs = comp->vs;
+		  bx = mc * hs;
+		  by = mr * vs;
 		}
+
+	      for (r2 = 0; r2 < vs; r2++)
+		for (c2 = 0; c2 < hs; c2++)
+		  {
+		    if (stream)
+		      {
+			grub_jpeg_decode_block (data, comp, data->block);
+			grub_jpeg_output_block (data, comp, data->block,
+						comp->plane
+						+ r2 * JPEG_UNIT_SIZE
+						* comp->pitch
+						+ (bx + c2) * JPEG_UNIT_SIZE);
+		      }
+		    else
+		      grub_jpeg_decode_block (data, comp, comp->coefs
+					      + ((by + r2) * comp->blocks_w
+						 + bx + c2) * 64);
+		  }
 	    }
-      }
+
+	  if (grub_errno)
+	    return grub_errno;
+	  if (data->pad_bits > data->bit_count)
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			       "jpeg: premature end of data");
+	}
+
+      if (stream)
+	grub_jpeg_output_mcu_row (data, mr);
+    }
 
   return grub_errno;
 }
 
+/* Output an image whose coefficients were gathered from all its
+   scans.  */
 static void
-grub_jpeg_reset (struct grub_jpeg_data *data)
+grub_jpeg_output_coefs (struct grub_jpeg_data *data)
 {
-  data->bit_mask = 0x0;
+  unsigned mr, r2, bx;
+  int i;
 
-  data->dc_value[0] = 0;
-  data->dc_value[1] = 0;
-  data->dc_value[2] = 0;
+  for (mr = 0; mr < data->mcus_h; mr++)
+    {
+      for (i = 0; i < data->color_components; i++)
+	{
+	  struct grub_jpeg_component *comp = &data->comp[i];
+
+	  for (r2 = 0; r2 < comp->vs; r2++)
+	    for (bx = 0; bx < comp->blocks_w; bx++)
+	      grub_jpeg_output_block (data, comp,
+				      comp->coefs
+				      + ((mr * comp->vs + r2) * comp->blocks_w
+					 + bx) * 64,
+				      comp->plane
+				      + r2 * JPEG_UNIT_SIZE * comp->pitch
+				      + bx * JPEG_UNIT_SIZE);
+	}
+
+      grub_jpeg_output_mcu_row (data, mr);
+    }
+}
+
+static grub_err_t
+grub_jpeg_decode_sos (struct grub_jpeg_data *data)
+{
+  int i, j, cc;
+  grub_uint32_t data_offset;
+
+  if (!*data->bitmap)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: scan before frame");
+
+  data_offset = data->file->offset;
+  data_offset += grub_jpeg_get_word (data);
+
+  cc = grub_jpeg_get_byte (data);
+
+  if (cc < 1 || cc > data->color_components)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+		       "jpeg: component count must be 1 or 3");
+  data->scan_components = cc;
+
+  for (i = 0; i < cc; i++)
+    {
+      int id, ht;
+
+      id = grub_jpeg_get_byte (data);
+      for (j = 0; j < data->color_components; j++)
+	if (data->comp[j].id == id)
+	  break;
+      if (j == data->color_components)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid index");
+      data->scan_comp[i] = &data->comp[j];
+
+      ht = grub_jpeg_get_byte (data);
+      if ((ht >> 4) > 3 || (ht & 0xF) > 3)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid index");
+      data->comp[j].dc_table = (ht >> 4);
+      data->comp[j].ac_table = (ht & 0xF) + 4;
+    }
+
+  data->ss = grub_jpeg_get_byte (data);
+  data->se = grub_jpeg_get_byte (data);
+  data->al = grub_jpeg_get_byte (data);
+  data->ah = data->al >> 4;
+  data->al &= 0xF;
+
+  if (data->file->offset != data_offset)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in sos");
+
+  if (data->progressive)
+    {
+      if (data->ss > data->se || data->se > 63
+	  || (data->ss == 0) != (data->se == 0)
+	  || (data->ss && cc != 1) || data->al > 13)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: invalid progressive scan");
+    }
+  else if (cc != data->color_components && !data->comp[0].coefs)
+    {
+      /* Components come in separate scans, so keep them all until the
+	 end.  */
+      for (i = 0; i < data->color_components; i++)
+	{
+	  struct grub_jpeg_component *comp = &data->comp[i];
+	  grub_size_t n = comp->blocks_w * comp->blocks_h;
+
+	  if (n > GRUB_SIZE_MAX / sizeof (data->block))
+	    return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+	  comp->coefs = grub_zalloc (n * sizeof (data->block));
+	  if (!comp->coefs)
+	    return grub_errno;
+	}
+    }
+
+  for (i = 0; i < cc; i++)
+    {
+      struct grub_jpeg_component *comp = data->scan_comp[i];
+
+      if ((!data->progressive || (data->ss == 0 && data->ah == 0))
+	  && !data->huff_value[comp->dc_table])
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: huffman table not defined");
+      if ((!data->progressive || data->ss)
+	  && !data->huff_value[comp->ac_table])
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: huffman table not defined");
+      comp->dc_value = 0;
+    }
+  data->eobrun = 0;
+
+  return GRUB_ERR_NONE;
 }
 
 static grub_uint8_t
@@ -700,7 +1253,12 @@ grub_jpeg_get_marker (struct grub_jpeg_data *data)
       return 0;
     }
 
-  return grub_jpeg_get_byte (data);
+  /* Markers may be preceded by any number of 0xFF.  */
+  do
+    r = grub_jpeg_get_byte (data);
+  while (r == JPEG_ESC_CHAR && grub_errno == GRUB_ERR_NONE);
+
+  return r;
 }
 
 static grub_err_t
@@ -727,16 +1285,34 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 	case JPEG_MARKER_DQT:	/* Define Quantization Table.  */
 	  grub_jpeg_decode_quan_table (data);
 	  break;
+	case JPEG_MARKER_SOF2:	/* Start Of Frame 2, progressive.  */
+	  data->progressive = 1;
+	  /* FALLTHROUGH */
 	case JPEG_MARKER_SOF0:	/* Start Of Frame 0.  */
+	case JPEG_MARKER_SOF1:	/* Start Of Frame 1, extended sequential.  */
 	  grub_jpeg_decode_sof (data);
 	  break;
+	case JPEG_MARKER_SOF3:
+	case JPEG_MARKER_SOF5:
+	case JPEG_MARKER_SOF6:
+	case JPEG_MARKER_SOF7:
+	case JPEG_MARKER_SOF9:
+	case JPEG_MARKER_SOF10:
+	case JPEG_MARKER_SOF11:
+	case JPEG_MARKER_SOF13:
+	case JPEG_MARKER_SOF14:
+	case JPEG_MARKER_SOF15:
+	  return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			     "jpeg: coding process not supported");
 	case JPEG_MARKER_DRI:	/* Define Restart Interval.  */
 	  grub_jpeg_decode_dri (data);
 	  break;
 	case JPEG_MARKER_SOS:	/* Start Of Scan.  */
 	  if (grub_jpeg_decode_sos (data))
 	    break;
-	  /* FALLTHROUGH */
+	  grub_jpeg_decode_data (data);
+	  grub_jpeg_release_input (data);
+	  break;
 	case JPEG_MARKER_RST0:	/* Restart.  */
 	case JPEG_MARKER_RST1:
 	case JPEG_MARKER_RST2:
@@ -745,10 +1321,14 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 	case JPEG_MARKER_RST5:
 	case JPEG_MARKER_RST6:
 	case JPEG_MARKER_RST7:
-	  grub_jpeg_decode_data (data);
-	  grub_jpeg_reset (data);
+	  /* Those within scans are handled there.  */
 	  break;
 	case JPEG_MARKER_EOI:	/* End Of Image.  */
+	  if (!*data->bitmap)
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			       "jpeg: no image data");
+	  if (data->comp[0].coefs)
+	    grub_jpeg_output_coefs (data);
 	  return grub_errno;
 	default:		/* Skip unrecognized marker.  */
 	  {
@@ -757,6 +1337,9 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 	    sz = grub_jpeg_get_word (data);
 	    if (grub_errno)
 	      return (grub_errno);
+	    if (sz < 2)
+	      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+				 "jpeg: invalid marker length");
 	    grub_file_seek (data->file, data->file->offset + sz - 2);
 	  }
 	}
@@ -776,6 +1359,7 @@ grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
   if (!file)
     return grub_errno;
 
+  *bitmap = 0;
   data = grub_zalloc (sizeof (*data));
   if (data != NULL)
     {
@@ -785,9 +1369,15 @@ grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
       data->bitmap = bitmap;
       grub_jpeg_decode_jpeg (data);
 
-      for (i = 0; i < 4; i++)
+      for (i = 0; i < 8; i++)
 	grub_free (data->huff_value[i]);
 
+      for (i = 0; i < JPEG_MAX_COMPONENTS; i++)
+	{
+	  grub_free (data->comp[i].coefs);
+	  grub_free (data->comp[i].plane);
+	}
+
       grub_free (data);
     }
 
@@ -78,6 +78,13 @@ enum
 
 #define DEFLATE_HUFF_LEN	16
 
+/* Codes up to this long are decoded with a single table lookup.  */
+#define HUFF_FAST_BITS		9
+#define HUFF_FAST_LEN_SHIFT	12
+
+/* IDAT data is read in blocks of this size.  */
+#define PNG_INBUF_SIZE		0x2000
+
 #ifdef PNG_DEBUG
 static grub_command_t cmd;
 #endif
@@ -85,7 +92,11 @@ static grub_command_t cmd;
 struct huff_table
 {
   int *values, *maxval, *offset;
-  int num_values, max_length;
+  /* Indexed by the next HUFF_FAST_BITS bits of input, the symbol in
+     the low bits and the code length above HUFF_FAST_LEN_SHIFT, or 0
+     for codes that are longer.  */
+  grub_uint16_t *fast;
+  int max_length;
 };
 
 struct grub_png_data
@@ -93,25 +104,31 @@ struct grub_png_data
   grub_file_t file;
   struct grub_video_bitmap **bitmap;
 
-  int bit_count, bit_save;
+  int bit_count;
+  grub_uint32_t bit_save;
 
   grub_uint32_t next_offset;
 
   unsigned image_width, image_height;
   int bpp, is_16bit;
-  int raw_bytes, is_gray, is_alpha, is_palette;
+  int is_gray, is_alpha, is_palette;
   int row_bytes, color_bits;
-  grub_uint8_t *image_data;
 
-  int inside_idat, idat_remain;
+  int inside_idat, idat_done;
+  grub_uint32_t idat_remain;
+
+  grub_uint8_t inbuf[PNG_INBUF_SIZE];
+  int in_pos, in_len;
 
   int code_values[DEFLATE_HLIT_MAX];
   int code_maxval[DEFLATE_HUFF_LEN];
   int code_offset[DEFLATE_HUFF_LEN];
+  grub_uint16_t code_fast[1 << HUFF_FAST_BITS];
 
   int dist_values[DEFLATE_HDIST_MAX];
   int dist_maxval[DEFLATE_HUFF_LEN];
   int dist_offset[DEFLATE_HUFF_LEN];
+  grub_uint16_t dist_fast[1 << HUFF_FAST_BITS];
 
   grub_uint8_t palette[256][3];
 
@@ -119,11 +136,17 @@ struct grub_png_data
   struct huff_table dist_table;
 
   grub_uint8_t slide[WSIZE];
-  int wp;
+  int wp, flushed;
 
-  grub_uint8_t *cur_rgb;
+  /* Scanlines are unfiltered in CUR_ROW against PREV_ROW.  When the
+     PNG samples already are in the bitmap's format they point into
+     the bitmap itself, otherwise into ROW_BUF and each finished row is
+     converted into the bitmap.  */
+  grub_uint8_t *row_buf, *cur_row, *prev_row;
+  int direct;
 
-  int cur_column, cur_filter, first_line;
+  unsigned cur_y;
+  int cur_column, cur_filter;
 };
 
 static grub_uint32_t
@@ -132,17 +155,21 @@ grub_png_get_dword (struct grub_png_data *data)
   grub_uint32_t r;
 
   r = 0;
-  grub_file_read (data->file, &r, sizeof (grub_uint32_t));
+  if (grub_file_read (data->file, &r, sizeof (grub_uint32_t))
+      != sizeof (grub_uint32_t) && grub_errno == GRUB_ERR_NONE)
+    grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: unexpected end of file");
 
   return grub_be_to_cpu32 (r);
 }
 
-static grub_uint8_t
-grub_png_get_byte (struct grub_png_data *data)
+/* Refill the input buffer from the current IDAT chunk, going on to the
+   next one at its end.  */
+static grub_err_t
+grub_png_fill_input (struct grub_png_data *data)
 {
-  grub_uint8_t r;
+  grub_ssize_t n;
 
-  if ((data->inside_idat) && (data->idat_remain == 0))
+  if (data->idat_remain == 0)
     {
       grub_uint32_t len, type;
 
@@ -152,20 +179,14 @@ grub_png_get_byte (struct grub_png_data *data)
 	  grub_png_get_dword (data);
 
           if (data->file->offset != data->next_offset)
-            {
-              grub_error (GRUB_ERR_BAD_FILE_TYPE,
-                          "png: chunk size error");
-              return 0;
-            }
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			       "png: chunk size error");
 
 	  len = grub_png_get_dword (data);
 	  type = grub_png_get_dword (data);
 	  if (type != PNG_CHUNK_IDAT)
-	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			  "png: unexpected end of data");
-	      return 0;
-	    }
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			       "png: unexpected end of data");
 
           data->next_offset = data->file->offset + len + 4;
 	}
@@ -173,54 +194,84 @@ grub_png_get_byte (struct grub_png_data *data)
       data->idat_remain = len;
     }
 
-  r = 0;
-  grub_file_read (data->file, &r, 1);
+  n = PNG_INBUF_SIZE;
+  if (data->idat_remain < PNG_INBUF_SIZE)
+    n = data->idat_remain;
+  if (grub_file_read (data->file, data->inbuf, n) != n)
+    {
+      if (grub_errno == GRUB_ERR_NONE)
+	grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: unexpected end of data");
+      return grub_errno;
+    }
+
+  data->idat_remain -= n;
+  data->in_pos = 0;
+  data->in_len = n;
+  return GRUB_ERR_NONE;
+}
+
+static grub_uint8_t
+grub_png_get_byte (struct grub_png_data *data)
+{
+  grub_uint8_t r;
 
   if (data->inside_idat)
-    data->idat_remain--;
+    {
+      if (data->in_pos == data->in_len && grub_png_fill_input (data))
+	return 0;
+      return data->inbuf[data->in_pos++];
+    }
+
+  r = 0;
+  grub_file_read (data->file, &r, 1);
 
   return r;
 }
 
-static int
-grub_png_get_bits (struct grub_png_data *data, int num)
+static inline void
+grub_png_need_bits (struct grub_png_data *data, int num)
 {
-  int code, shift;
+  if (data->bit_count >= num)
+    return;
 
-  if (data->bit_count == 0)
+  /* Take what the buffer has, only going to the next chunk when
+     really needed.  */
+  while (data->bit_count <= 24 && data->in_pos < data->in_len)
     {
-      data->bit_save = grub_png_get_byte (data);
-      data->bit_count = 8;
+      data->bit_save |= (grub_uint32_t) data->inbuf[data->in_pos++]
+	<< data->bit_count;
+      data->bit_count += 8;
     }
 
-  code = 0;
-  shift = 0;
-  while (grub_errno == 0)
+  while (data->bit_count < num)
     {
-      int n;
-
-      n = data->bit_count;
-      if (n > num)
-	n = num;
-
-      code += (int) (data->bit_save & ((1 << n) - 1)) << shift;
-      num -= n;
-      if (!num)
-	{
-	  data->bit_count -= n;
-	  data->bit_save >>= n;
-	  break;
-	}
+      data->bit_save |= (grub_uint32_t) grub_png_get_byte (data)
+	<< data->bit_count;
+      data->bit_count += 8;
+    }
+}
 
-      shift += n;
+static int
+grub_png_get_bits (struct grub_png_data *data, int num)
+{
+  int code;
 
-      data->bit_save = grub_png_get_byte (data);
-      data->bit_count = 8;
-    }
+  grub_png_need_bits (data, num);
+  code = data->bit_save & ((1 << num) - 1);
+  data->bit_save >>= num;
+  data->bit_count -= num;
 
   return code;
 }
 
+/* Drop the bits up to the next byte boundary.  */
+static void
+grub_png_align_bits (struct grub_png_data *data)
+{
+  data->bit_save >>= data->bit_count & 7;
+  data->bit_count &= ~7;
+}
+
 static grub_err_t
 grub_png_decode_image_palette (struct grub_png_data *data,
 			       unsigned len)
@@ -233,8 +284,8 @@ grub_png_decode_image_palette (struct grub_png_data *data,
   for (i = 0; 3 * i < len && i < 256; i++)
     for (j = 0; j < 3; j++)
       data->palette[i][j] = grub_png_get_byte (data);
-  for (i *= 3; i < len; i++)
-    grub_png_get_byte (data);
+  if (3 * i < len)
+    grub_file_seek (data->file, data->file->offset + len - 3 * i);
 
   grub_png_get_dword (data);
 
@@ -251,7 +302,11 @@ grub_png_decode_image_header (struct grub_png_data *data)
   data->image_width = grub_png_get_dword (data);
   data->image_height = grub_png_get_dword (data);
 
-  if ((!data->image_height) || (!data->image_width))
+  /* Rows of up to 8 bytes per pixel, and the bitmap, must stay within
+     an int.  */
+  if ((!data->image_height) || (!data->image_width)
+      || (grub_uint64_t) data->image_width * data->image_height * 8
+      > GRUB_INT_MAX)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: invalid image size");
 
   color_bits = grub_png_get_byte (data);
@@ -270,7 +325,10 @@ grub_png_decode_image_header (struct grub_png_data *data)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 		       "png: color type not supported");
   if (color_type & PNG_COLOR_MASK_ALPHA)
-    blt = GRUB_VIDEO_BLIT_FORMAT_RGBA_8888;
+    {
+      data->is_alpha = 1;
+      blt = GRUB_VIDEO_BLIT_FORMAT_RGBA_8888;
+    }
   else
     blt = GRUB_VIDEO_BLIT_FORMAT_RGB_888;
   if (data->is_palette)
@@ -284,8 +342,8 @@ grub_png_decode_image_header (struct grub_png_data *data)
     }
 
   if ((color_bits != 8) && (color_bits != 16)
-      && (color_bits != 4
-	  || !(data->is_gray || data->is_palette)))
+      && ((color_bits != 1 && color_bits != 2 && color_bits != 4)
+	  || data->is_alpha || !(data->is_gray || data->is_palette)))
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
                        "png: bit depth must be 8 or 16");
 
@@ -302,31 +360,47 @@ grub_png_decode_image_header (struct grub_png_data *data)
 
   data->color_bits = color_bits;
   data->row_bytes = data->image_width * data->bpp;
-  if (data->color_bits <= 4)
+  if (data->color_bits < 8)
     data->row_bytes = (data->image_width * data->color_bits + 7) / 8;
 
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-  if (data->is_16bit || data->is_gray || data->is_palette)
-#endif
+  if (data->is_gray && data->color_bits < 8)
     {
-      data->image_data = grub_malloc (data->image_height * data->row_bytes);
-      if (grub_errno)
-        return grub_errno;
-
-      data->cur_rgb = data->image_data;
+      /* Generic formula is
+	 (0xff * i) / ((1U << data->color_bits) - 1)
+	 but for allowed bit depth of 1, 2 and for it's
+	 equivalent to
+	 (0xff / ((1U << data->color_bits) - 1)) * i
+	 Precompute the multipliers to avoid division.
+      */
+
+      const grub_uint8_t multipliers[5] = { 0xff, 0xff, 0x55, 0x24, 0x11 };
+      unsigned i;
+
+      for (i = 0; i < (1U << data->color_bits); i++)
+	{
+	  grub_uint8_t col = multipliers[data->color_bits] * i;
+	  data->palette[i][0] = col;
+	  data->palette[i][1] = col;
+	  data->palette[i][2] = col;
+	}
     }
+
+  /* Two rows, the first one being the zero row above the image.  */
+  data->row_buf = grub_zalloc (2 * data->row_bytes);
+  if (!data->row_buf)
+    return grub_errno;
+
+  data->prev_row = data->row_buf;
 #ifndef GRUB_CPU_WORDS_BIGENDIAN
-  else
-    {
-      data->image_data = 0;
-      data->cur_rgb = (*data->bitmap)->data;
-    }
+  data->direct = !(data->is_16bit || data->is_gray || data->is_palette);
 #endif
+  if (data->direct)
+    data->cur_row = (*data->bitmap)->data;
+  else
+    data->cur_row = data->row_buf + data->row_bytes;
 
-  data->raw_bytes = data->image_height * (data->row_bytes + 1);
-
+  data->cur_y = 0;
   data->cur_column = 0;
-  data->first_line = 1;
 
   if (grub_png_get_byte (data) != PNG_COMPRESSION_BASE)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
@@ -354,14 +428,14 @@ static const grub_uint8_t bitorder[] = {
 /* Copy lengths for literal codes 257..285.  */
 static const int cplens[] = {
   3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
 };
 
 /* Extra bits for literal codes 257..285.  */
 static const grub_uint8_t cplext[] = {
   0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 99, 99
-};				/* 99==invalid  */
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
 
 /* Copy offsets for distance codes 0..29.  */
 static const int cpdist[] = {
@@ -379,53 +453,67 @@ static const grub_uint8_t cpdext[] = {
 
 static void
 grub_png_init_huff_table (struct huff_table *ht, int cur_maxlen,
-			  int *cur_values, int *cur_maxval, int *cur_offset)
+			  int *cur_values, int *cur_maxval, int *cur_offset,
+			  grub_uint16_t *cur_fast)
 {
   ht->values = cur_values;
   ht->maxval = cur_maxval;
   ht->offset = cur_offset;
-  ht->num_values = 0;
+  ht->fast = cur_fast;
   ht->max_length = cur_maxlen;
-  grub_memset (cur_maxval, 0, sizeof (int) * cur_maxlen);
 }
 
+/* Build the canonical code for the NUM symbols with code lengths
+   LENS.  */
 static void
-grub_png_insert_huff_item (struct huff_table *ht, int code, int len)
+grub_png_build_huff_table (struct huff_table *ht, const grub_uint8_t *lens,
+			   int num)
 {
-  int i, n;
+  int count[DEFLATE_HUFF_LEN + 1], next[DEFLATE_HUFF_LEN + 1];
+  int base, ofs, i, j;
 
-  if (len == 0)
-    return;
+  grub_memset (count, 0, sizeof (count));
+  for (i = 0; i < num; i++)
+    count[lens[i]]++;
 
-  if (len > ht->max_length)
+  ofs = 0;
+  for (i = 1; i <= ht->max_length; i++)
     {
-      grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: invalid code length");
-      return;
+      next[i] = ofs;
+      ofs += count[i];
     }
 
-  n = 0;
-  for (i = len; i < ht->max_length; i++)
-    n += ht->maxval[i];
+  /* Symbols of the same length get consecutive codes in their
+     order.  */
+  for (i = 0; i < num; i++)
+    if (lens[i])
+      ht->values[next[lens[i]]++] = i;
 
-  for (i = 0; i < n; i++)
-    ht->values[ht->num_values - i] = ht->values[ht->num_values - i - 1];
-
-  ht->values[ht->num_values - n] = code;
-  ht->num_values++;
-  ht->maxval[len - 1]++;
-}
-
-static void
-grub_png_build_huff_table (struct huff_table *ht)
-{
-  int base, ofs, i;
+  grub_memset (ht->fast, 0, sizeof (ht->fast[0]) << HUFF_FAST_BITS);
 
   base = 0;
   ofs = 0;
   for (i = 0; i < ht->max_length; i++)
     {
-      base += ht->maxval[i];
-      ofs += ht->maxval[i];
+      int len = i + 1;
+
+      /* The input is read starting from the low bit, but the codes
+	 from their high bit, so the table is indexed by the codes
+	 reversed, with all the values the remaining bits can take.  */
+      if (len <= HUFF_FAST_BITS)
+	for (j = 0; j < count[len]; j++)
+	  {
+	    int code = base + j, rev = 0, k;
+
+	    for (k = 0; k < len; k++, code >>= 1)
+	      rev = (rev << 1) | (code & 1);
+
+	    for (k = rev; k < (1 << HUFF_FAST_BITS); k += 1 << len)
+	      ht->fast[k] = ht->values[ofs + j] | (len << HUFF_FAST_LEN_SHIFT);
+	  }
+
+      base += count[len];
+      ofs += count[len];
 
       ht->maxval[i] = base;
       ht->offset[i] = ofs - base;
@@ -434,10 +522,23 @@ grub_png_build_huff_table (struct huff_table *ht)
     }
 }
 
-static int
+static inline int
 grub_png_get_huff_code (struct grub_png_data *data, struct huff_table *ht)
 {
-  int code, i;
+  int code, i, entry;
+
+  /* The table may look past the last code of the stream, into the
+     adler checksum that follows it.  */
+  grub_png_need_bits (data, HUFF_FAST_BITS);
+  entry = ht->fast[data->bit_save & ((1 << HUFF_FAST_BITS) - 1)];
+  if (entry)
+    {
+      int len = entry >> HUFF_FAST_LEN_SHIFT;
+
+      data->bit_save >>= len;
+      data->bit_count -= len;
+      return entry & ((1 << HUFF_FAST_LEN_SHIFT) - 1);
+    }
 
   code = 0;
   for (i = 0; i < ht->max_length; i++)
@@ -446,40 +547,43 @@ grub_png_get_huff_code (struct grub_png_data *data, struct huff_table *ht)
       if (code < ht->maxval[i])
 	return ht->values[code + ht->offset[i]];
     }
+
+  grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: invalid huffman code");
   return 0;
 }
 
 static grub_err_t
 grub_png_init_fixed_block (struct grub_png_data *data)
 {
+  grub_uint8_t lens[DEFLATE_HLIT_MAX];
   int i;
 
   grub_png_init_huff_table (&data->code_table, DEFLATE_HUFF_LEN,
 			    data->code_values, data->code_maxval,
-			    data->code_offset);
+			    data->code_offset, data->code_fast);
 
   for (i = 0; i < 144; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 8);
+    lens[i] = 8;
 
   for (; i < 256; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 9);
+    lens[i] = 9;
 
   for (; i < 280; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 7);
+    lens[i] = 7;
 
   for (; i < DEFLATE_HLIT_MAX; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 8);
+    lens[i] = 8;
 
-  grub_png_build_huff_table (&data->code_table);
+  grub_png_build_huff_table (&data->code_table, lens, DEFLATE_HLIT_MAX);
 
   grub_png_init_huff_table (&data->dist_table, DEFLATE_HUFF_LEN,
 			    data->dist_values, data->dist_maxval,
-			    data->dist_offset);
+			    data->dist_offset, data->dist_fast);
 
   for (i = 0; i < DEFLATE_HDIST_MAX; i++)
-    grub_png_insert_huff_item (&data->dist_table, i, 5);
+    lens[i] = 5;
 
-  grub_png_build_huff_table (&data->dist_table);
+  grub_png_build_huff_table (&data->dist_table, lens, DEFLATE_HDIST_MAX);
 
   return grub_errno;
 }
@@ -492,7 +596,8 @@ grub_png_init_dynamic_block (struct grub_png_data *data)
   int cl_values[sizeof (bitorder)];
   int cl_maxval[8];
   int cl_offset[8];
-  grub_uint8_t lens[DEFLATE_HCLEN_MAX];
+  grub_uint16_t cl_fast[1 << HUFF_FAST_BITS];
+  grub_uint8_t lens[DEFLATE_HLIT_MAX + DEFLATE_HDIST_MAX];
 
   nl = DEFLATE_HLIT_BASE + grub_png_get_bits (data, 5);
   nd = DEFLATE_HDIST_BASE + grub_png_get_bits (data, 5);
@@ -502,7 +607,8 @@ grub_png_init_dynamic_block (struct grub_png_data *data)
       (nb > DEFLATE_HCLEN_MAX))
     return grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: too much data");
 
-  grub_png_init_huff_table (&cl, 8, cl_values, cl_maxval, cl_offset);
+  grub_png_init_huff_table (&cl, 8, cl_values, cl_maxval, cl_offset,
+			    cl_fast);
 
   for (i = 0; i < nb; i++)
     lens[bitorder[i]] = grub_png_get_bits (data, 3);
@@ -510,179 +616,347 @@ grub_png_init_dynamic_block (struct grub_png_data *data)
   for (; i < DEFLATE_HCLEN_MAX; i++)
     lens[bitorder[i]] = 0;
 
-  for (i = 0; i < DEFLATE_HCLEN_MAX; i++)
-    grub_png_insert_huff_item (&cl, i, lens[i]);
-
-  grub_png_build_huff_table (&cl);
+  grub_png_build_huff_table (&cl, lens, DEFLATE_HCLEN_MAX);
 
   grub_png_init_huff_table (&data->code_table, DEFLATE_HUFF_LEN,
 			    data->code_values, data->code_maxval,
-			    data->code_offset);
+			    data->code_offset, data->code_fast);
 
   grub_png_init_huff_table (&data->dist_table, DEFLATE_HUFF_LEN,
 			    data->dist_values, data->dist_maxval,
-			    data->dist_offset);
+			    data->dist_offset, data->dist_fast);
 
   prev = 0;
-  for (i = 0; i < nl + nd; i++)
+  for (i = 0; i < nl + nd;)
     {
-      int n, code;
-      struct huff_table *ht;
+      int n, c, len;
 
       if (grub_errno)
 	return grub_errno;
 
-      if (i < nl)
-	{
-	  ht = &data->code_table;
-	  code = i;
-	}
-      else
-	{
-	  ht = &data->dist_table;
-	  code = i - nl;
-	}
-
       n = grub_png_get_huff_code (data, &cl);
       if (n < 16)
 	{
-	  grub_png_insert_huff_item (ht, code, n);
+	  lens[i++] = n;
 	  prev = n;
+	  continue;
 	}
-      else if (n == 16)
-	{
-	  int c;
 
+      if (n == 16)
+	{
 	  c = 3 + grub_png_get_bits (data, 2);
-	  while (c > 0)
-	    {
-	      grub_png_insert_huff_item (ht, code++, prev);
-	      i++;
-	      c--;
-	    }
-	  i--;
+	  len = prev;
 	}
       else if (n == 17)
-	i += 3 + grub_png_get_bits (data, 3) - 1;
+	{
+	  c = 3 + grub_png_get_bits (data, 3);
+	  len = 0;
+	}
       else
-	i += 11 + grub_png_get_bits (data, 7) - 1;
+	{
+	  c = 11 + grub_png_get_bits (data, 7);
+	  len = 0;
+	}
+
+      if (i + c > nl + nd)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: too much data");
+
+      while (c-- > 0)
+	lens[i++] = len;
     }
 
-  grub_png_build_huff_table (&data->code_table);
-  grub_png_build_huff_table (&data->dist_table);
+  grub_png_build_huff_table (&data->code_table, lens, nl);
+  grub_png_build_huff_table (&data->dist_table, lens + nl, nd);
 
   return grub_errno;
 }
 
-static grub_err_t
-grub_png_output_byte (struct grub_png_data *data, grub_uint8_t n)
+/* Add the bytes of two words without carries between them.  */
+static inline grub_uint32_t
+grub_png_add_bytes (grub_uint32_t a, grub_uint32_t b)
 {
-  if (--data->raw_bytes < 0)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "image size overflown");
+  return ((a & 0x7f7f7f7f) + (b & 0x7f7f7f7f)) ^ ((a ^ b) & 0x80808080);
+}
 
-  if (data->cur_column == 0)
+static void
+grub_png_unfilter_up (grub_uint8_t *cur, const grub_uint8_t *up, int len)
+{
+  int i = 0;
+
+  /* A word at a time, when the rows are aligned alike.  */
+  if ((((grub_addr_t) cur ^ (grub_addr_t) up) & 3) == 0)
     {
-      if (n >= PNG_FILTER_VALUE_LAST)
-	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid filter value");
+      for (; i < len && ((grub_addr_t) (cur + i) & 3); i++)
+	cur[i] += up[i];
 
-      data->cur_filter = n;
+      for (; i + 4 <= len; i += 4)
+	*(grub_uint32_t *) (cur + i)
+	  = grub_png_add_bytes (*(grub_uint32_t *) (cur + i),
+				*(const grub_uint32_t *) (up + i));
+    }
+
+  for (; i < len; i++)
+    cur[i] += up[i];
+}
+
+static void
+grub_png_unfilter_sub (grub_uint8_t *cur, int len, int bpp)
+{
+  int i = bpp;
+
+  /* Four byte pixels are added a pixel at a time.  */
+  if (bpp == 4 && ((grub_addr_t) cur & 3) == 0)
+    {
+      grub_uint32_t *p = (grub_uint32_t *) cur;
+      grub_uint32_t left = p[0];
+
+      for (; i + 4 <= len; i += 4)
+	left = p[i / 4] = grub_png_add_bytes (p[i / 4], left);
     }
-  else
-    *data->cur_rgb++ = n;
 
-  data->cur_column++;
-  if (data->cur_column == data->row_bytes + 1)
+  for (; i < len; i++)
+    cur[i] += cur[i - bpp];
+}
+
+static void
+grub_png_unfilter_row (struct grub_png_data *data)
+{
+  grub_uint8_t *cur = data->cur_row;
+  const grub_uint8_t *up = data->prev_row;
+  int len = data->row_bytes, bpp = data->bpp;
+  int i;
+
+  switch (data->cur_filter)
     {
-      grub_uint8_t *blank_line = NULL;
-      grub_uint8_t *cur = data->cur_rgb - data->row_bytes;
-      grub_uint8_t *left = cur;
-      grub_uint8_t *up;
+    case PNG_FILTER_VALUE_SUB:
+      grub_png_unfilter_sub (cur, len, bpp);
+      break;
+
+    case PNG_FILTER_VALUE_UP:
+      grub_png_unfilter_up (cur, up, len);
+      break;
+
+    case PNG_FILTER_VALUE_AVG:
+      for (i = 0; i < bpp; i++)
+	cur[i] += up[i] >> 1;
+
+      for (; i < len; i++)
+	cur[i] += ((int) up[i] + (int) cur[i - bpp]) >> 1;
+
+      break;
 
-      if (data->first_line)
+    case PNG_FILTER_VALUE_PAETH:
+      /* Above the first row, the predictor always picks the left
+	 byte.  */
+      if (data->cur_y == 0)
 	{
-	  blank_line = grub_zalloc (data->row_bytes);
-	  if (blank_line == NULL)
-	    return grub_errno;
+	  grub_png_unfilter_sub (cur, len, bpp);
+	  break;
+	}
+
+      for (i = 0; i < bpp; i++)
+	cur[i] += up[i];
+
+      for (; i < len; i++)
+	{
+	  int a, b, c, pa, pb, pc;
+
+	  a = cur[i - bpp];
+	  b = up[i];
+	  c = up[i - bpp];
+
+	  pa = b - c;
+	  pb = a - c;
+	  pc = pa + pb;
+
+	  if (pa < 0)
+	    pa = -pa;
+
+	  if (pb < 0)
+	    pb = -pb;
+
+	  if (pc < 0)
+	    pc = -pc;
 
-	  up = blank_line;
+	  cur[i] += ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
 	}
-      else
-	up = cur - data->row_bytes;
+      break;
+    }
+}
+
+#ifndef GRUB_CPU_WORDS_BIGENDIAN
+#define R4 0
+#define G4 1
+#define B4 2
+#define A4 3
+#define R3 0
+#define G3 1
+#define B3 2
+#else
+#define R4 3
+#define G4 2
+#define B4 1
+#define A4 0
+#define R3 2
+#define G3 1
+#define B3 0
+#endif
+
+/* Convert the samples of an unfiltered row to the bitmap's format.  */
+static void
+grub_png_convert_row (struct grub_png_data *data, const grub_uint8_t *s,
+		      grub_uint8_t *d)
+{
+  unsigned i, w = data->image_width;
+  /* Only the upper 8 bit of 16-bit samples are used.  */
+  int step = data->is_16bit ? 2 : 1;
 
-      switch (data->cur_filter)
+  if (data->color_bits < 8)
+    {
+      int shift = 8;
+      int mask = (1 << data->color_bits) - 1;
+
+      for (i = 0; i < w; i++, d += 3)
 	{
-	case PNG_FILTER_VALUE_SUB:
-	  {
-	    int i;
+	  const grub_uint8_t *col;
 
-	    cur += data->bpp;
-	    for (i = data->bpp; i < data->row_bytes; i++, cur++, left++)
-	      *cur += *left;
+	  shift -= data->color_bits;
+	  col = data->palette[(*s >> shift) & mask];
+	  if (shift == 0)
+	    {
+	      s++;
+	      shift = 8;
+	    }
 
-	    break;
-	  }
-	case PNG_FILTER_VALUE_UP:
-	  {
-	    int i;
+	  d[R3] = col[0];
+	  d[G3] = col[1];
+	  d[B3] = col[2];
+	}
+      return;
+    }
 
-	    for (i = 0; i < data->row_bytes; i++, cur++, up++)
-	      *cur += *up;
+  if (data->is_palette)
+    {
+      for (i = 0; i < w; i++, d += 3, s++)
+	{
+	  d[R3] = data->palette[*s][0];
+	  d[G3] = data->palette[*s][1];
+	  d[B3] = data->palette[*s][2];
+	}
+      return;
+    }
 
-	    break;
+  if (data->is_gray)
+    {
+      if (data->is_alpha)
+	for (i = 0; i < w; i++, d += 4, s += 2 * step)
+	  {
+	    d[R4] = s[0];
+	    d[G4] = s[0];
+	    d[B4] = s[0];
+	    d[A4] = s[step];
 	  }
-	case PNG_FILTER_VALUE_AVG:
+      else
+	for (i = 0; i < w; i++, d += 3, s += step)
 	  {
-	    int i;
+	    d[R3] = s[0];
+	    d[G3] = s[0];
+	    d[B3] = s[0];
+	  }
+      return;
+    }
 
-	    for (i = 0; i < data->bpp; i++, cur++, up++)
-	      *cur += *up >> 1;
+  if (data->is_alpha)
+    for (i = 0; i < w; i++, d += 4, s += 4 * step)
+      {
+	d[R4] = s[0];
+	d[G4] = s[step];
+	d[B4] = s[2 * step];
+	d[A4] = s[3 * step];
+      }
+  else
+    for (i = 0; i < w; i++, d += 3, s += 3 * step)
+      {
+	d[R3] = s[0];
+	d[G3] = s[step];
+	d[B3] = s[2 * step];
+      }
+}
 
-	    for (; i < data->row_bytes; i++, cur++, up++, left++)
-	      *cur += ((int) *up + (int) *left) >> 1;
+/* Split inflated data into scanlines, unfiltering and converting each
+   as soon as it is complete.  */
+static grub_err_t
+grub_png_output (struct grub_png_data *data, const grub_uint8_t *src,
+		 int len)
+{
+  while (len > 0)
+    {
+      int n;
 
-	    break;
-	  }
-	case PNG_FILTER_VALUE_PAETH:
-	  {
-	    int i;
-	    grub_uint8_t *upper_left = up;
+      if (data->cur_column == 0)
+	{
+	  if (data->cur_y >= data->image_height)
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "image size overflown");
 
-	    for (i = 0; i < data->bpp; i++, cur++, up++)
-	      *cur += *up;
+	  if (*src >= PNG_FILTER_VALUE_LAST)
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid filter value");
 
-	    for (; i < data->row_bytes; i++, cur++, up++, left++, upper_left++)
-	      {
-		int a, b, c, pa, pb, pc;
+	  data->cur_filter = *src++;
+	  data->cur_column++;
+	  len--;
+	  continue;
+	}
 
-                a = *left;
-                b = *up;
-                c = *upper_left;
+      n = data->row_bytes + 1 - data->cur_column;
+      if (n > len)
+	n = len;
+      grub_memcpy (data->cur_row + data->cur_column - 1, src, n);
+      src += n;
+      len -= n;
+      data->cur_column += n;
 
-                pa = b - c;
-                pb = a - c;
-                pc = pa + pb;
+      if (data->cur_column == data->row_bytes + 1)
+	{
+	  grub_png_unfilter_row (data);
 
-                if (pa < 0)
-                  pa = -pa;
+	  if (data->direct)
+	    {
+	      data->prev_row = data->cur_row;
+	      data->cur_row += data->row_bytes;
+	    }
+	  else
+	    {
+	      grub_uint8_t *t;
 
-                if (pb < 0)
-                  pb = -pb;
+	      grub_png_convert_row (data, data->cur_row,
+				    (grub_uint8_t *) (*data->bitmap)->data
+				    + data->cur_y
+				    * (*data->bitmap)->mode_info.pitch);
 
-                if (pc < 0)
-                  pc = -pc;
+	      t = data->prev_row;
+	      data->prev_row = data->cur_row;
+	      data->cur_row = t;
+	    }
 
-                *cur += ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
-	      }
-	  }
+	  data->cur_y++;
+	  data->cur_column = 0;
 	}
+    }
 
-      grub_free (blank_line);
+  return GRUB_ERR_NONE;
+}
 
-      data->cur_column = 0;
-      data->first_line = 0;
-    }
+/* Pass on the data added to the window since the last call.  */
+static void
+grub_png_flush_window (struct grub_png_data *data)
+{
+  if (grub_errno == GRUB_ERR_NONE)
+    grub_png_output (data, data->slide + data->flushed,
+		     data->wp - data->flushed);
 
-  return grub_errno;
+  if (data->wp == WSIZE)
+    data->wp = 0;
+  data->flushed = data->wp;
 }
 
 static grub_err_t
@@ -695,12 +969,9 @@ grub_png_read_dynamic_block (struct grub_png_data *data)
       n = grub_png_get_huff_code (data, &data->code_table);
       if (n < 256)
 	{
-	  data->slide[data->wp] = n;
-	  grub_png_output_byte (data, n);
-
-	  data->wp++;
-	  if (data->wp >= WSIZE)
-	    data->wp = 0;
+	  data->slide[data->wp++] = n;
+	  if (data->wp == WSIZE)
+	    grub_png_flush_window (data);
 	}
       else if (n == 256)
 	break;
@@ -709,6 +980,10 @@ grub_png_read_dynamic_block (struct grub_png_data *data)
 	  int len, dist, pos;
 
 	  n -= 257;
+	  if (n >= (int) ARRAY_SIZE (cplens))
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			       "png: invalid huffman code");
+
 	  len = cplens[n];
 	  if (cplext[n])
 	    len += grub_png_get_bits (data, cplext[n]);
@@ -718,24 +993,29 @@ grub_png_read_dynamic_block (struct grub_png_data *data)
 	  if (cpdext[n])
 	    dist += grub_png_get_bits (data, cpdext[n]);
 
-	  pos = data->wp - dist;
-	  if (pos < 0)
-	    pos += WSIZE;
-
+	  pos = (data->wp - dist) & (WSIZE - 1);
 	  while (len > 0)
 	    {
-	      data->slide[data->wp] = data->slide[pos];
-	      grub_png_output_byte (data, data->slide[data->wp]);
-
-	      data->wp++;
-	      if (data->wp >= WSIZE)
-		data->wp = 0;
-
-	      pos++;
-	      if (pos >= WSIZE)
-		pos = 0;
-
-	      len--;
+	      grub_uint8_t *d, *s;
+
+	      /* Copy up to where either end wraps around, forwards as
+		 the source may overlap the destination.  */
+	      n = len;
+	      if (n > WSIZE - data->wp)
+		n = WSIZE - data->wp;
+	      if (n > WSIZE - pos)
+		n = WSIZE - pos;
+
+	      d = data->slide + data->wp;
+	      s = data->slide + pos;
+	      len -= n;
+	      data->wp += n;
+	      pos = (pos + n) & (WSIZE - 1);
+	      while (n-- > 0)
+		*d++ = *s++;
+
+	      if (data->wp == WSIZE)
+		grub_png_flush_window (data);
 	    }
 	}
     }
@@ -771,18 +1051,20 @@ grub_png_decode_image_data (struct grub_png_data *data)
 	{
 	case INFLATE_STORED:
 	  {
-	    grub_uint16_t i, len;
+	    int len;
 
-	    data->bit_count = 0;
-	    len = grub_png_get_byte (data);
-	    len += ((grub_uint16_t) grub_png_get_byte (data)) << 8;
+	    grub_png_align_bits (data);
+	    len = grub_png_get_bits (data, 16);
 
             /* Skip NLEN field.  */
-	    grub_png_get_byte (data);
-	    grub_png_get_byte (data);
+	    grub_png_get_bits (data, 16);
 
-	    for (i = 0; i < len; i++)
-	      grub_png_output_byte (data, grub_png_get_byte (data));
+	    while (len-- > 0 && grub_errno == GRUB_ERR_NONE)
+	      {
+		data->slide[data->wp++] = grub_png_get_bits (data, 8);
+		if (data->wp == WSIZE)
+		  grub_png_flush_window (data);
+	      }
 
 	    break;
 	  }
@@ -804,8 +1086,12 @@ grub_png_decode_image_data (struct grub_png_data *data)
     }
   while ((!final) && (grub_errno == 0));
 
-  /* Skip adler checksum.  */
-  grub_png_get_dword (data);
+  grub_png_flush_window (data);
+
+  /* Skip adler checksum, part of which may already be in BIT_SAVE.  */
+  grub_png_align_bits (data);
+  grub_png_get_bits (data, 16);
+  grub_png_get_bits (data, 16);
 
   /* Skip crc checksum.  */
   grub_png_get_dword (data);
@@ -816,209 +1102,6 @@ grub_png_decode_image_data (struct grub_png_data *data)
 static const grub_uint8_t png_magic[8] =
   { 0x89, 0x50, 0x4e, 0x47, 0xd, 0xa, 0x1a, 0x0a };
 
-static void
-grub_png_convert_image (struct grub_png_data *data)
-{
-  unsigned i;
-  grub_uint8_t *d1, *d2;
-
-  d1 = (*data->bitmap)->data;
-  d2 = data->image_data + data->is_16bit;
-
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-#define R4 3
-#define G4 2
-#define B4 1
-#define A4 0
-#define R3 2
-#define G3 1
-#define B3 0
-#else
-#define R4 0
-#define G4 1
-#define B4 2
-#define A4 3
-#define R3 0
-#define G3 1
-#define B3 2
-#endif
-
-  if (data->color_bits <= 4)
-    {
-      grub_uint8_t palette[16][3];
-      grub_uint8_t *d1c, *d2c;
-      int shift;
-      int mask = (1 << data->color_bits) - 1;
-      unsigned j;
-      if (data->is_gray)
-	{
-	  /* Generic formula is
-	     (0xff * i) / ((1U << data->color_bits) - 1)
-	     but for allowed bit depth of 1, 2 and for it's
-	     equivalent to
-	     (0xff / ((1U << data->color_bits) - 1)) * i
-	     Precompute the multipliers to avoid division.
-	  */
-
-	  const grub_uint8_t multipliers[5] = { 0xff, 0xff, 0x55, 0x24, 0x11 };
-	  for (i = 0; i < (1U << data->color_bits); i++)
-	    {
-	      grub_uint8_t col = multipliers[data->color_bits] * i;
-	      palette[i][0] = col;
-	      palette[i][1] = col;
-	      palette[i][2] = col;
-	    }
-	}
-      else
-	grub_memcpy (palette, data->palette, 3 << data->color_bits);
-      d1c = d1;
-      d2c = d2;
-      for (j = 0; j < data->image_height; j++, d1c += data->image_width * 3,
-	   d2c += data->row_bytes)
-	{
-	  d1 = d1c;
-	  d2 = d2c;
-	  shift = 8 - data->color_bits;
-	  for (i = 0; i < data->image_width; i++, d1 += 3)
-	    {
-	      grub_uint8_t col = (d2[0] >> shift) & mask;
-	      d1[R3] = data->palette[col][2];
-	      d1[G3] = data->palette[col][1];
-	      d1[B3] = data->palette[col][0];
-	      shift -= data->color_bits;
-	      if (shift < 0)
-		{
-		  d2++;
-		  shift += 8;
-		}
-	    }
-	}
-      return;
-    }
-
-  if (data->is_palette)
-    {
-      for (i = 0; i < (data->image_width * data->image_height);
-	   i++, d1 += 3, d2++)
-	{
-	  d1[R3] = data->palette[d2[0]][2];
-	  d1[G3] = data->palette[d2[0]][1];
-	  d1[B3] = data->palette[d2[0]][0];
-	}
-      return;
-    }
-  
-  if (data->is_gray)
-    {
-      switch (data->bpp)
-	{
-	case 4:
-	  /* 16-bit gray with alpha.  */
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2 += 4)
-	    {
-	      d1[R4] = d2[3];
-	      d1[G4] = d2[3];
-	      d1[B4] = d2[3];
-	      d1[A4] = d2[1];
-	    }
-	  break;
-	case 2:
-	  if (data->is_16bit)
-	    /* 16-bit gray without alpha.  */
-	    {
-	      for (i = 0; i < (data->image_width * data->image_height);
-		   i++, d1 += 4, d2 += 2)
-		{
-		  d1[R3] = d2[1];
-		  d1[G3] = d2[1];
-		  d1[B3] = d2[1];
-		}
-	    }
-	  else
-	    /* 8-bit gray with alpha.  */
-	    {
-	      for (i = 0; i < (data->image_width * data->image_height);
-		   i++, d1 += 4, d2 += 2)
-		{
-		  d1[R4] = d2[1];
-		  d1[G4] = d2[1];
-		  d1[B4] = d2[1];
-		  d1[A4] = d2[0];
-		}
-	    }
-	  break;
-	  /* 8-bit gray without alpha.  */
-	case 1:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2++)
-	    {
-	      d1[R3] = d2[0];
-	      d1[G3] = d2[0];
-	      d1[B3] = d2[0];
-	    }
-	  break;
-	}
-      return;
-    }
-
-    {
-  /* Only copy the upper 8 bit.  */
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-      for (i = 0; i < (data->image_width * data->image_height * data->bpp >> 1);
-	   i++, d1++, d2 += 2)
-	*d1 = *d2;
-#else
-      switch (data->bpp)
-	{
-	  /* 16-bit with alpha.  */
-	case 8:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2+=8)
-	    {
-	      d1[0] = d2[7];
-	      d1[1] = d2[5];
-	      d1[2] = d2[3];
-	      d1[3] = d2[1];
-	    }
-	  break;
-	  /* 16-bit without alpha.  */
-	case 6:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2+=6)
-	    {
-	      d1[0] = d2[5];
-	      d1[1] = d2[3];
-	      d1[2] = d2[1];
-	    }
-	  break;
-	case 4:
-	  /* 8-bit with alpha.  */
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2 += 4)
-	    {
-	      d1[0] = d2[3];
-	      d1[1] = d2[2];
-	      d1[2] = d2[1];
-	      d1[3] = d2[0];
-	    }
-	  break;
-	  /* 8-bit without alpha.  */
-	case 3:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2 += 3)
-	    {
-	      d1[0] = d2[2];
-	      d1[1] = d2[1];
-	      d1[2] = d2[0];
-	    }
-	  break;
-	}
-#endif
-    }
-
-}
-
 static grub_err_t
 grub_png_decode_png (struct grub_png_data *data)
 {
@@ -1049,19 +1132,30 @@ grub_png_decode_png (struct grub_png_data *data)
 	  break;
 
 	case PNG_CHUNK_IDAT:
+	  if (!data->row_buf)
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			       "png: image data before header");
+
+	  /* Empty chunks may follow the end of the stream.  */
+	  if (data->idat_done)
+	    {
+	      grub_file_seek (data->file, data->file->offset + len + 4);
+	      break;
+	    }
+
 	  data->inside_idat = 1;
 	  data->idat_remain = len;
+	  data->in_pos = data->in_len = 0;
 	  data->bit_count = 0;
+	  data->bit_save = 0;
 
 	  grub_png_decode_image_data (data);
 
 	  data->inside_idat = 0;
+	  data->idat_done = 1;
 	  break;
 
 	case PNG_CHUNK_IEND:
-          if (data->image_data)
-            grub_png_convert_image (data);
-
 	  return grub_errno;
 
 	default:
@@ -1098,7 +1192,7 @@ grub_video_reader_png (struct grub_video_bitmap **bitmap,
 
       grub_png_decode_png (data);
 
-      grub_free (data->image_data);
+      grub_free (data->row_buf);
       grub_free (data);
     }
 
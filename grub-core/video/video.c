@@ -467,6 +467,80 @@ grub_video_edid_preferred_mode (struct grub_video_edid_info *edid_info,
   return grub_error (GRUB_ERR_BAD_DEVICE, "no preferred mode available");
 }
 
+static grub_uint64_t
+rect_area (const grub_video_rect_t *r)
+{
+  return (grub_uint64_t) r->width * r->height;
+}
+
+static void
+rect_union (grub_video_rect_t *u, const grub_video_rect_t *a,
+	    const grub_video_rect_t *b)
+{
+  unsigned x2 = grub_max (a->x + a->width, b->x + b->width);
+  unsigned y2 = grub_max (a->y + a->height, b->y + b->height);
+
+  u->x = grub_min (a->x, b->x);
+  u->y = grub_min (a->y, b->y);
+  u->width = x2 - u->x;
+  u->height = y2 - u->y;
+}
+
+void
+grub_video_damage_add (struct grub_video_damage *damage,
+		       unsigned x, unsigned y,
+		       unsigned width, unsigned height)
+{
+  grub_video_rect_t r, u;
+  grub_uint64_t growth, best_growth;
+  unsigned i, best;
+
+  if (width == 0 || height == 0)
+    return;
+
+  r.x = x;
+  r.y = y;
+  r.width = width;
+  r.height = height;
+
+ again:
+  /* Adjacent glyphs, lines of text and overlapping redraws all end up
+     with a bounding box no bigger than their areas added up.  */
+  for (i = 0; i < damage->count; i++)
+    {
+      rect_union (&u, &damage->rects[i], &r);
+      if (rect_area (&u) <= rect_area (&damage->rects[i]) + rect_area (&r))
+	{
+	  r = u;
+	  damage->rects[i] = damage->rects[--damage->count];
+	  goto again;
+	}
+    }
+
+  if (damage->count < GRUB_VIDEO_DAMAGE_MAX_RECTS)
+    {
+      damage->rects[damage->count++] = r;
+      return;
+    }
+
+  /* Out of room: merge with the rectangle that grows least.  */
+  best = 0;
+  best_growth = ~(grub_uint64_t) 0;
+  for (i = 0; i < damage->count; i++)
+    {
+      rect_union (&u, &damage->rects[i], &r);
+      growth = rect_area (&u) - rect_area (&damage->rects[i]);
+      if (growth < best_growth)
+	{
+	  best = i;
+	  best_growth = growth;
+	}
+    }
+  rect_union (&r, &damage->rects[best], &r);
+  damage->rects[best] = damage->rects[--damage->count];
+  goto again;
+}
+
 /* Parse <width>x<height>[x<depth>]*/
 static grub_err_t
 parse_modespec (const char *current_mode, int *width, int *height, int *depth)
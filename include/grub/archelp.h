@@ -34,6 +34,7 @@ typedef enum
   } grub_archelp_mode_t;
 
 struct grub_archelp_data;
+struct grub_archelp_index;
 
 struct grub_archelp_ops
 {
@@ -47,17 +48,44 @@ struct grub_archelp_ops
 
   void
   (*rewind) (struct grub_archelp_data *data);
+
+  /* Return the position of the member find_file reads next, and make
+     find_file read the member at POS.  Optional, but without them the
+     archive can't be indexed and is scanned on every lookup.  */
+  grub_off_t
+  (*tell) (struct grub_archelp_data *data);
+
+  void
+  (*seek) (struct grub_archelp_data *data, grub_off_t pos);
 };
 
+/* Return the index of the members of the archive on DISK, building it
+   with DATA if FS has none cached for DISK yet, or NULL if the archive
+   can't be indexed.  Give it back with grub_archelp_index_release.  */
+struct grub_archelp_index *
+grub_archelp_index_get (grub_fs_t fs, grub_disk_t disk,
+			struct grub_archelp_data *data,
+			struct grub_archelp_ops *ops);
+
+void
+grub_archelp_index_release (struct grub_archelp_index *index);
+
+/* The unmount function of filesystems using an index.  */
+void
+grub_archelp_index_free (void *index);
+
+/* INDEX may be NULL, in which case the archive is scanned.  */
 grub_err_t
 grub_archelp_dir (struct grub_archelp_data *data,
 		  struct grub_archelp_ops *ops,
+		  struct grub_archelp_index *index,
 		  const char *path_in,
 		  grub_fs_dir_hook_t hook, void *hook_data);
 
 grub_err_t
 grub_archelp_open (struct grub_archelp_data *data,
 		   struct grub_archelp_ops *ops,
+		   struct grub_archelp_index *index,
 		   const char *name_in);
 
 #endif
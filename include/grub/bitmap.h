@@ -31,6 +31,10 @@ struct grub_video_bitmap
 
   /* Pointer to bitmap data formatted according to mode_info.  */
   void *data;
+
+  /* Number of references to the bitmap, see
+     grub_video_bitmap_load_cached.  */
+  unsigned int refcnt;
 };
 
 struct grub_video_bitmap_reader
@@ -59,6 +63,21 @@ grub_err_t EXPORT_FUNC (grub_video_bitmap_destroy) (struct grub_video_bitmap *bi
 grub_err_t EXPORT_FUNC (grub_video_bitmap_load) (struct grub_video_bitmap **bitmap,
 						 const char *filename);
 
+grub_err_t EXPORT_FUNC (grub_video_bitmap_load_cached) (struct grub_video_bitmap **bitmap,
+							const char *filename);
+
+struct grub_video_bitmap *
+EXPORT_FUNC (grub_video_bitmap_cache_find) (struct grub_video_bitmap *src,
+					    unsigned int width,
+					    unsigned int height,
+					    grub_uint32_t variant);
+
+void EXPORT_FUNC (grub_video_bitmap_cache_add) (struct grub_video_bitmap *src,
+						struct grub_video_bitmap *bitmap,
+						unsigned int width,
+						unsigned int height,
+						grub_uint32_t variant);
+
 /* Return bitmap width.  */
 static inline unsigned int
 grub_video_bitmap_get_width (struct grub_video_bitmap *bitmap)
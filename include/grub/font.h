@@ -88,6 +88,28 @@ struct grub_font_glyph
   grub_uint8_t bitmap[0];
 };
 
+/* Counters of the glyph caches, as shown by lsfonts.  */
+struct grub_font_cache_stats
+{
+  /* Reads of glyph data from font files, and the glyphs they loaded.  */
+  unsigned long glyph_reads;
+  unsigned long glyphs_loaded;
+
+  /* Glyphs drawn from the atlases of expanded glyphs, and glyphs which
+     had to be added to an atlas first.  */
+  unsigned long atlas_hits;
+  unsigned long atlas_misses;
+
+  /* Blits from the atlases; a run of glyphs is drawn with one.  */
+  unsigned long atlas_blits;
+
+  /* Atlases dropped to stay within the memory limit.  */
+  unsigned long atlas_evictions;
+
+  /* Memory used by the atlases.  */
+  grub_size_t atlas_bytes;
+};
+
 /* Part of code field which is really used as such.  */
 #define GRUB_FONT_CODE_CHAR_MASK     0x001fffff
 #define GRUB_FONT_CODE_RIGHT_JOINED  0x80000000
@@ -143,6 +165,17 @@ grub_err_t EXPORT_FUNC (grub_font_draw_glyph) (struct grub_font_glyph *glyph,
 					       grub_video_color_t color,
 					       int left_x, int baseline_y);
 
+/* Draw COUNT glyphs, in visual order, from LEFT_X onwards on the baseline
+   BASELINE_Y.  Glyphs which were drawn next to each other before are
+   drawn with a single blit.  */
+grub_err_t EXPORT_FUNC (grub_font_draw_glyphs) (grub_font_t hinted_font,
+						const struct grub_unicode_glyph *glyphs,
+						grub_size_t count,
+						grub_video_color_t color,
+						int left_x, int baseline_y);
+
+void EXPORT_FUNC (grub_font_get_cache_stats) (struct grub_font_cache_stats *stats);
+
 int
 EXPORT_FUNC (grub_font_get_constructed_device_width) (grub_font_t hinted_font,
 					const struct grub_unicode_glyph *glyph_id);
@@ -47,6 +47,16 @@ typedef int (*grub_fs_dir_hook_t) (const char *filename,
 				   const struct grub_dirhook_info *info,
 				   void *data);
 
+/* A magic value at a fixed place of a filesystem.  */
+struct grub_fs_signature
+{
+  /* Offset in bytes from the start of the device.  */
+  grub_uint32_t offset;
+  /* Length of MAGIC, at most 16 bytes.  */
+  grub_uint32_t len;
+  const char *magic;
+};
+
 /* Filesystem descriptor.  */
 struct grub_fs
 {
@@ -83,6 +93,17 @@ struct grub_fs
   /* Get writing time of filesystem. */
   grub_err_t (*mtime) (grub_device_t device, grub_int32_t *timebuf);
 
+  /* Signatures of which at least one is present in every instance of
+     this filesystem, terminated by an entry with a zero length.  When
+     set, grub_fs_probe only tries to mount the filesystem if one of them
+     matches.  */
+  const struct grub_fs_signature *signatures;
+
+  /* Free the mount data DATA kept in the mount cache, once it has been
+     dropped from the cache and released by its last user.  Only needed
+     by filesystems using grub_fs_mount_cache_put.  */
+  void (*unmount) (void *data);
+
 #ifdef GRUB_UTIL
   /* Determine sectors available for embedding.  */
   grub_err_t (*embed) (grub_device_t device, unsigned int *nsectors,
@@ -118,9 +139,12 @@ grub_fs_register (grub_fs_t fs)
 }
 #endif
 
+void EXPORT_FUNC(grub_fs_cache_invalidate_fs) (grub_fs_t fs);
+
 static inline void
 grub_fs_unregister (grub_fs_t fs)
 {
+  grub_fs_cache_invalidate_fs (fs);
   grub_list_remove (GRUB_AS_LIST (fs));
 }
 
@@ -128,4 +152,22 @@ grub_fs_unregister (grub_fs_t fs)
 
 grub_fs_t EXPORT_FUNC(grub_fs_probe) (grub_device_t device);
 
+/* Cache of the filesystems found on devices.  Besides remembering the
+   probed filesystem type, a filesystem can keep its mount data across
+   opens: grub_fs_mount_cache_get returns a reference to the data cached
+   for DISK, if any, and grub_fs_mount_cache_put puts freshly mounted
+   data into the cache, returning non-zero if it did.  In both cases the
+   caller must give its reference back with grub_fs_mount_cache_release
+   instead of freeing the data.  The cache is flushed when the disks have
+   been idle for a while, and for a disk when it is written to.  */
+void *EXPORT_FUNC(grub_fs_mount_cache_get) (grub_fs_t fs,
+					    struct grub_disk *disk);
+int EXPORT_FUNC(grub_fs_mount_cache_put) (grub_fs_t fs,
+					  struct grub_disk *disk, void *data);
+/* Return zero if DATA isn't in the cache and should be freed by the
+   caller.  */
+int EXPORT_FUNC(grub_fs_mount_cache_release) (void *data);
+void EXPORT_FUNC(grub_fs_cache_invalidate) (struct grub_disk *disk);
+void grub_fs_cache_invalidate_all (void);
+
 #endif /* ! GRUB_FS_HEADER */
@@ -73,6 +73,39 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+/* Cache of path component lookups of one mounted filesystem, mapping
+   (directory, name) to the child node found or to its absence.  */
+typedef struct grub_fshelp_dcache *grub_fshelp_dcache_t;
+
+/* Create a lookup cache.  Nodes are cached as copies of NODE_SIZE bytes,
+   so they must not own memory.  NODE_ID identifies a directory node
+   within the filesystem.  */
+grub_fshelp_dcache_t
+EXPORT_FUNC(grub_fshelp_dcache_new) (grub_size_t node_size,
+				     grub_uint64_t (*node_id) (grub_fshelp_node_t node));
+
+void
+EXPORT_FUNC(grub_fshelp_dcache_free) (grub_fshelp_dcache_t dcache);
+
+/* Like grub_fshelp_find_file or grub_fshelp_find_file_lookup (whichever
+   of ITERATE_DIR and LOOKUP_FILE is given), but answer path components
+   from DCACHE when possible and remember the rest there.  DCACHE may be
+   NULL.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   grub_err_t (*lookup_file) (grub_fshelp_node_t dir,
+								      const char *name,
+								      grub_fshelp_node_t *foundnode,
+								      enum grub_fshelp_filetype *foundtype),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   grub_fshelp_dcache_t dcache);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
@@ -88,4 +121,28 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+/* Map the file block BLOCK of NODE to a run of disk blocks.  Store in
+   *START the disk block holding BLOCK, or 0 if it isn't allocated, and
+   in *COUNT the number of file blocks from BLOCK on which follow
+   contiguously (or are all unallocated).  *COUNT must be at least 1.  */
+typedef grub_err_t (*grub_fshelp_get_extent_t) (grub_fshelp_node_t node,
+						 grub_disk_addr_t block,
+						 grub_disk_addr_t *start,
+						 grub_disk_addr_t *count);
+
+/* Like grub_fshelp_read_file, but translates file blocks to disk
+   blocks a whole extent at a time with GET_EXTENT, so that every
+   contiguous run is read with a single disk read.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_extents) (grub_disk_t disk,
+					    grub_fshelp_node_t node,
+					    grub_disk_read_hook_t read_hook,
+					    void *read_hook_data,
+					    grub_off_t pos, grub_size_t len,
+					    char *buf,
+					    grub_fshelp_get_extent_t get_extent,
+					    grub_off_t filesize,
+					    int log2blocksize,
+					    grub_disk_addr_t blocks_start);
+
 #endif /* ! GRUB_FSHELP_HEADER */
@@ -22,6 +22,7 @@
 
 #include <grub/types.h>
 #include <grub/symbol.h>
+#include <grub/err.h>
 #include <config.h>
 
 #ifndef NULL
@@ -29,6 +30,48 @@
 #endif
 
 void grub_mm_init_region (void *addr, grub_size_t size);
+void grub_mm_init_region_flags (void *addr, grub_size_t size,
+				unsigned int flags);
+int grub_mm_remove_region (void *addr);
+
+#define GRUB_MM_INIT_REGION_NONE	0
+/* Don't merge the region into the one right above it, so that
+   grub_mm_remove_region can take it out again later.  */
+#define GRUB_MM_INIT_REGION_NO_MERGE	(1 << 0)
+
+#define GRUB_MM_ADD_REGION_NONE		0
+/* The whole request must be satisfied by a single region.  */
+#define GRUB_MM_ADD_REGION_CONSECUTIVE	(1 << 0)
+
+/* Called when the existing regions cannot satisfy an allocation, to ask
+   the platform for at least the given number of bytes of new heap.  FLAGS
+   is a combination of GRUB_MM_ADD_REGION_* values.  */
+typedef grub_err_t (*grub_mm_add_region_func_t) (grub_size_t bytes,
+						  unsigned int flags);
+#ifndef GRUB_MACHINE_EMU
+extern grub_mm_add_region_func_t EXPORT_VAR (grub_mm_add_region_fn);
+#endif
+
+/* Allocation profiler hooks.  ALLOC is called after every allocation
+   attempt with the requested SIZE, the FOOTPRINT actually taken from the
+   heap (0 on failure) and the time spent, in units of CLOCK.  Its return
+   value is kept with the block and passed back to FREE.  FILE and LINE
+   are only known with MM_DEBUG.  */
+struct grub_mm_profiler
+{
+  grub_uint64_t (*clock) (void);
+  grub_uint32_t (*alloc) (grub_size_t size, grub_size_t footprint,
+			  void *caller, const char *file, int line,
+			  grub_uint64_t ticks);
+  void (*free) (grub_uint32_t tag, grub_size_t footprint, void *caller,
+		grub_uint64_t ticks);
+};
+typedef struct grub_mm_profiler *grub_mm_profiler_t;
+
+#ifndef GRUB_MACHINE_EMU
+extern grub_mm_profiler_t EXPORT_VAR (grub_mm_profiler);
+#endif
+
 void *EXPORT_FUNC(grub_malloc) (grub_size_t size);
 void *EXPORT_FUNC(grub_zalloc) (grub_size_t size);
 void EXPORT_FUNC(grub_free) (void *ptr);
@@ -30,11 +30,11 @@ typedef struct grub_mm_header
   struct grub_mm_header *next;
   grub_size_t size;
   grub_size_t magic;
-#if GRUB_CPU_SIZEOF_VOID_P == 4
+  /* Allocation profiler tag of allocated blocks.  */
+  grub_uint32_t tag;
+#if GRUB_CPU_SIZEOF_VOID_P == 8
   char padding[4];
-#elif GRUB_CPU_SIZEOF_VOID_P == 8
-  char padding[8];
-#else
+#elif GRUB_CPU_SIZEOF_VOID_P != 4
 # error "unknown word size"
 #endif
 }
@@ -57,8 +57,48 @@ typedef struct grub_mm_region
 }
 *grub_mm_region_t;
 
+/* Small allocations are carved from slabs of equally sized objects.
+   Every object is preceded by one cell whose header carries one of the
+   slab magics, NEXT pointing to the owning slab while allocated and to
+   the next free object while free, and SIZE holding the object size in
+   cells, header included.  */
+#define GRUB_MM_SLAB_MAGIC	0x5ab0c3e1
+#define GRUB_MM_SLAB_FREE_MAGIC	0x5ab0f4ee
+
+/* Largest request served from slabs, in bytes.  */
+#define GRUB_MM_SLAB_MAX	2048
+/* Size of one slab including its region block header.  */
+#define GRUB_MM_SLAB_SIZE	0x4000
+#define GRUB_MM_SLAB_CLASSES	12
+
+struct grub_mm_slab_class;
+
+typedef struct grub_mm_slab
+{
+  struct grub_mm_slab *next;
+  struct grub_mm_slab **prev;
+  struct grub_mm_slab_class *class;
+  grub_mm_header_t free;
+  grub_size_t used;
+}
+*grub_mm_slab_t;
+
+struct grub_mm_slab_class
+{
+  /* Object size in cells, header included.  */
+  grub_size_t size;
+  /* Number of objects per slab.  */
+  grub_size_t count;
+  /* Slabs with at least one free object.  */
+  grub_mm_slab_t partial;
+  grub_mm_slab_t full;
+  grub_size_t slabs;
+  grub_size_t used;
+};
+
 #ifndef GRUB_MACHINE_EMU
 extern grub_mm_region_t EXPORT_VAR (grub_mm_base);
+extern struct grub_mm_slab_class EXPORT_VAR (grub_mm_slab_classes)[GRUB_MM_SLAB_CLASSES];
 #endif
 
 #endif
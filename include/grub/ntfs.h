@@ -84,6 +84,11 @@ enum
 #define GRUB_NTFS_MAX_MFT		(4096 >> GRUB_NTFS_BLK_SHR)
 #define GRUB_NTFS_MAX_IDX		(16384 >> GRUB_NTFS_BLK_SHR)
 
+/* Number of fixed-up MFT records kept per mount, and how many
+   neighbouring records a miss reads along.  */
+#define GRUB_NTFS_MFT_CACHE_SIZE	16
+#define GRUB_NTFS_MFT_READAHEAD	8
+
 #define GRUB_NTFS_COM_LEN		4096
 #define GRUB_NTFS_COM_LOG_LEN	12
 #define GRUB_NTFS_COM_SEC		(GRUB_NTFS_COM_LEN >> GRUB_NTFS_BLK_SHR)
@@ -127,6 +132,14 @@ struct grub_ntfs_bpb
   grub_uint32_t checksum;
 } GRUB_PACKED;
 
+/* One run of a decoded run list.  LCN is 0 for sparse runs.  */
+struct grub_ntfs_run
+{
+  grub_disk_addr_t vcn;
+  grub_disk_addr_t lcn;
+  grub_disk_addr_t len;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
@@ -135,6 +148,11 @@ struct grub_ntfs_attr
   grub_uint32_t save_pos;
   grub_uint8_t *sbuf;
   struct grub_ntfs_file *mft;
+  /* Whole run list of the attribute at MAP_ATTR, sorted by VCN.  RUNS is
+     NULL if that attribute can't be mapped this way.  */
+  grub_uint8_t *map_attr;
+  struct grub_ntfs_run *runs;
+  grub_size_t nruns;
 };
 
 struct grub_ntfs_file
@@ -148,6 +166,13 @@ struct grub_ntfs_file
   struct grub_ntfs_attr attr;
 };
 
+struct grub_ntfs_mft_cache
+{
+  grub_uint64_t mftno;
+  grub_uint32_t stamp;
+  grub_uint8_t *buf;
+};
+
 struct grub_ntfs_data
 {
   struct grub_ntfs_file cmft;
@@ -158,6 +183,8 @@ struct grub_ntfs_data
   int log_spc;
   grub_uint64_t mft_start;
   grub_uint64_t uuid;
+  struct grub_ntfs_mft_cache mft_cache[GRUB_NTFS_MFT_CACHE_SIZE];
+  grub_uint32_t mft_stamp;
 };
 
 struct grub_ntfs_comp_table_element
@@ -207,6 +207,17 @@ struct grub_video_signed_rect
 };
 typedef struct grub_video_signed_rect grub_video_signed_rect_t;
 
+#define GRUB_VIDEO_DAMAGE_MAX_RECTS 8
+
+/* The parts of the screen that changed since the last update, as a few
+   rectangles.  Rectangles that touch or overlap, or that would cover
+   hardly more together than apart, are merged as they are added.  */
+struct grub_video_damage
+{
+  unsigned count;
+  grub_video_rect_t rects[GRUB_VIDEO_DAMAGE_MAX_RECTS];
+};
+
 struct grub_video_palette_data
 {
   grub_uint8_t r; /* Red color value (0-255).  */
@@ -551,6 +562,16 @@ grub_video_check_mode_flag (grub_video_mode_type_t flags,
 
 grub_video_driver_id_t EXPORT_FUNC (grub_video_get_driver_id) (void);
 
+static inline void
+grub_video_damage_reset (struct grub_video_damage *damage)
+{
+  damage->count = 0;
+}
+
+void EXPORT_FUNC (grub_video_damage_add) (struct grub_video_damage *damage,
+					  unsigned x, unsigned y,
+					  unsigned width, unsigned height);
+
 static __inline grub_video_rgba_color_t
 grub_video_rgba_color_rgb (grub_uint8_t r, grub_uint8_t g, grub_uint8_t b)
 {